@@ -3,12 +3,70 @@
 
 #include "stdafx.h"
 #include "Serial.h"
-//#include "st_iocp.h"
-#include "Win32Error.h"
+#include "SerialClock.h"
+#include "SerialTrace.h"
+#include <mmsystem.h>
+#include <stdlib.h>
+
+#pragma comment(lib, "winmm.lib")
 
 using namespace network;
 
+//! size of the buffer used by the listener to read the received data
+#define SERIAL_RX_BUFFER_LEN        (1024)
+
+//! largest frame assembled in idle-line framing mode, longer frames are split
+#define SERIAL_MAX_FRAME_LEN        (4096)
+
+//! gaps from this value on (in microseconds) are detected by the driver inter-byte timeout,
+//!   whose resolution is the millisecond; shorter gaps use the high resolution timer
+#define SERIAL_IDLE_DRIVER_MIN_US   (10000)
+
+//! largest block written at once with the flow control on, bounds what is sent after the peer throttles
+#define SERIAL_FLOW_TX_CHUNK        (256)
+
+//! flow control characters
+#define SERIAL_XON                  (0x11)
+#define SERIAL_XOFF                 (0x13)
+
+//! flag of a chunk posted to the strand: an idle-line frame, for the frame callback
+#define SERIAL_CHUNK_FRAME          (0x00000001)
+
+//! the end of an RS-485 transmission is polled when EV_TXEMPTY is this late (in milliseconds)
+#define SERIAL_RS485_DRAIN_MARGIN_MS    (50)
+
+//! last part of an RS-485 delay that is spun instead of slept (in microseconds), Sleep has the
+//!   resolution of the system timer
+#define SERIAL_RS485_SPIN_US        (16000)
 
+//! shortest interval between two polls of the transmit queue by the transmit monitor (in microseconds)
+#define SERIAL_TX_POLL_MIN_US       (500)
+
+//! most writes of PostWrite queued on a completion port at once
+#define SERIAL_COMPLETION_MAX_WRITES    (64)
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION   (0x00000002)
+#endif
+
+//! waits until ullDeadlineUs (see GetTimestampUs) with the precision of the performance counter
+static void WaitUntilUs( ULONGLONG ullDeadlineUs )
+{
+    ULONGLONG ullNowUs = GetTimestampUs();
+
+    while (ullNowUs < ullDeadlineUs)
+    {
+        if (ullDeadlineUs - ullNowUs > SERIAL_RS485_SPIN_US)
+        {
+            Sleep(DWORD((ullDeadlineUs - ullNowUs - SERIAL_RS485_SPIN_US) / 1000));
+        }
+        else
+        {
+            YieldProcessor();
+        }
+        ullNowUs = GetTimestampUs();
+    }
+}
 
 //-----------------------------------------------------------------------------------------------------------------------------------------------------
 
@@ -17,22 +75,127 @@ CSerial::CSerial()
     hPort = NULL;
     bQuit = FALSE;
 
-    //iIOCP = IOCP::Create();
-    //if (iIOCP == -1)
-    //{
-    //    CWin32Error e;
-    //    throw e.ErrorCode();
-    //}
+    // a local port until Open says otherwise
+    pTransport = new CSerialTtyTransport();
 
     process = NULL;
+    processFrame = NULL;
+
+    dIdleCharTimes = 0.0;
+    dwCharTimeNs = 0;
+    dwIdleGapUs = 0;
+    hIdleTimer = NULL;
+    bTimerPeriod = FALSE;
+    pFrame = NULL;
+    dwFrameLen = 0;
+    ullFrameFirstUs = 0;
+    ullFrameLastUs = 0;
+
+    pStrand = NULL;
+    lRxDropped = 0;
+    tap = NULL;
+    pTapContext = NULL;
+    capture = NULL;
+    pCaptureContext = NULL;
+    InitializeSRWLock(&srwStrand);
+
+    SecureZeroMemory(&dcb, sizeof(DCB));
+    SecureZeroMemory(&ov, sizeof(OVERLAPPED));
+    SecureZeroMemory(&ovRead, sizeof(OVERLAPPED));
+    SecureZeroMemory(&ovFrame, sizeof(OVERLAPPED));
+    SecureZeroMemory(&ovWrite, sizeof(OVERLAPPED));
+
+    // the listener only runs while the port is open, see Open
+    hListenerThread = NULL;
+    dwListenerThreadId = 0;
+    dwListenerError = ERROR_SUCCESS;
+    dwReadMask = 0;
+    bReadDrain = FALSE;
+
+    processModem = NULL;
+    dwModemEvents = 0;
+    bRtsOn = FALSE;
+    bDtrOn = FALSE;
+
+    flowControl = FLOW_CONTROL_OFF;
+    dwHighWatermark = 0;
+    dwLowWatermark = 0;
+    bThrottled = FALSE;
+    bPeerThrottled = FALSE;
+    ullThrottleStartUs = 0;
+    ullPeerThrottleStartUs = 0;
+    SecureZeroMemory(&flowStats, sizeof(SERIAL_FLOW_STATS));
+    lFramingErrors = 0;
+    lParityErrors = 0;
+    lOverrunErrors = 0;
+    lBreakErrors = 0;
+    InitializeCriticalSection(&csFlow);
+
+    rs485Mode = RS485_OFF;
+    dwRs485BeforeUs = 0;
+    dwRs485AfterUs = 0;
+    ullTxEmptyUs = 0;
+    ullTxStartUs = 0;
+    SecureZeroMemory(&rs485Stats, sizeof(SERIAL_RS485_STATS));
+
+    txCallback = NULL;
+    pTxContext = NULL;
+    hTxMonitorThread = NULL;
+    bTxMonitorQuit = FALSE;
+    dwTxHead = 0;
+    dwTxCount = 0;
+    ullTxWritten = 0;
+    ullTxLineFreeUs = 0;
+    ullWriteStartUs = 0;
+    SecureZeroMemory(&txStats, sizeof(SERIAL_TX_STATS));
+    InitializeCriticalSection(&csTx);
+
+    pCompletionPort = NULL;
+    bCompletion = FALSE;
+    pCompletionBuffers = NULL;
+    dwCompletionMask = 0;
+    lOpsPending = 0;
+    lWritesPending = 0;
+    SecureZeroMemory(&opEvent, sizeof(SERIAL_COMPLETION_OP));
+    SecureZeroMemory(opRead, sizeof(opRead));
+    InitializeCriticalSection(&csCompletion);
+
+    hQuitEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (hQuitEvent == NULL)
+    {
+        throw (unsigned int)::GetLastError();
+    }
+
+    // signaled while the peer accepts data
+    hPeerReady = CreateEvent(NULL, TRUE, TRUE, NULL);
+    if (hPeerReady == NULL)
+    {
+        throw (unsigned int)::GetLastError();
+    }
+
+    // signaled by the listener when the driver transmit queue drained
+    hTxEmpty = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (hTxEmpty == NULL)
+    {
+        throw (unsigned int)::GetLastError();
+    }
+
+    // wakes the transmit monitor
+    hTxQueued = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (hTxQueued == NULL)
+    {
+        throw (unsigned int)::GetLastError();
+    }
 
-    hListenerThread = ::CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)CSerial::ThreadStartSerialPortListener, this, 0, NULL);
-    if (hListenerThread == NULL)
+    // signaled while no operation of the port is on a completion port
+    hOpsDone = CreateEvent(NULL, TRUE, TRUE, NULL);
+    if (hOpsDone == NULL)
     {
-        CWin32Error e;
-        throw e.ErrorCode();
+        throw (unsigned int)::GetLastError();
     }
 
+    CSerialTrace::AddRef();
+
     return;
 }
 
@@ -43,7 +206,21 @@ CSerial::~CSerial( )
     try
     {
         Close();
-        bQuit = TRUE;
+        SetExecutor(NULL);
+        if (pCompletionBuffers != NULL)
+        {
+            VirtualFree(pCompletionBuffers, 0, MEM_RELEASE);
+        }
+        CloseHandle(hOpsDone);
+        CloseHandle(hTxQueued);
+        CloseHandle(hTxEmpty);
+        CloseHandle(hPeerReady);
+        CloseHandle(hQuitEvent);
+        DeleteCriticalSection(&csCompletion);
+        DeleteCriticalSection(&csTx);
+        DeleteCriticalSection(&csFlow);
+        delete pTransport;
+        CSerialTrace::Release();
     }
     catch (...)
     {
@@ -55,30 +232,119 @@ CSerial::~CSerial( )
 
 int CSerial::Open(const char *device)
 {
-    hPort = CreateFile((LPCTSTR)device,
-                        GENERIC_READ | GENERIC_WRITE,
-                        0,
-                        NULL,
-                        OPEN_EXISTING,
-                        0,
-                        NULL);
+    return Open(device, CBR_9600, 8, NOPARITY, ONESTOPBIT);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+int CSerial::Open(const char *device, int baud_rate, int byte_size, int parity, int stop_bits)
+{
+    int iResult;
+
+    iResult = OpenPort(device, baud_rate, byte_size, parity, stop_bits);
+
+    SERIAL_TRACE_OPEN(device, baud_rate, iResult);
+
+    return iResult;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+int CSerial::OpenPort(const char *device, int baud_rate, int byte_size, int parity, int stop_bits)
+{
+    DWORD dwError;
+    const char * pAddress;
+
+    if (hPort != NULL)
+    {
+        Close();
+    }
+
+    // the scheme of the device selects the transport, a plain path is a local port
+    delete pTransport;
+    pTransport = CSerialTransport::Create(device, &pAddress);
 
-    if (hPort == INVALID_HANDLE_VALUE)
+    // overlapped, so the listener can wait for the data and the idle timer at the same time
+    dwError = pTransport->Open(pAddress);
+    if (dwError != ERROR_SUCCESS)
     {
-        CWin32Error e;
+        return dwError;
+    }
+    hPort = pTransport->GetHandle();
+
+    ovWrite.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (ovWrite.hEvent == NULL)
+    {
+        DWORD dwError = ::GetLastError();
+        pTransport->Close();
         hPort = NULL;
-        return e.ErrorCode();
+        return dwError;
     }
 
     _snprintf(cDevice, sizeof(cDevice) - 1, device);
 
-    // Seta os valores default para a porta
-    SetBaudRate(9600);
-    SetStopBits(1);
-    SetByteSize(8);
-    SetParity(NOPARITY);
-    SetHandshaking(HAND_SHAKE_OFF);
-    SetTimeouts();
+    // one SetCommState for the whole configuration: each one costs several requests to the
+    // driver, and a round trip to the device for the USB adapters
+    SecureZeroMemory(&dcb, sizeof(DCB));
+
+    dcb.DCBlength = sizeof(DCB);
+
+    if (!pTransport->GetCommState(&dcb))
+    {
+        dwError = ::GetLastError();
+        Close();
+        return dwError;
+    }
+
+    dwError = SetLineFields(baud_rate, byte_size, parity, stop_bits);
+    if (dwError != ERROR_SUCCESS)
+    {
+        Close();
+        return dwError;
+    }
+
+    SetHandshakeFields(HAND_SHAKE_OFF);
+
+    if (!ApplyCommState())
+    {
+        dwError = ::GetLastError();
+        Close();
+        return dwError;
+    }
+
+    // the pre-posted reads of a completion port must complete as soon as data is there: the comm
+    // driver does with its read timeouts, a pipe does by itself; the links emulated over a socket
+    // keep their listener thread
+    bCompletion = (pCompletionPort != NULL) && (pTransport->HasIntervalTimeout() || pTransport->HasStreamReads());
+
+    // also sets the timeouts
+    UpdateIdleGap();
+
+    bQuit = FALSE;
+    dwListenerError = ERROR_SUCCESS;
+    ResetEvent(hQuitEvent);
+
+    if (bCompletion)
+    {
+        dwError = CompletionStart();
+        if (dwError != ERROR_SUCCESS && bCompletion)
+        {
+            Close();
+            return dwError;
+        }
+    }
+
+    // a port the completion port could not take falls back to the listener thread
+    if (!bCompletion)
+    {
+        hListenerThread = ::CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)CSerial::ThreadStartSerialPortListener, this, 0, &dwListenerThreadId);
+        if (hListenerThread == NULL)
+        {
+            dwError = ::GetLastError();
+            Close();
+            return dwError;
+        }
+    }
 
     return 0;
 }
@@ -96,10 +362,78 @@ void CSerial::Close()
 {
     if (hPort != NULL)
     {
-        CloseHandle(hPort);
+        SERIAL_TRACE_CLOSE(cDevice);
+    }
+
+    // wake the listener and wait for it, unless the listener itself is closing the port
+    if (hListenerThread != NULL)
+    {
+        bQuit = TRUE;
+        SetEvent(hQuitEvent);
+
+        if (GetCurrentThreadId() != dwListenerThreadId)
+        {
+            WaitForSingleObject(hListenerThread, INFINITE);
+        }
+
+        CloseHandle(hListenerThread);
+        hListenerThread = NULL;
+        dwListenerThreadId = 0;
+    }
+
+    // the kernel refers to the operations on the completion port until they are reaped
+    if (bCompletion)
+    {
+        EnterCriticalSection(&csCompletion);
+        bQuit = TRUE;
+        pTransport->CancelIoEx(NULL);
+        LeaveCriticalSection(&csCompletion);
+
+        SetEvent(hQuitEvent);
+
+        // the last completion may have been reaped before bQuit was set
+        if (InterlockedCompareExchange(&lOpsPending, 0, 0) == 0)
+        {
+            SetEvent(hOpsDone);
+        }
+
+        // unless a callback run by the completion port is closing the port, the next Open
+        // then falls back to a listener thread until the operations are reaped
+        if (!pCompletionPort->IsRingThread())
+        {
+            WaitForSingleObject(hOpsDone, INFINITE);
+        }
+
+        pCompletionPort->Detach();
+        bCompletion = FALSE;
+
+        ovWrite.hEvent = (HANDLE)((ULONG_PTR)ovWrite.hEvent & ~(ULONG_PTR)1);
+    }
+
+    // the monitor polls the port
+    StopTxMonitor();
+
+    if (hPort != NULL)
+    {
+        pTransport->Close();
         hPort = NULL;
     }
 
+    if (ovWrite.hEvent != NULL)
+    {
+        CloseHandle(ovWrite.hEvent);
+        ovWrite.hEvent = NULL;
+    }
+
+    // the throttling dies with the port
+    EnterCriticalSection(&csFlow);
+    flowControl = FLOW_CONTROL_OFF;
+    SetThrottled(FALSE);
+    SetPeerThrottled(FALSE);
+    LeaveCriticalSection(&csFlow);
+
+    rs485Mode = RS485_OFF;
+
     cDevice[0] = '\0';
 
     return;
@@ -114,12 +448,25 @@ DWORD CSerial::SetHandshaking(EnumSerialHandshake SerialHandshake)
 
     dcb.DCBlength = sizeof(DCB);
 
-    if (!GetCommState(hPort, &dcb))
+    if (!pTransport->GetCommState(&dcb))
+    {
+        return ::GetLastError();
+    }
+
+    SetHandshakeFields(SerialHandshake);
+
+    if (!ApplyCommState())
     {
-        CWin32Error e;
-        return e.ErrorCode();
+        return ::GetLastError();
     }
 
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerial::SetHandshakeFields(EnumSerialHandshake SerialHandshake)
+{
     switch (SerialHandshake)
     {
             case HAND_SHAKE_OFF:
@@ -155,14 +502,38 @@ DWORD CSerial::SetHandshaking(EnumSerialHandshake SerialHandshake)
             }
             break;
     }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerial::ApplyCommState( void )
+{
+    // the driver raises RTS while it transmits in the RS-485 mode
+    if (rs485Mode == RS485_DRIVER)
+    {
+        dcb.fRtsControl = RTS_CONTROL_TOGGLE;
+    }
 
-    if (!SetCommState(hPort, &dcb))
+    // RTS and DTR driven by SetRts and SetDtr keep their level across the reconfigurations
+    if (dcb.fRtsControl == RTS_CONTROL_DISABLE || dcb.fRtsControl == RTS_CONTROL_ENABLE)
     {
-        CWin32Error e;
-        return e.ErrorCode();
+        dcb.fRtsControl = bRtsOn ? RTS_CONTROL_ENABLE : RTS_CONTROL_DISABLE;
     }
 
-    return ERROR_SUCCESS;
+    if (dcb.fDtrControl == DTR_CONTROL_DISABLE || dcb.fDtrControl == DTR_CONTROL_ENABLE)
+    {
+        dcb.fDtrControl = bDtrOn ? DTR_CONTROL_ENABLE : DTR_CONTROL_DISABLE;
+    }
+
+    if (!pTransport->SetCommState(&dcb))
+    {
+        SERIAL_TRACE_CONFIG(cDevice, &dcb, ::GetLastError());
+        return FALSE;
+    }
+
+    SERIAL_TRACE_CONFIG(cDevice, &dcb, ERROR_SUCCESS);
+
+    return TRUE;
 }
 
 //-----------------------------------------------------------------------------------------------------------------------------------------------------
@@ -174,7 +545,7 @@ DWORD CSerial::SetBaudRate(int baud_rate)
 
     dcb.DCBlength = sizeof(DCB);
 
-    if (!GetCommState(hPort, &dcb))
+    if (!pTransport->GetCommState(&dcb))
         return GetLastError();
 
     switch (baud_rate)
@@ -201,12 +572,13 @@ DWORD CSerial::SetBaudRate(int baud_rate)
             return ERROR_BAD_COMMAND;
     }
 
-    if (!SetCommState(hPort, &dcb))
+    if (!ApplyCommState())
     {
-        CWin32Error e;
-        return e.ErrorCode();
+        return ::GetLastError();
     }
 
+    UpdateIdleGap();
+
     return ERROR_SUCCESS;
 }
 
@@ -219,7 +591,7 @@ DWORD CSerial::SetStopBits(int stop_bits)
 
     dcb.DCBlength = sizeof(DCB);
 
-    if (!GetCommState(hPort, &dcb))
+    if (!pTransport->GetCommState(&dcb))
         return ::GetLastError();
 
     switch (stop_bits)
@@ -234,12 +606,13 @@ DWORD CSerial::SetStopBits(int stop_bits)
             return ERROR_BAD_COMMAND;
     }
 
-    if (!SetCommState(hPort, &dcb))
+    if (!ApplyCommState())
     {
-        CWin32Error e;
-        return e.ErrorCode();
+        return ::GetLastError();
     }
 
+    UpdateIdleGap();
+
     return ERROR_SUCCESS;
 }
 
@@ -252,10 +625,9 @@ DWORD CSerial::SetParity(int parity)
 
     dcb.DCBlength = sizeof(DCB);
 
-    if (!GetCommState(hPort, &dcb))
+    if (!pTransport->GetCommState(&dcb))
     {
-        CWin32Error e;
-        return e.ErrorCode();
+        return ::GetLastError();
     }
 
     switch (parity)
@@ -272,12 +644,13 @@ DWORD CSerial::SetParity(int parity)
             return ERROR_BAD_COMMAND;
     }
 
-    if (!SetCommState(hPort, &dcb))
+    if (!ApplyCommState())
     {
-        CWin32Error e;
-        return e.ErrorCode();
+        return ::GetLastError();
     }
 
+    UpdateIdleGap();
+
     return ERROR_SUCCESS;
 }
 
@@ -290,10 +663,9 @@ DWORD CSerial::SetByteSize(int byte_size)
 
     dcb.DCBlength = sizeof(DCB);
 
-    if (!GetCommState(hPort, &dcb))
+    if (!pTransport->GetCommState(&dcb))
     {
-        CWin32Error e;
-        return e.ErrorCode();
+        return ::GetLastError();
     }
 
     switch (byte_size)
@@ -309,177 +681,2197 @@ DWORD CSerial::SetByteSize(int byte_size)
             return ERROR_BAD_COMMAND;
     }
 
-    if (!SetCommState(hPort, &dcb))
+    if (!ApplyCommState())
     {
-        CWin32Error e;
-        return e.ErrorCode();
+        return ::GetLastError();
     }
 
+    UpdateIdleGap();
+
     return ERROR_SUCCESS;
 }
 
 //-----------------------------------------------------------------------------------------------------------------------------------------------------
 
-void CSerial::SetTimeouts()
+DWORD CSerial::SetLineFormat(int baud_rate, int byte_size, int parity, int stop_bits)
 {
-    COMMTIMEOUTS cto;
+    DWORD dwError;
 
-    cto.ReadIntervalTimeout = MAXWORD;
-    cto.ReadTotalTimeoutMultiplier = 0;
-    cto.ReadTotalTimeoutConstant = 1;
-    cto.WriteTotalTimeoutMultiplier = 0;
-    cto.WriteTotalTimeoutConstant = 0;
-
-    SetCommTimeouts(hPort, &cto);
-}
-
-//-----------------------------------------------------------------------------------------------------------------------------------------------------
+    SecureZeroMemory(&dcb, sizeof(DCB));
 
-//int CSerial::Read(char *s, int len)
-//{
-//	DWORD read = 0;
-//
-//	if( !ReadFile(hPort, (char *)s, len, &read, 0) )
-//	{
-//		return 0;
-//	}
-//	
-//	return read;
-//}
+    dcb.DCBlength = sizeof(DCB);
 
-//-----------------------------------------------------------------------------------------------------------------------------------------------------
+    if (!pTransport->GetCommState(&dcb))
+    {
+        return ::GetLastError();
+    }
 
-int CSerial::Write(char *s, int len)
-{
-    DWORD wrote = 0;
+    dwError = SetLineFields(baud_rate, byte_size, parity, stop_bits);
+    if (dwError != ERROR_SUCCESS)
+    {
+        return dwError;
+    }
 
-    if (!WriteFile(hPort, (char *)s, len, &wrote, 0))
+    if (!ApplyCommState())
     {
-        return 0;
+        return ::GetLastError();
     }
 
-    return wrote;
+    UpdateIdleGap();
+
+    return ERROR_SUCCESS;
 }
 
 //-----------------------------------------------------------------------------------------------------------------------------------------------------
 
-int CSerial::Write(char *s, int len, int delay)
+DWORD CSerial::SetLineFields(int baud_rate, int byte_size, int parity, int stop_bits)
 {
-    DWORD wrote = 0;
-    char temp[2];
-    int i;
-
-    for (i = 0; i < len; i++)
+    switch (baud_rate)
     {
-        Sleep(delay);
+        case CBR_110:
+        case CBR_300:
+        case CBR_600:
+        case CBR_1200:
+        case CBR_2400:
+        case CBR_4800:
+        case CBR_9600:
+        case CBR_14400:
+        case CBR_19200:
+        case CBR_38400:
+        case CBR_56000:
+        case CBR_57600:
+        case CBR_115200:
+        case CBR_128000:
+        case CBR_256000:
+            break;
 
-        temp[0] = s[i];
-        temp[1] = 0;
+        default:
+            return ERROR_BAD_COMMAND;
+    }
 
-        if (!WriteFile(hPort, (char *)temp, 1, &wrote, 0))
-        {
-            return 0;
-        }
+    if (byte_size < 5 || byte_size > 8 || parity < NOPARITY || parity > SPACEPARITY ||
+        (stop_bits != ONESTOPBIT && stop_bits != ONE5STOPBITS && stop_bits != TWOSTOPBITS))
+    {
+        return ERROR_BAD_COMMAND;
     }
 
-    return len;
+    dcb.BaudRate = DWORD(baud_rate);
+    dcb.ByteSize = BYTE(byte_size);
+    dcb.Parity = BYTE(parity);
+    dcb.StopBits = BYTE(stop_bits);
+    dcb.fParity = (parity != NOPARITY);
+
+    return ERROR_SUCCESS;
 }
 
 //-----------------------------------------------------------------------------------------------------------------------------------------------------
 
-DWORD CSerial::RegisterListenner( SERIAL_PORT_CALLBACK func_process )
+DWORD CSerial::Purge( DWORD dwFlags )
 {
-    process = func_process;
-    if (process == NULL)
+    if (!pTransport->PurgeComm(dwFlags))
     {
-        return (-1);
+        return ::GetLastError();
     }
+
     return ERROR_SUCCESS;
 }
 
 //-----------------------------------------------------------------------------------------------------------------------------------------------------
 
-DWORD CSerial::SerialPortListener( void )
+void CSerial::GetLineErrors( SERIAL_LINE_ERRORS * pErrors )
 {
-  DWORD rxEvnt;
-  DWORD dwRet;
-  DWORD dwBytesRead;
-  BYTE * pBuffer;
-  const int bufferLen = (1024);
-  //struct SERIAL_DATA * serialData;
-
-  ov.hEvent = CreateEvent( NULL, TRUE, FALSE, NULL );
-  ov.Internal = 0;
-  ov.InternalHigh = 0;
-  ov.Offset = 0;
-  ov.OffsetHigh = 0;
-  
-  if ( ov.hEvent == NULL )
-  {
-    CWin32Error e;
-    return e.ErrorCode();
-  }
+    pErrors->dwFraming = DWORD(lFramingErrors);
+    pErrors->dwParity = DWORD(lParityErrors);
+    pErrors->dwOverrun = DWORD(lOverrunErrors);
+    pErrors->dwBreak = DWORD(lBreakErrors);
+}
 
-  // configura o evento a ser recebido
-  if ( SetCommMask( hPort, (DWORD)EV_RXCHAR ) )
-  {
-    CWin32Error e;
-    return e.ErrorCode();
-  }
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
 
-  do
+void CSerial::CountLineErrors( DWORD dwErrors )
+{
+    if (dwErrors != 0)
+    {
+        SERIAL_TRACE_ERROR(cDevice, SERIAL_OPERATION_LINE, dwErrors);
+    }
+
+    // the listener and the transmit monitor may count at the same time
+    if (dwErrors & CE_FRAME)
+    {
+        InterlockedIncrement(&lFramingErrors);
+    }
+    if (dwErrors & CE_RXPARITY)
+    {
+        InterlockedIncrement(&lParityErrors);
+    }
+    if (dwErrors & (CE_OVERRUN | CE_RXOVER))
+    {
+        InterlockedIncrement(&lOverrunErrors);
+    }
+    if (dwErrors & CE_BREAK)
+    {
+        InterlockedIncrement(&lBreakErrors);
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerial::SetTimeouts()
+{
+    COMMTIMEOUTS cto;
+
+    cto.ReadTotalTimeoutMultiplier = 0;
+    cto.ReadTotalTimeoutConstant = 0;
+
+    if (DriverGap())
+    {
+        // the driver completes the read when the inter-byte gap expires
+        cto.ReadIntervalTimeout = (dwIdleGapUs + 999) / 1000;
+    }
+    else if (bCompletion)
+    {
+        // the pre-posted read waits for the first byte and returns with what was received by then
+        cto.ReadIntervalTimeout = MAXDWORD;
+        cto.ReadTotalTimeoutMultiplier = MAXDWORD;
+        cto.ReadTotalTimeoutConstant = MAXDWORD - 1;
+    }
+    else
+    {
+        // the read returns at once with the data already received
+        cto.ReadIntervalTimeout = MAXDWORD;
+    }
+    cto.WriteTotalTimeoutMultiplier = 0;
+    cto.WriteTotalTimeoutConstant = 0;
+
+    pTransport->SetCommTimeouts(&cto);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//int CSerial::Read(char *s, int len)
+//{
+//	DWORD read = 0;
+//
+//	if( !ReadFile(hPort, (char *)s, len, &read, 0) )
+//	{
+//		return 0;
+//	}
+//	
+//	return read;
+//}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+int CSerial::Write(char *s, int len)
+{
+    int sent;
+    int chunk;
+    DWORD wrote;
+
+    if (flowControl == FLOW_CONTROL_OFF)
+    {
+        return (WriteRaw(s, len, &wrote) == ERROR_SUCCESS) ? int(wrote) : 0;
+    }
+
+    // in chunks, so a throttle from the peer holds the transmission within one chunk
+    for (sent = 0; sent < len; sent += chunk)
+    {
+        if (!WaitPeerReady())
+        {
+            return sent;
+        }
+
+        chunk = (len - sent < SERIAL_FLOW_TX_CHUNK) ? len - sent : SERIAL_FLOW_TX_CHUNK;
+        // the chunks before are on the line, and what the failed one wrote: the caller resumes from there
+        if (WriteRaw(s + sent, chunk, &wrote) != ERROR_SUCCESS || int(wrote) != chunk)
+        {
+            return sent + int(wrote);
+        }
+    }
+
+    return len;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerial::WriteRaw(char *s, int len, DWORD * pdwWrote)
+{
+    DWORD wrote = 0;
+    DWORD dwError = ERROR_SUCCESS;
+    BOOL bRs485 = (rs485Mode == RS485_LIBRARY);
+    ULONGLONG ullStartUs;
+
+    SERIAL_TRACE_WRITE_START(cDevice, len);
+
+    if (bRs485)
+    {
+        Rs485Begin();
+    }
+
+    ullStartUs = GetTimestampUs();
+
+    if (!pTransport->WriteFile((char *)s, len, &wrote, &ovWrite))
+    {
+        dwError = ::GetLastError();
+        if (dwError == ERROR_IO_PENDING)
+        {
+            dwError = pTransport->GetOverlappedResult(&ovWrite, &wrote, TRUE) ? ERROR_SUCCESS : ::GetLastError();
+        }
+    }
+
+    if (bRs485)
+    {
+        Rs485End(wrote);
+    }
+
+    if (wrote != 0)
+    {
+        TrackWrite(wrote, ullStartUs);
+    }
+
+    SERIAL_TRACE_WRITE_DONE(cDevice, wrote, dwError);
+
+    *pdwWrote = wrote;
+
+    return dwError;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerial::BeginWrite(const char *s, int len)
+{
+    DWORD wrote = 0;
+    DWORD dwError;
+
+    SERIAL_TRACE_WRITE_START(cDevice, len);
+
+    if (rs485Mode == RS485_LIBRARY)
+    {
+        Rs485Begin();
+    }
+
+    ullWriteStartUs = GetTimestampUs();
+
+    if (!pTransport->WriteFile(s, len, &wrote, &ovWrite))
+    {
+        dwError = ::GetLastError();
+        if (dwError != ERROR_IO_PENDING)
+        {
+            if (rs485Mode == RS485_LIBRARY)
+            {
+                Rs485End(0);
+            }
+            SERIAL_TRACE_WRITE_DONE(cDevice, 0, dwError);
+            return dwError;
+        }
+    }
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+int CSerial::EndWrite( void )
+{
+    DWORD wrote = 0;
+    DWORD dwError = ERROR_SUCCESS;
+
+    if (!pTransport->GetOverlappedResult(&ovWrite, &wrote, TRUE))
+    {
+        dwError = ::GetLastError();
+    }
+
+    if (rs485Mode == RS485_LIBRARY)
+    {
+        Rs485End(wrote);
+    }
+
+    if (wrote != 0)
+    {
+        TrackWrite(wrote, ullWriteStartUs);
+    }
+
+    if (dwError != ERROR_SUCCESS)
+    {
+        SERIAL_TRACE_WRITE_DONE(cDevice, wrote, dwError);
+        return 0;
+    }
+
+    SERIAL_TRACE_WRITE_DONE(cDevice, wrote, ERROR_SUCCESS);
+
+    return wrote;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerial::PostWrite(const char *s, int len)
+{
+    SERIAL_COMPLETION_OP * pOp;
+    DWORD dwError = ERROR_SUCCESS;
+
+    // nothing would reap the write, or the write must wait for the peer or the bus
+    if (!bCompletion || flowControl != FLOW_CONTROL_OFF || rs485Mode == RS485_LIBRARY)
+    {
+        return (Write((char *)s, len) == len) ? ERROR_SUCCESS : ERROR_WRITE_FAULT;
+    }
+
+    if (InterlockedIncrement(&lWritesPending) > SERIAL_COMPLETION_MAX_WRITES)
+    {
+        InterlockedDecrement(&lWritesPending);
+        return ERROR_NOT_ENOUGH_QUOTA;
+    }
+
+    // the data follows the operation
+    pOp = (SERIAL_COMPLETION_OP*)malloc(sizeof(SERIAL_COMPLETION_OP) + len);
+    if (pOp == NULL)
+    {
+        InterlockedDecrement(&lWritesPending);
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    SecureZeroMemory(&pOp->ov, sizeof(OVERLAPPED));
+    pOp->type = COMPLETION_OP_WRITE;
+    pOp->dwLen = len;
+    pOp->pData = (BYTE*)(pOp + 1);
+    memcpy(pOp->pData, s, len);
+
+    SERIAL_TRACE_WRITE_START(cDevice, len);
+
+    EnterCriticalSection(&csCompletion);
+
+    if (bQuit)
+    {
+        dwError = ERROR_OPERATION_ABORTED;
+    }
+    else
+    {
+        pOp->ullStartUs = GetTimestampUs();
+        CompletionPosted();
+
+        // the driver queues the writes behind each other, in the order they were posted
+        if (!pTransport->WriteFile(pOp->pData, len, NULL, &pOp->ov) && ::GetLastError() != ERROR_IO_PENDING)
+        {
+            dwError = ::GetLastError();
+            CompletionDone();
+        }
+    }
+
+    LeaveCriticalSection(&csCompletion);
+
+    if (dwError != ERROR_SUCCESS)
+    {
+        SERIAL_TRACE_WRITE_DONE(cDevice, 0, dwError);
+        InterlockedDecrement(&lWritesPending);
+        free(pOp);
+    }
+
+    return dwError;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+int CSerial::Write(char *s, int len, int delay)
+{
+    char temp[2];
+    int i;
+
+    for (i = 0; i < len; i++)
+    {
+        Sleep(delay);
+
+        temp[0] = s[i];
+        temp[1] = 0;
+
+        if (Write(temp, 1) != 1)
+        {
+            return 0;
+        }
+    }
+
+    return len;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerial::RegisterListenner( SERIAL_PORT_CALLBACK func_process )
+{
+    process = func_process;
+    if (process == NULL)
+    {
+        return (-1);
+    }
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerial::RegisterFrameListenner( SERIAL_FRAME_CALLBACK func_process )
+{
+    processFrame = func_process;
+    if (processFrame == NULL)
+    {
+        return (-1);
+    }
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerial::SetIdleFraming(double dCharTimes)
+{
+    if (dCharTimes < 0.0)
+    {
+        return ERROR_BAD_COMMAND;
+    }
+
+    dIdleCharTimes = dCharTimes;
+
+    if (hPort != NULL)
+    {
+        // Obtem os parametros da porta serial aberta
+        SecureZeroMemory(&dcb, sizeof(DCB));
+
+        dcb.DCBlength = sizeof(DCB);
+
+        if (!pTransport->GetCommState(&dcb))
+        {
+            return ::GetLastError();
+        }
+    }
+
+    UpdateIdleGap();
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerial::GetIdleGap( void )
+{
+    return dwIdleGapUs;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerial::GetCharTime( void )
+{
+    return dwCharTimeNs;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerial::RegisterModemListenner( SERIAL_MODEM_CALLBACK func_process, DWORD dwEvents )
+{
+    if (dwEvents & ~(DWORD)(EV_CTS | EV_DSR | EV_RLSD | EV_RING))
+    {
+        return ERROR_BAD_COMMAND;
+    }
+
+    processModem = func_process;
+
+    dwModemEvents = (func_process != NULL) ? dwEvents : 0;
+
+    // completes the pending WaitCommEvent, so the listener waits again with the new mask
+    if ((hListenerThread != NULL || bCompletion) && !pTransport->SetCommMask(ListenerMask()))
+    {
+        return ::GetLastError();
+    }
+
+    if (processModem == NULL)
+    {
+        return (-1);
+    }
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerial::GetModemStatus( DWORD * pdwModemStatus )
+{
+    if (!pTransport->GetCommModemStatus(pdwModemStatus))
+    {
+        return ::GetLastError();
+    }
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerial::SetRts( BOOL bOn )
+{
+    if (!pTransport->EscapeCommFunction(bOn ? SETRTS : CLRRTS))
+    {
+        return ::GetLastError();
+    }
+
+    bRtsOn = bOn;
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerial::SetDtr( BOOL bOn )
+{
+    if (!pTransport->EscapeCommFunction(bOn ? SETDTR : CLRDTR))
+    {
+        return ::GetLastError();
+    }
+
+    bDtrOn = bOn;
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerial::SetFlowControl( EnumSerialFlowControl FlowControl, DWORD dwHigh, DWORD dwLow )
+{
+    DWORD dwRet;
+    DWORD dwModemStatus;
+
+    if (FlowControl != FLOW_CONTROL_OFF && dwLow >= dwHigh)
+    {
+        return ERROR_BAD_COMMAND;
+    }
+
+    // RTS enables the RS-485 transmitter
+    if (FlowControl == FLOW_CONTROL_HARDWARE && rs485Mode != RS485_OFF)
+    {
+        return ERROR_BAD_COMMAND;
+    }
+
+    // the driver handshake would fight with the library for the same lines
+    if (FlowControl != FLOW_CONTROL_OFF)
+    {
+        dwRet = SetHandshaking(HAND_SHAKE_OFF);
+        if (dwRet != ERROR_SUCCESS)
+        {
+            return dwRet;
+        }
+    }
+
+    EnterCriticalSection(&csFlow);
+
+    // release the peer with the previous mode before switching
+    SetThrottled(FALSE);
+
+    flowControl = FlowControl;
+    dwHighWatermark = dwHigh;
+    dwLowWatermark = dwLow;
+
+    dwRet = ERROR_SUCCESS;
+    if (FlowControl == FLOW_CONTROL_HARDWARE)
+    {
+        if (!pTransport->EscapeCommFunction(SETRTS) || !pTransport->GetCommModemStatus(&dwModemStatus))
+        {
+            dwRet = ::GetLastError();
+        }
+        else
+        {
+            bRtsOn = TRUE;
+            SetPeerThrottled(!(dwModemStatus & MS_CTS_ON));
+        }
+    }
+    else
+    {
+        SetPeerThrottled(FALSE);
+    }
+
+    LeaveCriticalSection(&csFlow);
+
+    // the listener watches CTS in the hardware mode
+    if (hListenerThread != NULL || bCompletion)
+    {
+        pTransport->SetCommMask(ListenerMask());
+    }
+
+    return dwRet;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerial::GetFlowStats( SERIAL_FLOW_STATS * pStats )
+{
+    ULONGLONG ullNowUs = GetTimestampUs();
+
+    EnterCriticalSection(&csFlow);
+
+    *pStats = flowStats;
+
+    // include the throttling still going on
+    if (bThrottled)
+    {
+        pStats->ullThrottledUs += ullNowUs - ullThrottleStartUs;
+    }
+    if (bPeerThrottled)
+    {
+        pStats->ullPeerThrottledUs += ullNowUs - ullPeerThrottleStartUs;
+    }
+
+    LeaveCriticalSection(&csFlow);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerial::SetRs485( BOOL bEnable, DWORD dwDelayBeforeUs, DWORD dwDelayAfterUs )
+{
+    DWORD dwError;
+
+    if (hPort == NULL)
+    {
+        return ERROR_INVALID_HANDLE;
+    }
+
+    // Obtem os parametros da porta serial aberta
+    SecureZeroMemory(&dcb, sizeof(DCB));
+
+    dcb.DCBlength = sizeof(DCB);
+
+    if (!pTransport->GetCommState(&dcb))
+    {
+        return ::GetLastError();
+    }
+
+    // the handshake and the flow control would drive RTS too
+    if (bEnable && (dcb.fRtsControl == RTS_CONTROL_HANDSHAKE || flowControl == FLOW_CONTROL_HARDWARE))
+    {
+        return ERROR_BAD_COMMAND;
+    }
+
+    dwRs485BeforeUs = dwDelayBeforeUs;
+    dwRs485AfterUs = dwDelayAfterUs;
+
+    // the transmitter is disabled while idle, so the bus is free for the other nodes
+    bRtsOn = FALSE;
+
+    rs485Mode = bEnable ? RS485_LIBRARY : RS485_OFF;
+
+    // the driver toggle has no delays, and many USB adapters reject it
+    if (bEnable && dwDelayBeforeUs == 0 && dwDelayAfterUs == 0)
+    {
+        rs485Mode = RS485_DRIVER;
+        if (!ApplyCommState())
+        {
+            rs485Mode = RS485_LIBRARY;
+        }
+    }
+
+    if (rs485Mode != RS485_DRIVER)
+    {
+        dcb.fRtsControl = RTS_CONTROL_DISABLE;
+        if (!ApplyCommState())
+        {
+            dwError = ::GetLastError();
+            rs485Mode = RS485_OFF;
+            return dwError;
+        }
+    }
+
+    // the listener watches EV_TXEMPTY in the library mode
+    if (hListenerThread != NULL || bCompletion)
+    {
+        pTransport->SetCommMask(ListenerMask());
+    }
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+EnumSerialRs485 CSerial::GetRs485Mode( void )
+{
+    return rs485Mode;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerial::GetRs485Stats( SERIAL_RS485_STATS * pStats )
+{
+    EnterCriticalSection(&csTx);
+    *pStats = rs485Stats;
+    LeaveCriticalSection(&csTx);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerial::Rs485Begin( void )
+{
+    ULONGLONG ullRtsUs;
+
+    // a EV_TXEMPTY left by an earlier transmission must not end this one
+    ResetEvent(hTxEmpty);
+
+    pTransport->EscapeCommFunction(SETRTS);
+    ullRtsUs = GetTimestampUs();
+
+    if (dwRs485BeforeUs != 0)
+    {
+        WaitUntilUs(ullRtsUs + dwRs485BeforeUs);
+    }
+
+    ullTxStartUs = GetTimestampUs();
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerial::Rs485End( DWORD dwLen )
+{
+    COMSTAT comStat;
+    DWORD dwErrors;
+    DWORD dwCharUs = (dwCharTimeNs + 999) / 1000;
+    ULONGLONG ullNowUs;
+    ULONGLONG ullWireEndUs;
+    ULONGLONG ullEndUs;
+    ULONGLONG ullTurnaroundUs;
+    BOOL bSignaled = FALSE;
+    BOOL bPolled = FALSE;
+
+    if (dwLen == 0)
+    {
+        pTransport->EscapeCommFunction(CLRRTS);
+        return;
+    }
+
+    if (pTransport->HasTxEmpty())
+    {
+        // the last stop bit cannot leave before the character time of everything that was sent
+        ullWireEndUs = ullTxStartUs + (ULONGLONG)dwLen * dwCharTimeNs / 1000;
+
+        // EV_TXEMPTY: the driver handed its last byte to the UART
+        ullNowUs = GetTimestampUs();
+        bSignaled = (WaitForSingleObject(hTxEmpty, DWORD(((ullWireEndUs > ullNowUs) ? ullWireEndUs - ullNowUs : 0) / 1000) + SERIAL_RS485_DRAIN_MARGIN_MS) == WAIT_OBJECT_0);
+
+        // confirmed by the transmit queue, which is polled when the event did not come
+        while (pTransport->ClearCommError(&dwErrors, &comStat))
+        {
+            CountLineErrors(dwErrors);
+            if (comStat.cbOutQue == 0)
+            {
+                break;
+            }
+            bSignaled = FALSE;
+            Sleep(DWORD((ULONGLONG)comStat.cbOutQue * dwCharTimeNs / 1000000));
+        }
+        bPolled = !bSignaled;
+
+        // the UART still shifts out its last character, the FIFO is covered by the character times
+        ullEndUs = (bSignaled ? ullTxEmptyUs : GetTimestampUs()) + dwCharUs;
+        if (ullEndUs < ullWireEndUs)
+        {
+            ullEndUs = ullWireEndUs;
+        }
+    }
+    else
+    {
+        // no line: the stream took the data when the write completed
+        ullEndUs = GetTimestampUs();
+    }
+
+    WaitUntilUs(ullEndUs + dwRs485AfterUs);
+
+    pTransport->EscapeCommFunction(CLRRTS);
+
+    ullTurnaroundUs = GetTimestampUs() - ullEndUs;
+
+    // Write may run on several threads, GetRs485Stats on any
+    EnterCriticalSection(&csTx);
+
+    if (bPolled)
+    {
+        rs485Stats.dwDrainPolls++;
+    }
+
+    rs485Stats.dwTransmissions++;
+    rs485Stats.ullLastTurnaroundUs = ullTurnaroundUs;
+    rs485Stats.ullTotalTurnaroundUs += ullTurnaroundUs;
+    if (ullTurnaroundUs > rs485Stats.ullMaxTurnaroundUs)
+    {
+        rs485Stats.ullMaxTurnaroundUs = ullTurnaroundUs;
+    }
+
+    LeaveCriticalSection(&csTx);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerial::SetTxMonitor( SERIAL_TX_CALLBACK func, LPVOID pContext )
+{
+    if (func == NULL)
+    {
+        StopTxMonitor();
+        return ERROR_SUCCESS;
+    }
+
+    if (hPort == NULL)
+    {
+        return ERROR_INVALID_HANDLE;
+    }
+
+    if (hTxMonitorThread == NULL)
+    {
+        bTxMonitorQuit = FALSE;
+        hTxMonitorThread = ::CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)CSerial::ThreadStartTxMonitor, this, 0, NULL);
+        if (hTxMonitorThread == NULL)
+        {
+            return ::GetLastError();
+        }
+    }
+
+    // the writes are followed from here on
+    EnterCriticalSection(&csTx);
+    txCallback = func;
+    pTxContext = pContext;
+    LeaveCriticalSection(&csTx);
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerial::StopTxMonitor( void )
+{
+    EnterCriticalSection(&csTx);
+    txCallback = NULL;
+    pTxContext = NULL;
+    LeaveCriticalSection(&csTx);
+
+    if (hTxMonitorThread != NULL)
+    {
+        bTxMonitorQuit = TRUE;
+        SetEvent(hTxQueued);
+
+        WaitForSingleObject(hTxMonitorThread, INFINITE);
+
+        CloseHandle(hTxMonitorThread);
+        hTxMonitorThread = NULL;
+    }
+
+    EnterCriticalSection(&csTx);
+    dwTxHead = 0;
+    dwTxCount = 0;
+    ullTxWritten = 0;
+    ullTxLineFreeUs = 0;
+    LeaveCriticalSection(&csTx);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerial::GetTxStats( SERIAL_TX_STATS * pStats )
+{
+    EnterCriticalSection(&csTx);
+    *pStats = txStats;
+    LeaveCriticalSection(&csTx);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerial::GetTxQueueDepth( DWORD * pdwBytes )
+{
+    COMSTAT comStat;
+    DWORD dwErrors;
+
+    if (!pTransport->ClearCommError(&dwErrors, &comStat))
+    {
+        return ::GetLastError();
+    }
+
+    CountLineErrors(dwErrors);
+
+    *pdwBytes = comStat.cbOutQue;
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerial::TrackWrite( DWORD dwLen, ULONGLONG ullStartUs )
+{
+    ULONGLONG ullNowUs;
+    TX_PENDING * pPending;
+
+    if (txCallback == NULL)
+    {
+        return;
+    }
+
+    ullNowUs = GetTimestampUs();
+
+    EnterCriticalSection(&csTx);
+
+    if (txCallback == NULL)
+    {
+        LeaveCriticalSection(&csTx);
+        return;
+    }
+
+    ullTxWritten += dwLen;
+
+    // the line sends without gaps: first what was written before, then this write
+    if (ullTxLineFreeUs < ullStartUs)
+    {
+        ullTxLineFreeUs = ullStartUs;
+    }
+    ullTxLineFreeUs += (ULONGLONG)dwLen * dwCharTimeNs / 1000;
+
+    if (dwTxCount == TX_MAX_PENDING)
+    {
+        txStats.dwUntracked++;
+    }
+    else
+    {
+        pPending = &aTxPending[(dwTxHead + dwTxCount) % TX_MAX_PENDING];
+        pPending->ullEnd = ullTxWritten;
+        pPending->ullReturnUs = ullNowUs;
+        pPending->ullLineUs = ullTxLineFreeUs;
+        dwTxCount++;
+    }
+
+    LeaveCriticalSection(&csTx);
+
+    SetEvent(hTxQueued);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerial::TxMonitor( void )
+{
+    HANDLE hTimer;
+    HANDLE hWait[2];
+    BOOL bPeriod = FALSE;
+    BOOL bDrained;
+    LARGE_INTEGER liDue;
+    COMSTAT comStat;
+    DWORD dwErrors;
+    DWORD dwOutQue;
+    DWORD dwCharUs;
+    TX_PENDING pending;
+    ULONGLONG ullNowUs;
+    ULONGLONG ullPollUs = 0;
+    ULONGLONG ullQueuedUs = 0;
+    ULONGLONG ullSent;
+    ULONGLONG ullWireUs;
+    ULONGLONG ullGapUs;
+    SERIAL_TX_CALLBACK func;
+    LPVOID pContext;
+
+    // the timers of the listener: high resolution, or coarse with the system timer resolution raised
+    hTimer = CreateWaitableTimerEx(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (hTimer == NULL)
+    {
+        hTimer = CreateWaitableTimer(NULL, FALSE, NULL);
+        if (hTimer != NULL)
+        {
+            bPeriod = (timeBeginPeriod(1) == TIMERR_NOERROR);
+        }
+    }
+
+    hWait[0] = hTxQueued;
+    hWait[1] = hTimer;
+
+    while (!bTxMonitorQuit)
+    {
+        EnterCriticalSection(&csTx);
+        if (dwTxCount == 0)
+        {
+            LeaveCriticalSection(&csTx);
+            WaitForSingleObject(hTxQueued, INFINITE);
+            continue;
+        }
+        pending = aTxPending[dwTxHead];
+        LeaveCriticalSection(&csTx);
+
+        // the driver is not asked before the line can have sent the write
+        if (ullPollUs < pending.ullLineUs)
+        {
+            ullPollUs = pending.ullLineUs;
+        }
+
+        // a new write or a stop wakes the monitor early, it looks again
+        ullNowUs = GetTimestampUs();
+        if (ullPollUs > ullNowUs)
+        {
+            if (hTimer != NULL)
+            {
+                liDue.QuadPart = -(LONGLONG)((ullPollUs - ullNowUs) * 10);
+                SetWaitableTimer(hTimer, &liDue, 0, NULL, NULL, FALSE);
+                WaitForMultipleObjects(2, hWait, FALSE, INFINITE);
+            }
+            else
+            {
+                WaitForSingleObject(hTxQueued, DWORD((ullPollUs - ullNowUs + 999) / 1000));
+            }
+            continue;
+        }
+
+        // the bytes still in the driver transmit queue have not been sent; when the queue cannot
+        //   be read, the port is drained and everything written so far has been sent
+        bDrained = FALSE;
+        dwOutQue = 0;
+        if (pTransport->ClearCommError(&dwErrors, &comStat))
+        {
+            CountLineErrors(dwErrors);
+            dwOutQue = comStat.cbOutQue;
+        }
+        else
+        {
+            pTransport->FlushFileBuffers();
+            bDrained = TRUE;
+        }
+
+        ullNowUs = GetTimestampUs();
+        dwCharUs = (dwCharTimeNs + 999) / 1000;
+
+        EnterCriticalSection(&csTx);
+
+        if (bDrained)
+        {
+            txStats.dwDrains++;
+            ullQueuedUs = ullNowUs;
+        }
+
+        ullSent = (ullTxWritten > dwOutQue) ? ullTxWritten - dwOutQue : 0;
+
+        if (dwTxCount != 0 && aTxPending[dwTxHead].ullEnd > ullSent)
+        {
+            // still queued: looked at again when the character time says it should have drained
+            ullPollUs = ullNowUs + (aTxPending[dwTxHead].ullEnd - ullSent) * dwCharTimeNs / 1000;
+            if (ullPollUs < ullNowUs + SERIAL_TX_POLL_MIN_US)
+            {
+                ullPollUs = ullNowUs + SERIAL_TX_POLL_MIN_US;
+            }
+            ullQueuedUs = ullNowUs;
+            LeaveCriticalSection(&csTx);
+            continue;
+        }
+
+        // every write released by the queue whose characters the line had time to send
+        while (dwTxCount != 0 && aTxPending[dwTxHead].ullEnd <= ullSent && aTxPending[dwTxHead].ullLineUs <= ullNowUs)
+        {
+            pending = aTxPending[dwTxHead];
+            dwTxHead = (dwTxHead + 1) % TX_MAX_PENDING;
+            dwTxCount--;
+
+            // the write left the queue after the last poll that still held it, then the UART
+            //   shifted out its last character
+            ullWireUs = (ullQueuedUs != 0) ? ullQueuedUs + dwCharUs : 0;
+            if (ullWireUs < pending.ullLineUs)
+            {
+                ullWireUs = pending.ullLineUs;
+            }
+
+            ullGapUs = (ullWireUs > pending.ullReturnUs) ? ullWireUs - pending.ullReturnUs : 0;
+            txStats.dwWrites++;
+            txStats.ullLastGapUs = ullGapUs;
+            txStats.ullTotalGapUs += ullGapUs;
+            if (ullGapUs > txStats.ullMaxGapUs)
+            {
+                txStats.ullMaxGapUs = ullGapUs;
+            }
+
+            func = txCallback;
+            pContext = pTxContext;
+            LeaveCriticalSection(&csTx);
+
+            if (func != NULL)
+            {
+                func(pContext, pending.ullEnd, pending.ullReturnUs, ullWireUs);
+            }
+
+            EnterCriticalSection(&csTx);
+        }
+
+        LeaveCriticalSection(&csTx);
+
+        ullPollUs = 0;
+        ullQueuedUs = 0;
+    }
+
+    if (hTimer != NULL)
+    {
+        CloseHandle(hTimer);
+    }
+    if (bPeriod)
+    {
+        timeEndPeriod(1);
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD WINAPI CSerial::ThreadStartTxMonitor( LPVOID lpParam )
+{
+    ((CSerial*)lpParam)->TxMonitor();
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+std::error_code CSerial::GetListenerError( void )
+{
+    return MakeSerialError(dwListenerError);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerial::SetReceiveTap( SERIAL_TAP_CALLBACK func, LPVOID pContext )
+{
+    AcquireSRWLockExclusive(&srwStrand);
+    tap = func;
+    pTapContext = pContext;
+    ReleaseSRWLockExclusive(&srwStrand);
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerial::SetCapture( SERIAL_CAPTURE_CALLBACK func, LPVOID pContext )
+{
+    AcquireSRWLockExclusive(&srwStrand);
+    capture = func;
+    pCaptureContext = pContext;
+    ReleaseSRWLockExclusive(&srwStrand);
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerial::SetExecutor( CSerialExecutor * pExecutor )
+{
+    CSerialStrand * pNewStrand = NULL;
+    CSerialStrand * pOldStrand;
+    BOOL bOwnCallback;
+
+    // the strand would wait for the callback that is waiting for it
+    AcquireSRWLockShared(&srwStrand);
+    bOwnCallback = (pStrand != NULL && pStrand->IsCurrentThread());
+    ReleaseSRWLockShared(&srwStrand);
+
+    if (bOwnCallback)
+    {
+        return ERROR_BUSY;
+    }
+
+    if (pExecutor != NULL)
+    {
+        pNewStrand = new CSerialStrand(pExecutor, CSerial::DispatchStrand, this);
+    }
+
+    AcquireSRWLockExclusive(&srwStrand);
+    pOldStrand = pStrand;
+    pStrand = pNewStrand;
+    ReleaseSRWLockExclusive(&srwStrand);
+
+    // the chunks already queued are processed before the strand goes away
+    if (pOldStrand != NULL)
+    {
+        delete pOldStrand;
+    }
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerial::GetRxQueueDepth( void )
+{
+    DWORD dwDepth = 0;
+
+    AcquireSRWLockShared(&srwStrand);
+    if (pStrand != NULL)
+    {
+        dwDepth = pStrand->GetQueueDepth();
+    }
+    ReleaseSRWLockShared(&srwStrand);
+
+    return dwDepth;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerial::GetRxQueuedBytes( void )
+{
+    DWORD dwBytes = 0;
+
+    AcquireSRWLockShared(&srwStrand);
+    if (pStrand != NULL)
+    {
+        dwBytes = pStrand->GetQueuedBytes();
+    }
+    ReleaseSRWLockShared(&srwStrand);
+
+    return dwBytes;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerial::GetRxDropped( void )
+{
+    return DWORD(lRxDropped);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerial::SetCompletionPort( CSerialCompletionPort * pCompletionPort )
+{
+    // the operations of a port closed from a callback are still counted by their completion port
+    if (hPort != NULL || lOpsPending != 0)
+    {
+        return ERROR_BUSY;
+    }
+
+    this->pCompletionPort = pCompletionPort;
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerial::UsesCompletionPort( void )
+{
+    return bCompletion;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerial::UpdateIdleGap( void )
+{
+    double dBits;
+    DWORD dwGapUs;
+
+    if (dcb.BaudRate == 0)
+    {
+        dwCharTimeNs = 0;
+        dwIdleGapUs = 0;
+        return;
+    }
+
+    // start bit + data bits + parity bit + stop bits
+    dBits = 1.0 + dcb.ByteSize + ((dcb.Parity != NOPARITY) ? 1.0 : 0.0);
+    switch (dcb.StopBits)
+    {
+        case ONE5STOPBITS:  dBits += 1.5;   break;
+        case TWOSTOPBITS:   dBits += 2.0;   break;
+        default:            dBits += 1.0;   break;
+    }
+
+    dwCharTimeNs = DWORD(dBits * 1000000000.0 / dcb.BaudRate + 0.5);
+
+    if (dIdleCharTimes > 0.0)
+    {
+        // the listener reads the gap concurrently, so it never sees an intermediate value
+        dwGapUs = DWORD(dIdleCharTimes * dwCharTimeNs / 1000.0 + 0.5);
+        dwIdleGapUs = (dwGapUs > 0) ? dwGapUs : 1;
+    }
+    else
+    {
+        dwIdleGapUs = 0;
+    }
+
+    if (hPort != NULL)
+    {
+        SetTimeouts();
+    }
+
+    // wake the listener, it may have to switch between the driver timeout and the timer
+    if (hListenerThread != NULL || bCompletion)
+    {
+        pTransport->SetCommMask(ListenerMask());
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerial::DriverGap( void )
+{
+    // the reads of a completion port end every frame with the driver timeout, there is no timer
+    if (bCompletion)
+    {
+        return (dwIdleGapUs > 0);
+    }
+
+    // the links emulated over a stream have no inter-byte timeout, the timer closes their frames
+    return (dwIdleGapUs >= SERIAL_IDLE_DRIVER_MIN_US) && pTransport->HasIntervalTimeout();
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerial::ListenerMask( void )
+{
+    // with the driver inter-byte timeout, or the reads of a completion port, the read itself waits for the data
+    return ((DriverGap() || bCompletion) ? 0 : (DWORD)EV_RXCHAR) | dwModemEvents |
+           ((flowControl == FLOW_CONTROL_HARDWARE) ? (DWORD)EV_CTS : 0) |
+           ((rs485Mode == RS485_LIBRARY) ? (DWORD)EV_TXEMPTY : 0) | EV_ERR | EV_BREAK;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerial::SerialPortListener( void )
+{
+  DWORD rxEvnt = 0;
+  DWORD dwRet;
+  DWORD dwResult = ERROR_SUCCESS;
+  DWORD dwBytesRead;
+  DWORD dwMask = 0;
+  DWORD dwNewMask;
+  BOOL bDriverGap;
+  BOOL bEventPending = FALSE;
+  BOOL bFramePending = FALSE;
+  HANDLE hWait[4];
+  HANDLE hSignaled;
+  ULONGLONG ullWakeUs;
+  DWORD nWait;
+  BYTE * pBuffer;
+  const int bufferLen = SERIAL_RX_BUFFER_LEN;
+  //struct SERIAL_DATA * serialData;
+
+  ov.hEvent = CreateEvent( NULL, TRUE, FALSE, NULL );
+  ov.Internal = 0;
+  ov.InternalHigh = 0;
+  ov.Offset = 0;
+  ov.OffsetHigh = 0;
+  ovRead.hEvent = CreateEvent( NULL, TRUE, FALSE, NULL );
+  ovFrame.hEvent = CreateEvent( NULL, TRUE, FALSE, NULL );
+
+  // high resolution timer where the system offers it, otherwise a coarse timer
+  // with the system timer resolution raised to 1 ms while the listener runs
+  hIdleTimer = CreateWaitableTimerEx( NULL, NULL, CREATE_WAITABLE_TIMER_MANUAL_RESET | CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS );
+  if ( hIdleTimer == NULL )
+  {
+    hIdleTimer = CreateWaitableTimer( NULL, TRUE, NULL );
+    if ( hIdleTimer != NULL )
+    {
+      bTimerPeriod = ( timeBeginPeriod( 1 ) == TIMERR_NOERROR );
+    }
+  }
+
+  if ( ov.hEvent == NULL || ovRead.hEvent == NULL || ovFrame.hEvent == NULL || hIdleTimer == NULL )
+  {
+    dwResult = ::GetLastError();
+    bQuit = TRUE;
+  }
+
+  pBuffer = new BYTE [ bufferLen ];
+  pFrame = new BYTE [ SERIAL_MAX_FRAME_LEN ];
+  dwFrameLen = 0;
+
+  // any failure other than a pending operation means the device is gone: the
+  // listener stops instead of spinning on the error
+  do
+  {
+    if ( bQuit == TRUE )
+    {
+      break;
+    }
+
+    bDriverGap = DriverGap();
+
+    // configura o evento a ser recebido
+    dwNewMask = ListenerMask();
+    if ( dwNewMask != dwMask )
+    {
+      if ( !pTransport->SetCommMask( dwNewMask ) )
+      {
+        dwResult = ::GetLastError();
+        break;
+      }
+      dwMask = dwNewMask;
+    }
+
+    if ( !bEventPending && dwMask != 0 )
+    {
+      rxEvnt = 0;
+      if ( pTransport->WaitCommEvent( &rxEvnt, &ov ) )
+      {
+        if ( !OnCommEvent( rxEvnt, GetTimestampUs(), pBuffer, bufferLen ) )
+        {
+          dwResult = ::GetLastError();
+          break;
+        }
+        continue;
+      }
+
+      if ( GetLastError() != ERROR_IO_PENDING )
+      {
+        dwResult = ::GetLastError();
+        break;
+      }
+      bEventPending = TRUE;
+    }
+
+    if ( bFramePending && !bDriverGap )
+    {
+      // back from the driver timeout to the timer: the frame read must not share pFrame
+      pTransport->CancelIoEx( &ovFrame );
+      bFramePending = FALSE;
+      if ( pTransport->GetOverlappedResult( &ovFrame, &dwBytesRead, TRUE ) )
+      {
+        OnDriverFrame( dwBytesRead, GetTimestampUs() );
+      }
+    }
+
+    if ( !bFramePending && bDriverGap )
+    {
+      // a frame left by the timer would be overwritten by the read
+      DeliverFrame();
+
+      dwBytesRead = 0;
+      if ( pTransport->ReadFile( (LPVOID)pFrame, SERIAL_MAX_FRAME_LEN, &dwBytesRead, &ovFrame ) )
+      {
+        OnDriverFrame( dwBytesRead, GetTimestampUs() );
+        continue;
+      }
+
+      if ( GetLastError() != ERROR_IO_PENDING )
+      {
+        dwResult = ::GetLastError();
+        break;
+      }
+      bFramePending = TRUE;
+    }
+
+    // Close signals hQuitEvent, so the wait never outlives the port
+    nWait = 0;
+    hWait[ nWait++ ] = hQuitEvent;
+    if ( bEventPending )
+    {
+      hWait[ nWait++ ] = ov.hEvent;
+    }
+    if ( bFramePending )
+    {
+      hWait[ nWait++ ] = ovFrame.hEvent;
+    }
+    if ( dwFrameLen > 0 && !bFramePending )
+    {
+      hWait[ nWait++ ] = hIdleTimer;
+    }
+
+    dwRet = WaitForMultipleObjects( nWait, hWait, FALSE, INFINITE );
+    if ( dwRet >= WAIT_OBJECT_0 + nWait )
+    {
+      dwResult = ::GetLastError();
+      break;
+    }
+    hSignaled = hWait[ dwRet - WAIT_OBJECT_0 ];
+
+    // taken before anything else, it is the time of the modem line edges
+    ullWakeUs = GetTimestampUs();
+
+    if ( hSignaled == hQuitEvent )
+    {
+      break;
+    }
+    else if ( hSignaled == ov.hEvent )
+    {
+      bEventPending = FALSE;
+      if ( !pTransport->GetOverlappedResult( &ov, &dwBytesRead, FALSE ) ||
+           !OnCommEvent( rxEvnt, ullWakeUs, pBuffer, bufferLen ) )
+      {
+        dwResult = ::GetLastError();
+        break;
+      }
+    }
+    else if ( hSignaled == ovFrame.hEvent )
+    {
+      bFramePending = FALSE;
+      if ( !pTransport->GetOverlappedResult( &ovFrame, &dwBytesRead, FALSE ) )
+      {
+        dwResult = ::GetLastError();
+        break;
+      }
+      OnDriverFrame( dwBytesRead, GetTimestampUs() );
+    }
+    else
+    {
+      OnIdleTimer( pBuffer, bufferLen );
+    }
+
+  }while( 1 );
+
+  // the kernel still refers to the OVERLAPPED structures of the pending operations; an emulated
+  // link may read with the event of ov even when no wait is pending
+  pTransport->CancelIo( );
+  if ( bEventPending )
+  {
+    pTransport->GetOverlappedResult( &ov, &dwBytesRead, TRUE );
+  }
+  if ( bFramePending )
+  {
+    pTransport->GetOverlappedResult( &ovFrame, &dwBytesRead, TRUE );
+  }
+
+  // a frame interrupted by Close is still handed over
+  DeliverFrame();
+
+  if ( bTimerPeriod )
+  {
+    timeEndPeriod( 1 );
+    bTimerPeriod = FALSE;
+  }
+
+  if ( hIdleTimer != NULL )
+  {
+    CloseHandle( hIdleTimer );
+    hIdleTimer = NULL;
+  }
+  if ( ovFrame.hEvent != NULL )
+  {
+    CloseHandle( ovFrame.hEvent );
+    ovFrame.hEvent = NULL;
+  }
+  if ( ovRead.hEvent != NULL )
+  {
+    CloseHandle( ovRead.hEvent );
+    ovRead.hEvent = NULL;
+  }
+  if ( ov.hEvent != NULL )
+  {
+    CloseHandle( ov.hEvent );
+    ov.hEvent = NULL;
+  }
+
+  delete [] pFrame;
+  pFrame = NULL;
+  delete [] pBuffer;
+
+  dwListenerError = dwResult;
+
+  return dwResult;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerial::OnLineEvent( DWORD dwEvent, ULONGLONG ullTimestampUs )
+{
+  DWORD dwModemStatus;
+  SERIAL_MODEM_CALLBACK func = processModem;
+  BOOL bFlowCts = ( flowControl == FLOW_CONTROL_HARDWARE ) && ( dwEvent & EV_CTS );
+  DWORD dwErrors;
+
+  // ends the RS-485 transmission waiting in Rs485End
+  if ( dwEvent & EV_TXEMPTY )
+  {
+    ullTxEmptyUs = ullTimestampUs;
+    SetEvent( hTxEmpty );
+  }
+
+  if ( dwEvent & ( EV_ERR | EV_BREAK ) )
+  {
+    // the driver keeps the error flags until they are cleared
+    if ( pTransport->ClearCommError( &dwErrors, NULL ) )
+    {
+      CountLineErrors( dwErrors );
+    }
+  }
+
+  if ( ( ( dwEvent & dwModemEvents ) && func != NULL ) || bFlowCts )
+  {
+    // the status is read after the edge, a line that toggled again meanwhile shows its new state
+    if ( !pTransport->GetCommModemStatus( &dwModemStatus ) )
+    {
+      return FALSE;
+    }
+
+    if ( bFlowCts )
+    {
+      EnterCriticalSection( &csFlow );
+      SetPeerThrottled( !( dwModemStatus & MS_CTS_ON ) );
+      LeaveCriticalSection( &csFlow );
+    }
+
+    if ( ( dwEvent & dwModemEvents ) && func != NULL )
+    {
+      func( dwEvent & dwModemEvents, dwModemStatus, ullTimestampUs );
+    }
+  }
+
+  return TRUE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerial::OnCommEvent( DWORD dwEvent, ULONGLONG ullTimestampUs, BYTE * pBuffer, DWORD dwLen )
+{
+  if ( !OnLineEvent( dwEvent, ullTimestampUs ) )
+  {
+    return FALSE;
+  }
+
+  if ( dwEvent & EV_RXCHAR )
+  {
+    return ReadChunks( pBuffer, dwLen );
+  }
+
+  return TRUE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerial::ReadChunks( BYTE * pBuffer, DWORD dwLen )
+{
+  DWORD dwBytesRead;
+  DWORD dwDataLen;
+
+  // EV_RXCHAR is not signaled again for data that is already in the driver buffer
+  do
+  {
+    dwBytesRead = 0;
+    if ( !pTransport->ReadFile( (LPVOID)pBuffer, dwLen, &dwBytesRead, &ovRead ) )
+    {
+      if ( GetLastError() != ERROR_IO_PENDING )
+      {
+        return FALSE;
+      }
+
+      if ( !pTransport->GetOverlappedResult( &ovRead, &dwBytesRead, TRUE ) )
+      {
+        return FALSE;
+      }
+    }
+
+    SERIAL_TRACE_READ( cDevice, dwBytesRead );
+
+    dwDataLen = dwBytesRead;
+    if ( flowControl == FLOW_CONTROL_SOFTWARE )
+    {
+      dwDataLen = StripFlowChars( pBuffer, dwBytesRead );
+    }
+
+    if ( dwDataLen > 0 )
+    {
+      OnRxChunk( pBuffer, dwDataLen, GetTimestampUs() );
+    }
+  } while ( dwBytesRead == dwLen );
+
+  return TRUE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerial::OnRxChunk( BYTE * pBuffer, DWORD dwLen, ULONGLONG ullTimestampUs )
+{
+  DWORD dwGapUs = dwIdleGapUs;
+  ULONGLONG ullSpanUs;
+
+  if ( capture != NULL )
+  {
+    // the chunk is timestamped when read: the first byte arrived one character per byte earlier
+    ullSpanUs = (ULONGLONG)( dwLen - 1 ) * dwCharTimeNs / 1000;
+    DispatchCapture( pBuffer, dwLen, ( ullSpanUs < ullTimestampUs ) ? ullTimestampUs - ullSpanUs : ullTimestampUs );
+  }
+
+  if ( tap != NULL && DispatchTap( pBuffer, dwLen ) )
+  {
+    return;
+  }
+
+  if ( dwGapUs == 0 )
+  {
+    Dispatch( pBuffer, dwLen, ullTimestampUs, ullTimestampUs, FALSE );
+    return;
+  }
+
+  while ( dwLen > 0 )
+  {
+    if ( dwFrameLen == SERIAL_MAX_FRAME_LEN )
+    {
+      DeliverFrame();
+    }
+
+    DWORD dwCopy = SERIAL_MAX_FRAME_LEN - dwFrameLen;
+    if ( dwCopy > dwLen )
+    {
+      dwCopy = dwLen;
+    }
+
+    if ( dwFrameLen == 0 )
+    {
+      // the chunk is timestamped when read: the first byte arrived one character per byte earlier
+      ullSpanUs = (ULONGLONG)( dwCopy - 1 ) * dwCharTimeNs / 1000;
+      ullFrameFirstUs = ( ullSpanUs < ullTimestampUs ) ? ullTimestampUs - ullSpanUs : ullTimestampUs;
+    }
+
+    memcpy( pFrame + dwFrameLen, pBuffer, dwCopy );
+    dwFrameLen += dwCopy;
+    pBuffer += dwCopy;
+    dwLen -= dwCopy;
+  }
+
+  ullFrameLastUs = ullTimestampUs;
+  ArmIdleTimer( ullTimestampUs + dwGapUs );
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerial::OnDriverFrame( DWORD dwLen, ULONGLONG ullTimestampUs )
+{
+  DWORD dwGapUs = dwIdleGapUs;
+  ULONGLONG ullSpanUs;
+
+  if ( dwLen == 0 )
+  {
+    return;
+  }
+
+  SERIAL_TRACE_READ( cDevice, dwLen );
+
+  // the read completes one gap after the last byte
+  ullFrameLastUs = ( dwGapUs < ullTimestampUs ) ? ullTimestampUs - dwGapUs : ullTimestampUs;
+  ullSpanUs = (ULONGLONG)( dwLen - 1 ) * dwCharTimeNs / 1000;
+  ullFrameFirstUs = ( ullSpanUs < ullFrameLastUs ) ? ullFrameLastUs - ullSpanUs : ullFrameLastUs;
+
+  if ( capture != NULL )
+  {
+    DispatchCapture( pFrame, dwLen, ullFrameFirstUs );
+  }
+
+  if ( tap != NULL && DispatchTap( pFrame, dwLen ) )
+  {
+    return;
+  }
+
+  dwFrameLen = dwLen;
+
+  DeliverFrame();
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerial::OnIdleTimer( BYTE * pBuffer, DWORD dwLen )
+{
+  DWORD dwErrors;
+  COMSTAT comStat;
+  ULONGLONG ullDeadlineUs;
+
+  comStat.cbInQue = 0;
+  if ( pTransport->ClearCommError( &dwErrors, &comStat ) )
+  {
+    CountLineErrors( dwErrors );
+  }
+
+  // data that arrived while the timer expired belongs to the current frame
+  if ( comStat.cbInQue > 0 )
+  {
+    ReadChunks( pBuffer, dwLen );
+    return;
+  }
+
+  ullDeadlineUs = ullFrameLastUs + dwIdleGapUs;
+  if ( GetTimestampUs() < ullDeadlineUs )
+  {
+    ArmIdleTimer( ullDeadlineUs );
+    return;
+  }
+
+  DeliverFrame();
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerial::ArmIdleTimer( ULONGLONG ullDeadlineUs )
+{
+  LARGE_INTEGER liDue;
+  ULONGLONG ullNowUs = GetTimestampUs();
+
+  // relative due time, in 100 ns units
+  liDue.QuadPart = ( ullDeadlineUs > ullNowUs ) ? -(LONGLONG)( ( ullDeadlineUs - ullNowUs ) * 10 ) : -1;
+
+  SetWaitableTimer( hIdleTimer, &liDue, 0, NULL, NULL, FALSE );
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerial::DeliverFrame( void )
+{
+  if ( dwFrameLen == 0 )
+  {
+    return;
+  }
+
+  Dispatch( pFrame, dwFrameLen, ullFrameFirstUs, ullFrameLastUs, TRUE );
+
+  dwFrameLen = 0;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerial::Dispatch( BYTE * pBuffer, DWORD dwLen, ULONGLONG ullFirstUs, ULONGLONG ullLastUs, BOOL bFrame )
+{
+  DWORD dwResult;
+
+  AcquireSRWLockShared( &srwStrand );
+
+  if ( pStrand != NULL )
+  {
+    dwResult = pStrand->Post( pBuffer, dwLen, ullFirstUs, ullLastUs, bFrame ? SERIAL_CHUNK_FRAME : 0 );
+    ReleaseSRWLockShared( &srwStrand );
+
+    // calling back from here would run beside the strand and out of order, the chunk is lost
+    if ( dwResult != ERROR_SUCCESS )
+    {
+      InterlockedIncrement( &lRxDropped );
+      SERIAL_TRACE_ERROR( cDevice, SERIAL_OPERATION_DISPATCH, dwResult );
+    }
+
+    if ( flowControl != FLOW_CONTROL_OFF )
+    {
+      CheckRxWatermarks();
+    }
+    return;
+  }
+
+  ReleaseSRWLockShared( &srwStrand );
+
+  if ( bFrame && processFrame != NULL )
+  {
+    SERIAL_TRACE_CALLBACK_ENTER( cDevice, dwLen );
+    processFrame( pBuffer, dwLen, ullFirstUs, ullLastUs );
+    SERIAL_TRACE_CALLBACK_EXIT( cDevice, dwLen );
+  }
+  else if ( process != NULL )
+  {
+    SERIAL_TRACE_CALLBACK_ENTER( cDevice, dwLen );
+    process( pBuffer, dwLen );
+    SERIAL_TRACE_CALLBACK_EXIT( cDevice, dwLen );
+  }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerial::DispatchTap( BYTE * pBuffer, DWORD dwLen )
+{
+  BOOL bTapped = FALSE;
+
+  AcquireSRWLockShared( &srwStrand );
+
+  if ( tap != NULL )
+  {
+    tap( pTapContext, pBuffer, dwLen );
+    bTapped = TRUE;
+  }
+
+  ReleaseSRWLockShared( &srwStrand );
+
+  return bTapped;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerial::DispatchCapture( const BYTE * pBuffer, DWORD dwLen, ULONGLONG ullFirstUs )
+{
+  AcquireSRWLockShared( &srwStrand );
+
+  if ( capture != NULL )
+  {
+    capture( pCaptureContext, pBuffer, dwLen, ullFirstUs );
+  }
+
+  ReleaseSRWLockShared( &srwStrand );
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerial::DispatchStrand( LPVOID pContext, BYTE * pBuffer, DWORD dwLen, ULONGLONG ullFirstUs, ULONGLONG ullLastUs, DWORD dwFlags )
+{
+  CSerial * serial;
+
+  serial = (CSerial*)pContext;
+
+  // the framing in use when the chunk was received, SetIdleFraming may have changed it since
+  if ( ( dwFlags & SERIAL_CHUNK_FRAME ) && serial->processFrame != NULL )
+  {
+    SERIAL_TRACE_CALLBACK_ENTER( serial->cDevice, dwLen );
+    serial->processFrame( pBuffer, dwLen, ullFirstUs, ullLastUs );
+    SERIAL_TRACE_CALLBACK_EXIT( serial->cDevice, dwLen );
+  }
+  else if ( serial->process != NULL )
+  {
+    SERIAL_TRACE_CALLBACK_ENTER( serial->cDevice, dwLen );
+    serial->process( pBuffer, dwLen );
+    SERIAL_TRACE_CALLBACK_EXIT( serial->cDevice, dwLen );
+  }
+
+  if ( serial->flowControl != FLOW_CONTROL_OFF )
+  {
+    serial->CheckRxWatermarks();
+  }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerial::CheckRxWatermarks( void )
+{
+  DWORD dwQueued = GetRxQueuedBytes();
+
+  EnterCriticalSection( &csFlow );
+
+  if ( !bThrottled && dwQueued >= dwHighWatermark )
+  {
+    SetThrottled( TRUE );
+  }
+  else if ( bThrottled && dwQueued <= dwLowWatermark )
+  {
+    SetThrottled( FALSE );
+  }
+
+  LeaveCriticalSection( &csFlow );
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerial::SetThrottled( BOOL bOn )
+{
+  // called with csFlow held
+  if ( bOn == bThrottled )
+  {
+    return;
+  }
+
+  if ( flowControl == FLOW_CONTROL_HARDWARE )
+  {
+    pTransport->EscapeCommFunction( bOn ? CLRRTS : SETRTS );
+  }
+  else if ( flowControl == FLOW_CONTROL_SOFTWARE )
+  {
+    // sent ahead of the data waiting in the output buffer
+    pTransport->TransmitCommChar( bOn ? SERIAL_XOFF : SERIAL_XON );
+  }
+
+  bThrottled = bOn;
+  if ( bOn )
   {
-    if ( bQuit == TRUE )
+    ullThrottleStartUs = GetTimestampUs();
+    flowStats.dwThrottleEvents++;
+  }
+  else
+  {
+    flowStats.ullThrottledUs += GetTimestampUs() - ullThrottleStartUs;
+  }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerial::SetPeerThrottled( BOOL bOn )
+{
+  // called with csFlow held
+  if ( bOn == bPeerThrottled )
+  {
+    return;
+  }
+
+  bPeerThrottled = bOn;
+  if ( bOn )
+  {
+    ResetEvent( hPeerReady );
+    ullPeerThrottleStartUs = GetTimestampUs();
+    flowStats.dwPeerThrottleEvents++;
+  }
+  else
+  {
+    flowStats.ullPeerThrottledUs += GetTimestampUs() - ullPeerThrottleStartUs;
+    SetEvent( hPeerReady );
+  }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerial::StripFlowChars( BYTE * pBuffer, DWORD dwLen )
+{
+  DWORD i;
+  DWORD j = 0;
+
+  for ( i = 0; i < dwLen; i++ )
+  {
+    if ( pBuffer[ i ] == SERIAL_XOFF || pBuffer[ i ] == SERIAL_XON )
     {
-      break;
+      EnterCriticalSection( &csFlow );
+      SetPeerThrottled( pBuffer[ i ] == SERIAL_XOFF );
+      LeaveCriticalSection( &csFlow );
+      continue;
     }
 
-    if ( WaitCommEvent( hPort, &rxEvnt, &ov ) == 0 )
+    pBuffer[ j++ ] = pBuffer[ i ];
+  }
+
+  return j;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerial::WaitPeerReady( void )
+{
+  HANDLE hWait[2];
+
+  hWait[0] = hPeerReady;
+  hWait[1] = hQuitEvent;
+
+  return WaitForMultipleObjects( 2, hWait, FALSE, INFINITE ) == WAIT_OBJECT_0;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerial::ListenerStart( void )
+{
+  ov.hEvent = CreateEvent( NULL, TRUE, FALSE, NULL );
+  ovRead.hEvent = CreateEvent( NULL, TRUE, FALSE, NULL );
+
+  dwReadMask = 0;
+  bReadDrain = TRUE;
+
+  if ( ov.hEvent == NULL || ovRead.hEvent == NULL )
+  {
+    dwListenerError = ::GetLastError();
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerial::ListenerRead( BYTE * pBuffer, DWORD dwLen, DWORD * pdwRead, ULONGLONG * pullTimestampUs )
+{
+  HANDLE hWait[2];
+  DWORD rxEvnt;
+  DWORD dwMask;
+  DWORD dwRet;
+  DWORD dwBytesRead;
+  DWORD dwDataLen;
+  ULONGLONG ullSpanUs;
+
+  hWait[0] = hQuitEvent;
+  hWait[1] = ov.hEvent;
+
+  while ( bQuit == FALSE )
+  {
+    // EV_RXCHAR is not signaled again for data that is already in the driver buffer
+    if ( bReadDrain )
     {
-      dwRet = GetLastError();
-      if( dwRet == ERROR_IO_PENDING)
+      dwBytesRead = 0;
+      if ( !pTransport->ReadFile( (LPVOID)pBuffer, dwLen, &dwBytesRead, &ovRead ) )
+      {
+        if ( GetLastError() != ERROR_IO_PENDING ||
+             !pTransport->GetOverlappedResult( &ovRead, &dwBytesRead, TRUE ) )
+        {
+          dwListenerError = ::GetLastError();
+          return FALSE;
+        }
+      }
+
+      SERIAL_TRACE_READ( cDevice, dwBytesRead );
+
+      bReadDrain = ( dwBytesRead == dwLen );
+
+      dwDataLen = dwBytesRead;
+      if ( flowControl == FLOW_CONTROL_SOFTWARE )
+      {
+        dwDataLen = StripFlowChars( pBuffer, dwBytesRead );
+      }
+
+      if ( dwDataLen == 0 )
       {
         continue;
       }
+
+      *pullTimestampUs = GetTimestampUs();
+
+      if ( capture != NULL )
+      {
+        ullSpanUs = (ULONGLONG)( dwDataLen - 1 ) * dwCharTimeNs / 1000;
+        DispatchCapture( pBuffer, dwDataLen, ( ullSpanUs < *pullTimestampUs ) ? *pullTimestampUs - ullSpanUs : *pullTimestampUs );
+      }
+
+      if ( !( tap != NULL && DispatchTap( pBuffer, dwDataLen ) ) )
+      {
+        *pdwRead = dwDataLen;
+        return TRUE;
+      }
+      continue;
     }
 
-    if ( rxEvnt & EV_RXCHAR )
+    // the received data is always wanted here, whatever the idle-line framing says
+    dwMask = ListenerMask() | EV_RXCHAR;
+    if ( dwMask != dwReadMask )
     {
-      pBuffer = new BYTE [ bufferLen + 1 ];
-      if ( pBuffer == NULL )
+      if ( !pTransport->SetCommMask( dwMask ) )
       {
-        continue;
+        dwListenerError = ::GetLastError();
+        return FALSE;
       }
-      
-      dwRet = ReadFile( hPort, (LPVOID)pBuffer, bufferLen, &dwBytesRead, &ov );
+      dwReadMask = dwMask;
+    }
 
-      if ( !dwRet )
+    rxEvnt = 0;
+    if ( !pTransport->WaitCommEvent( &rxEvnt, &ov ) )
+    {
+      if ( GetLastError() != ERROR_IO_PENDING )
       {
-        dwRet = ::GetLastError();
-        delete pBuffer;
-        continue;
+        dwListenerError = ::GetLastError();
+        return FALSE;
       }
 
-      //serialData = new SERIAL_DATA;
-      //serialData->dwLen = dwBytesRead;
-      //serialData->pData = new BYTE[ serialData->dwLen ];
-      //memcpy( (BYTE*)serialData->pData, (BYTE*)pBuffer, serialData->dwLen );
-
-      if (process != NULL)
+      dwRet = WaitForMultipleObjects( 2, hWait, FALSE, INFINITE );
+      if ( dwRet != WAIT_OBJECT_0 + 1 )
       {
-          process(pBuffer, dwBytesRead);
+        // the kernel still refers to ov
+        pTransport->CancelIo( );
+        pTransport->GetOverlappedResult( &ov, &dwBytesRead, TRUE );
+        if ( dwRet != WAIT_OBJECT_0 )
+        {
+          dwListenerError = ::GetLastError();
+        }
+        return FALSE;
       }
 
-      //IOCP::Send(iIOCP, serialData);
+      if ( !pTransport->GetOverlappedResult( &ov, &dwBytesRead, FALSE ) )
+      {
+        dwListenerError = ::GetLastError();
+        return FALSE;
+      }
+    }
 
-      ///PostQueuedCompletionStatus( hCompletionEvnt, sizeof( SERIAL_DATA ), (ULONG_PTR)serialData, NULL );
+    // no event: SetCommMask was called by the configuration, arm the mask again
+    if ( rxEvnt == 0 )
+    {
+      dwReadMask = 0;
+      continue;
+    }
 
-      delete pBuffer;
+    if ( !OnLineEvent( rxEvnt, GetTimestampUs() ) )
+    {
+      dwListenerError = ::GetLastError();
+      return FALSE;
     }
 
-  }while( 1 );
+    bReadDrain = ( rxEvnt & EV_RXCHAR ) != 0;
+  }
+
+  return FALSE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerial::ListenerStop( void )
+{
+  // an emulated link may still read with the event of ov
+  pTransport->CancelIo( );
+
+  if ( ovRead.hEvent != NULL )
+  {
+    CloseHandle( ovRead.hEvent );
+    ovRead.hEvent = NULL;
+  }
+  if ( ov.hEvent != NULL )
+  {
+    CloseHandle( ov.hEvent );
+    ov.hEvent = NULL;
+  }
 
-  return ERROR_SUCCESS;
+  return dwListenerError;
 }
 
 //-----------------------------------------------------------------------------------------------------------------------------------------------------
@@ -487,13 +2879,320 @@ DWORD CSerial::SerialPortListener( void )
 DWORD WINAPI CSerial::ThreadStartSerialPortListener( LPVOID lpParam )
 {
   CSerial * serial;
+  DWORD dwResult;
   
   serial = (CSerial*)lpParam;
 
-  serial->SerialPortListener( );
+  dwResult = serial->SerialPortListener( );
+  if ( dwResult != ERROR_SUCCESS )
+  {
+    SERIAL_TRACE_ERROR( serial->cDevice, SERIAL_OPERATION_LISTENER, dwResult );
+  }
+
+  return dwResult;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+
+DWORD CSerial::CompletionStart( void )
+{
+  DWORD dwError = ERROR_SUCCESS;
+  DWORD i;
+
+  // operations left by a Close from a callback of the completion port still use the buffers
+  if ( lOpsPending != 0 )
+  {
+    dwError = ERROR_BUSY;
+  }
+  else if ( pCompletionBuffers == NULL )
+  {
+    // page aligned, and kept until the port is destroyed
+    pCompletionBuffers = (BYTE*)VirtualAlloc( NULL, COMPLETION_READS * SERIAL_MAX_FRAME_LEN, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE );
+    if ( pCompletionBuffers == NULL )
+    {
+      dwError = ::GetLastError();
+    }
+  }
+
+  if ( dwError == ERROR_SUCCESS )
+  {
+    dwError = pCompletionPort->Attach( hPort, this );
+  }
+
+  // the handle is not on the completion port, the listener thread takes it with its own timeouts
+  if ( dwError != ERROR_SUCCESS )
+  {
+    bCompletion = FALSE;
+    SetTimeouts();
+    return dwError;
+  }
+
+  // the blocking writes are waited for with their event, their completion must not be queued
+  ovWrite.hEvent = (HANDLE)( (ULONG_PTR)ovWrite.hEvent | 1 );
+
+  ResetEvent( hOpsDone );
+  dwCompletionMask = 0;
+  lWritesPending = 0;
+
+  opEvent.type = COMPLETION_OP_EVENT;
+  opEvent.pData = NULL;
+  for ( i = 0; i < COMPLETION_READS; i++ )
+  {
+    opRead[ i ].type = COMPLETION_OP_READ;
+    opRead[ i ].pData = pCompletionBuffers + i * SERIAL_MAX_FRAME_LEN;
+    abReadHeld[ i ] = FALSE;
+  }
+
+  // the reads queue behind each other in the driver, the second one is there as soon as the first completes
+  EnterCriticalSection( &csCompletion );
 
-  return 0;
+  // a stream read directly has no line events to wait for
+  if ( !pTransport->HasStreamReads() && !PostCommEvent() )
+  {
+    dwError = ::GetLastError();
+  }
+  for ( i = 0; dwError == ERROR_SUCCESS && i < COMPLETION_READS; i++ )
+  {
+    if ( !PostRead( &opRead[ i ] ) )
+    {
+      dwError = ::GetLastError();
+    }
+  }
+
+  LeaveCriticalSection( &csCompletion );
+
+  return dwError;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerial::PostCommEvent( void )
+{
+  DWORD dwMask = ListenerMask();
+
+  if ( dwMask != dwCompletionMask )
+  {
+    if ( !pTransport->SetCommMask( dwMask ) )
+    {
+      return FALSE;
+    }
+    dwCompletionMask = dwMask;
+  }
+
+  SecureZeroMemory( &opEvent.ov, sizeof( OVERLAPPED ) );
+  opEvent.dwLen = 0;
+
+  CompletionPosted();
+
+  // even when it completes at once, the completion is queued to the port
+  if ( !pTransport->WaitCommEvent( &opEvent.dwLen, &opEvent.ov ) && GetLastError() != ERROR_IO_PENDING )
+  {
+    CompletionDone();
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerial::PostRead( SERIAL_COMPLETION_OP * pOp )
+{
+  BOOL bPosted;
+
+  SecureZeroMemory( &pOp->ov, sizeof( OVERLAPPED ) );
+
+  CompletionPosted();
+
+  if ( pTransport->HasStreamReads() )
+  {
+    bPosted = pTransport->ReadStream( (LPVOID)pOp->pData, SERIAL_MAX_FRAME_LEN, &pOp->ov );
+  }
+  else
+  {
+    bPosted = pTransport->ReadFile( (LPVOID)pOp->pData, SERIAL_MAX_FRAME_LEN, NULL, &pOp->ov );
+  }
+
+  // a stream still waiting for its other end takes one read, which completes once it is there
+  if ( !bPosted && GetLastError() == ERROR_PIPE_LISTENING )
+  {
+    abReadHeld[ pOp - opRead ] = TRUE;
+    CompletionDone();
+    return TRUE;
+  }
+
+  if ( !bPosted && GetLastError() != ERROR_IO_PENDING )
+  {
+    CompletionDone();
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerial::OnCompletion( OVERLAPPED * pOv, ULONGLONG ullWakeUs )
+{
+  SERIAL_COMPLETION_OP * pOp = CONTAINING_RECORD( pOv, SERIAL_COMPLETION_OP, ov );
+  DWORD dwBytes = 0;
+  DWORD dwError = ERROR_SUCCESS;
+  BOOL bRepost = TRUE;
+  DWORD i;
+
+  // the result is already in the OVERLAPPED, nothing is asked to the driver
+  if ( !::GetOverlappedResult( hPort, pOv, &dwBytes, FALSE ) )
+  {
+    dwError = ::GetLastError();
+  }
+
+  switch ( pOp->type )
+  {
+    case COMPLETION_OP_EVENT:
+      // no event: SetCommMask was called by the configuration, arm the new mask
+      if ( dwError == ERROR_SUCCESS && opEvent.dwLen != 0 && !bQuit && !OnLineEvent( opEvent.dwLen, ullWakeUs ) )
+      {
+        dwError = ::GetLastError();
+      }
+      break;
+
+    case COMPLETION_OP_READ:
+      // a read cut by Close still hands over what it received
+      if ( dwBytes > 0 )
+      {
+        OnCompletionRead( pOp->pData, dwBytes, ullWakeUs );
+      }
+      break;
+
+    case COMPLETION_OP_WRITE:
+      if ( dwBytes != 0 )
+      {
+        TrackWrite( dwBytes, pOp->ullStartUs );
+      }
+      SERIAL_TRACE_WRITE_DONE( cDevice, dwBytes, dwError );
+
+      // a failed write is the business of its caller, not of the receive side
+      dwError = ERROR_SUCCESS;
+      bRepost = FALSE;
+      InterlockedDecrement( &lWritesPending );
+      free( pOp );
+      break;
+  }
+
+  EnterCriticalSection( &csCompletion );
+
+  // the operations of a port closed from a callback may still be reaped after it was opened again
+  if ( !bQuit && bCompletion )
+  {
+    if ( dwError == ERROR_SUCCESS && bRepost )
+    {
+      if ( !( ( pOp == &opEvent ) ? PostCommEvent() : PostRead( pOp ) ) )
+      {
+        dwError = ::GetLastError();
+      }
+    }
+
+    // a read completed, the reads it held back can follow it (a write was freed and holds none)
+    for ( i = 0; dwError == ERROR_SUCCESS && bRepost && pOp != &opEvent && i < COMPLETION_READS; i++ )
+    {
+      if ( abReadHeld[ i ] )
+      {
+        abReadHeld[ i ] = FALSE;
+        if ( !PostRead( &opRead[ i ] ) )
+        {
+          dwError = ::GetLastError();
+        }
+      }
+    }
+
+    if ( dwError != ERROR_SUCCESS )
+    {
+      CompletionError( dwError );
+    }
+  }
+
+  LeaveCriticalSection( &csCompletion );
+
+  CompletionDone();
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerial::OnCompletionRead( BYTE * pData, DWORD dwLen, ULONGLONG ullTimestampUs )
+{
+  DWORD dwDataLen;
+  ULONGLONG ullSpanUs;
+
+  // with idle-line framing each read ends with the driver inter-byte timeout: one read, one frame
+  if ( dwIdleGapUs > 0 )
+  {
+    pFrame = pData;
+    OnDriverFrame( dwLen, ullTimestampUs );
+    pFrame = NULL;
+    return;
+  }
+
+  SERIAL_TRACE_READ( cDevice, dwLen );
+
+  dwDataLen = dwLen;
+  if ( flowControl == FLOW_CONTROL_SOFTWARE )
+  {
+    dwDataLen = StripFlowChars( pData, dwLen );
+  }
+
+  if ( dwDataLen == 0 )
+  {
+    return;
+  }
+
+  if ( capture != NULL )
+  {
+    // the chunk is timestamped when reaped: the first byte arrived one character per byte earlier
+    ullSpanUs = (ULONGLONG)( dwDataLen - 1 ) * dwCharTimeNs / 1000;
+    DispatchCapture( pData, dwDataLen, ( ullSpanUs < ullTimestampUs ) ? ullTimestampUs - ullSpanUs : ullTimestampUs );
+  }
+
+  if ( tap != NULL && DispatchTap( pData, dwDataLen ) )
+  {
+    return;
+  }
+
+  Dispatch( pData, dwDataLen, ullTimestampUs, ullTimestampUs, FALSE );
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerial::CompletionError( DWORD dwError )
+{
+  // any failure means the device is gone: stop posting and let the pending operations drain,
+  // as the listener thread stops instead of spinning on the error
+  dwListenerError = dwError;
+  bQuit = TRUE;
+  pTransport->CancelIoEx( NULL );
+
+  SERIAL_TRACE_ERROR( cDevice, SERIAL_OPERATION_LISTENER, dwError );
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerial::CompletionPosted( void )
+{
+  InterlockedIncrement( &lOpsPending );
+  InterlockedIncrement( &pCompletionPort->lInFlight );
 }
 
 //-----------------------------------------------------------------------------------------------------------------------------------------------------
 
+void CSerial::CompletionDone( void )
+{
+  InterlockedDecrement( &pCompletionPort->lInFlight );
+
+  // Close waits for the last one before the port goes away
+  if ( InterlockedDecrement( &lOpsPending ) == 0 && bQuit )
+  {
+    SetEvent( hOpsDone );
+  }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
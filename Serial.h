@@ -5,6 +5,10 @@
 #define __SERIAL_H__
 
 #include <windows.h>
+#include "SerialExecutor.h"
+#include "SerialError.h"
+#include "SerialTransport.h"
+#include "SerialCompletion.h"
 
 namespace network {
 
@@ -17,6 +21,26 @@ namespace network {
 
   typedef void(*SERIAL_PORT_CALLBACK)( BYTE*, DWORD );
 
+  //! callback that receives a whole idle-delimited frame and the timestamps (in microseconds,
+  //!   see GetTimestampUs) of its first and last bytes
+  typedef void(*SERIAL_FRAME_CALLBACK)( BYTE*, DWORD, ULONGLONG, ULONGLONG );
+
+  //! callback that receives the modem line edges: the EV_CTS/EV_DSR/EV_RLSD/EV_RING events
+  //!   signaled, the MS_*_ON modem status and the timestamp (in microseconds) of the edge
+  typedef void(*SERIAL_MODEM_CALLBACK)( DWORD, DWORD, ULONGLONG );
+
+  //! function that takes the received data over from the callbacks, with its context
+  typedef void(*SERIAL_TAP_CALLBACK)( LPVOID, BYTE*, DWORD );
+
+  //! function that receives a copy of the received data, with its context and the timestamp
+  //!   (in microseconds) of the first byte
+  typedef void(*SERIAL_CAPTURE_CALLBACK)( LPVOID, const BYTE*, DWORD, ULONGLONG );
+
+  //! function told that a write has left the line, with its context, the offset after its last
+  //!   byte in the transmitted stream, the time the write returned and the time its last stop bit
+  //!   left the line (in microseconds)
+  typedef void(*SERIAL_TX_CALLBACK)( LPVOID, ULONGLONG, ULONGLONG, ULONGLONG );
+
   // Enum para controle do Handshake
   enum EnumSerialHandshake
   {
@@ -25,8 +49,65 @@ namespace network {
 	  HAND_SHAKE_SOFTWARE	=	2,			// SOFTWARE HANDSHAKING (XON/XOFF)
   };
 
+  // Enum para controle de fluxo feito pela biblioteca, a partir da fila de recepcao
+  enum EnumSerialFlowControl
+  {
+	  FLOW_CONTROL_OFF			=	0,			// NO FLOW CONTROL
+	  FLOW_CONTROL_HARDWARE	=	1,			// RTS DRIVEN BY THE RECEIVE QUEUE, CTS HOLDS Write
+	  FLOW_CONTROL_SOFTWARE	=	2,			// XON/XOFF SENT BY THE RECEIVE QUEUE, XON/XOFF RECEIVED HOLD Write
+  };
+
+  //! counters of the flow control
+  struct SERIAL_FLOW_STATS
+  {
+    DWORD     dwThrottleEvents;       // times the peer was throttled by the receive queue
+    ULONGLONG ullThrottledUs;         // time the peer spent throttled
+    DWORD     dwPeerThrottleEvents;   // times the peer throttled the transmission
+    ULONGLONG ullPeerThrottledUs;     // time Write spent held by the peer
+  };
+
+  //! line errors reported by the driver, errors signaled together count once
+  struct SERIAL_LINE_ERRORS
+  {
+    DWORD dwFraming;    // CE_FRAME
+    DWORD dwParity;     // CE_RXPARITY
+    DWORD dwOverrun;    // CE_OVERRUN and CE_RXOVER
+    DWORD dwBreak;      // CE_BREAK
+  };
+
+  // Enum para o modo RS-485 half duplex
+  enum EnumSerialRs485
+  {
+	  RS485_OFF			=	0,			// FULL DUPLEX
+	  RS485_DRIVER		=	1,			// RTS RAISED BY THE DRIVER WHILE IT TRANSMITS (RTS_CONTROL_TOGGLE)
+	  RS485_LIBRARY	=	2,			// RTS RAISED BY Write UNTIL THE TRANSMISSION DRAINED
+  };
+
+  //! timings of the RS-485 mode, measured by Write in the RS485_LIBRARY mode
+  struct SERIAL_RS485_STATS
+  {
+    DWORD     dwTransmissions;      // writes framed by RTS
+    DWORD     dwDrainPolls;         // transmissions whose end was polled, EV_TXEMPTY did not come
+    ULONGLONG ullLastTurnaroundUs;  // last stop bit on the line to RTS dropped, last transmission
+    ULONGLONG ullMaxTurnaroundUs;   // longest turnaround
+    ULONGLONG ullTotalTurnaroundUs; // sum of the turnarounds
+  };
+
+  //! counters of the transmit monitor, see SetTxMonitor
+  struct SERIAL_TX_STATS
+  {
+    DWORD     dwWrites;             // writes seen leaving the line
+    DWORD     dwUntracked;          // writes not followed, too many were pending
+    DWORD     dwDrains;             // times the transmit queue could not be read and was drained
+    ULONGLONG ullLastGapUs;         // write returned to last stop bit on the line, last write
+    ULONGLONG ullMaxGapUs;          // longest gap
+    ULONGLONG ullTotalGapUs;        // sum of the gaps
+  };
+
     class CSerial
     {
+    friend class CSerialCompletionPort;
+
     private:
       
         volatile BOOL bQuit;
@@ -36,10 +117,20 @@ namespace network {
          */
         HANDLE hPort;
 
+        //! link of the port, local or emulated over a stream, selected by the device given to Open
+        CSerialTransport * pTransport;
+
         //! handle to control the read event
         HANDLE hListenerThread;
-        //! iocompletion port handle
-        //int iIOCP;
+
+        //! identifier of the listener thread
+        DWORD dwListenerThreadId;
+
+        //! manual-reset event that wakes the listener when the port is closed
+        HANDLE hQuitEvent;
+
+        //! error that stopped the listener, ERROR_SUCCESS while it runs or after Close
+        volatile DWORD dwListenerError;
 
         //! name of device
         char   cDevice[128];
@@ -52,14 +143,340 @@ namespace network {
       
         //! overlapped structure for use with the 
         OVERLAPPED ov;
+
+        //! overlapped structure used by the listener to read the received data
+        OVERLAPPED ovRead;
+
+        //! overlapped structure used by the listener to read a frame closed by the driver
+        OVERLAPPED ovFrame;
+
+        //! overlapped structure used by Write
+        OVERLAPPED ovWrite;
       
         //! pointer to function of type SERIAL_PORT_CALLBACK that is 
         //!   perform the processing of the  data received by the serial port
         SERIAL_PORT_CALLBACK  process;
 
-        DWORD SerialPortListener( void );
+        //! pointer to function that receives the frames in idle-line framing mode
+        SERIAL_FRAME_CALLBACK processFrame;
+
+        //! idle gap requested in character times (0 = idle-line framing disabled)
+        double dIdleCharTimes;
+
+        //! duration of one character, in nanoseconds, for the current line settings
+        volatile DWORD dwCharTimeNs;
+
+        //! idle gap, in microseconds, that closes a frame (0 = idle-line framing disabled)
+        volatile DWORD dwIdleGapUs;
+
+        //! waitable timer that closes frames when the gap is too short for the driver timeout
+        HANDLE hIdleTimer;
+
+        //! the idle timer is a coarse one and the system timer resolution was raised
+        BOOL bTimerPeriod;
+
+        //! frame being assembled in idle-line framing mode
+        BYTE * pFrame;
+        DWORD dwFrameLen;
+        ULONGLONG ullFrameFirstUs;
+        ULONGLONG ullFrameLastUs;
+
+        //! pointer to function that receives the modem line edges
+        SERIAL_MODEM_CALLBACK processModem;
+
+        //! modem line events watched by the listener
+        volatile DWORD dwModemEvents;
+
+        //! level of RTS and DTR set by SetRts and SetDtr
+        BOOL bRtsOn;
+        BOOL bDtrOn;
+
+        //! flow control driven by the receive queue
+        volatile EnumSerialFlowControl flowControl;
+        DWORD dwHighWatermark;
+        DWORD dwLowWatermark;
+
+        //! the peer is throttled by the receive queue
+        BOOL bThrottled;
+
+        //! the peer throttled the transmission
+        volatile BOOL bPeerThrottled;
+
+        //! RS-485 half duplex mode and its delays, see SetRs485
+        volatile EnumSerialRs485 rs485Mode;
+        DWORD dwRs485BeforeUs;
+        DWORD dwRs485AfterUs;
+        SERIAL_RS485_STATS rs485Stats;
+
+        //! signaled by the listener on EV_TXEMPTY, with the time it woke up
+        HANDLE hTxEmpty;
+        ULONGLONG ullTxEmptyUs;
+
+        //! time the first byte of the transmission in progress was handed to the driver
+        ULONGLONG ullTxStartUs;
+
+        //! raise RTS before a write in the RS485_LIBRARY mode
+        void Rs485Begin( void );
+
+        //! wait for the dwLen bytes written to leave the line, then drop RTS
+        void Rs485End( DWORD dwLen );
+
+        enum { TX_MAX_PENDING = 256 };
+
+        //! write followed by the transmit monitor
+        struct TX_PENDING
+        {
+          ULONGLONG ullEnd;         // offset after its last byte in the transmitted stream
+          ULONGLONG ullReturnUs;    // time the write returned
+          ULONGLONG ullLineUs;      // earliest time the line can have sent it
+        };
+
+        //! transmit monitor, see SetTxMonitor
+        SERIAL_TX_CALLBACK txCallback;
+        LPVOID pTxContext;
+        HANDLE hTxMonitorThread;
+        volatile BOOL bTxMonitorQuit;
+
+        //! wakes the transmit monitor when a write is queued or when it must stop
+        HANDLE hTxQueued;
+
+        //! protects the writes pending, the counters of the transmit monitor and rs485Stats
+        CRITICAL_SECTION csTx;
+
+        //! writes not yet seen leaving the line, oldest first
+        TX_PENDING aTxPending[TX_MAX_PENDING];
+        DWORD dwTxHead;
+        DWORD dwTxCount;
+
+        //! bytes handed to the driver, and the time the line is busy until with them
+        ULONGLONG ullTxWritten;
+        ULONGLONG ullTxLineFreeUs;
+
+        //! time BeginWrite handed its data to the driver
+        ULONGLONG ullWriteStartUs;
+
+        SERIAL_TX_STATS txStats;
+
+        //! queue a write of dwLen bytes started at ullStartUs for the transmit monitor
+        void TrackWrite( DWORD dwLen, ULONGLONG ullStartUs );
+
+        //! body of the transmit monitor thread
+        void TxMonitor( void );
+
+        //! stop the transmit monitor thread and forget the writes pending
+        void StopTxMonitor( void );
+
+        static DWORD WINAPI ThreadStartTxMonitor( LPVOID lpParam );
+
+        enum { COMPLETION_READS = 2 };
+
+        //! completion port chosen by SetCompletionPort, used from the next Open
+        CSerialCompletionPort * pCompletionPort;
+
+        //! the port is served by pCompletionPort instead of a listener thread
+        volatile BOOL bCompletion;
+
+        //! operations kept posted on the completion port: the WaitCommEvent and the reads
+        SERIAL_COMPLETION_OP opEvent;
+        SERIAL_COMPLETION_OP opRead[COMPLETION_READS];
+
+        //! reads the transport could not take yet, posted again with the next completion of a read
+        BOOL abReadHeld[COMPLETION_READS];
+
+        //! buffers of the reads, allocated once for the life of the port
+        BYTE * pCompletionBuffers;
+
+        //! events armed on the completion port
+        DWORD dwCompletionMask;
+
+        //! operations not reaped yet, and the writes of PostWrite among them
+        volatile LONG lOpsPending;
+        volatile LONG lWritesPending;
+
+        //! signaled when the port is closing and its last operation was reaped
+        HANDLE hOpsDone;
+
+        //! orders the posting of the operations against Close
+        CRITICAL_SECTION csCompletion;
+
+        //! attach the open port to pCompletionPort and post its operations; bCompletion is
+        //!   cleared if the port stays with the listener thread
+        DWORD CompletionStart( void );
+
+        //! arm the WaitCommEvent on the completion port, with csCompletion held
+        BOOL PostCommEvent( void );
+
+        //! post a read on the completion port, with csCompletion held; a read the transport cannot
+        //!   take yet (ERROR_PIPE_LISTENING) is held instead
+        BOOL PostRead( SERIAL_COMPLETION_OP * pOp );
+
+        //! handle an operation reaped by the completion port
+        void OnCompletion( OVERLAPPED * pOv, ULONGLONG ullWakeUs );
+
+        //! hand over the data of a read reaped by the completion port
+        void OnCompletionRead( BYTE * pData, DWORD dwLen, ULONGLONG ullTimestampUs );
+
+        //! stop posting on an error, as the listener thread stops, with csCompletion held
+        void CompletionError( DWORD dwError );
+
+        //! an operation is about to be posted
+        void CompletionPosted( void );
+
+        //! an operation was reaped, or could not be posted
+        void CompletionDone( void );
+
+        //! signaled while the peer accepts data
+        HANDLE hPeerReady;
+
+        //! protects the flow control state
+        CRITICAL_SECTION csFlow;
+
+        SERIAL_FLOW_STATS flowStats;
+
+        //! line errors, see SERIAL_LINE_ERRORS; counted by the listener, the transmit monitor and Write,
+        //!   each from the flags its own ClearCommError cleared
+        volatile LONG lFramingErrors;
+        volatile LONG lParityErrors;
+        volatile LONG lOverrunErrors;
+        volatile LONG lBreakErrors;
+
+        //! count the errors returned by ClearCommError, which clears them: every caller must count them
+        void CountLineErrors( DWORD dwErrors );
+        ULONGLONG ullThrottleStartUs;
+        ULONGLONG ullPeerThrottleStartUs;
+
+        //! throttle or release the peer according to the receive queue watermarks
+        void CheckRxWatermarks( void );
+
+        //! throttle or release the peer, with csFlow held
+        void SetThrottled( BOOL bOn );
+
+        //! record a throttle or release from the peer, with csFlow held
+        void SetPeerThrottled( BOOL bOn );
+
+        //! remove the XON/XOFF sent by the peer from the received data
+        DWORD StripFlowChars( BYTE * pBuffer, DWORD dwLen );
+
+        //! wait while the peer throttles the transmission
+        BOOL WaitPeerReady( void );
+
+        //! write without the flow control; pdwWrote receives what reached the driver, on an error too
+        DWORD WriteRaw(char *s, int len, DWORD * pdwWrote);
+
+        //! SetCommState with the dcb, keeping the RTS and DTR levels set by SetRts and SetDtr
+        BOOL ApplyCommState( void );
+
+        //! body of Open
+        int OpenPort(const char *device, int baud_rate, int byte_size, int parity, int stop_bits);
+
+        //! validate the line settings and write them to the dcb
+        DWORD SetLineFields(int baud_rate, int byte_size, int parity, int stop_bits);
+
+        //! write the handshake settings to the dcb
+        void SetHandshakeFields(EnumSerialHandshake SerialHandshake);
+
+        //! recompute the character time and the idle gap from the dcb
+        void UpdateIdleGap( void );
+
+        //! the idle gap is detected by the driver inter-byte timeout
+        BOOL DriverGap( void );
+
+        //! events the listener waits for
+        DWORD ListenerMask( void );
+
+        //! handle the modem line and line error events signaled by WaitCommEvent
+        BOOL OnLineEvent( DWORD dwEvent, ULONGLONG ullTimestampUs );
+
+        //! handle the events signaled by WaitCommEvent
+        BOOL OnCommEvent( DWORD dwEvent, ULONGLONG ullTimestampUs, BYTE * pBuffer, DWORD dwLen );
+
+        //! read everything that is waiting in the driver, delivering it chunk by chunk
+        BOOL ReadChunks( BYTE * pBuffer, DWORD dwLen );
+
+        //! handle a chunk received at ullTimestampUs
+        void OnRxChunk( BYTE * pBuffer, DWORD dwLen, ULONGLONG ullTimestampUs );
+
+        //! handle a frame closed by the driver inter-byte timeout
+        void OnDriverFrame( DWORD dwLen, ULONGLONG ullTimestampUs );
+
+        //! handle the expiration of the idle timer
+        void OnIdleTimer( BYTE * pBuffer, DWORD dwLen );
+
+        //! arm the idle timer to expire at ullDeadlineUs
+        void ArmIdleTimer( ULONGLONG ullDeadlineUs );
+
+        //! hand over the frame being assembled
+        void DeliverFrame( void );
+
+        //! strand of the executor that processes the received data, NULL to process it on the listener
+        CSerialStrand * pStrand;
+
+        //! function that takes the received data over, see SetReceiveTap
+        SERIAL_TAP_CALLBACK tap;
+        LPVOID pTapContext;
+
+        //! function that receives a copy of the received data, see SetCapture
+        SERIAL_CAPTURE_CALLBACK capture;
+        LPVOID pCaptureContext;
+
+        //! protects pStrand, the tap and the capture against their replacement
+        SRWLOCK srwStrand;
+
+        //! received chunks lost because the strand could not queue them
+        volatile LONG lRxDropped;
+
+        //! hand received data to the tap, returns FALSE if there is none
+        BOOL DispatchTap( BYTE * pBuffer, DWORD dwLen );
+
+        //! hand a copy of received data to the capture
+        void DispatchCapture( const BYTE * pBuffer, DWORD dwLen, ULONGLONG ullFirstUs );
+
+        //! hand received data to the callbacks, directly or through the strand
+        void Dispatch( BYTE * pBuffer, DWORD dwLen, ULONGLONG ullFirstUs, ULONGLONG ullLastUs, BOOL bFrame );
+
+        //! strand callback
+        static void DispatchStrand( LPVOID pContext, BYTE * pBuffer, DWORD dwLen, ULONGLONG ullFirstUs, ULONGLONG ullLastUs, DWORD dwFlags );
+
+        //! events armed by ListenerRead, 0 to arm them again
+        DWORD dwReadMask;
+
+        //! ListenerRead has not emptied the driver buffer yet
+        BOOL bReadDrain;
+
         static DWORD WINAPI ThreadStartSerialPortListener( LPVOID lpParam );
 
+    protected:
+        /**
+         *  \brief  Body of the listener thread, called once per Open. A derived class may replace
+         *          it by its own loop built on ListenerStart, ListenerRead and ListenerStop.
+         *  \return error that stopped the listener
+         */
+        virtual DWORD SerialPortListener( void );
+
+        /**
+         *  \brief  Prepares the listener thread for ListenerRead
+         *  \return FALSE on error, to be reported by ListenerStop
+         */
+        BOOL ListenerStart( void );
+
+        /**
+         *  \brief  Waits for received data and reads it, handling the modem line events, the
+         *          software flow control, the receive tap and the capture on the way. Idle-line framing and
+         *          the executor are not applied.
+         *  \param  pBuffer buffer that receives the data
+         *  \param  dwLen size of pBuffer
+         *  \param  pdwRead number of bytes read
+         *  \param  pullTimestampUs time the data was read, see GetTimestampUs
+         *  \return FALSE when the port is closed or on error
+         */
+        BOOL ListenerRead( BYTE * pBuffer, DWORD dwLen, DWORD * pdwRead, ULONGLONG * pullTimestampUs );
+
+        /**
+         *  \brief  Releases what ListenerStart prepared
+         *  \return error that stopped the listener, ERROR_SUCCESS after Close
+         */
+        DWORD ListenerStop( void );
+
     public:
         /**
          *  \brief Constructor
@@ -72,17 +489,31 @@ namespace network {
         virtual ~CSerial( );
 
         /**
-         *  \brief Opens a serial device
+         *  \brief Opens a serial device at 9600 8N1 without handshake and starts its listener thread
          */
             int Open(const char *device);
 
+        /**
+         *  \brief  Opens a serial device with the given line settings, no handshake, and starts its
+         *          listener thread. The whole configuration is applied with a single SetCommState.
+         *  \param  device name of the device, as \\.\COM3, or the URI of a networked or in-memory
+         *          port: tcp://host:port, rfc2217://host:port or mem://name (see CSerialTransport)
+         *  \param  baud_rate as SetBaudRate
+         *  \param  byte_size as SetByteSize
+         *  \param  parity as SetParity
+         *  \param  stop_bits as SetStopBits
+         *  \return status of operation
+         */
+        int Open(const char *device, int baud_rate, int byte_size, int parity, int stop_bits);
+
         /**
          *  \brief Inform that the serial port is open
          */
         BYTE IsOpen( void );
 
         /**
-         *  \brief Close the serial comunications
+         *  \brief Close the serial comunications, waking the listener thread and waiting for it
+         *         to finish. The callback may close its own port, but must not reopen it.
          */
         void Close();
 
@@ -121,6 +552,29 @@ namespace network {
          */
         DWORD SetHandshaking(EnumSerialHandshake SerialHandshake);	
 
+        /**
+         *  \brief  Configures baud rate, byte size, parity and stop bits with a single SetCommState.
+         *          The parity is checked by the driver unless it is NOPARITY.
+         *  \param  baud_rate as SetBaudRate
+         *  \param  byte_size as SetByteSize
+         *  \param  parity as SetParity
+         *  \param  stop_bits as SetStopBits
+         *  \return status of operation
+         */
+        DWORD SetLineFormat(int baud_rate, int byte_size, int parity, int stop_bits);
+
+        /**
+         *  \brief  Discards the data waiting in the driver buffers
+         *  \param  dwFlags PURGE_RXCLEAR and/or PURGE_TXCLEAR
+         *  \return status of operation
+         */
+        DWORD Purge( DWORD dwFlags );
+
+        /**
+         *  \brief  Read the line errors counted since the port was created
+         */
+        void GetLineErrors( SERIAL_LINE_ERRORS * pErrors );
+
         ///**
         // *  \brief Le dados da porta COMM, retornando o tamanho do dado lido, se houver timeout ou nenhum dado retorna 0
         // */
@@ -140,6 +594,30 @@ namespace network {
          */
         int Write(char *s, int len, int delay);
 
+        /**
+         *  \brief  Starts writing data to the COM port without waiting for it, so the caller can
+         *          prepare the next block meanwhile. The buffer must stay valid until EndWrite.
+         *          Must not overlap with Write.
+         *  \return status of operation
+         */
+        DWORD BeginWrite(const char *s, int len);
+
+        /**
+         *  \brief  Waits for the write started by BeginWrite
+         *  \return number of bytes written, 0 on error
+         */
+        int EndWrite( void );
+
+        /**
+         *  \brief  Queues a copy of the data to be written without waiting for it. On a port
+         *          served by a completion port the writes are queued to the driver in the order
+         *          they were posted and reaped in batches with the received data; elsewhere, and
+         *          with the flow control or the RS485_LIBRARY mode, which pace the writes
+         *          themselves, the data is written at once as Write does.
+         *  \return status of operation, ERROR_NOT_ENOUGH_QUOTA when too many writes are queued
+         */
+        DWORD PostWrite(const char *s, int len);
+
 
         /**
          *  \brief  perform the action of sei the listenner function
@@ -147,6 +625,209 @@ namespace network {
          *  \return status of operation
          */
         DWORD RegisterListenner( SERIAL_PORT_CALLBACK func);
+
+        /**
+         *  \brief  perform the action of set the function that receives the frames in idle-line framing mode
+         *  \param  func pointer to a function of type SERIAL_FRAME_CALLBACK
+         *  \return status of operation
+         */
+        DWORD RegisterFrameListenner( SERIAL_FRAME_CALLBACK func);
+
+        /**
+         *  \brief  Enables the idle-line framing: received bytes are grouped in frames that are closed
+         *          when the line stays idle for the given number of character times. The character
+         *          time follows the baudrate, byte size, parity and stop bits currently configured.
+         *          Long gaps are detected by the driver inter-byte timeout, short ones by a high
+         *          resolution timer.
+         *  \param  dCharTimes idle gap in character times (e.g. 3.5 for Modbus RTU), 0 disables the framing
+         *  \return status of operation
+         */
+        DWORD SetIdleFraming(double dCharTimes);
+
+        /**
+         *  \brief  Idle gap currently used to close the frames
+         *  \return gap in microseconds, 0 if the idle-line framing is disabled
+         */
+        DWORD GetIdleGap( void );
+
+        /**
+         *  \brief  Duration of one character (start, data, parity and stop bits) for the current
+         *          line settings
+         *  \return duration in nanoseconds, 0 before the port is configured
+         */
+        DWORD GetCharTime( void );
+
+        /**
+         *  \brief  Subscribes to the modem line edges. The listener waits for them in WaitCommEvent,
+         *          together with the received data, and timestamps each edge when it wakes up.
+         *          The callback runs on the listener thread.
+         *  \param  func pointer to a function of type SERIAL_MODEM_CALLBACK, NULL to unsubscribe
+         *  \param  dwEvents combination of EV_CTS, EV_DSR, EV_RLSD (DCD) and EV_RING
+         *  \return status of operation
+         */
+        DWORD RegisterModemListenner( SERIAL_MODEM_CALLBACK func, DWORD dwEvents );
+
+        /**
+         *  \brief  Reads the modem status lines
+         *  \param  pdwModemStatus receives a combination of MS_CTS_ON, MS_DSR_ON, MS_RING_ON and MS_RLSD_ON
+         *  \return status of operation
+         */
+        DWORD GetModemStatus( DWORD * pdwModemStatus );
+
+        /**
+         *  \brief  Drives the RTS line, without reconfiguring the port. Has no effect with the hardware handshake.
+         *  \return status of operation
+         */
+        DWORD SetRts( BOOL bOn );
+
+        /**
+         *  \brief  Drives the DTR line, without reconfiguring the port. Has no effect with the hardware handshake.
+         *  \return status of operation
+         */
+        DWORD SetDtr( BOOL bOn );
+
+        /**
+         *  \brief  Configures the flow control driven by the library receive queue (the data
+         *          waiting for the executor, see SetExecutor). The peer is throttled (RTS low or
+         *          XOFF) when the queue reaches dwHigh bytes and released (RTS high or XON) when
+         *          it drains to dwLow bytes. A throttle from the peer (CTS low or XOFF received)
+         *          holds Write. Turns the driver handshake off.
+         *  \param  FlowControl type of flow control. Look at EnumSerialFlowControl.
+         *  \param  dwHigh high watermark, in bytes
+         *  \param  dwLow low watermark, in bytes
+         *  \return status of operation
+         */
+        DWORD SetFlowControl( EnumSerialFlowControl FlowControl, DWORD dwHigh, DWORD dwLow );
+
+        /**
+         *  \brief  Read the counters of the flow control
+         */
+        void GetFlowStats( SERIAL_FLOW_STATS * pStats );
+
+        /**
+         *  \brief  Configures the RS-485 half duplex mode, where RTS enables the transmitter only
+         *          while Write sends. Without delays the driver toggles RTS where it supports it
+         *          (RTS_CONTROL_TOGGLE); otherwise Write raises RTS, waits dwDelayBeforeUs, sends,
+         *          waits for the last stop bit to leave the line (EV_TXEMPTY, the transmit queue and
+         *          the character time of what was sent) and dwDelayAfterUs, then drops RTS. The
+         *          links without a line (tcp://, rfc2217://, mem://) only wait for the write.
+         *          Excludes the hardware handshake and flow control, which also drive RTS.
+         *  \param  bEnable FALSE goes back to full duplex
+         *  \param  dwDelayBeforeUs delay from RTS raised to the first byte, in microseconds
+         *  \param  dwDelayAfterUs delay from the last stop bit to RTS dropped, in microseconds
+         *  \return status of operation
+         */
+        DWORD SetRs485( BOOL bEnable, DWORD dwDelayBeforeUs = 0, DWORD dwDelayAfterUs = 0 );
+
+        /**
+         *  \brief  RS-485 mode in use, the driver one or the library one chosen by SetRs485
+         */
+        EnumSerialRs485 GetRs485Mode( void );
+
+        /**
+         *  \brief  Read the turnaround times measured in the RS485_LIBRARY mode
+         */
+        void GetRs485Stats( SERIAL_RS485_STATS * pStats );
+
+        /**
+         *  \brief  Follows the writes until their last stop bit has left the line. A monitor thread
+         *          polls the driver transmit queue (ClearCommError) as the character time says the
+         *          writes should drain, and drains the port when the queue cannot be read. The time
+         *          a write left the line is the later of the moment the queue released its bytes
+         *          and the character time of everything sent before it and with it, which also
+         *          covers the UART FIFO. The function runs on the monitor thread, in the order of
+         *          the writes, and must not call SetTxMonitor.
+         *  \param  func pointer to a function of type SERIAL_TX_CALLBACK, NULL to stop the monitor
+         *  \param  pContext value passed to func
+         *  \return status of operation
+         */
+        DWORD SetTxMonitor( SERIAL_TX_CALLBACK func, LPVOID pContext );
+
+        /**
+         *  \brief  Read the counters of the transmit monitor
+         */
+        void GetTxStats( SERIAL_TX_STATS * pStats );
+
+        /**
+         *  \brief  Number of bytes waiting in the driver transmit queue, a single request to the driver
+         *  \param  pdwBytes receives the number of bytes
+         *  \return status of operation
+         */
+        DWORD GetTxQueueDepth( DWORD * pdwBytes );
+
+        /**
+         *  \brief  Error that stopped the listener thread, e.g. when the device was removed.
+         *          The message is only formatted if requested through message().
+         *  \return error code of the serial_category, empty while the listener runs
+         */
+        std::error_code GetListenerError( void );
+
+        /**
+         *  \brief  Hands the raw received data to a function instead of the callbacks, e.g. for
+         *          a protocol engine that needs the replies of the peer for a while. The function
+         *          runs on the listener thread and must not call SetReceiveTap.
+         *  \param  func pointer to a function of type SERIAL_TAP_CALLBACK, NULL to go back to the callbacks
+         *  \param  pContext value passed to func
+         *  \return status of operation
+         */
+        DWORD SetReceiveTap( SERIAL_TAP_CALLBACK func, LPVOID pContext );
+
+        /**
+         *  \brief  Hands a copy of the received data, timestamped, to a function before it is
+         *          processed, e.g. to record the traffic. The function runs on the listener thread
+         *          and must not call SetCapture.
+         *  \param  func pointer to a function of type SERIAL_CAPTURE_CALLBACK, NULL to stop the capture
+         *  \param  pContext value passed to func
+         *  \return status of operation
+         */
+        DWORD SetCapture( SERIAL_CAPTURE_CALLBACK func, LPVOID pContext );
+
+        /**
+         *  \brief  Moves the processing of the received data from the listener thread to an executor.
+         *          The data of this port is processed in order and never concurrently (a strand),
+         *          while several ports share the workers of the executor. The previous strand is
+         *          drained first, so the function must not be called from a callback of the
+         *          executor: from one of this port it fails with ERROR_BUSY, from one of another
+         *          port of the same executor it needs another worker and deadlocks on a single one.
+         *  \param  pExecutor executor that runs the callbacks, NULL to run them on the listener thread
+         *  \return status of operation
+         */
+        DWORD SetExecutor( CSerialExecutor * pExecutor );
+
+        /**
+         *  \brief  Number of received chunks waiting for the executor
+         */
+        DWORD GetRxQueueDepth( void );
+
+        /**
+         *  \brief  Number of received bytes waiting for the executor
+         */
+        DWORD GetRxQueuedBytes( void );
+
+        /**
+         *  \brief  Number of received chunks lost because the strand could not queue them (out of memory)
+         */
+        DWORD GetRxDropped( void );
+
+        /**
+         *  \brief  Serves the port from a completion port shared with other ports instead of a
+         *          listener thread of its own, from the next Open. The callbacks then run on the
+         *          thread of the completion port; the idle-line framing always uses the driver
+         *          inter-byte timeout, rounded up to the millisecond, and SerialPortListener is
+         *          not called. A mem:// link is read directly, without line events, and with
+         *          idle-line framing each of its reads is a frame. The links emulated over a
+         *          socket keep their listener thread, as does a port the completion port cannot
+         *          take (see UsesCompletionPort). A callback may close the port, but not destroy it.
+         *  \param  pCompletionPort completion port, NULL for a listener thread
+         *  \return status of operation, ERROR_BUSY while the port is open or the operations
+         *          of a port closed by a callback are not reaped yet
+         */
+        DWORD SetCompletionPort( CSerialCompletionPort * pCompletionPort );
+
+        /**
+         *  \brief  The open port is served by its completion port, FALSE when it has a listener thread
+         */
+        BOOL UsesCompletionPort( void );
   };
 
 };
@@ -0,0 +1,347 @@
+// $Id$
+
+#include "stdafx.h"
+#include "SerialAutoBaud.h"
+#include "SerialClock.h"
+
+using namespace network;
+
+//! bytes after which a probe is conclusive
+#define SERIAL_AUTOBAUD_TARGET      (64)
+
+//! bytes of a clean sample that end the search early
+#define SERIAL_AUTOBAUD_CLEAN       (32)
+
+//! scores under this are not a detection
+#define SERIAL_AUTOBAUD_MIN_SCORE   (0.5)
+
+//! candidate baud rates, the most common first
+static const int aiBaudRates[] =
+{
+    CBR_9600, CBR_115200, CBR_19200, CBR_38400, CBR_57600, CBR_4800, CBR_2400, CBR_1200,
+    CBR_14400, CBR_56000, CBR_128000, CBR_256000, CBR_600, CBR_300, CBR_110
+};
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static BOOL OddBits( BYTE b )
+{
+    b ^= b >> 4;
+    b ^= b >> 2;
+    b ^= b >> 1;
+
+    return b & 1;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+CSerialAutoBaud::CSerialAutoBaud( CSerial * pSerial )
+{
+    this->pSerial = pSerial;
+
+    dwSampleLen = 0;
+    dwSampleTarget = SERIAL_AUTOBAUD_TARGET;
+    dwMaxSampleMs = 100;
+    bHaveLast = FALSE;
+    memset(&last, 0, sizeof(last));
+
+    InitializeCriticalSection(&csSample);
+
+    hSampleFull = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (hSampleFull == NULL)
+    {
+        throw (unsigned int)::GetLastError();
+    }
+
+    return;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+CSerialAutoBaud::~CSerialAutoBaud( )
+{
+    CloseHandle(hSampleFull);
+    DeleteCriticalSection(&csSample);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialAutoBaud::SetMaxSampleTime( DWORD dwMs )
+{
+    dwMaxSampleMs = dwMs;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialAutoBaud::OnReceive( LPVOID pContext, BYTE * pBuffer, DWORD dwLen )
+{
+    CSerialAutoBaud * pThis = (CSerialAutoBaud*)pContext;
+    DWORD dwCopy;
+
+    EnterCriticalSection(&pThis->csSample);
+
+    dwCopy = SAMPLE_LEN - pThis->dwSampleLen;
+    dwCopy = (dwCopy < dwLen) ? dwCopy : dwLen;
+    memcpy(pThis->abSample + pThis->dwSampleLen, pBuffer, dwCopy);
+    pThis->dwSampleLen += dwCopy;
+
+    if (pThis->dwSampleLen >= pThis->dwSampleTarget)
+    {
+        SetEvent(pThis->hSampleFull);
+    }
+
+    LeaveCriticalSection(&pThis->csSample);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialAutoBaud::Probe( int iBaudRate, int iByteSize, int iParity, DWORD dwWaitMs, SERIAL_LINE_ERRORS * pErrors )
+{
+    SERIAL_LINE_ERRORS before;
+    DWORD dwResult;
+
+    dwResult = pSerial->SetLineFormat(iBaudRate, iByteSize, iParity, ONESTOPBIT);
+    if (dwResult != ERROR_SUCCESS)
+    {
+        return dwResult;
+    }
+
+    // what was received with the previous settings is meaningless
+    pSerial->Purge(PURGE_RXCLEAR);
+
+    EnterCriticalSection(&csSample);
+    dwSampleLen = 0;
+    ResetEvent(hSampleFull);
+    LeaveCriticalSection(&csSample);
+
+    pSerial->GetLineErrors(&before);
+
+    WaitForSingleObject(hSampleFull, dwWaitMs);
+
+    pSerial->GetLineErrors(pErrors);
+    pErrors->dwFraming -= before.dwFraming;
+    pErrors->dwParity -= before.dwParity;
+    pErrors->dwOverrun -= before.dwOverrun;
+    pErrors->dwBreak -= before.dwBreak;
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+double CSerialAutoBaud::Score( const SERIAL_LINE_ERRORS * pErrors, double * pdJunk )
+{
+    DWORD dwLen;
+    DWORD dwJunk = 0;
+    DWORD dwText = 0;
+    DWORD dwErrors;
+    double dErrorRate;
+    BYTE b;
+    DWORD i;
+
+    EnterCriticalSection(&csSample);
+
+    dwLen = dwSampleLen;
+
+    for (i = 0; i < dwLen; i++)
+    {
+        b = abSample[i];
+
+        // a receiver faster than the line sees the start bit and a few data bits of each character,
+        // then ones: a run of zero bits followed by ones, or nothing but ones
+        if (b == 0x00 || b == 0x80 || b == 0xC0 || b == 0xE0 || b == 0xF0 || b == 0xF8 || b == 0xFC || b == 0xFE || b == 0xFF)
+        {
+            dwJunk++;
+        }
+
+        // printable with the parity bit of a 7 bits format masked
+        b &= 0x7F;
+        if ((b >= 0x20 && b < 0x7F) || b == '\r' || b == '\n' || b == '\t')
+        {
+            dwText++;
+        }
+    }
+
+    LeaveCriticalSection(&csSample);
+
+    *pdJunk = (dwLen > 0) ? double(dwJunk) / dwLen : 1.0;
+
+    if (dwLen == 0)
+    {
+        return 0.0;
+    }
+
+    dwErrors = pErrors->dwFraming + pErrors->dwParity + pErrors->dwBreak;
+    dErrorRate = double(dwErrors) / dwLen;
+    dErrorRate = (dErrorRate < 1.0) ? dErrorRate : 1.0;
+
+    // binary protocols are not penalized much for not being text
+    return (1.0 - dErrorRate) * (1.0 - *pdJunk) * (0.6 + 0.4 * double(dwText) / dwLen);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialAutoBaud::Detect( SERIAL_LINE_FORMAT * pFormat, DWORD dwBudgetMs )
+{
+    int aiOrder[sizeof(aiBaudRates) / sizeof(aiBaudRates[0]) + 1];
+    SERIAL_LINE_ERRORS errors;
+    SERIAL_LINE_ERRORS bestErrors;
+    ULONGLONG ullDeadlineUs;
+    ULONGLONG ullNowUs;
+    DWORD dwCandidates = 0;
+    DWORD dwWaitMs;
+    DWORD dwLen;
+    DWORD dwParity[2];
+    DWORD dwHigh = 0;
+    DWORD dwEven = 0;
+    DWORD dwOdd = 0;
+    DWORD dwResult = ERROR_SUCCESS;
+    BOOL bReceived = FALSE;
+    double dScore;
+    double dJunk;
+    double dBest = 0.0;
+    int iBest = 0;
+    int iLastProbed = 0;
+    DWORD i;
+    int p;
+
+    ullDeadlineUs = GetTimestampUs() + ULONGLONG(dwBudgetMs) * 1000;
+
+    // the previous result first, a device rarely changes its settings
+    if (bHaveLast)
+    {
+        aiOrder[dwCandidates++] = last.iBaudRate;
+    }
+    for (i = 0; i < sizeof(aiBaudRates) / sizeof(aiBaudRates[0]); i++)
+    {
+        if (!bHaveLast || aiBaudRates[i] != last.iBaudRate)
+        {
+            aiOrder[dwCandidates++] = aiBaudRates[i];
+        }
+    }
+
+    memset(&bestErrors, 0, sizeof(bestErrors));
+
+    pSerial->SetReceiveTap(CSerialAutoBaud::OnReceive, this);
+
+    for (i = 0; i < dwCandidates; i++)
+    {
+        ullNowUs = GetTimestampUs();
+        if (ullNowUs >= ullDeadlineUs)
+        {
+            break;
+        }
+
+        // time for SERIAL_AUTOBAUD_TARGET characters and a half, within the limits
+        dwWaitMs = DWORD(SERIAL_AUTOBAUD_TARGET * 10 * 1500 / aiOrder[i]) + 10;
+        dwWaitMs = (dwWaitMs < dwMaxSampleMs) ? dwWaitMs : dwMaxSampleMs;
+        dwWaitMs = (dwWaitMs < (ullDeadlineUs - ullNowUs) / 1000) ? dwWaitMs : DWORD((ullDeadlineUs - ullNowUs) / 1000);
+
+        dwResult = Probe(aiOrder[i], 8, NOPARITY, dwWaitMs, &errors);
+        if (dwResult != ERROR_SUCCESS)
+        {
+            break;
+        }
+        iLastProbed = aiOrder[i];
+
+        dScore = Score(&errors, &dJunk);
+        bReceived = bReceived || dwSampleLen > 0;
+
+        if (dScore > dBest)
+        {
+            dBest = dScore;
+            iBest = aiOrder[i];
+            bestErrors = errors;
+        }
+
+        // a clean sample is conclusive, the remaining candidates are not worth the time
+        if (errors.dwFraming == 0 && errors.dwParity == 0 && errors.dwBreak == 0 &&
+            dwSampleLen >= SERIAL_AUTOBAUD_CLEAN && dJunk < 0.25)
+        {
+            break;
+        }
+    }
+
+    if (dwResult == ERROR_SUCCESS && (iBest == 0 || dBest < SERIAL_AUTOBAUD_MIN_SCORE))
+    {
+        dwResult = bReceived ? ERROR_NOT_FOUND : ERROR_TIMEOUT;
+    }
+
+    if (dwResult != ERROR_SUCCESS)
+    {
+        pSerial->SetReceiveTap(NULL, NULL);
+        return dwResult;
+    }
+
+    pFormat->iBaudRate = iBest;
+    pFormat->iByteSize = 8;
+    pFormat->iParity = NOPARITY;
+    pFormat->iStopBits = ONESTOPBIT;
+
+    // the format is read from a sample taken at the chosen rate
+    if (iBest != iLastProbed)
+    {
+        Probe(iBest, 8, NOPARITY, dwMaxSampleMs, &bestErrors);
+    }
+
+    EnterCriticalSection(&csSample);
+    dwLen = dwSampleLen;
+    for (i = 0; i < dwLen; i++)
+    {
+        if (abSample[i] & 0x80)
+        {
+            dwHigh++;
+        }
+        if (OddBits(abSample[i]))
+        {
+            dwOdd++;
+        }
+        else
+        {
+            dwEven++;
+        }
+    }
+    LeaveCriticalSection(&csSample);
+
+    if (bestErrors.dwFraming * 20 >= dwLen)
+    {
+        // 11 bits characters: the parity bit lands where 8N1 expects the stop bit
+        dwParity[0] = dwParity[1] = MAXDWORD;
+        for (p = 0; p < 2; p++)
+        {
+            if (Probe(iBest, 8, (p == 0) ? EVENPARITY : ODDPARITY, dwMaxSampleMs, &errors) == ERROR_SUCCESS && dwSampleLen > 0)
+            {
+                dwParity[p] = errors.dwParity + errors.dwFraming;
+            }
+        }
+
+        if (dwParity[0] != dwParity[1])
+        {
+            pFormat->iParity = (dwParity[0] < dwParity[1]) ? EVENPARITY : ODDPARITY;
+        }
+    }
+    else if (dwHigh * 10 > dwLen && dwEven * 50 >= dwLen * 49)
+    {
+        // 10 bits characters with the parity in the eighth data bit
+        pFormat->iByteSize = 7;
+        pFormat->iParity = EVENPARITY;
+    }
+    else if (dwHigh * 10 > dwLen && dwOdd * 50 >= dwLen * 49)
+    {
+        pFormat->iByteSize = 7;
+        pFormat->iParity = ODDPARITY;
+    }
+
+    pSerial->SetReceiveTap(NULL, NULL);
+
+    dwResult = pSerial->SetLineFormat(pFormat->iBaudRate, pFormat->iByteSize, pFormat->iParity, pFormat->iStopBits);
+    if (dwResult == ERROR_SUCCESS)
+    {
+        last = *pFormat;
+        bHaveLast = TRUE;
+    }
+
+    return dwResult;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
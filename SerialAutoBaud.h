@@ -0,0 +1,87 @@
+// $Id$
+
+#ifndef __SERIAL_AUTO_BAUD_H__
+#define __SERIAL_AUTO_BAUD_H__
+
+#include <windows.h>
+#include "Serial.h"
+
+namespace network {
+
+  //! line settings, with the values taken by the Set* methods of CSerial
+  struct SERIAL_LINE_FORMAT
+  {
+    int iBaudRate;    // CBR_*
+    int iByteSize;    // 7 or 8
+    int iParity;      // NOPARITY, EVENPARITY or ODDPARITY
+    int iStopBits;    // ONESTOPBIT or TWOSTOPBITS
+  };
+
+  /**
+   *  \brief  Finds the line settings of a device that is sending data. Each candidate baud rate
+   *          is listened to at 8N1 for a short sample, scored from the line errors and the
+   *          byte distribution, and the most likely rates are tried first, stopping at the first
+   *          clean sample. The byte size and parity are then derived from the sample taken at
+   *          the chosen rate, probing 8E1 and 8O1 only when the 8N1 sample shows framing errors.
+   *          A receiver set to one stop bit also receives two, so ONESTOPBIT is always reported.
+   */
+  class CSerialAutoBaud
+  {
+    private:
+
+      enum { SAMPLE_LEN = 256 };
+
+      CSerial * pSerial;
+
+      //! data received during the current probe, filled by the listener thread
+      BYTE abSample[SAMPLE_LEN];
+      DWORD dwSampleLen;
+      DWORD dwSampleTarget;
+      CRITICAL_SECTION csSample;
+
+      //! signaled when the sample reaches dwSampleTarget bytes
+      HANDLE hSampleFull;
+
+      DWORD dwMaxSampleMs;
+
+      //! last settings found, tried first by the next detection
+      SERIAL_LINE_FORMAT last;
+      BOOL bHaveLast;
+
+      static void OnReceive( LPVOID pContext, BYTE * pBuffer, DWORD dwLen );
+
+      //! listen with the given settings, returning the line errors seen meanwhile
+      DWORD Probe( int iBaudRate, int iByteSize, int iParity, DWORD dwWaitMs, SERIAL_LINE_ERRORS * pErrors );
+
+      //! likelihood, from 0 to 1, that the sample was received with the right baud rate
+      double Score( const SERIAL_LINE_ERRORS * pErrors, double * pdJunk );
+
+    public:
+      /**
+       *  \brief  Constructor
+       *  \param  pSerial open port connected to the device
+       */
+      CSerialAutoBaud( CSerial * pSerial ) throw( ... );
+
+      /**
+       *  \brief  Destructor
+       */
+      virtual ~CSerialAutoBaud( );
+
+      /**
+       *  \brief  Finds the settings of the device and applies them to the port
+       *  \param  pFormat settings found
+       *  \param  dwBudgetMs time allowed for the detection
+       *  \return status of operation: ERROR_TIMEOUT if the device sent nothing, ERROR_NOT_FOUND if no setting was convincing
+       */
+      DWORD Detect( SERIAL_LINE_FORMAT * pFormat, DWORD dwBudgetMs = 1000 );
+
+      /**
+       *  \brief  Longest time to listen to each candidate, 100 ms by default
+       */
+      void SetMaxSampleTime( DWORD dwMs );
+  };
+
+};
+
+#endif
@@ -0,0 +1,4774 @@
+// $Id$
+
+#include "stdafx.h"
+#include <winsock2.h>
+#include "SerialBench.h"
+#include "Serial.h"
+#include "SerialAutoBaud.h"
+#include "SerialClock.h"
+#include "SerialError.h"
+#include "SerialFileTransfer.h"
+#include "SerialMerger.h"
+#include "SerialParity.h"
+#include "SerialPipeline.h"
+#include "SerialPorts.h"
+#include "SerialShared.h"
+#include "SerialTransport.h"
+#include "SerialTxLanes.h"
+#include "Win32Error.h"
+#include <mmsystem.h>
+#include <tlhelp32.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+
+#pragma comment(lib, "ws2_32.lib")
+
+using namespace network;
+
+//! arguments taken from the command line
+#define BENCH_MAX_ARGS          (8)
+
+//! merger benchmark: sources, size of their chunks and threads writing them
+#define BENCH_MERGER_SOURCES    (64)
+#define BENCH_MERGER_CHUNK      (32)
+#define BENCH_MERGER_THREADS    (4)
+#define BENCH_MERGER_WINDOW_US  (10000)
+
+//! lanes benchmark: urgent frames and their period, blocks of the bulk transfer
+#define BENCH_LANES_URGENT_LEN  (8)
+#define BENCH_LANES_URGENT_MS   (20)
+#define BENCH_LANES_BULK_BLOCK  (16384)
+
+//! shared benchmark: consumers, stamps written per second, ring of the publisher
+#define BENCH_SHARED_CONSUMERS  (4)
+#define BENCH_SHARED_RATE       (1000)
+#define BENCH_SHARED_RING       "bench"
+#define BENCH_SHARED_CAPACITY   (1048576)
+#define BENCH_STAMP_MAGIC       (0x504D5453)
+
+//! a consumer gives up when nothing arrives for this long, e.g. its source died
+#define BENCH_CONSUMER_IDLE_MS  (10000)
+
+//! completion benchmark: links, stamps per second on each, threads writing them, reads a port keeps posted
+#define BENCH_COMPLETION_PAIRS   (256)
+#define BENCH_COMPLETION_RATE    (100)
+#define BENCH_COMPLETION_WRITERS (4)
+#define BENCH_COMPLETION_READS   (2)
+
+//! gap test: frames written per gap, each in two halves
+#define BENCH_GAP_FRAMES        (20)
+#define BENCH_GAP_FRAME_LEN     (8)
+
+//! lap test: ring as small as allowed, writes of the source, marker of the words of the stream
+#define BENCH_LAP_CAPACITY      (65536)
+#define BENCH_LAP_WRITE         (1024)
+#define BENCH_LAP_MARKER        (0xA5ULL)
+#define BENCH_LAP_INDEX_MASK    (0x00FFFFFFFFFFFFFFULL)
+
+//! flow test: watermarks of the receive queue, and the time the slow consumer takes per chunk
+#define BENCH_FLOW_HIGH         (4096)
+#define BENCH_FLOW_LOW          (1024)
+#define BENCH_FLOW_CONSUMER_MS  (20)
+#define BENCH_FLOW_WRITE        (1000)
+#define BENCH_FLOW_DRAIN_MS     (30000)
+
+//! cycle test: ports left idle, cycles of a link, CPU time allowed while idle, and the handles the
+//!   system may keep after the cycles (a leak of one per cycle is thousands)
+#define BENCH_CYCLE_PORTS       (64)
+#define BENCH_CYCLE_COUNT       (10000)
+#define BENCH_CYCLE_IDLE_MS     (1000)
+#define BENCH_CYCLE_IDLE_CPU_MS (20)
+#define BENCH_CYCLE_HANDLE_SLACK (16)
+
+//! errors test: errors built of each kind
+#define BENCH_ERRORS_COUNT      (100000)
+
+//! transfer test: file size, time the receiver waits for the sender, its tries, and the period of
+//!   its first 'C' while the sender may not listen yet
+#define BENCH_XFER_SIZE_KB      (256)
+#define BENCH_XFER_TIMEOUT_MS   (3000)
+#define BENCH_XFER_TRIES        (10)
+#define BENCH_XFER_POLL_MS      (100)
+
+//! what the receivers of the transfer test know of XMODEM and ZMODEM
+#define BENCH_X_SOH             (0x01)
+#define BENCH_X_STX             (0x02)
+#define BENCH_X_EOT             (0x04)
+#define BENCH_X_ACK             (0x06)
+#define BENCH_X_NAK             (0x15)
+#define BENCH_Z_DLE             (0x18)
+#define BENCH_Z_RQINIT          (0)
+#define BENCH_Z_RINIT           (1)
+#define BENCH_Z_ACK             (3)
+#define BENCH_Z_FILE            (4)
+#define BENCH_Z_NAK             (6)
+#define BENCH_Z_FIN             (8)
+#define BENCH_Z_RPOS            (9)
+#define BENCH_Z_DATA            (10)
+#define BENCH_Z_EOF             (11)
+#define BENCH_Z_CRCE            ('h')
+#define BENCH_Z_CRCG            ('i')
+#define BENCH_Z_CRCQ            ('j')
+#define BENCH_Z_CRCW            ('k')
+
+//! pipeline benchmark: sentences, rounds of the in-process run, the longest line, one bad sentence
+//!   in so many, size of the reads, and the time the link run may take
+#define BENCH_PIPELINE_SENTENCES    (100000)
+#define BENCH_PIPELINE_ROUNDS       (20)
+#define BENCH_PIPELINE_LINE         (128)
+#define BENCH_PIPELINE_BAD_EVERY    (50)
+#define BENCH_PIPELINE_CHUNK        (1024)
+#define BENCH_PIPELINE_TIMEOUT_MS   (60000)
+
+//! autobaud test: time allowed to each detection
+#define BENCH_AUTOBAUD_BUDGET_MS    (5000)
+
+//! RFC 2217 stand-in: idle characters after each sample, and what it knows of telnet and COM-PORT-OPTION
+#define BENCH_RFC2217_IDLE          (8)
+#define BENCH_T_SE                  (240)
+#define BENCH_T_SB                  (250)
+#define BENCH_T_WILL                (251)
+#define BENCH_T_DONT                (254)
+#define BENCH_T_IAC                 (255)
+#define BENCH_T_COM_PORT            (44)
+#define BENCH_T_SET_BAUDRATE        (1)
+#define BENCH_T_SET_DATASIZE        (2)
+#define BENCH_T_SET_PARITY          (3)
+#define BENCH_T_NOTIFY_LINESTATE    (106)
+#define BENCH_T_STATE_DATA          (0)
+#define BENCH_T_STATE_IAC           (1)
+#define BENCH_T_STATE_OPTION        (2)
+#define BENCH_T_STATE_SB            (3)
+#define BENCH_T_STATE_SB_IAC        (4)
+
+//! open benchmark: ports, those opened at the same time by the bulk open, and rounds of each way
+#define BENCH_OPEN_PORTS            (64)
+#define BENCH_OPEN_PARALLELISM      (16)
+#define BENCH_OPEN_ROUNDS           (5)
+
+//! framer test: the longest line, lines of the equivalence run, largest chunk it feeds, and lines
+//!   and rounds of the benchmark
+#define BENCH_FRAMER_LINE           (512)
+#define BENCH_FRAMER_TEST_LINES     (2000)
+#define BENCH_FRAMER_CHUNK          (100)
+#define BENCH_FRAMER_LINES          (10000)
+#define BENCH_FRAMER_ROUNDS         (50)
+
+//! parity test: bytes and rounds of the benchmark, rounds of the 128 characters of the round trip,
+//!   and the time it may take
+#define BENCH_PARITY_BYTES          (65536)
+#define BENCH_PARITY_ROUNDS         (200)
+#define BENCH_PARITY_ECHO_ROUNDS    (8)
+#define BENCH_PARITY_TIMEOUT_MS     (5000)
+
+//! rfc2217 test: bytes echoed and taken at a time, the time they may take, and the bytes read with
+//!   the wrong parity and for how long
+#define BENCH_RFC2217_BYTES         (16384)
+#define BENCH_RFC2217_PIECE         (7)
+#define BENCH_RFC2217_TIMEOUT_MS    (5000)
+#define BENCH_RFC2217_ERROR_BYTES   (256)
+#define BENCH_RFC2217_ERROR_MS      (500)
+
+//! transports benchmark: size of the stream, writes of the senders and the time it may take
+#define BENCH_TRANSPORTS_MB         (16)
+#define BENCH_TRANSPORTS_BLOCK      (65536)
+#define BENCH_TRANSPORTS_TIMEOUT_MS (60000)
+
+//! decoder of the callback path of the pipeline benchmark: the line being assembled, the sentences
+//!   counted, and where the good ones go
+struct BENCH_NMEA_RX
+{
+    BYTE abLine[BENCH_PIPELINE_LINE];
+    DWORD dwLineLen;
+    BOOL bOverrun;
+    void (*pfnSentence)( const BYTE * pSentence, DWORD dwLen );
+    volatile DWORD dwFrames;
+    volatile DWORD dwBadFrames;
+    ULONGLONG ullBytes;
+};
+
+//! stand-in of an RFC 2217 terminal server with a device on its port that sends a sample over and
+//!   over, or echoes what it reads: the device, the UART set by the client, and the telnet state of
+//!   the commands received
+struct BENCH_RFC2217
+{
+    SOCKET sListen;
+    SOCKET s;
+    HANDLE hThread;
+    volatile BOOL bStop;
+    char cDevice[64];
+    const char * pcSample;
+    DWORD dwSampleLen;
+    int iBaudRate;
+    int iByteSize;
+    int iParity;
+    DWORD dwRxBaudRate;
+    int iRxByteSize;
+    int iRxParity;
+    ULONGLONG ullSearchBit;
+    int iTelnetState;
+    BYTE abSb[16];
+    DWORD dwSbLen;
+
+    //! echo device: the line from the client, read by the UART of the device, and the line of the
+    //!   device from ullTxBase, one byte per bit
+    std::vector<BYTE> rxBits;
+    DWORD dwRxBitPos;
+    std::vector<BYTE> txBits;
+    ULONGLONG ullTxBase;
+    volatile DWORD dwDeviceChars;
+    volatile DWORD dwDeviceErrors;
+};
+
+//! receiving end of the round trip of the parity test, and the hardware end that echoes to it
+struct BENCH_PARITY_RX
+{
+    CRITICAL_SECTION cs;
+    std::vector<BYTE> data;
+    CSerial * pEcho;
+};
+
+//! receiver of the transports benchmark: the bytes counted, checked against their offset
+struct BENCH_TRANSPORTS_RX
+{
+    volatile DWORD dwReceived;
+    volatile BOOL bCorrupt;
+};
+
+//! loopback server of the transports benchmark, the source of the stream for tcp:// and rfc2217://
+struct BENCH_STREAM_SERVER
+{
+    SOCKET sListen;
+    HANDLE hThread;
+    BOOL bTelnet;
+    DWORD dwBytes;
+};
+
+//! ends of a link of a benchmark, the data goes from pTx to pRx
+struct BENCH_LINK
+{
+    CSerial * pRx;
+    CSerial * pTx;
+};
+
+//! sources written by one thread of the merger and completion benchmarks
+struct BENCH_WRITER
+{
+    std::vector<BENCH_LINK> * pLinks;
+    DWORD dwFirst;
+    DWORD dwCount;
+    DWORD dwPeriodUs;
+    ULONGLONG ullEndUs;
+    LONGLONG llWritten;
+    HANDLE hThread;
+};
+
+//! bulk transfer of the lanes benchmark, kept queued on its lane until bStop
+struct BENCH_LANES_BULK
+{
+    CSerialTxLanes * pLanes;
+    volatile BOOL bStop;
+};
+
+//! message of the shared benchmark, the time it was written starts its latency
+struct BENCH_STAMP
+{
+    DWORD dwMagic;
+    DWORD dwSeq;
+    ULONGLONG ullSentUs;
+};
+
+//! stamps received by a consumer of the shared benchmark
+struct BENCH_CONSUMER
+{
+    std::vector<DWORD> latencies;
+    BYTE abStamp[sizeof(BENCH_STAMP)];
+    DWORD dwFill;
+    DWORD dwNextSeq;
+    DWORD dwLost;
+};
+
+//! receiving end of a link of the completion benchmark: its stamps, and the reads handed to its tap
+struct BENCH_COMPLETION_RX
+{
+    BENCH_CONSUMER consumer;
+    volatile LONGLONG llReads;
+};
+
+//! source of the lap test, writes the stream until bStop
+struct BENCH_LAP_WRITER
+{
+    CSerial * pTx;
+    volatile BOOL bStop;
+};
+
+//! chunks of the lap test checked against the stream
+struct BENCH_LAP_CHECK
+{
+    ULONGLONG ullNext;
+    BOOL bSynced;
+    LONGLONG llChunks;
+    LONGLONG llBytes;
+    LONGLONG llGaps;
+    LONGLONG llTorn;
+    LONGLONG llUnplaced;
+};
+
+//! frames of the gap test, counted by the frame callback
+struct BENCH_GAP_RX
+{
+    DWORD dwGapUs;
+    volatile LONG lFrames;
+    DWORD dwSplit;
+    DWORD dwMerged;
+    DWORD dwEarly;
+    DWORD dwTimed;
+    ULONGLONG ullLateSumUs;
+    ULONGLONG ullLateMaxUs;
+
+    //! the first half of each frame handed to Write, the second half returned from it
+    volatile ULONGLONG aullStartUs[BENCH_GAP_FRAMES];
+    volatile ULONGLONG aullEndUs[BENCH_GAP_FRAMES];
+};
+
+//! stream received by the slow consumer of the flow test, checked byte by byte
+struct BENCH_FLOW_RX
+{
+    CSerial * pRx;
+    volatile LONGLONG llReceived;
+    LONGLONG llCorrupt;
+    DWORD dwMaxQueued;
+    DWORD dwChunks;
+};
+
+//! receiver of the transfer test: the bytes of the line, queued by the listener for the thread
+//!   that plays the protocol, and the file they carried
+struct BENCH_TRANSFER_RX
+{
+    CSerial * pPort;
+    EnumSerialTransferProtocol protocol;
+    DWORD dwLatencyMs;
+    CRITICAL_SECTION cs;
+    HANDLE hData;
+    std::deque<BYTE> queue;
+    std::vector<BYTE> file;
+    DWORD dwReplyBytes;
+    DWORD dwResult;
+};
+
+//! frames of the gap run in progress
+static BENCH_GAP_RX gapRx;
+
+//! stream of the flow run in progress
+static BENCH_FLOW_RX flowRx;
+
+//! receiver of the transfer run in progress
+static BENCH_TRANSFER_RX transferRx;
+
+//! decoder of the callback path of the pipeline run in progress
+static BENCH_NMEA_RX nmeaRx;
+
+//! round trip of the parity run in progress
+static BENCH_PARITY_RX parityRx;
+
+//! stream of the transports run in progress
+static BENCH_TRANSPORTS_RX transportsRx;
+
+//! delay from the timestamp of a chunk to its output, taken by the merge thread
+static ULONGLONG ullMergeDelaySumUs;
+static ULONGLONG ullMergeDelayMaxUs;
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! opens the ends of a link, the receiving one first: it creates a mem:// pair
+static DWORD OpenLink( BENCH_LINK * pLink, const char * cRxDevice, const char * cTxDevice, int iBaudRate )
+{
+    int iResult;
+
+    iResult = pLink->pRx->Open(cRxDevice, iBaudRate, 8, NOPARITY, ONESTOPBIT);
+    if (iResult == 0)
+    {
+        iResult = pLink->pTx->Open(cTxDevice, iBaudRate, 8, NOPARITY, ONESTOPBIT);
+    }
+
+    if (iResult != 0)
+    {
+        printf("cannot open %s and %s: %d\n", cRxDevice, cTxDevice, iResult);
+    }
+
+    return DWORD(iResult);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static void OnMerged( DWORD dwPortId, const BYTE * pData, DWORD dwLen, ULONGLONG ullTimestampUs )
+{
+    ULONGLONG ullDelayUs = GetTimestampUs() - ullTimestampUs;
+
+    ullMergeDelaySumUs += ullDelayUs;
+    if (ullDelayUs > ullMergeDelayMaxUs)
+    {
+        ullMergeDelayMaxUs = ullDelayUs;
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static DWORD WINAPI MergerWriterThread( LPVOID lpParam )
+{
+    BENCH_WRITER * pWriter = (BENCH_WRITER*)lpParam;
+    char acChunk[BENCH_MERGER_CHUNK];
+    ULONGLONG ullNextUs;
+    DWORD i;
+
+    memset(acChunk, 0x55, sizeof(acChunk));
+
+    ullNextUs = GetTimestampUs();
+
+    while (ullNextUs < pWriter->ullEndUs)
+    {
+        for (i = pWriter->dwFirst; i < pWriter->dwFirst + pWriter->dwCount; i++)
+        {
+            if ((*pWriter->pLinks)[i].pTx->Write(acChunk, sizeof(acChunk)) == sizeof(acChunk))
+            {
+                pWriter->llWritten++;
+            }
+        }
+
+        // one chunk per source and period, a late period is caught up at once
+        if (pWriter->dwPeriodUs == 0)
+        {
+            ullNextUs = GetTimestampUs();
+            continue;
+        }
+
+        ullNextUs += pWriter->dwPeriodUs;
+        while (GetTimestampUs() < ullNextUs)
+        {
+            Sleep(1);
+        }
+    }
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static int BenchMerger( int argc, char * argv[] )
+{
+    std::vector<BENCH_LINK> links;
+    BENCH_WRITER aWriters[BENCH_MERGER_THREADS];
+    SERIAL_MERGER_STATS stats;
+    CSerialMerger merger(BENCH_MERGER_WINDOW_US);
+    char cDevice[64];
+    DWORD dwSources = (argc > 0) ? DWORD(atoi(argv[0])) : BENCH_MERGER_SOURCES;
+    DWORD dwSeconds = (argc > 1) ? DWORD(atoi(argv[1])) : 10;
+    DWORD dwRate = (argc > 2) ? DWORD(atoi(argv[2])) : 500;
+    DWORD dwError = ERROR_SUCCESS;
+    LONGLONG llWritten = 0;
+    ULONGLONG ullStartUs;
+    double dSeconds;
+    DWORD i;
+
+    if (dwSources < BENCH_MERGER_THREADS || dwSeconds == 0)
+    {
+        printf("merger: at least %d sources and 1 second\n", BENCH_MERGER_THREADS);
+        return 2;
+    }
+
+    ullMergeDelaySumUs = 0;
+    ullMergeDelayMaxUs = 0;
+
+    links.resize(dwSources);
+    for (i = 0; i < dwSources; i++)
+    {
+        links[i].pRx = new CSerial();
+        links[i].pTx = new CSerial();
+
+        if (dwError == ERROR_SUCCESS)
+        {
+            _snprintf(cDevice, sizeof(cDevice) - 1, "mem://merger.%lu", (unsigned long)i);
+            cDevice[sizeof(cDevice) - 1] = '\0';
+            dwError = OpenLink(&links[i], cDevice, cDevice, CBR_115200);
+        }
+
+        if (dwError == ERROR_SUCCESS)
+        {
+            dwError = merger.AddPort(links[i].pRx, i);
+        }
+    }
+
+    merger.SetOutputCallback(OnMerged);
+
+    if (dwError == ERROR_SUCCESS)
+    {
+        dwError = merger.Start();
+    }
+
+    ullStartUs = GetTimestampUs();
+
+    for (i = 0; dwError == ERROR_SUCCESS && i < BENCH_MERGER_THREADS; i++)
+    {
+        aWriters[i].pLinks = &links;
+        aWriters[i].dwFirst = i * dwSources / BENCH_MERGER_THREADS;
+        aWriters[i].dwCount = (i + 1) * dwSources / BENCH_MERGER_THREADS - aWriters[i].dwFirst;
+        aWriters[i].dwPeriodUs = (dwRate != 0) ? 1000000 / dwRate : 0;
+        aWriters[i].ullEndUs = ullStartUs + (ULONGLONG)dwSeconds * 1000000;
+        aWriters[i].llWritten = 0;
+        aWriters[i].hThread = ::CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)MergerWriterThread, &aWriters[i], 0, NULL);
+        if (aWriters[i].hThread == NULL)
+        {
+            dwError = ::GetLastError();
+        }
+    }
+
+    while (i > 0)
+    {
+        i--;
+        WaitForSingleObject(aWriters[i].hThread, INFINITE);
+        CloseHandle(aWriters[i].hThread);
+        llWritten += aWriters[i].llWritten;
+    }
+
+    dSeconds = double(GetTimestampUs() - ullStartUs) / 1e6;
+
+    // the last chunks are received and leave the window
+    Sleep(200);
+    merger.Stop();
+    merger.GetStats(&stats);
+
+    for (i = 0; i < dwSources; i++)
+    {
+        delete links[i].pTx;
+        delete links[i].pRx;
+    }
+
+    if (dwError != ERROR_SUCCESS)
+    {
+        printf("merger: failed with %lu\n", (unsigned long)dwError);
+        return 1;
+    }
+
+    printf("merger: %lu sources, %lu chunks/s each, %.1f s\n", (unsigned long)dwSources, (unsigned long)dwRate, dSeconds);
+    printf("  written  %lld chunks, %.0f chunks/s\n", llWritten, double(llWritten) / dSeconds);
+    printf("  merged   %lld chunks, %.0f chunks/s, %lld bytes\n", stats.llChunks, double(stats.llChunks) / dSeconds, stats.llBytes);
+    printf("  late     %lld\n", stats.llLate);
+    printf("  pending  %lu chunks at most\n", (unsigned long)stats.dwMaxPending);
+    printf("  delay    %llu us average, %llu us max (window %d us)\n",
+           (stats.llChunks != 0) ? ullMergeDelaySumUs / ULONGLONG(stats.llChunks) : 0ULL, ullMergeDelayMaxUs, BENCH_MERGER_WINDOW_US);
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static DWORD WINAPI LanesBulkThread( LPVOID lpParam )
+{
+    BENCH_LANES_BULK * pBulk = (BENCH_LANES_BULK*)lpParam;
+    SERIAL_LANE_STATS stats;
+    BYTE abBlock[BENCH_LANES_BULK_BLOCK];
+
+    memset(abBlock, 0xAA, sizeof(abBlock));
+
+    // the lane never runs dry, so the link is busy whenever an urgent frame arrives
+    while (!pBulk->bStop)
+    {
+        pBulk->pLanes->GetStats(1, &stats);
+        if (stats.dwQueuedBytes < 2 * sizeof(abBlock))
+        {
+            pBulk->pLanes->Send(1, abBlock, sizeof(abBlock));
+        }
+        else
+        {
+            Sleep(1);
+        }
+    }
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static int BenchLanes( int argc, char * argv[] )
+{
+    BENCH_LINK link;
+    BENCH_LANES_BULK bulk;
+    SERIAL_LANE_STATS urgent;
+    SERIAL_LANE_STATS bulkStats;
+    CSerialTxLanes * pLanes;
+    HANDLE hBulkThread;
+    BYTE abFrame[BENCH_LANES_URGENT_LEN];
+    DWORD dwSeconds = (argc > 0) ? DWORD(atoi(argv[0])) : 10;
+    const char * cRxDevice = (argc > 2) ? argv[1] : "mem://lanes";
+    const char * cTxDevice = (argc > 2) ? argv[2] : "mem://lanes";
+    DWORD dwError;
+    DWORD dwCharNs;
+    ULONGLONG ullBulkStartUs;
+    ULONGLONG ullEndUs;
+    double dBulkSeconds;
+
+    link.pRx = new CSerial();
+    link.pTx = new CSerial();
+
+    dwError = OpenLink(&link, cRxDevice, cTxDevice, CBR_115200);
+    if (dwError != ERROR_SUCCESS)
+    {
+        delete link.pTx;
+        delete link.pRx;
+        return 1;
+    }
+
+    // lane 0 urgent frames, lane 1 a stream cut in chunks of 10 ms of line time
+    pLanes = new CSerialTxLanes(link.pTx, 2);
+    pLanes->SetLane(1, 1, TRUE);
+
+    bulk.pLanes = pLanes;
+    bulk.bStop = FALSE;
+    ullBulkStartUs = GetTimestampUs();
+    hBulkThread = ::CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)LanesBulkThread, &bulk, 0, NULL);
+    if (hBulkThread == NULL)
+    {
+        dwError = ::GetLastError();
+    }
+
+    // the bulk transfer fills the link before the first urgent frame
+    Sleep(500);
+
+    ullEndUs = GetTimestampUs() + (ULONGLONG)dwSeconds * 1000000;
+
+    memset(abFrame, 0x55, sizeof(abFrame));
+    while (dwError == ERROR_SUCCESS && GetTimestampUs() < ullEndUs)
+    {
+        pLanes->Send(0, abFrame, sizeof(abFrame));
+        Sleep(BENCH_LANES_URGENT_MS);
+    }
+
+    // before the lanes are destroyed, the bulk queued is discarded
+    pLanes->GetStats(0, &urgent);
+    pLanes->GetStats(1, &bulkStats);
+    dBulkSeconds = double(GetTimestampUs() - ullBulkStartUs) / 1e6;
+
+    bulk.bStop = TRUE;
+    if (hBulkThread != NULL)
+    {
+        WaitForSingleObject(hBulkThread, INFINITE);
+        CloseHandle(hBulkThread);
+    }
+
+    dwCharNs = link.pTx->GetCharTime();
+
+    delete pLanes;
+    delete link.pTx;
+    delete link.pRx;
+
+    if (dwError != ERROR_SUCCESS)
+    {
+        printf("lanes: failed with %lu\n", (unsigned long)dwError);
+        return 1;
+    }
+
+    printf("lanes: %s to %s, 115200 bps, %lu s, urgent frame every %d ms\n", cTxDevice, cRxDevice, (unsigned long)dwSeconds, BENCH_LANES_URGENT_MS);
+    printf("  bulk     %llu bytes, %.0f bytes/s, chunks of %lu bytes\n", bulkStats.ullBytes, double(bulkStats.ullBytes) / dBulkSeconds,
+           (unsigned long)((dwCharNs != 0) ? 10000000 / dwCharNs : 0));
+    printf("  urgent   %lld frames, %lu errors\n", urgent.llFrames, (unsigned long)urgent.dwErrors);
+    printf("  wait     %llu us average, %llu us max (one chunk is 10000 us of line time)\n",
+           (urgent.llFrames != 0) ? urgent.ullTotalWaitUs / ULONGLONG(urgent.llFrames) : 0ULL, urgent.ullMaxWaitUs);
+    printf("  written  %llu us max after Send\n", urgent.ullMaxDoneUs);
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! CPU time of a process so far, user and kernel
+static double CpuMs( HANDLE hProcess )
+{
+    FILETIME ftCreation;
+    FILETIME ftExit;
+    FILETIME ftKernel;
+    FILETIME ftUser;
+    ULONGLONG ullTime;
+
+    if (!GetProcessTimes(hProcess, &ftCreation, &ftExit, &ftKernel, &ftUser))
+    {
+        return 0.0;
+    }
+
+    ullTime = ((ULONGLONG)ftKernel.dwHighDateTime << 32) + ftKernel.dwLowDateTime;
+    ullTime += ((ULONGLONG)ftUser.dwHighDateTime << 32) + ftUser.dwLowDateTime;
+
+    // 100 ns units
+    return double(ullTime) / 10000.0;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! starts the consumer processes: this program with the arguments "<mode> <argument> <index>"
+static DWORD SpawnConsumers( const char * cMode, const char * cArgument, DWORD dwCount, std::vector<HANDLE> * pProcesses )
+{
+    char cPath[MAX_PATH];
+    char cCommand[MAX_PATH + 128];
+    STARTUPINFOA si;
+    PROCESS_INFORMATION pi;
+    DWORD i;
+
+    if (GetModuleFileNameA(NULL, cPath, MAX_PATH) == 0)
+    {
+        return ::GetLastError();
+    }
+
+    for (i = 0; i < dwCount; i++)
+    {
+        _snprintf(cCommand, sizeof(cCommand) - 1, "\"%s\" %s %s %lu", cPath, cMode, cArgument, (unsigned long)i);
+        cCommand[sizeof(cCommand) - 1] = '\0';
+
+        memset(&si, 0, sizeof(si));
+        si.cb = sizeof(si);
+
+        // the consumers share the console, each prints its results when its source stops
+        if (!CreateProcessA(NULL, cCommand, NULL, NULL, FALSE, 0, NULL, NULL, &si, &pi))
+        {
+            return ::GetLastError();
+        }
+
+        CloseHandle(pi.hThread);
+        pProcesses->push_back(pi.hProcess);
+    }
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! waits for the consumer processes, returns how many failed
+static DWORD WaitConsumers( std::vector<HANDLE> * pProcesses )
+{
+    DWORD dwExitCode;
+    DWORD dwFailed = 0;
+    size_t i;
+
+    for (i = 0; i < pProcesses->size(); i++)
+    {
+        WaitForSingleObject((*pProcesses)[i], INFINITE);
+        if (!GetExitCodeProcess((*pProcesses)[i], &dwExitCode) || dwExitCode != 0)
+        {
+            dwFailed++;
+        }
+        CloseHandle((*pProcesses)[i]);
+    }
+
+    pProcesses->clear();
+
+    return dwFailed;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! writes the stamps, dwRate per second for dwSeconds, returns how many were written
+static DWORD WriteStamps( CSerial * pTx, DWORD dwSeconds, DWORD dwRate )
+{
+    BENCH_STAMP stamp;
+    ULONGLONG ullStartUs = GetTimestampUs();
+    ULONGLONG ullElapsedUs;
+
+    stamp.dwMagic = BENCH_STAMP_MAGIC;
+    stamp.dwSeq = 0;
+
+    do
+    {
+        ullElapsedUs = GetTimestampUs() - ullStartUs;
+
+        // one Write per stamp, the ones due since the last tick are caught up at once
+        while ((ULONGLONG)stamp.dwSeq < ullElapsedUs * dwRate / 1000000)
+        {
+            stamp.ullSentUs = GetTimestampUs();
+            if (pTx->Write((char *)&stamp, sizeof(stamp)) != sizeof(stamp))
+            {
+                return stamp.dwSeq;
+            }
+            stamp.dwSeq++;
+        }
+
+        Sleep(1);
+
+    } while (ullElapsedUs < (ULONGLONG)dwSeconds * 1000000);
+
+    return stamp.dwSeq;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! takes the stamps out of the received stream, they may be cut anywhere
+static void TakeStamps( BENCH_CONSUMER * pConsumer, const BYTE * pData, DWORD dwLen )
+{
+    ULONGLONG ullNowUs = GetTimestampUs();
+    BENCH_STAMP stamp;
+    DWORD i;
+
+    for (i = 0; i < dwLen; i++)
+    {
+        pConsumer->abStamp[pConsumer->dwFill++] = pData[i];
+        if (pConsumer->dwFill < sizeof(BENCH_STAMP))
+        {
+            continue;
+        }
+
+        memcpy(&stamp, pConsumer->abStamp, sizeof(stamp));
+        if (stamp.dwMagic != BENCH_STAMP_MAGIC)
+        {
+            // out of step after an overrun: slide by one byte until a stamp starts
+            memmove(pConsumer->abStamp, pConsumer->abStamp + 1, sizeof(BENCH_STAMP) - 1);
+            pConsumer->dwFill--;
+            continue;
+        }
+        pConsumer->dwFill = 0;
+
+        if (stamp.dwSeq > pConsumer->dwNextSeq)
+        {
+            pConsumer->dwLost += stamp.dwSeq - pConsumer->dwNextSeq;
+        }
+        pConsumer->dwNextSeq = stamp.dwSeq + 1;
+
+        // the clock is the same for every process of the machine
+        pConsumer->latencies.push_back(DWORD(ullNowUs - stamp.ullSentUs));
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static int ReportConsumer( const char * cMode, const char * cIndex, BENCH_CONSUMER * pConsumer, DWORD dwOverruns )
+{
+    std::vector<DWORD> & latencies = pConsumer->latencies;
+    size_t nCount = latencies.size();
+
+    if (nCount == 0)
+    {
+        printf("  %s %s: no stamp received\n", cMode, cIndex);
+        return 1;
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+
+    printf("  %s %s: %lu stamps, %lu lost, %lu overruns, latency %lu us median, %lu us 99%%, %lu us max, cpu %.1f ms\n",
+           cMode, cIndex, (unsigned long)nCount, (unsigned long)pConsumer->dwLost, (unsigned long)dwOverruns,
+           (unsigned long)latencies[nCount / 2], (unsigned long)latencies[nCount * 99 / 100], (unsigned long)latencies[nCount - 1],
+           CpuMs(GetCurrentProcess()));
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! consumer process of the shared memory ring: shared-sub <ring> <index>
+static int BenchSharedSub( int argc, char * argv[] )
+{
+    CSerialSubscriber subscriber;
+    BENCH_CONSUMER consumer;
+    std::vector<BYTE> buffer(4096);
+    ULONGLONG ullTimestampUs;
+    DWORD dwRead;
+    DWORD dwError;
+
+    if (argc < 2)
+    {
+        printf("shared-sub: ring and index expected\n");
+        return 2;
+    }
+
+    dwError = subscriber.Open(argv[0]);
+    if (dwError != ERROR_SUCCESS)
+    {
+        printf("  shared-sub %s: cannot open %s: %lu\n", argv[1], argv[0], (unsigned long)dwError);
+        return 1;
+    }
+
+    consumer.dwFill = 0;
+    consumer.dwNextSeq = 0;
+    consumer.dwLost = 0;
+
+    // until the publisher stops
+    do
+    {
+        dwError = subscriber.Read(&buffer[0], DWORD(buffer.size()), &dwRead, &ullTimestampUs, BENCH_CONSUMER_IDLE_MS);
+        if (dwError == ERROR_MORE_DATA)
+        {
+            buffer.resize(dwRead);
+        }
+        else if (dwError == ERROR_SUCCESS)
+        {
+            TakeStamps(&consumer, &buffer[0], dwRead);
+        }
+    } while (dwError == ERROR_SUCCESS || dwError == ERROR_MORE_DATA);
+
+    return ReportConsumer("shared-sub", argv[1], &consumer, subscriber.GetOverruns());
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! consumer process of the socket relay: relay-sub <port> <index>
+static int BenchRelaySub( int argc, char * argv[] )
+{
+    WSADATA wsaData;
+    SOCKADDR_IN addr;
+    BENCH_CONSUMER consumer;
+    char acBuffer[4096];
+    SOCKET s;
+    int iRecv;
+
+    if (argc < 2)
+    {
+        printf("relay-sub: port and index expected\n");
+        return 2;
+    }
+
+    WSAStartup(MAKEWORD(2, 2), &wsaData);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((unsigned short)atoi(argv[0]));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (s == INVALID_SOCKET || connect(s, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        printf("  relay-sub %s: cannot connect to port %s: %d\n", argv[1], argv[0], WSAGetLastError());
+        WSACleanup();
+        return 1;
+    }
+
+    consumer.dwFill = 0;
+    consumer.dwNextSeq = 0;
+    consumer.dwLost = 0;
+
+    // until the relay closes the connection
+    while ((iRecv = recv(s, acBuffer, sizeof(acBuffer), 0)) > 0)
+    {
+        TakeStamps(&consumer, (const BYTE *)acBuffer, DWORD(iRecv));
+    }
+
+    closesocket(s);
+    WSACleanup();
+
+    return ReportConsumer("relay-sub", argv[1], &consumer, 0);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! capture of the source port in the relay run: a copy of each chunk to every consumer
+static void RelayCapture( LPVOID pContext, const BYTE * pData, DWORD dwLen, ULONGLONG ullTimestampUs )
+{
+    std::vector<SOCKET> * pSockets = (std::vector<SOCKET>*)pContext;
+    size_t i;
+
+    for (i = 0; i < pSockets->size(); i++)
+    {
+        send((*pSockets)[i], (const char *)pData, int(dwLen), 0);
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! relay run of the shared benchmark: the consumers connect to a loopback socket of this process
+static DWORD RunRelay( CSerial * pRx, CSerial * pTx, DWORD dwConsumers, DWORD dwSeconds, DWORD dwRate, std::vector<HANDLE> * pProcesses,
+                       DWORD * pdwWritten, double * pdCpuMs )
+{
+    WSADATA wsaData;
+    SOCKADDR_IN addr;
+    std::vector<SOCKET> sockets;
+    char cPort[16];
+    BOOL bNoDelay = TRUE;
+    DWORD dwError = ERROR_SUCCESS;
+    SOCKET sListen;
+    SOCKET s;
+    int iLen;
+    size_t i;
+
+    WSAStartup(MAKEWORD(2, 2), &wsaData);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = 0;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    iLen = sizeof(addr);
+
+    sListen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sListen == INVALID_SOCKET || bind(sListen, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(sListen, SOMAXCONN) != 0 || getsockname(sListen, (struct sockaddr *)&addr, &iLen) != 0)
+    {
+        dwError = DWORD(WSAGetLastError());
+    }
+
+    if (dwError == ERROR_SUCCESS)
+    {
+        _snprintf(cPort, sizeof(cPort) - 1, "%u", (unsigned int)ntohs(addr.sin_port));
+        cPort[sizeof(cPort) - 1] = '\0';
+        dwError = SpawnConsumers("relay-sub", cPort, dwConsumers, pProcesses);
+    }
+
+    // every consumer is connected before the first stamp
+    while (dwError == ERROR_SUCCESS && sockets.size() < pProcesses->size())
+    {
+        s = accept(sListen, NULL, NULL);
+        if (s == INVALID_SOCKET)
+        {
+            dwError = DWORD(WSAGetLastError());
+            break;
+        }
+        setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&bNoDelay, sizeof(bNoDelay));
+        sockets.push_back(s);
+    }
+
+    if (dwError == ERROR_SUCCESS)
+    {
+        pRx->SetCapture(RelayCapture, &sockets);
+
+        *pdCpuMs = CpuMs(GetCurrentProcess());
+        *pdwWritten = WriteStamps(pTx, dwSeconds, dwRate);
+        Sleep(200);
+        *pdCpuMs = CpuMs(GetCurrentProcess()) - *pdCpuMs;
+
+        pRx->SetCapture(NULL, NULL);
+    }
+
+    // the consumers see the end of the stream
+    for (i = 0; i < sockets.size(); i++)
+    {
+        closesocket(sockets[i]);
+    }
+    if (sListen != INVALID_SOCKET)
+    {
+        closesocket(sListen);
+    }
+
+    WSACleanup();
+
+    return dwError;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static int BenchShared( int argc, char * argv[] )
+{
+    CSerialPublisher publisher;
+    SERIAL_PUBLISHER_STATS stats;
+    BENCH_LINK link;
+    std::vector<HANDLE> processes;
+    DWORD dwConsumers = (argc > 0) ? DWORD(atoi(argv[0])) : BENCH_SHARED_CONSUMERS;
+    DWORD dwSeconds = (argc > 1) ? DWORD(atoi(argv[1])) : 10;
+    DWORD dwRate = (argc > 2) ? DWORD(atoi(argv[2])) : BENCH_SHARED_RATE;
+    DWORD dwSharedWritten = 0;
+    DWORD dwRelayWritten = 0;
+    DWORD dwFailed = 0;
+    DWORD dwError;
+    double dSharedCpuMs = 0.0;
+    double dRelayCpuMs = 0.0;
+
+    if (dwConsumers == 0 || dwSeconds == 0 || dwRate == 0)
+    {
+        printf("shared: at least 1 consumer, 1 second and 1 stamp per second\n");
+        return 2;
+    }
+
+    link.pRx = new CSerial();
+    link.pTx = new CSerial();
+
+    dwError = OpenLink(&link, "mem://shared", "mem://shared", CBR_115200);
+    if (dwError != ERROR_SUCCESS)
+    {
+        delete link.pTx;
+        delete link.pRx;
+        return 1;
+    }
+
+    printf("shared: %lu consumers, %lu stamps/s of %d bytes, %lu s\n", (unsigned long)dwConsumers, (unsigned long)dwRate,
+           (int)sizeof(BENCH_STAMP), (unsigned long)dwSeconds);
+
+    // the received data written once to the ring, each consumer copies it out
+    printf("shared memory ring:\n");
+    dwError = publisher.Start(link.pRx, BENCH_SHARED_RING, BENCH_SHARED_CAPACITY, dwConsumers);
+    if (dwError == ERROR_SUCCESS)
+    {
+        dwError = SpawnConsumers("shared-sub", BENCH_SHARED_RING, dwConsumers, &processes);
+
+        // the consumers take their slot before the first stamp
+        Sleep(1000);
+
+        if (dwError == ERROR_SUCCESS)
+        {
+            dSharedCpuMs = CpuMs(GetCurrentProcess());
+            dwSharedWritten = WriteStamps(link.pTx, dwSeconds, dwRate);
+            Sleep(200);
+            dSharedCpuMs = CpuMs(GetCurrentProcess()) - dSharedCpuMs;
+        }
+
+        publisher.GetStats(&stats);
+        publisher.Stop();
+        dwFailed += WaitConsumers(&processes);
+
+        printf("  source: %lu stamps written, %lld chunks published, %lld wakeups, cpu %.1f ms\n", (unsigned long)dwSharedWritten,
+               stats.llChunks, stats.llWakeups, dSharedCpuMs);
+    }
+
+    // the same stream sent to each consumer over a loopback connection
+    if (dwError == ERROR_SUCCESS)
+    {
+        printf("socket relay:\n");
+        dwError = RunRelay(link.pRx, link.pTx, dwConsumers, dwSeconds, dwRate, &processes, &dwRelayWritten, &dRelayCpuMs);
+        dwFailed += WaitConsumers(&processes);
+
+        printf("  source: %lu stamps written, cpu %.1f ms\n", (unsigned long)dwRelayWritten, dRelayCpuMs);
+    }
+
+    delete link.pTx;
+    delete link.pRx;
+
+    if (dwError != ERROR_SUCCESS)
+    {
+        WaitConsumers(&processes);
+        printf("shared: failed with %lu\n", (unsigned long)dwError);
+        return 1;
+    }
+
+    return (dwFailed == 0) ? 0 : 1;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! byte of the lap test stream at an offset: 8 byte words of their index, marked in the high byte
+static BYTE LapStreamByte( ULONGLONG ullOffset )
+{
+    ULONGLONG ullWord = ((ullOffset >> 3) & BENCH_LAP_INDEX_MASK) | (BENCH_LAP_MARKER << 56);
+
+    return BYTE(ullWord >> ((ullOffset & 7) * 8));
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! offset in the stream of a chunk, from two whole words in a row
+static BOOL LapStreamOffset( const BYTE * pData, DWORD dwLen, ULONGLONG * pullOffset )
+{
+    ULONGLONG ullWord;
+    ULONGLONG ullNextWord;
+    DWORD i;
+
+    for (i = 0; i < 8 && i + 16 <= dwLen; i++)
+    {
+        memcpy(&ullWord, pData + i, 8);
+        memcpy(&ullNextWord, pData + i + 8, 8);
+
+        if ((ullWord >> 56) == BENCH_LAP_MARKER && (ullNextWord >> 56) == BENCH_LAP_MARKER &&
+            (ullNextWord & BENCH_LAP_INDEX_MASK) == (ullWord & BENCH_LAP_INDEX_MASK) + 1)
+        {
+            *pullOffset = (ullWord & BENCH_LAP_INDEX_MASK) * 8 - i;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! checks a chunk read from the ring: a copy the publisher wrote over is torn, a chunk after a skip starts past the expected offset
+static void LapCheckChunk( BENCH_LAP_CHECK * pCheck, const BYTE * pData, DWORD dwLen, BOOL bOverrun )
+{
+    ULONGLONG ullOffset = pCheck->ullNext;
+    DWORD i;
+
+    pCheck->llChunks++;
+    pCheck->llBytes += dwLen;
+
+    if (bOverrun)
+    {
+        pCheck->bSynced = FALSE;
+    }
+
+    if (!LapStreamOffset(pData, dwLen, &ullOffset))
+    {
+        if (dwLen >= 16)
+        {
+            pCheck->llTorn++;
+            return;
+        }
+
+        // too short to tell where it comes from: only in step with the stream
+        if (!pCheck->bSynced)
+        {
+            pCheck->llUnplaced++;
+            return;
+        }
+    }
+
+    for (i = 0; i < dwLen; i++)
+    {
+        if (pData[i] != LapStreamByte(ullOffset + i))
+        {
+            pCheck->llTorn++;
+            return;
+        }
+    }
+
+    if (ullOffset > pCheck->ullNext)
+    {
+        pCheck->llGaps++;
+    }
+    else if (ullOffset < pCheck->ullNext)
+    {
+        // data read twice
+        pCheck->llTorn++;
+    }
+
+    pCheck->ullNext = ullOffset + dwLen;
+    pCheck->bSynced = TRUE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static DWORD WINAPI LapWriterThread( LPVOID lpParam )
+{
+    BENCH_LAP_WRITER * pWriter = (BENCH_LAP_WRITER*)lpParam;
+    BYTE abBlock[BENCH_LAP_WRITE];
+    ULONGLONG ullOffset = 0;
+    DWORD i;
+
+    // as fast as the link goes, the reader cannot keep up with a ring this small
+    while (!pWriter->bStop)
+    {
+        for (i = 0; i < sizeof(abBlock); i++)
+        {
+            abBlock[i] = LapStreamByte(ullOffset + i);
+        }
+
+        if (pWriter->pTx->Write((char *)abBlock, sizeof(abBlock)) != sizeof(abBlock))
+        {
+            return ERROR_WRITE_FAULT;
+        }
+        ullOffset += sizeof(abBlock);
+    }
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static int BenchSharedLap( int argc, char * argv[] )
+{
+    CSerialPublisher publisher;
+    CSerialSubscriber subscriber;
+    BENCH_LINK link;
+    BENCH_LAP_WRITER writer;
+    BENCH_LAP_CHECK check;
+    std::vector<BYTE> buffer(BENCH_LAP_CAPACITY);
+    HANDLE hWriterThread = NULL;
+    DWORD dwSeconds = (argc > 0) ? DWORD(atoi(argv[0])) : 10;
+    DWORD dwOverruns = 0;
+    DWORD dwRead;
+    DWORD dwError;
+    ULONGLONG ullTimestampUs;
+    ULONGLONG ullEndUs;
+    BOOL bPass;
+
+    link.pRx = new CSerial();
+    link.pTx = new CSerial();
+
+    dwError = OpenLink(&link, "mem://lap", "mem://lap", CBR_115200);
+    if (dwError == ERROR_SUCCESS)
+    {
+        dwError = publisher.Start(link.pRx, "lap", BENCH_LAP_CAPACITY, 1);
+    }
+    if (dwError == ERROR_SUCCESS)
+    {
+        dwError = subscriber.Open("lap");
+    }
+
+    memset(&check, 0, sizeof(check));
+    check.bSynced = TRUE;
+
+    // the subscriber starts at the beginning of the stream
+    writer.pTx = link.pTx;
+    writer.bStop = FALSE;
+    if (dwError == ERROR_SUCCESS)
+    {
+        hWriterThread = ::CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)LapWriterThread, &writer, 0, NULL);
+        if (hWriterThread == NULL)
+        {
+            dwError = ::GetLastError();
+        }
+    }
+
+    ullEndUs = GetTimestampUs() + (ULONGLONG)dwSeconds * 1000000;
+
+    while (dwError == ERROR_SUCCESS)
+    {
+        // stopped: the rest of the ring, up to the end of the stream
+        if (!writer.bStop && GetTimestampUs() >= ullEndUs)
+        {
+            writer.bStop = TRUE;
+            WaitForSingleObject(hWriterThread, INFINITE);
+            Sleep(200);
+            publisher.Stop();
+        }
+
+        dwError = subscriber.Read(&buffer[0], DWORD(buffer.size()), &dwRead, &ullTimestampUs, 1000);
+        if (dwError == ERROR_TIMEOUT)
+        {
+            dwError = ERROR_SUCCESS;
+            continue;
+        }
+        if (dwError != ERROR_SUCCESS)
+        {
+            break;
+        }
+
+        LapCheckChunk(&check, &buffer[0], dwRead, subscriber.GetOverruns() != dwOverruns);
+        dwOverruns = subscriber.GetOverruns();
+
+        // behind by more than the ring now and then, or in the middle of a copy the publisher laps
+        if ((check.llChunks % 64) == 0)
+        {
+            Sleep(1);
+        }
+    }
+
+    if (hWriterThread != NULL)
+    {
+        writer.bStop = TRUE;
+        WaitForSingleObject(hWriterThread, INFINITE);
+        CloseHandle(hWriterThread);
+    }
+
+    publisher.Stop();
+    subscriber.Close();
+    delete link.pTx;
+    delete link.pRx;
+
+    if (dwError != ERROR_BROKEN_PIPE)
+    {
+        printf("shared-lap: failed with %lu\n", (unsigned long)dwError);
+        return 1;
+    }
+
+    // each overrun skips at least one record, and a copy the publisher wrote over is never returned
+    bPass = (check.llTorn == 0 && check.llGaps == LONGLONG(dwOverruns) && dwOverruns != 0);
+
+    printf("shared-lap: ring of %d bytes, %lu s\n", BENCH_LAP_CAPACITY, (unsigned long)dwSeconds);
+    printf("  read     %lld chunks, %lld bytes\n", check.llChunks, check.llBytes);
+    printf("  skipped  %lu overruns, %lld gaps in the stream, %lld short chunks after a skip\n", (unsigned long)dwOverruns,
+           check.llGaps, check.llUnplaced);
+    printf("  torn     %lld\n", check.llTorn);
+    printf("  %s\n", bPass ? "PASS" : "FAIL");
+
+    return bPass ? 0 : 1;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! tap of the receiving ends of the completion benchmark, on their listener thread or their ring
+static void CompletionTap( LPVOID pContext, BYTE * pData, DWORD dwLen )
+{
+    BENCH_COMPLETION_RX * pRx = (BENCH_COMPLETION_RX*)pContext;
+
+    pRx->llReads++;
+    TakeStamps(&pRx->consumer, pData, dwLen);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static DWORD WINAPI CompletionWriterThread( LPVOID lpParam )
+{
+    BENCH_WRITER * pWriter = (BENCH_WRITER*)lpParam;
+    BENCH_STAMP stamp;
+    ULONGLONG ullNextUs;
+    DWORD i;
+
+    stamp.dwMagic = BENCH_STAMP_MAGIC;
+    stamp.dwSeq = 0;
+
+    ullNextUs = GetTimestampUs();
+
+    // one stamp per link and period, the links of a period carry the same sequence number
+    while (ullNextUs < pWriter->ullEndUs)
+    {
+        for (i = pWriter->dwFirst; i < pWriter->dwFirst + pWriter->dwCount; i++)
+        {
+            stamp.ullSentUs = GetTimestampUs();
+            if ((*pWriter->pLinks)[i].pTx->Write((char *)&stamp, sizeof(stamp)) == sizeof(stamp))
+            {
+                pWriter->llWritten++;
+            }
+        }
+        stamp.dwSeq++;
+
+        ullNextUs += pWriter->dwPeriodUs;
+        while (GetTimestampUs() < ullNextUs)
+        {
+            Sleep(1);
+        }
+    }
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! sums the reads handed to the taps of the receiving ends
+static LONGLONG CompletionReads( std::vector<BENCH_COMPLETION_RX> * pReceivers )
+{
+    LONGLONG llReads = 0;
+    size_t i;
+
+    for (i = 0; i < pReceivers->size(); i++)
+    {
+        llReads += (*pReceivers)[i].llReads;
+    }
+
+    return llReads;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! one run of the completion benchmark, both ends of every link on pCompletionPort, or on listener threads if NULL
+static int RunCompletion( CSerialCompletionPort * pCompletionPort, DWORD dwPairs, DWORD dwSeconds, DWORD dwRate )
+{
+    std::vector<BENCH_LINK> links(dwPairs);
+    std::vector<BENCH_COMPLETION_RX> receivers(dwPairs);
+    std::vector<DWORD> latencies;
+    BENCH_WRITER aWriters[BENCH_COMPLETION_WRITERS];
+    SERIAL_COMPLETION_STATS idle;
+    SERIAL_COMPLETION_STATS after;
+    char cDevice[64];
+    DWORD dwError = ERROR_SUCCESS;
+    DWORD dwFallbacks = 0;
+    DWORD dwLost = 0;
+    LONGLONG llWritten = 0;
+    LONGLONG llReadsBefore;
+    LONGLONG llReadsAfter;
+    ULONGLONG ullStartUs;
+    double dSeconds;
+    double dCpuMs;
+    size_t nCount;
+    BOOL bPass = TRUE;
+    DWORD i;
+
+    for (i = 0; i < dwPairs; i++)
+    {
+        links[i].pRx = new CSerial();
+        links[i].pTx = new CSerial();
+        links[i].pRx->SetCompletionPort(pCompletionPort);
+        links[i].pTx->SetCompletionPort(pCompletionPort);
+
+        receivers[i].consumer.dwFill = 0;
+        receivers[i].consumer.dwNextSeq = 0;
+        receivers[i].consumer.dwLost = 0;
+        receivers[i].llReads = 0;
+
+        if (dwError == ERROR_SUCCESS)
+        {
+            _snprintf(cDevice, sizeof(cDevice) - 1, "mem://completion.%lu", (unsigned long)i);
+            cDevice[sizeof(cDevice) - 1] = '\0';
+            dwError = OpenLink(&links[i], cDevice, cDevice, CBR_115200);
+        }
+
+        if (dwError == ERROR_SUCCESS)
+        {
+            links[i].pRx->SetReceiveTap(CompletionTap, &receivers[i]);
+            if (pCompletionPort != NULL && (!links[i].pRx->UsesCompletionPort() || !links[i].pTx->UsesCompletionPort()))
+            {
+                dwFallbacks++;
+            }
+        }
+    }
+
+    // the reads of the ends that created the pairs waited for the other ends, they are posted again
+    Sleep(500);
+
+    if (pCompletionPort != NULL)
+    {
+        pCompletionPort->GetStats(&idle);
+    }
+    llReadsBefore = CompletionReads(&receivers);
+
+    dCpuMs = CpuMs(GetCurrentProcess());
+    ullStartUs = GetTimestampUs();
+
+    for (i = 0; dwError == ERROR_SUCCESS && i < BENCH_COMPLETION_WRITERS; i++)
+    {
+        aWriters[i].pLinks = &links;
+        aWriters[i].dwFirst = i * dwPairs / BENCH_COMPLETION_WRITERS;
+        aWriters[i].dwCount = (i + 1) * dwPairs / BENCH_COMPLETION_WRITERS - aWriters[i].dwFirst;
+        aWriters[i].dwPeriodUs = 1000000 / dwRate;
+        aWriters[i].ullEndUs = ullStartUs + (ULONGLONG)dwSeconds * 1000000;
+        aWriters[i].llWritten = 0;
+        aWriters[i].hThread = ::CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)CompletionWriterThread, &aWriters[i], 0, NULL);
+        if (aWriters[i].hThread == NULL)
+        {
+            dwError = ::GetLastError();
+        }
+    }
+
+    while (i > 0)
+    {
+        i--;
+        WaitForSingleObject(aWriters[i].hThread, INFINITE);
+        CloseHandle(aWriters[i].hThread);
+        llWritten += aWriters[i].llWritten;
+    }
+
+    dSeconds = double(GetTimestampUs() - ullStartUs) / 1e6;
+
+    // the last stamps are received
+    Sleep(500);
+    dCpuMs = CpuMs(GetCurrentProcess()) - dCpuMs;
+
+    if (pCompletionPort != NULL)
+    {
+        pCompletionPort->GetStats(&after);
+    }
+    llReadsAfter = CompletionReads(&receivers);
+
+    for (i = 0; i < dwPairs; i++)
+    {
+        delete links[i].pTx;
+        delete links[i].pRx;
+
+        latencies.insert(latencies.end(), receivers[i].consumer.latencies.begin(), receivers[i].consumer.latencies.end());
+        dwLost += receivers[i].consumer.dwLost;
+    }
+
+    if (dwError != ERROR_SUCCESS)
+    {
+        printf("completion: failed with %lu\n", (unsigned long)dwError);
+        return 1;
+    }
+
+    if (pCompletionPort != NULL)
+    {
+        printf("completion port, %lu rings for %lu ports:\n", (unsigned long)pCompletionPort->GetThreadCount(), (unsigned long)(2 * dwPairs));
+    }
+    else
+    {
+        printf("listener threads, one per port: %lu\n", (unsigned long)(2 * dwPairs));
+    }
+
+    nCount = latencies.size();
+    std::sort(latencies.begin(), latencies.end());
+
+    printf("  stamps   %lld written, %lu received, %lu lost, %.0f stamps/s\n", llWritten, (unsigned long)nCount, (unsigned long)dwLost,
+           double(nCount) / dSeconds);
+    if (nCount != 0)
+    {
+        printf("  latency  %lu us median, %lu us 99%%, %lu us max\n", (unsigned long)latencies[nCount / 2],
+               (unsigned long)latencies[nCount * 99 / 100], (unsigned long)latencies[nCount - 1]);
+    }
+    printf("  cpu      %.1f ms, %.2f us per stamp\n", dCpuMs, (nCount != 0) ? dCpuMs * 1000.0 / double(nCount) : 0.0);
+
+    if (pCompletionPort == NULL)
+    {
+        return (nCount != 0) ? 0 : 1;
+    }
+
+    // a mem:// port keeps its two reads posted and no WaitCommEvent, and the blocking writes
+    // (their event tagged with the low bit) queue no completion: one completion per read
+    printf("  ports    %lu on the completion port, %lu fell back to a listener thread\n", (unsigned long)idle.lPorts, (unsigned long)dwFallbacks);
+    printf("  posted   %ld when idle, %ld after the run, %d per port expected\n", idle.lInFlight, after.lInFlight, BENCH_COMPLETION_READS);
+    printf("  reaped   %lld completions for %lld reads, %lld waits, %lu at most at once\n", after.llCompletions - idle.llCompletions,
+           llReadsAfter - llReadsBefore, after.llWaits - idle.llWaits, (unsigned long)after.dwMaxBatch);
+
+    bPass = (dwFallbacks == 0) && (idle.lInFlight == BENCH_COMPLETION_READS * idle.lPorts) && (after.lInFlight == idle.lInFlight) &&
+            (after.llCompletions - idle.llCompletions == llReadsAfter - llReadsBefore) && (nCount != 0);
+
+    printf("  %s\n", bPass ? "PASS" : "FAIL");
+
+    return bPass ? 0 : 1;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static int BenchCompletion( int argc, char * argv[] )
+{
+    CSerialCompletionPort * pCompletionPort;
+    DWORD dwPairs = (argc > 0) ? DWORD(atoi(argv[0])) : BENCH_COMPLETION_PAIRS;
+    DWORD dwSeconds = (argc > 1) ? DWORD(atoi(argv[1])) : 10;
+    DWORD dwRate = (argc > 2) ? DWORD(atoi(argv[2])) : BENCH_COMPLETION_RATE;
+    DWORD dwThreads = (argc > 3) ? DWORD(atoi(argv[3])) : 1;
+    int iResult;
+
+    if (dwPairs < BENCH_COMPLETION_WRITERS || dwSeconds == 0 || dwRate == 0 || dwRate > 1000000)
+    {
+        printf("completion: at least %d links, 1 second and 1 stamp per second\n", BENCH_COMPLETION_WRITERS);
+        return 2;
+    }
+
+    printf("completion: %lu mem:// links, %lu stamps/s on each, %lu s\n", (unsigned long)dwPairs, (unsigned long)dwRate, (unsigned long)dwSeconds);
+
+    iResult = RunCompletion(NULL, dwPairs, dwSeconds, dwRate);
+
+    // the ports are closed before their completion port
+    pCompletionPort = new CSerialCompletionPort(dwThreads);
+    iResult |= RunCompletion(pCompletionPort, dwPairs, dwSeconds, dwRate);
+    delete pCompletionPort;
+
+    return iResult;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static void OnGapFrame( BYTE * pData, DWORD dwLen, ULONGLONG ullFirstUs, ULONGLONG ullLastUs )
+{
+    ULONGLONG ullNowUs = GetTimestampUs();
+    ULONGLONG ullDelayUs;
+    LONG lFrame = gapRx.lFrames;
+
+    if (dwLen < BENCH_GAP_FRAME_LEN)
+    {
+        gapRx.dwSplit++;
+    }
+    else if (dwLen > BENCH_GAP_FRAME_LEN)
+    {
+        gapRx.dwMerged++;
+    }
+
+    // the timestamps of the driver frames are derived from the gap, the writer has the real ones;
+    // after a split or a merge the frames no longer match the ones written
+    if (dwLen == BENCH_GAP_FRAME_LEN && gapRx.dwSplit == 0 && gapRx.dwMerged == 0 && lFrame < BENCH_GAP_FRAMES &&
+        gapRx.aullEndUs[lFrame] != 0)
+    {
+        // the last byte was received after the first half was handed to Write
+        if (ullNowUs - gapRx.aullStartUs[lFrame] < gapRx.dwGapUs)
+        {
+            gapRx.dwEarly++;
+        }
+
+        ullDelayUs = ullNowUs - gapRx.aullEndUs[lFrame];
+        ullDelayUs = (ullDelayUs > gapRx.dwGapUs) ? ullDelayUs - gapRx.dwGapUs : 0;
+        gapRx.ullLateSumUs += ullDelayUs;
+        if (ullDelayUs > gapRx.ullLateMaxUs)
+        {
+            gapRx.ullLateMaxUs = ullDelayUs;
+        }
+        gapRx.dwTimed++;
+    }
+
+    InterlockedIncrement(&gapRx.lFrames);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! waits until a time, sleeping by the millisecond and spinning the last one
+static void WaitUntilUs( ULONGLONG ullUntilUs )
+{
+    ULONGLONG ullNowUs;
+
+    while ((ullNowUs = GetTimestampUs()) < ullUntilUs)
+    {
+        if (ullUntilUs - ullNowUs > 2000)
+        {
+            Sleep(1);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! one gap of the gap test: the halves of each frame are half a gap apart, the frames two gaps apart
+static BOOL RunGap( BENCH_LINK * pLink, DWORD dwTargetUs, BOOL bDriverTimeout )
+{
+    BYTE abFrame[BENCH_GAP_FRAME_LEN];
+    DWORD dwCharNs = pLink->pRx->GetCharTime();
+    DWORD dwHalf = BENCH_GAP_FRAME_LEN / 2;
+    DWORD dwLineUs;
+    ULONGLONG ullNextUs;
+    BOOL bPass;
+    DWORD i;
+
+    pLink->pRx->SetIdleFraming(double(dwTargetUs) * 1000.0 / dwCharNs);
+
+    // what the previous gap left on the line is closed first
+    Sleep(100);
+
+    memset((void *)&gapRx, 0, sizeof(gapRx));
+    gapRx.dwGapUs = pLink->pRx->GetIdleGap();
+
+    // on a link that paces the bytes, each half is on the line for a while after Write returns
+    dwLineUs = DWORD((ULONGLONG)BENCH_GAP_FRAME_LEN * dwCharNs / 1000);
+
+    memset(abFrame, 0x5A, sizeof(abFrame));
+    ullNextUs = GetTimestampUs();
+
+    for (i = 0; i < BENCH_GAP_FRAMES; i++)
+    {
+        WaitUntilUs(ullNextUs);
+        gapRx.aullStartUs[i] = GetTimestampUs();
+        pLink->pTx->Write((char *)abFrame, int(dwHalf));
+
+        WaitUntilUs(GetTimestampUs() + gapRx.dwGapUs / 2);
+        pLink->pTx->Write((char *)abFrame + dwHalf, int(BENCH_GAP_FRAME_LEN - dwHalf));
+        gapRx.aullEndUs[i] = GetTimestampUs();
+
+        ullNextUs = gapRx.aullEndUs[i] + dwLineUs + 2 * gapRx.dwGapUs;
+    }
+
+    // the last frame is closed
+    WaitUntilUs(ullNextUs + dwLineUs + 100000);
+
+    bPass = (gapRx.lFrames == BENCH_GAP_FRAMES && gapRx.dwSplit == 0 && gapRx.dwMerged == 0 && gapRx.dwEarly == 0);
+
+    printf("  gap %5lu us (%s): %ld frames, %lu split, %lu merged, %lu early, closed %llu us late on average, %llu us max  %s\n",
+           (unsigned long)gapRx.dwGapUs, bDriverTimeout ? "driver timeout" : "timer", gapRx.lFrames, (unsigned long)gapRx.dwSplit,
+           (unsigned long)gapRx.dwMerged, (unsigned long)gapRx.dwEarly,
+           (gapRx.dwTimed != 0) ? gapRx.ullLateSumUs / gapRx.dwTimed : 0ULL, gapRx.ullLateMaxUs, bPass ? "PASS" : "FAIL");
+
+    return bPass;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static int BenchGap( int argc, char * argv[] )
+{
+    static const DWORD adwGapsUs[] = { 2000, 5000, 9000, 11000, 20000 };
+    BENCH_LINK link;
+    const char * cRxDevice = (argc > 1) ? argv[0] : "mem://gap";
+    const char * cTxDevice = (argc > 1) ? argv[1] : "mem://gap";
+    int iBaudRate = (argc > 2) ? atoi(argv[2]) : CBR_9600;
+    BOOL bComm;
+    BOOL bPass = TRUE;
+    DWORD dwError;
+    DWORD i;
+
+    link.pRx = new CSerial();
+    link.pTx = new CSerial();
+
+    dwError = OpenLink(&link, cRxDevice, cTxDevice, iBaudRate);
+    if (dwError != ERROR_SUCCESS)
+    {
+        delete link.pTx;
+        delete link.pRx;
+        return 1;
+    }
+
+    link.pRx->RegisterFrameListenner(OnGapFrame);
+
+    // only a comm port has the driver inter-byte timeout, the other links always use the timer
+    bComm = (strstr(cRxDevice, "://") == NULL || _strnicmp(cRxDevice, "tty://", 6) == 0);
+
+    printf("gap: %s to %s, %d bps, character %lu ns, %d frames of %d bytes per gap\n", cTxDevice, cRxDevice, iBaudRate,
+           (unsigned long)link.pRx->GetCharTime(), BENCH_GAP_FRAMES, BENCH_GAP_FRAME_LEN);
+
+    for (i = 0; i < sizeof(adwGapsUs) / sizeof(adwGapsUs[0]); i++)
+    {
+        bPass = RunGap(&link, adwGapsUs[i], bComm && adwGapsUs[i] >= 10000) && bPass;
+    }
+
+    link.pRx->SetIdleFraming(0.0);
+
+    delete link.pTx;
+    delete link.pRx;
+
+    printf("  %s\n", bPass ? "PASS" : "FAIL");
+
+    return bPass ? 0 : 1;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! byte of the flow stream at an offset, never XON or XOFF so the stream is not taken for flow control
+static BYTE FlowStreamByte( LONGLONG llOffset )
+{
+    return BYTE('A' + llOffset % 26);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static void OnFlowData( BYTE * pData, DWORD dwLen )
+{
+    LONGLONG llOffset = flowRx.llReceived;
+    DWORD dwQueued = flowRx.pRx->GetRxQueuedBytes();
+    DWORD i;
+
+    for (i = 0; i < dwLen; i++)
+    {
+        if (pData[i] != FlowStreamByte(llOffset + i))
+        {
+            flowRx.llCorrupt++;
+        }
+    }
+
+    if (dwQueued > flowRx.dwMaxQueued)
+    {
+        flowRx.dwMaxQueued = dwQueued;
+    }
+    flowRx.dwChunks++;
+
+    InterlockedExchangeAdd64(&flowRx.llReceived, dwLen);
+
+    // the consumer falls behind the line, the receive queue grows to the high watermark
+    Sleep(BENCH_FLOW_CONSUMER_MS);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static int BenchFlow( int argc, char * argv[] )
+{
+    BENCH_LINK link;
+    CSerialExecutor * pExecutor;
+    SERIAL_FLOW_STATS rxStats;
+    SERIAL_FLOW_STATS txStats;
+    char acBlock[BENCH_FLOW_WRITE];
+    DWORD dwSeconds = (argc > 0) ? DWORD(atoi(argv[0])) : 10;
+    const char * cRxDevice = (argc > 2) ? argv[1] : "mem://flow";
+    const char * cTxDevice = (argc > 2) ? argv[2] : "mem://flow";
+    LONGLONG llWritten = 0;
+    ULONGLONG ullEndUs;
+    DWORD dwError;
+    DWORD dwDropped;
+    BOOL bPass;
+    int iWrote;
+    int i;
+
+    link.pRx = new CSerial();
+    link.pTx = new CSerial();
+
+    dwError = OpenLink(&link, cRxDevice, cTxDevice, CBR_115200);
+    if (dwError != ERROR_SUCCESS)
+    {
+        delete link.pTx;
+        delete link.pRx;
+        return 1;
+    }
+
+    memset(&flowRx, 0, sizeof(flowRx));
+    flowRx.pRx = link.pRx;
+
+    // the receive queue is the one of the executor; the sender honours the XOFF of the receiver
+    pExecutor = new CSerialExecutor(1);
+    link.pRx->RegisterListenner(OnFlowData);
+    dwError = link.pRx->SetExecutor(pExecutor);
+    if (dwError == ERROR_SUCCESS)
+    {
+        dwError = link.pRx->SetFlowControl(FLOW_CONTROL_SOFTWARE, BENCH_FLOW_HIGH, BENCH_FLOW_LOW);
+    }
+    if (dwError == ERROR_SUCCESS)
+    {
+        dwError = link.pTx->SetFlowControl(FLOW_CONTROL_SOFTWARE, BENCH_FLOW_HIGH, BENCH_FLOW_LOW);
+    }
+
+    // as fast as Write takes it, a short write is a failure the stream cannot recover from
+    ullEndUs = GetTimestampUs() + (ULONGLONG)dwSeconds * 1000000;
+    while (dwError == ERROR_SUCCESS && GetTimestampUs() < ullEndUs)
+    {
+        for (i = 0; i < BENCH_FLOW_WRITE; i++)
+        {
+            acBlock[i] = char(FlowStreamByte(llWritten + i));
+        }
+
+        iWrote = link.pTx->Write(acBlock, BENCH_FLOW_WRITE);
+        llWritten += iWrote;
+        if (iWrote != BENCH_FLOW_WRITE)
+        {
+            dwError = ERROR_WRITE_FAULT;
+        }
+    }
+
+    // the consumer catches up with what is queued and on the line
+    ullEndUs = GetTimestampUs() + (ULONGLONG)BENCH_FLOW_DRAIN_MS * 1000;
+    while (flowRx.llReceived < llWritten && GetTimestampUs() < ullEndUs)
+    {
+        Sleep(10);
+    }
+
+    link.pRx->GetFlowStats(&rxStats);
+    link.pTx->GetFlowStats(&txStats);
+    dwDropped = link.pRx->GetRxDropped();
+
+    // the port releases its strand before the executor goes
+    delete link.pTx;
+    delete link.pRx;
+    delete pExecutor;
+
+    if (dwError != ERROR_SUCCESS)
+    {
+        printf("flow: failed with %lu after %lld bytes\n", (unsigned long)dwError, llWritten);
+        return 1;
+    }
+
+    bPass = (flowRx.llReceived == llWritten && flowRx.llCorrupt == 0 && dwDropped == 0 &&
+             rxStats.dwThrottleEvents != 0 && txStats.dwPeerThrottleEvents != 0);
+
+    printf("flow: %s to %s, 115200 bps, %lu s, XON/XOFF at %d/%d queued bytes, consumer %d ms per chunk\n", cTxDevice, cRxDevice,
+           (unsigned long)dwSeconds, BENCH_FLOW_HIGH, BENCH_FLOW_LOW, BENCH_FLOW_CONSUMER_MS);
+    printf("  stream    %lld bytes written, %lld received in %lu chunks, %lld corrupt, %lu chunks dropped\n", llWritten,
+           flowRx.llReceived, (unsigned long)flowRx.dwChunks, flowRx.llCorrupt, (unsigned long)dwDropped);
+    printf("  receiver  %lu throttles, %llu ms throttled, %lu bytes queued at most\n", (unsigned long)rxStats.dwThrottleEvents,
+           rxStats.ullThrottledUs / 1000, (unsigned long)flowRx.dwMaxQueued);
+    printf("  sender    %lu throttles, %llu ms held\n", (unsigned long)txStats.dwPeerThrottleEvents, txStats.ullPeerThrottledUs / 1000);
+    printf("  %s\n", bPass ? "PASS" : "FAIL");
+
+    return bPass ? 0 : 1;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! threads of this process
+static DWORD ThreadCount( void )
+{
+    THREADENTRY32 te;
+    HANDLE hSnapshot;
+    DWORD dwPid = GetCurrentProcessId();
+    DWORD dwThreads = 0;
+
+    hSnapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+    if (hSnapshot == INVALID_HANDLE_VALUE)
+    {
+        return 0;
+    }
+
+    te.dwSize = sizeof(te);
+    if (Thread32First(hSnapshot, &te))
+    {
+        do
+        {
+            if (te.th32OwnerProcessID == dwPid)
+            {
+                dwThreads++;
+            }
+        } while (Thread32Next(hSnapshot, &te));
+    }
+
+    CloseHandle(hSnapshot);
+
+    return dwThreads;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! handles of this process
+static DWORD HandleCount( void )
+{
+    DWORD dwHandles = 0;
+
+    GetProcessHandleCount(GetCurrentProcess(), &dwHandles);
+
+    return dwHandles;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! CPU time the process takes while the main thread sleeps
+static double IdleCpuMs( DWORD dwMs )
+{
+    double dStartMs = CpuMs(GetCurrentProcess());
+
+    Sleep(dwMs);
+
+    return CpuMs(GetCurrentProcess()) - dStartMs;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static int BenchCycle( int argc, char * argv[] )
+{
+    BENCH_LINK link;
+    std::vector<CSerial*> ports;
+    DWORD dwCycles = (argc > 0) ? DWORD(atoi(argv[0])) : BENCH_CYCLE_COUNT;
+    const char * cRxDevice = (argc > 2) ? argv[1] : "mem://cycle";
+    const char * cTxDevice = (argc > 2) ? argv[2] : "mem://cycle";
+    DWORD dwThreads;
+    DWORD dwHandles;
+    DWORD dwIdleThreads;
+    DWORD dwOpenThreads;
+    DWORD dwDone = 0;
+    DWORD dwError = ERROR_SUCCESS;
+    double dCreatedCpuMs;
+    double dOpenCpuMs;
+    double dSeconds;
+    ULONGLONG ullStartUs;
+    BOOL bPass;
+    DWORD i;
+
+    link.pRx = new CSerial();
+    link.pTx = new CSerial();
+
+    // the first cycle loads what the process keeps afterwards (the trace provider, the timer resolution)
+    dwError = OpenLink(&link, cRxDevice, cTxDevice, CBR_115200);
+    link.pTx->Close();
+    link.pRx->Close();
+
+    dwThreads = ThreadCount();
+    dwHandles = HandleCount();
+
+    // ports that were never opened have no listener
+    for (i = 0; i < BENCH_CYCLE_PORTS; i++)
+    {
+        ports.push_back(new CSerial());
+    }
+    dwIdleThreads = ThreadCount();
+    dCreatedCpuMs = IdleCpuMs(BENCH_CYCLE_IDLE_MS);
+    for (i = 0; i < ports.size(); i++)
+    {
+        delete ports[i];
+    }
+
+    // an open link with nothing to receive: the listeners block
+    if (dwError == ERROR_SUCCESS)
+    {
+        dwError = OpenLink(&link, cRxDevice, cTxDevice, CBR_115200);
+    }
+    dwOpenThreads = ThreadCount();
+    dOpenCpuMs = IdleCpuMs(BENCH_CYCLE_IDLE_MS);
+    link.pTx->Close();
+    link.pRx->Close();
+
+    // the same objects opened again, each Close joins the listener it started
+    ullStartUs = GetTimestampUs();
+    while (dwError == ERROR_SUCCESS && dwDone < dwCycles)
+    {
+        dwError = OpenLink(&link, cRxDevice, cTxDevice, CBR_115200);
+        link.pTx->Close();
+        link.pRx->Close();
+        dwDone++;
+    }
+    dSeconds = double(GetTimestampUs() - ullStartUs) / 1e6;
+
+    delete link.pTx;
+    delete link.pRx;
+
+    if (dwError != ERROR_SUCCESS)
+    {
+        printf("cycle: failed with %lu after %lu cycles\n", (unsigned long)dwError, (unsigned long)dwDone);
+        return 1;
+    }
+
+    bPass = (dCreatedCpuMs <= BENCH_CYCLE_IDLE_CPU_MS && dOpenCpuMs <= BENCH_CYCLE_IDLE_CPU_MS && dwIdleThreads == dwThreads &&
+             ThreadCount() == dwThreads && HandleCount() <= dwHandles + BENCH_CYCLE_HANDLE_SLACK);
+
+    printf("cycle: %s and %s, %lu cycles of Open and Close of both ends\n", cRxDevice, cTxDevice, (unsigned long)dwCycles);
+    printf("  idle      %d ports created: %+ld threads, %.1f ms CPU in %d ms\n", BENCH_CYCLE_PORTS,
+           long(dwIdleThreads) - long(dwThreads), dCreatedCpuMs, BENCH_CYCLE_IDLE_MS);
+    printf("  open      link with no data: %+ld threads, %.1f ms CPU in %d ms\n", long(dwOpenThreads) - long(dwThreads), dOpenCpuMs,
+           BENCH_CYCLE_IDLE_MS);
+    printf("  cycles    %.0f per second, %.0f Open and Close per second\n", double(dwDone) / dSeconds, 4.0 * double(dwDone) / dSeconds);
+    printf("  after     %+ld threads, %+ld handles\n", long(ThreadCount()) - long(dwThreads), long(HandleCount()) - long(dwHandles));
+    printf("  %s\n", bPass ? "PASS" : "FAIL");
+
+    return bPass ? 0 : 1;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! the cost of one error of each kind, in nanoseconds: the error_code the library returns, the
+//!   CWin32Error it used to build, and the message of the error_code formatted on request
+static int BenchErrors( int argc, char * argv[] )
+{
+    static const DWORD adwErrors[] = { ERROR_OPERATION_ABORTED, ERROR_GEN_FAILURE, ERROR_ACCESS_DENIED, ERROR_DEVICE_NOT_CONNECTED };
+    DWORD dwCount = (argc > 0) ? DWORD(atoi(argv[0])) : BENCH_ERRORS_COUNT;
+    volatile ULONGLONG ullSink = 0;
+    ULONGLONG ullStartUs;
+    double dCodeNs;
+    double dWin32Ns;
+    double dMessageNs;
+    DWORD dwAborted = 0;
+    DWORD i;
+
+    if (dwCount == 0)
+    {
+        dwCount = BENCH_ERRORS_COUNT;
+    }
+
+    // what the listener does with an error: keep it and compare it to a condition
+    ullStartUs = GetTimestampUs();
+    for (i = 0; i < dwCount; i++)
+    {
+        std::error_code ec = MakeSerialError(adwErrors[i % 4]);
+
+        if (ec == std::errc::operation_canceled)
+        {
+            dwAborted++;
+        }
+        ullSink += ec.value();
+    }
+    dCodeNs = double(GetTimestampUs() - ullStartUs) * 1000.0 / dwCount;
+
+    // FormatMessage and a heap block for every error, even if only ErrorCode() is wanted
+    ullStartUs = GetTimestampUs();
+    for (i = 0; i < dwCount; i++)
+    {
+        CWin32Error e(adwErrors[i % 4]);
+
+        if (e.ErrorCode() == ERROR_OPERATION_ABORTED)
+        {
+            dwAborted++;
+        }
+        ullSink += e.ErrorCode();
+    }
+    dWin32Ns = double(GetTimestampUs() - ullStartUs) * 1000.0 / dwCount;
+
+    ullStartUs = GetTimestampUs();
+    for (i = 0; i < dwCount; i++)
+    {
+        ullSink += MakeSerialError(adwErrors[i % 4]).message().size();
+    }
+    dMessageNs = double(GetTimestampUs() - ullStartUs) * 1000.0 / dwCount;
+
+    printf("errors: %lu errors of 4 Win32 codes, %lu aborts seen\n", (unsigned long)dwCount, (unsigned long)dwAborted);
+    printf("  error_code   %10.1f ns per error, no allocation\n", dCodeNs);
+    printf("  CWin32Error  %10.1f ns per error, FormatMessage and a heap block each (%.0f times the error_code)\n", dWin32Ns,
+           (dCodeNs > 0.0) ? dWin32Ns / dCodeNs : 0.0);
+    printf("  message()    %10.1f ns per error, only when the text is asked for\n", dMessageNs);
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static void OnTransferData( BYTE * pData, DWORD dwLen )
+{
+    EnterCriticalSection(&transferRx.cs);
+    transferRx.queue.insert(transferRx.queue.end(), pData, pData + dwLen);
+    SetEvent(transferRx.hData);
+    LeaveCriticalSection(&transferRx.cs);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! next byte from the sender, -1 after dwTimeoutMs without one
+static int TransferRecvByte( DWORD dwTimeoutMs )
+{
+    ULONGLONG ullEndUs = GetTimestampUs() + (ULONGLONG)dwTimeoutMs * 1000;
+    ULONGLONG ullNowUs;
+    int c;
+
+    for (;;)
+    {
+        EnterCriticalSection(&transferRx.cs);
+        if (!transferRx.queue.empty())
+        {
+            c = transferRx.queue.front();
+            transferRx.queue.pop_front();
+            LeaveCriticalSection(&transferRx.cs);
+            return c;
+        }
+        ResetEvent(transferRx.hData);
+        LeaveCriticalSection(&transferRx.cs);
+
+        ullNowUs = GetTimestampUs();
+        if (ullNowUs >= ullEndUs)
+        {
+            return -1;
+        }
+        WaitForSingleObject(transferRx.hData, DWORD((ullEndUs - ullNowUs + 999) / 1000));
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! answer of the receiver, after the latency of the emulated link
+static void TransferReply( const BYTE * pData, DWORD dwLen )
+{
+    if (transferRx.dwLatencyMs != 0)
+    {
+        Sleep(transferRx.dwLatencyMs);
+    }
+
+    transferRx.pPort->Write((char *)pData, int(dwLen));
+    transferRx.dwReplyBytes += dwLen;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static void TransferReplyByte( BYTE b )
+{
+    TransferReply(&b, 1);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! CRC-16/XMODEM, the one of the XMODEM blocks and of the ZMODEM frames without CRC-32
+static WORD TransferCrc16( WORD wCrc, const BYTE * pData, DWORD dwLen )
+{
+    DWORD i;
+    int b;
+
+    for (i = 0; i < dwLen; i++)
+    {
+        wCrc ^= WORD(pData[i]) << 8;
+        for (b = 0; b < 8; b++)
+        {
+            wCrc = (wCrc & 0x8000) ? WORD((wCrc << 1) ^ 0x1021) : WORD(wCrc << 1);
+        }
+    }
+
+    return wCrc;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! rest of an XMODEM block after its SOH or STX, FALSE when it is late or damaged
+static BOOL TransferRecvBlock( DWORD dwBlockLen, BYTE * pbSeq, BYTE * pData )
+{
+    BYTE abHead[2];
+    BYTE abCrc[2];
+    DWORD i;
+    int c;
+
+    for (i = 0; i < dwBlockLen + 4; i++)
+    {
+        c = TransferRecvByte(BENCH_XFER_TIMEOUT_MS);
+        if (c < 0)
+        {
+            return FALSE;
+        }
+
+        if (i < 2)
+        {
+            abHead[i] = BYTE(c);
+        }
+        else if (i < dwBlockLen + 2)
+        {
+            pData[i - 2] = BYTE(c);
+        }
+        else
+        {
+            abCrc[i - dwBlockLen - 2] = BYTE(c);
+        }
+    }
+
+    *pbSeq = abHead[0];
+
+    return abHead[0] == BYTE(~abHead[1]) && TransferCrc16(0, pData, dwBlockLen) == ((WORD(abCrc[0]) << 8) | abCrc[1]);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! receiver of XMODEM-1K and YMODEM with CRC; the file keeps the padding of XMODEM, YMODEM cuts it to the size of the header
+static DWORD TransferRecvXmodem( BOOL bYmodem )
+{
+    BYTE abBlock[1024];
+    BYTE bNext = bYmodem ? 0 : 1;
+    BYTE bSeq;
+    DWORD dwBlockLen;
+    DWORD dwSize = 0;
+    DWORD dwTries = 0;
+    BOOL bStarted = FALSE;
+    BOOL bEot = FALSE;
+    int c;
+
+    // the sender may not listen yet, the first 'C' is repeated until a block comes
+    TransferReplyByte('C');
+
+    while (dwTries < BENCH_XFER_TRIES)
+    {
+        c = TransferRecvByte(bStarted ? BENCH_XFER_TIMEOUT_MS : BENCH_XFER_POLL_MS);
+        if (c < 0)
+        {
+            dwTries += bStarted ? 1 : 0;
+            TransferReplyByte(bStarted ? BENCH_X_NAK : 'C');
+            continue;
+        }
+
+        if (c == BENCH_X_EOT)
+        {
+            // YMODEM makes sure of the end with a NAK to the first EOT
+            if (bYmodem && !bEot)
+            {
+                bEot = TRUE;
+                TransferReplyByte(BENCH_X_NAK);
+                continue;
+            }
+            TransferReplyByte(BENCH_X_ACK);
+            break;
+        }
+
+        if (c != BENCH_X_SOH && c != BENCH_X_STX)
+        {
+            continue;
+        }
+
+        bStarted = TRUE;
+        dwBlockLen = (c == BENCH_X_STX) ? 1024 : 128;
+        if (!TransferRecvBlock(dwBlockLen, &bSeq, abBlock))
+        {
+            dwTries++;
+            TransferReplyByte(BENCH_X_NAK);
+            continue;
+        }
+        dwTries = 0;
+
+        // the YMODEM header: name, then the size in decimal; the data is asked for with a new 'C'
+        if (bYmodem && bNext == 0 && bSeq == 0)
+        {
+            dwSize = DWORD(atoi((const char *)abBlock + strlen((const char *)abBlock) + 1));
+            bNext = 1;
+            TransferReplyByte(BENCH_X_ACK);
+            TransferReplyByte('C');
+            continue;
+        }
+
+        // a block sent again because its ACK was late is acknowledged again
+        if (bSeq == bNext)
+        {
+            transferRx.file.insert(transferRx.file.end(), abBlock, abBlock + dwBlockLen);
+            bNext++;
+        }
+        TransferReplyByte(BENCH_X_ACK);
+    }
+
+    if (dwTries == BENCH_XFER_TRIES)
+    {
+        return ERROR_TIMEOUT;
+    }
+
+    if (bYmodem)
+    {
+        // the null header ends the batch
+        TransferReplyByte('C');
+        c = TransferRecvByte(BENCH_XFER_TIMEOUT_MS);
+        if (c != BENCH_X_SOH || !TransferRecvBlock(128, &bSeq, abBlock) || bSeq != 0 || abBlock[0] != 0)
+        {
+            return ERROR_INVALID_DATA;
+        }
+        TransferReplyByte(BENCH_X_ACK);
+
+        if (transferRx.file.size() > dwSize)
+        {
+            transferRx.file.resize(dwSize);
+        }
+    }
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! next byte of a ZMODEM frame with its escape undone, a frame end as 0x100 and the end, -1 on timeout
+static int TransferRecvZByte( void )
+{
+    int c;
+    int i;
+
+    for (i = 0; i < 2; i++)
+    {
+        // the flow control characters are never data, the sender escapes them
+        do
+        {
+            c = TransferRecvByte(BENCH_XFER_TIMEOUT_MS);
+        } while (c >= 0 && ((c & 0x7F) == 0x11 || (c & 0x7F) == 0x13));
+
+        if (c < 0 || (i == 0 && c != BENCH_Z_DLE))
+        {
+            return c;
+        }
+    }
+
+    if (c >= BENCH_Z_CRCE && c <= BENCH_Z_CRCW)
+    {
+        return 0x100 | c;
+    }
+
+    if (c == 'l' || c == 'm')
+    {
+        return (c == 'l') ? 0x7F : 0xFF;
+    }
+
+    return c ^ 0x40;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static int TransferHexValue( int c )
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+
+    return -1;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! next ZMODEM header, hex or binary with CRC-16: its type and position, -1 when it is late or damaged
+static int TransferRecvZHeader( DWORD * pdwPos )
+{
+    BYTE abFrame[7];
+    BOOL bPad = FALSE;
+    int iFormat = 0;
+    int c, hi, lo, i;
+
+    // what the sender writes between the headers ("rz", the line ends) is skipped
+    while (iFormat == 0)
+    {
+        c = TransferRecvByte(BENCH_XFER_TIMEOUT_MS);
+        if (c < 0)
+        {
+            return -1;
+        }
+
+        if (c == '*')
+        {
+            bPad = TRUE;
+            continue;
+        }
+
+        if (c == BENCH_Z_DLE && bPad)
+        {
+            c = TransferRecvByte(BENCH_XFER_TIMEOUT_MS);
+            if (c == 'A' || c == 'B')
+            {
+                iFormat = c;
+            }
+        }
+
+        bPad = FALSE;
+    }
+
+    for (i = 0; i < 7; i++)
+    {
+        if (iFormat == 'B')
+        {
+            hi = TransferHexValue(TransferRecvByte(BENCH_XFER_TIMEOUT_MS));
+            lo = TransferHexValue(TransferRecvByte(BENCH_XFER_TIMEOUT_MS));
+            c = (hi < 0 || lo < 0) ? -1 : (hi << 4) | lo;
+        }
+        else
+        {
+            c = TransferRecvZByte();
+        }
+
+        if (c < 0 || c > 0xFF)
+        {
+            return -1;
+        }
+        abFrame[i] = BYTE(c);
+    }
+
+    if (TransferCrc16(0, abFrame, 5) != ((WORD(abFrame[5]) << 8) | abFrame[6]))
+    {
+        return -1;
+    }
+
+    *pdwPos = DWORD(abFrame[1]) | (DWORD(abFrame[2]) << 8) | (DWORD(abFrame[3]) << 16) | (DWORD(abFrame[4]) << 24);
+
+    return abFrame[0];
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! one ZMODEM data subpacket appended to pData, returns its frame end, -1 (and nothing appended) when it is late or damaged
+static int TransferRecvZData( std::vector<BYTE> * pData )
+{
+    size_t nStart = pData->size();
+    BYTE abCrc[2];
+    BYTE bEnd;
+    WORD wCrc;
+    int c;
+    int i;
+
+    while ((c = TransferRecvZByte()) >= 0 && c <= 0xFF)
+    {
+        pData->push_back(BYTE(c));
+    }
+
+    bEnd = BYTE(c);
+    for (i = 0; c >= 0 && i < 2; i++)
+    {
+        c = TransferRecvZByte();
+        abCrc[i] = BYTE(c);
+    }
+
+    if (c >= 0 && c <= 0xFF)
+    {
+        wCrc = TransferCrc16(0, (pData->size() > nStart) ? &(*pData)[nStart] : NULL, DWORD(pData->size() - nStart));
+        if (TransferCrc16(wCrc, &bEnd, 1) == ((WORD(abCrc[0]) << 8) | abCrc[1]))
+        {
+            return bEnd;
+        }
+    }
+
+    pData->resize(nStart);
+
+    return -1;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! hex header of the receiver, positions are little endian
+static void TransferReplyZHeader( BYTE bType, DWORD dwPos )
+{
+    static const char cHex[] = "0123456789abcdef";
+    BYTE abFrame[7];
+    BYTE abOut[4 + 14 + 3];
+    DWORD dwLen = 0;
+    WORD wCrc;
+    int i;
+
+    abFrame[0] = bType;
+    for (i = 0; i < 4; i++)
+    {
+        abFrame[1 + i] = BYTE(dwPos >> (8 * i));
+    }
+    wCrc = TransferCrc16(0, abFrame, 5);
+    abFrame[5] = BYTE(wCrc >> 8);
+    abFrame[6] = BYTE(wCrc);
+
+    abOut[dwLen++] = '*';
+    abOut[dwLen++] = '*';
+    abOut[dwLen++] = BENCH_Z_DLE;
+    abOut[dwLen++] = 'B';
+    for (i = 0; i < 7; i++)
+    {
+        abOut[dwLen++] = cHex[abFrame[i] >> 4];
+        abOut[dwLen++] = cHex[abFrame[i] & 0x0F];
+    }
+    abOut[dwLen++] = '\r';
+    abOut[dwLen++] = 0x8A;
+    if (bType != BENCH_Z_ACK && bType != BENCH_Z_FIN)
+    {
+        abOut[dwLen++] = 0x11;
+    }
+
+    TransferReply(abOut, dwLen);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! receiver of ZMODEM with CRC-16 and no buffer limit, so the sender streams the file in a single frame
+static DWORD TransferRecvZmodem( void )
+{
+    std::vector<BYTE> info;
+    DWORD dwTries = 0;
+    DWORD dwPos;
+    BOOL bFile = FALSE;
+    int iType;
+    int iEnd;
+
+    while (dwTries < BENCH_XFER_TRIES)
+    {
+        iType = TransferRecvZHeader(&dwPos);
+        if (iType < 0)
+        {
+            // a lost header or a silent sender, it is asked for what is missing
+            dwTries++;
+            if (bFile)
+            {
+                TransferReplyZHeader(BENCH_Z_RPOS, DWORD(transferRx.file.size()));
+            }
+            continue;
+        }
+        dwTries = 0;
+
+        switch (iType)
+        {
+            case BENCH_Z_RQINIT:
+                TransferReplyZHeader(BENCH_Z_RINIT, 0);
+                break;
+
+            case BENCH_Z_FILE:
+                info.clear();
+                if (TransferRecvZData(&info) < 0)
+                {
+                    TransferReplyZHeader(BENCH_Z_NAK, 0);
+                    break;
+                }
+                bFile = TRUE;
+                TransferReplyZHeader(BENCH_Z_RPOS, DWORD(transferRx.file.size()));
+                break;
+
+            case BENCH_Z_DATA:
+                if (dwPos != transferRx.file.size())
+                {
+                    TransferReplyZHeader(BENCH_Z_RPOS, DWORD(transferRx.file.size()));
+                    break;
+                }
+
+                // ZCRCG streams on, ZCRCQ wants a ZACK, ZCRCW a ZACK and a new header, ZCRCE a new header
+                do
+                {
+                    iEnd = TransferRecvZData(&transferRx.file);
+                    if (iEnd == BENCH_Z_CRCQ || iEnd == BENCH_Z_CRCW)
+                    {
+                        TransferReplyZHeader(BENCH_Z_ACK, DWORD(transferRx.file.size()));
+                    }
+                } while (iEnd == BENCH_Z_CRCG || iEnd == BENCH_Z_CRCQ);
+
+                if (iEnd < 0)
+                {
+                    TransferReplyZHeader(BENCH_Z_RPOS, DWORD(transferRx.file.size()));
+                }
+                break;
+
+            case BENCH_Z_EOF:
+                if (dwPos == transferRx.file.size())
+                {
+                    TransferReplyZHeader(BENCH_Z_RINIT, 0);
+                }
+                break;
+
+            case BENCH_Z_FIN:
+                // the sender ends with "OO", it is not answered
+                TransferReplyZHeader(BENCH_Z_FIN, 0);
+                return ERROR_SUCCESS;
+        }
+    }
+
+    return ERROR_TIMEOUT;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static DWORD WINAPI TransferReceiverThread( LPVOID lpParam )
+{
+    if (transferRx.protocol == TRANSFER_ZMODEM)
+    {
+        transferRx.dwResult = TransferRecvZmodem();
+    }
+    else
+    {
+        transferRx.dwResult = TransferRecvXmodem(transferRx.protocol == TRANSFER_YMODEM);
+    }
+
+    return transferRx.dwResult;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! the file received matches the one sent, XMODEM pads the last block with SUB
+static BOOL TransferMatches( const std::vector<BYTE> * pSent )
+{
+    const std::vector<BYTE> * pReceived = &transferRx.file;
+    size_t i;
+
+    if (pReceived->size() < pSent->size() || (transferRx.protocol != TRANSFER_XMODEM_1K && pReceived->size() != pSent->size()))
+    {
+        return FALSE;
+    }
+
+    for (i = pSent->size(); i < pReceived->size(); i++)
+    {
+        if ((*pReceived)[i] != 0x1A)
+        {
+            return FALSE;
+        }
+    }
+
+    return pSent->empty() || memcmp(&(*pReceived)[0], &(*pSent)[0], pSent->size()) == 0;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static int BenchTransfer( int argc, char * argv[] )
+{
+    static const EnumSerialTransferProtocol aProtocols[] = { TRANSFER_XMODEM_1K, TRANSFER_YMODEM, TRANSFER_ZMODEM };
+    static const char * acProtocols[] = { "XMODEM-1K", "YMODEM", "ZMODEM" };
+    BENCH_LINK link;
+    SERIAL_TRANSFER_STATS stats;
+    CSerialFileTransfer * pTransfer;
+    std::vector<BYTE> sent;
+    char cTempPath[MAX_PATH];
+    char cPath[MAX_PATH];
+    DWORD dwSize = ((argc > 0) ? DWORD(atoi(argv[0])) : BENCH_XFER_SIZE_KB) * 1024;
+    DWORD dwLatencyMs = (argc > 1) ? DWORD(atoi(argv[1])) : 0;
+    const char * cRxDevice = (argc > 3) ? argv[2] : "mem://transfer";
+    const char * cTxDevice = (argc > 3) ? argv[3] : "mem://transfer";
+    int iBaudRate = (argc > 4) ? atoi(argv[4]) : CBR_115200;
+    ULONGLONG ullLineNs;
+    HANDLE hFile;
+    HANDLE hReceiver;
+    DWORD dwWritten;
+    DWORD dwResult;
+    DWORD dwCharNs;
+    BOOL bPaced;
+    BOOL bPass = TRUE;
+    DWORD i;
+
+    // every byte value, the ones ZMODEM escapes included
+    sent.resize(dwSize);
+    for (i = 0; i < dwSize; i++)
+    {
+        sent[i] = BYTE((i * 2654435761UL) >> 13);
+    }
+
+    if (GetTempPathA(sizeof(cTempPath), cTempPath) == 0 || GetTempFileNameA(cTempPath, "sxf", 0, cPath) == 0)
+    {
+        printf("transfer: no temporary file, %lu\n", (unsigned long)::GetLastError());
+        return 1;
+    }
+
+    hFile = CreateFileA(cPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE || !WriteFile(hFile, sent.empty() ? NULL : &sent[0], dwSize, &dwWritten, NULL))
+    {
+        printf("transfer: cannot write %s, %lu\n", cPath, (unsigned long)::GetLastError());
+        if (hFile != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(hFile);
+        }
+        DeleteFileA(cPath);
+        return 1;
+    }
+    CloseHandle(hFile);
+
+    link.pRx = new CSerial();
+    link.pTx = new CSerial();
+
+    if (OpenLink(&link, cRxDevice, cTxDevice, iBaudRate) != ERROR_SUCCESS)
+    {
+        delete link.pTx;
+        delete link.pRx;
+        DeleteFileA(cPath);
+        return 1;
+    }
+
+    InitializeCriticalSection(&transferRx.cs);
+    transferRx.hData = CreateEvent(NULL, TRUE, FALSE, NULL);
+    transferRx.pPort = link.pRx;
+    transferRx.dwLatencyMs = dwLatencyMs;
+    link.pRx->RegisterListenner(OnTransferData);
+
+    pTransfer = new CSerialFileTransfer(link.pTx);
+    pTransfer->SetTimeout(BENCH_XFER_TIMEOUT_MS);
+
+    // a mem:// link is not paced, the time on the line only means something on a real one
+    bPaced = (strstr(cTxDevice, "://") == NULL || _strnicmp(cTxDevice, "tty://", 6) == 0);
+    dwCharNs = link.pTx->GetCharTime();
+
+    printf("transfer: %lu KB file, %s to %s, %d bps, reply latency %lu ms\n", (unsigned long)(dwSize / 1024), cTxDevice, cRxDevice,
+           iBaudRate, (unsigned long)dwLatencyMs);
+
+    for (i = 0; i < sizeof(aProtocols) / sizeof(aProtocols[0]); i++)
+    {
+        // what the previous session left on the line is dropped
+        Sleep(200);
+        EnterCriticalSection(&transferRx.cs);
+        transferRx.queue.clear();
+        LeaveCriticalSection(&transferRx.cs);
+
+        transferRx.protocol = aProtocols[i];
+        transferRx.file.clear();
+        transferRx.dwReplyBytes = 0;
+        transferRx.dwResult = ERROR_IO_PENDING;
+
+        hReceiver = ::CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)TransferReceiverThread, NULL, 0, NULL);
+        if (hReceiver == NULL)
+        {
+            bPass = FALSE;
+            break;
+        }
+
+        dwResult = pTransfer->Send(cPath, aProtocols[i]);
+        pTransfer->GetStats(&stats);
+
+        WaitForSingleObject(hReceiver, BENCH_XFER_TRIES * BENCH_XFER_TIMEOUT_MS);
+        CloseHandle(hReceiver);
+
+        if (dwResult != ERROR_SUCCESS || transferRx.dwResult != ERROR_SUCCESS || !TransferMatches(&sent))
+        {
+            printf("  %-10s FAIL: sender %lu, receiver %lu, %lu of %lu bytes received\n", acProtocols[i], (unsigned long)dwResult,
+                   (unsigned long)transferRx.dwResult, (unsigned long)transferRx.file.size(), (unsigned long)dwSize);
+            bPass = FALSE;
+            continue;
+        }
+
+        // payload against the bytes written by both ends, and against the limit of the line
+        printf("  %-10s %8.0f bytes/s, efficiency %5.1f%% (%llu line bytes, %lu replied), %lu retries\n", acProtocols[i],
+               (stats.ullElapsedUs != 0) ? double(dwSize) * 1e6 / double(stats.ullElapsedUs) : 0.0,
+               100.0 * double(dwSize) / double(stats.ullLineBytes + transferRx.dwReplyBytes), stats.ullLineBytes,
+               (unsigned long)transferRx.dwReplyBytes, (unsigned long)stats.dwRetries);
+
+        if (bPaced && stats.ullElapsedUs != 0)
+        {
+            ullLineNs = stats.ullLineBytes * dwCharNs;
+            printf("  %-10s line busy %5.1f%% of the time, payload at %5.1f%% of the baud limit\n", "",
+                   double(ullLineNs) / 10.0 / double(stats.ullElapsedUs), double((ULONGLONG)dwSize * dwCharNs) / 10.0 / double(stats.ullElapsedUs));
+        }
+    }
+
+    delete pTransfer;
+    delete link.pTx;
+    delete link.pRx;
+
+    CloseHandle(transferRx.hData);
+    DeleteCriticalSection(&transferRx.cs);
+    DeleteFileA(cPath);
+
+    printf("  %s\n", bPass ? "PASS" : "FAIL");
+
+    return bPass ? 0 : 1;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! sink of the pipeline benchmark: counts the sentences, read by the main thread while the listener runs
+class CBenchNmeaSink
+{
+  public:
+    volatile DWORD dwFrames;
+    volatile DWORD dwBadFrames;
+    ULONGLONG ullBytes;
+
+    CBenchNmeaSink( ) : dwFrames(0), dwBadFrames(0), ullBytes(0)
+    {
+    }
+
+    void OnFrame( const BYTE * pFrame, DWORD dwLen, ULONGLONG ullTimestampUs )
+    {
+        ullBytes += dwLen;
+        dwFrames++;
+    }
+
+    void OnBadFrame( const BYTE * pFrame, DWORD dwLen, ULONGLONG ullTimestampUs )
+    {
+        dwBadFrames++;
+    }
+};
+
+typedef CSerialT<CSerialLineFramer<BENCH_PIPELINE_LINE>, CSerialNmeaChecksum, CBenchNmeaSink> CBenchNmeaPort;
+
+//! the pipeline of the port fed directly with the chunks a read would return
+class CBenchNmeaPipeline : public CBenchNmeaPort
+{
+  public:
+    void Feed( const BYTE * pData, DWORD dwLen )
+    {
+        Process(pData, dwLen, 0);
+    }
+};
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static void OnNmeaSentence( const BYTE * pSentence, DWORD dwLen )
+{
+    nmeaRx.ullBytes += dwLen;
+    nmeaRx.dwFrames++;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! checksum of a sentence $...*hh, one byte at a time
+static BOOL NmeaSentenceValid( const BYTE * pLine, DWORD dwLen )
+{
+    static const char acHex[] = "0123456789ABCDEF";
+    BYTE bXor = 0;
+    DWORD i;
+
+    if (dwLen < 4 || (pLine[0] != '$' && pLine[0] != '!') || pLine[dwLen - 3] != '*')
+    {
+        return FALSE;
+    }
+
+    for (i = 1; i < dwLen - 3; i++)
+    {
+        bXor ^= pLine[i];
+    }
+
+    return pLine[dwLen - 2] == acHex[bXor >> 4] && pLine[dwLen - 1] == acHex[bXor & 0x0F];
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! the callback path: the same framing and checksum as the pipeline, byte by byte, and each
+//!   sentence handed on through a function pointer
+static void OnNmeaData( BYTE * pData, DWORD dwLen )
+{
+    DWORD dwLine;
+    DWORD i;
+
+    for (i = 0; i < dwLen; i++)
+    {
+        if (pData[i] != '\n')
+        {
+            if (nmeaRx.dwLineLen + 1 >= BENCH_PIPELINE_LINE)
+            {
+                nmeaRx.bOverrun = TRUE;
+                nmeaRx.dwLineLen = 0;
+            }
+            else if (!nmeaRx.bOverrun)
+            {
+                nmeaRx.abLine[nmeaRx.dwLineLen++] = pData[i];
+            }
+            continue;
+        }
+
+        dwLine = nmeaRx.dwLineLen;
+        if (dwLine > 0 && nmeaRx.abLine[dwLine - 1] == '\r')
+        {
+            dwLine--;
+        }
+
+        if (!nmeaRx.bOverrun && dwLine > 0)
+        {
+            if (NmeaSentenceValid(nmeaRx.abLine, dwLine))
+            {
+                nmeaRx.pfnSentence(nmeaRx.abLine, dwLine - 3);
+            }
+            else
+            {
+                nmeaRx.dwBadFrames++;
+            }
+        }
+
+        nmeaRx.bOverrun = FALSE;
+        nmeaRx.dwLineLen = 0;
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! the sentences of the pipeline benchmark, every BENCH_PIPELINE_BAD_EVERY-th with a wrong checksum
+static void BuildNmeaStream( DWORD dwSentences, std::vector<BYTE> * pStream )
+{
+    static const char acHex[] = "0123456789ABCDEF";
+    char acSentence[BENCH_PIPELINE_LINE];
+    BYTE bXor;
+    int iLen;
+    int j;
+    DWORD i;
+
+    pStream->clear();
+
+    for (i = 0; i < dwSentences; i++)
+    {
+        iLen = _snprintf(acSentence, sizeof(acSentence) - 5, "$GPGGA,%02lu%02lu%02lu.%02lu,4807.%03lu,N,01131.%03lu,E,1,%02lu,0.9,545.4,M,46.9,M,,",
+                         (unsigned long)(i / 360000 % 24), (unsigned long)(i / 6000 % 60), (unsigned long)(i / 100 % 60),
+                         (unsigned long)(i % 100), (unsigned long)(i % 1000), (unsigned long)(i * 7 % 1000), (unsigned long)(4 + i % 9));
+
+        bXor = 0;
+        for (j = 1; j < iLen; j++)
+        {
+            bXor ^= BYTE(acSentence[j]);
+        }
+        if (i % BENCH_PIPELINE_BAD_EVERY == BENCH_PIPELINE_BAD_EVERY - 1)
+        {
+            bXor ^= 0x01;
+        }
+
+        acSentence[iLen++] = '*';
+        acSentence[iLen++] = acHex[bXor >> 4];
+        acSentence[iLen++] = acHex[bXor & 0x0F];
+        acSentence[iLen++] = '\r';
+        acSentence[iLen++] = '\n';
+
+        pStream->insert(pStream->end(), (const BYTE*)acSentence, (const BYTE*)acSentence + iLen);
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! writes the stream and waits for the receiver to count every sentence, good or bad; returns the
+//!   milliseconds it took, 0 on a timeout
+static double RunNmeaLink( CSerial * pTx, std::vector<BYTE> & stream, DWORD dwSentences, volatile DWORD * pdwFrames,
+                           volatile DWORD * pdwBadFrames )
+{
+    ULONGLONG ullStartUs = GetTimestampUs();
+    DWORD dwOffset;
+    DWORD dwLen;
+
+    for (dwOffset = 0; dwOffset < stream.size(); dwOffset += dwLen)
+    {
+        dwLen = std::min<DWORD>(DWORD(stream.size()) - dwOffset, BENCH_PIPELINE_CHUNK);
+        pTx->Write((char *)&stream[dwOffset], int(dwLen));
+    }
+
+    while (*pdwFrames + *pdwBadFrames < dwSentences)
+    {
+        if (GetTimestampUs() - ullStartUs > ULONGLONG(BENCH_PIPELINE_TIMEOUT_MS) * 1000)
+        {
+            return 0.0;
+        }
+        Sleep(1);
+    }
+
+    return double(GetTimestampUs() - ullStartUs) / 1000.0;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static int BenchPipeline( int argc, char * argv[] )
+{
+    DWORD dwSentences = (argc > 0) ? DWORD(atoi(argv[0])) : BENCH_PIPELINE_SENTENCES;
+    const char * cRxDevice = (argc > 2) ? argv[1] : "mem://pipeline";
+    const char * cTxDevice = (argc > 2) ? argv[2] : "mem://pipeline";
+    SERIAL_PORT_CALLBACK volatile pfnData = OnNmeaData;
+    std::vector<BYTE> stream;
+    CBenchNmeaPipeline * pPipeline;
+    CBenchNmeaPort * pPort;
+    BENCH_LINK link;
+    ULONGLONG ullStartUs;
+    DWORD dwGood;
+    DWORD dwOffset;
+    DWORD dwLen;
+    DWORD dwRound;
+    double dTemplateNs;
+    double dCallbackNs;
+    double dTemplateMs;
+    double dCallbackMs;
+    BOOL bPass = TRUE;
+
+    if (dwSentences == 0)
+    {
+        dwSentences = BENCH_PIPELINE_SENTENCES;
+    }
+
+    BuildNmeaStream(dwSentences, &stream);
+    dwGood = dwSentences - dwSentences / BENCH_PIPELINE_BAD_EVERY;
+
+    printf("pipeline: %lu NMEA sentences (%lu KB), one in %d with a wrong checksum, in reads of %d bytes\n", (unsigned long)dwSentences,
+           (unsigned long)(stream.size() / 1024), BENCH_PIPELINE_BAD_EVERY, BENCH_PIPELINE_CHUNK);
+
+    // the work of the listener alone: the chunks of the stream through each path, no I/O
+    pPipeline = new CBenchNmeaPipeline();
+    ullStartUs = GetTimestampUs();
+    for (dwRound = 0; dwRound < BENCH_PIPELINE_ROUNDS; dwRound++)
+    {
+        for (dwOffset = 0; dwOffset < stream.size(); dwOffset += dwLen)
+        {
+            dwLen = std::min<DWORD>(DWORD(stream.size()) - dwOffset, BENCH_PIPELINE_CHUNK);
+            pPipeline->Feed(&stream[dwOffset], dwLen);
+        }
+    }
+    dTemplateNs = double(GetTimestampUs() - ullStartUs) * 1000.0 / (double(dwSentences) * BENCH_PIPELINE_ROUNDS);
+
+    memset(&nmeaRx, 0, sizeof(nmeaRx));
+    nmeaRx.pfnSentence = OnNmeaSentence;
+    ullStartUs = GetTimestampUs();
+    for (dwRound = 0; dwRound < BENCH_PIPELINE_ROUNDS; dwRound++)
+    {
+        for (dwOffset = 0; dwOffset < stream.size(); dwOffset += dwLen)
+        {
+            dwLen = std::min<DWORD>(DWORD(stream.size()) - dwOffset, BENCH_PIPELINE_CHUNK);
+            pfnData(&stream[dwOffset], dwLen);
+        }
+    }
+    dCallbackNs = double(GetTimestampUs() - ullStartUs) * 1000.0 / (double(dwSentences) * BENCH_PIPELINE_ROUNDS);
+
+    // both paths must see the same sentences
+    if (pPipeline->GetSink().dwFrames != dwGood * BENCH_PIPELINE_ROUNDS || nmeaRx.dwFrames != dwGood * BENCH_PIPELINE_ROUNDS ||
+        pPipeline->GetSink().ullBytes != nmeaRx.ullBytes)
+    {
+        printf("  in process: CSerialT %lu sentences, callback %lu, %lu expected\n", (unsigned long)pPipeline->GetSink().dwFrames,
+               (unsigned long)nmeaRx.dwFrames, (unsigned long)(dwGood * BENCH_PIPELINE_ROUNDS));
+        bPass = FALSE;
+    }
+    delete pPipeline;
+
+    printf("  in process, %d rounds:\n", BENCH_PIPELINE_ROUNDS);
+    printf("    CSerialT    %8.1f ns per sentence, %8.0f sentences/s\n", dTemplateNs, (dTemplateNs > 0.0) ? 1e9 / dTemplateNs : 0.0);
+    printf("    callback    %8.1f ns per sentence, %8.0f sentences/s (%.2f times the CSerialT)\n", dCallbackNs,
+           (dCallbackNs > 0.0) ? 1e9 / dCallbackNs : 0.0, (dTemplateNs > 0.0) ? dCallbackNs / dTemplateNs : 0.0);
+
+    // the same stream over the link, received by each kind of port
+    pPort = new CBenchNmeaPort();
+    link.pRx = pPort;
+    link.pTx = new CSerial();
+    dTemplateMs = 0.0;
+    if (OpenLink(&link, cRxDevice, cTxDevice, CBR_115200) == ERROR_SUCCESS)
+    {
+        dTemplateMs = RunNmeaLink(link.pTx, stream, dwSentences, &pPort->GetSink().dwFrames, &pPort->GetSink().dwBadFrames);
+        if (pPort->GetSink().dwFrames != dwGood)
+        {
+            bPass = FALSE;
+        }
+    }
+    delete link.pTx;
+    delete link.pRx;
+
+    memset(&nmeaRx, 0, sizeof(nmeaRx));
+    nmeaRx.pfnSentence = OnNmeaSentence;
+    link.pRx = new CSerial();
+    link.pTx = new CSerial();
+    dCallbackMs = 0.0;
+    if (OpenLink(&link, cRxDevice, cTxDevice, CBR_115200) == ERROR_SUCCESS)
+    {
+        link.pRx->RegisterListenner(OnNmeaData);
+        dCallbackMs = RunNmeaLink(link.pTx, stream, dwSentences, &nmeaRx.dwFrames, &nmeaRx.dwBadFrames);
+        if (nmeaRx.dwFrames != dwGood)
+        {
+            bPass = FALSE;
+        }
+    }
+    delete link.pTx;
+    delete link.pRx;
+
+    bPass = bPass && dTemplateMs > 0.0 && dCallbackMs > 0.0;
+
+    printf("  %s to %s:\n", cTxDevice, cRxDevice);
+    printf("    CSerialT    %8.1f ms\n", dTemplateMs);
+    printf("    callback    %8.1f ms\n", dCallbackMs);
+    printf("  %s\n", bPass ? "PASS" : "FAIL");
+
+    return bPass ? 0 : 1;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! level of the line of the stand-in device at a bit, 0 or 1: the sample sent over and over, each line
+//!   followed by an idle time
+static int Rfc2217LineLevel( const BENCH_RFC2217 * pServer, ULONGLONG ullBit )
+{
+    DWORD dwCharBits = 1 + DWORD(pServer->iByteSize) + ((pServer->iParity != NOPARITY) ? 1 : 0) + 1;
+    DWORD dwSlots = pServer->dwSampleLen + BENCH_RFC2217_IDLE;
+    DWORD dwSlot = DWORD((ullBit / dwCharBits) % dwSlots);
+    DWORD dwBit = DWORD(ullBit % dwCharBits);
+    BYTE bMask = BYTE((1 << pServer->iByteSize) - 1);
+    BYTE c;
+    BYTE bOnes;
+
+    if (pServer->pcSample == NULL)
+    {
+        return (ullBit >= pServer->ullTxBase && ullBit - pServer->ullTxBase < pServer->txBits.size()) ?
+               pServer->txBits[size_t(ullBit - pServer->ullTxBase)] : 1;
+    }
+
+    if (dwSlot >= pServer->dwSampleLen)
+    {
+        return 1;
+    }
+
+    c = BYTE(pServer->pcSample[dwSlot]) & bMask;
+
+    if (dwBit == 0)
+    {
+        return 0;
+    }
+    if (dwBit <= DWORD(pServer->iByteSize))
+    {
+        return (c >> (dwBit - 1)) & 1;
+    }
+    if (dwBit == DWORD(pServer->iByteSize) + 1 && pServer->iParity != NOPARITY)
+    {
+        for (bOnes = 0; c != 0; c >>= 1)
+        {
+            bOnes ^= c & 1;
+        }
+        return (pServer->iParity == ODDPARITY) ? !bOnes : bOnes;
+    }
+
+    return 1;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! the characters the UART set by the client reads from the line up to a bit, into out; returns the
+//!   NOTIFY-LINESTATE bits of their errors
+static BYTE Rfc2217ReadLine( BENCH_RFC2217 * pServer, ULONGLONG ullNowBit, std::vector<BYTE> * pOut )
+{
+    double dRatio = double(pServer->iBaudRate) / double(pServer->dwRxBaudRate);
+    DWORD dwBits = DWORD(pServer->iRxByteSize) + ((pServer->iRxParity != NOPARITY) ? 1 : 0) + 1;
+    ULONGLONG ullStop;
+    BYTE bLineState = 0;
+    BYTE bData;
+    BYTE bOnes;
+    BOOL bZero;
+    int iLevel;
+    DWORD j;
+
+    for (;;)
+    {
+        // a character starts at a falling edge, searched for from the end of the previous one
+        while (pServer->ullSearchBit < ullNowBit &&
+               !(Rfc2217LineLevel(pServer, pServer->ullSearchBit) == 0 &&
+                 (pServer->ullSearchBit == 0 || Rfc2217LineLevel(pServer, pServer->ullSearchBit - 1) == 1)))
+        {
+            pServer->ullSearchBit++;
+        }
+
+        // each bit is sampled in its middle, at the rate of the UART
+        ullStop = pServer->ullSearchBit + ULONGLONG((dwBits + 0.5) * dRatio);
+        if (ullStop >= ullNowBit)
+        {
+            return bLineState;
+        }
+
+        bData = 0;
+        bOnes = 0;
+        bZero = TRUE;
+        for (j = 1; j <= dwBits; j++)
+        {
+            iLevel = Rfc2217LineLevel(pServer, pServer->ullSearchBit + ULONGLONG((j + 0.5) * dRatio));
+            bZero = bZero && iLevel == 0;
+
+            if (j <= DWORD(pServer->iRxByteSize))
+            {
+                bData |= BYTE(iLevel << (j - 1));
+                bOnes ^= BYTE(iLevel);
+            }
+            else if (j < dwBits)
+            {
+                // the parity bit
+                if (BYTE(iLevel) != ((pServer->iRxParity == ODDPARITY) ? BYTE(!bOnes) : bOnes))
+                {
+                    bLineState |= 0x04;
+                }
+            }
+            else if (iLevel == 0)
+            {
+                // no stop bit: a break when the whole character was low
+                bLineState |= bZero ? 0x10 : 0x08;
+            }
+        }
+
+        // the driver keeps the characters of a framing or a parity error
+        if (bData == BENCH_T_IAC)
+        {
+            pOut->push_back(BENCH_T_IAC);
+        }
+        pOut->push_back(bData);
+
+        pServer->ullSearchBit = ullStop + 1;
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! a character on a line: start bit, data bits, parity bit and stop bit
+static void Rfc2217PutChar( std::vector<BYTE> * pBits, BYTE c, int iByteSize, int iParity )
+{
+    BYTE bOnes = 0;
+    int i;
+
+    pBits->push_back(0);
+    for (i = 0; i < iByteSize; i++)
+    {
+        pBits->push_back((c >> i) & 1);
+        bOnes ^= (c >> i) & 1;
+    }
+    if (iParity != NOPARITY)
+    {
+        pBits->push_back((iParity == ODDPARITY) ? BYTE(!bOnes) : bOnes);
+    }
+    pBits->push_back(1);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! the echo device: reads the line from the client with its UART, parity checked as with fParity,
+//!   and sends each character back from now on. Both UARTs run at the same rate, the line from the
+//!   client is taken back to back.
+static void Rfc2217Echo( BENCH_RFC2217 * pServer, ULONGLONG ullNowBit )
+{
+    DWORD dwCharBits = 1 + DWORD(pServer->iByteSize) + ((pServer->iParity != NOPARITY) ? 1 : 0) + 1;
+    const BYTE * pBits;
+    BYTE bData;
+    BYTE bOnes;
+    BOOL bError;
+    int i;
+
+    while (pServer->dwRxBitPos + dwCharBits <= pServer->rxBits.size())
+    {
+        pBits = &pServer->rxBits[pServer->dwRxBitPos];
+
+        // idle, waiting for a start bit
+        if (pBits[0] != 0)
+        {
+            pServer->dwRxBitPos++;
+            continue;
+        }
+
+        bData = 0;
+        bOnes = 0;
+        for (i = 0; i < pServer->iByteSize; i++)
+        {
+            bData |= BYTE(pBits[1 + i] << i);
+            bOnes ^= pBits[1 + i];
+        }
+
+        bError = pBits[dwCharBits - 1] != 1;
+        if (pServer->iParity != NOPARITY)
+        {
+            bError = bError || pBits[1 + pServer->iByteSize] != ((pServer->iParity == ODDPARITY) ? BYTE(!bOnes) : bOnes);
+        }
+
+        pServer->dwRxBitPos += dwCharBits;
+        pServer->dwDeviceErrors += bError ? 1 : 0;
+        pServer->dwDeviceChars++;
+
+        if (pServer->txBits.empty())
+        {
+            pServer->ullTxBase = ullNowBit;
+        }
+        else if (pServer->ullTxBase + pServer->txBits.size() < ullNowBit)
+        {
+            pServer->txBits.resize(size_t(ullNowBit - pServer->ullTxBase), 1);
+        }
+        Rfc2217PutChar(&pServer->txBits, bData, pServer->iByteSize, pServer->iParity);
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! a COM-PORT-OPTION command of the client: the settings of its UART, which restarts
+static void Rfc2217Command( BENCH_RFC2217 * pServer, ULONGLONG ullNowBit )
+{
+    if (pServer->dwSbLen < 3 || pServer->abSb[0] != BENCH_T_COM_PORT)
+    {
+        return;
+    }
+
+    switch (pServer->abSb[1])
+    {
+        case BENCH_T_SET_BAUDRATE:
+            if (pServer->dwSbLen >= 6)
+            {
+                pServer->dwRxBaudRate = (DWORD(pServer->abSb[2]) << 24) | (DWORD(pServer->abSb[3]) << 16) |
+                                        (DWORD(pServer->abSb[4]) << 8) | DWORD(pServer->abSb[5]);
+            }
+            break;
+
+        case BENCH_T_SET_DATASIZE:
+            pServer->iRxByteSize = pServer->abSb[2];
+            break;
+
+        case BENCH_T_SET_PARITY:
+            // NONE, ODD and EVEN are 1 to 3
+            pServer->iRxParity = pServer->abSb[2] - 1;
+            break;
+
+        default:
+            return;
+    }
+
+    pServer->ullSearchBit = ullNowBit;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! the telnet stream of the client: data for the device, put on its line for an echo device and
+//!   dropped otherwise, and the commands
+static void Rfc2217Receive( BENCH_RFC2217 * pServer, const BYTE * pData, DWORD dwLen, ULONGLONG ullNowBit )
+{
+    BOOL bData;
+    BYTE b;
+    DWORD i;
+
+    for (i = 0; i < dwLen; i++)
+    {
+        b = pData[i];
+        bData = FALSE;
+
+        switch (pServer->iTelnetState)
+        {
+            case BENCH_T_STATE_DATA:
+                pServer->iTelnetState = (b == BENCH_T_IAC) ? BENCH_T_STATE_IAC : BENCH_T_STATE_DATA;
+                bData = (b != BENCH_T_IAC);
+                break;
+
+            case BENCH_T_STATE_IAC:
+                pServer->iTelnetState = BENCH_T_STATE_DATA;
+                bData = (b == BENCH_T_IAC);
+                if (b == BENCH_T_SB)
+                {
+                    pServer->dwSbLen = 0;
+                    pServer->iTelnetState = BENCH_T_STATE_SB;
+                }
+                else if (b >= BENCH_T_WILL && b <= BENCH_T_DONT)
+                {
+                    pServer->iTelnetState = BENCH_T_STATE_OPTION;
+                }
+                break;
+
+            case BENCH_T_STATE_OPTION:
+                // the options of the client are taken silently
+                pServer->iTelnetState = BENCH_T_STATE_DATA;
+                break;
+
+            case BENCH_T_STATE_SB:
+                if (b == BENCH_T_IAC)
+                {
+                    pServer->iTelnetState = BENCH_T_STATE_SB_IAC;
+                }
+                else if (pServer->dwSbLen < sizeof(pServer->abSb))
+                {
+                    pServer->abSb[pServer->dwSbLen++] = b;
+                }
+                break;
+
+            case BENCH_T_STATE_SB_IAC:
+                if (b == BENCH_T_SE)
+                {
+                    pServer->iTelnetState = BENCH_T_STATE_DATA;
+                    Rfc2217Command(pServer, ullNowBit);
+                }
+                else
+                {
+                    pServer->iTelnetState = BENCH_T_STATE_SB;
+                    if (pServer->dwSbLen < sizeof(pServer->abSb))
+                    {
+                        pServer->abSb[pServer->dwSbLen++] = b;
+                    }
+                }
+                break;
+        }
+
+        if (bData && pServer->pcSample == NULL)
+        {
+            Rfc2217PutChar(&pServer->rxBits, b, pServer->iRxByteSize, pServer->iRxParity);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static DWORD WINAPI Rfc2217Thread( LPVOID lpParam )
+{
+    BENCH_RFC2217 * pServer = (BENCH_RFC2217 *)lpParam;
+    std::vector<BYTE> out;
+    BYTE abNotify[] = { BENCH_T_IAC, BENCH_T_SB, BENCH_T_COM_PORT, BENCH_T_NOTIFY_LINESTATE, 0, BENCH_T_IAC, BENCH_T_SE };
+    BYTE abBuffer[256];
+    ULONGLONG ullStartUs;
+    ULONGLONG ullNowBit;
+    u_long ulNonBlocking = 1;
+    BOOL bNoDelay = TRUE;
+    int iRecv;
+
+    pServer->s = accept(pServer->sListen, NULL, NULL);
+    if (pServer->s == INVALID_SOCKET)
+    {
+        return 1;
+    }
+    setsockopt(pServer->s, IPPROTO_TCP, TCP_NODELAY, (const char*)&bNoDelay, sizeof(bNoDelay));
+    ioctlsocket(pServer->s, FIONBIO, &ulNonBlocking);
+
+    // the device sends from the start, paced by the millisecond as the line would
+    ullStartUs = GetTimestampUs();
+    while (!pServer->bStop)
+    {
+        ullNowBit = (GetTimestampUs() - ullStartUs) * ULONGLONG(pServer->iBaudRate) / 1000000;
+
+        while ((iRecv = recv(pServer->s, (char *)abBuffer, sizeof(abBuffer), 0)) > 0)
+        {
+            Rfc2217Receive(pServer, abBuffer, DWORD(iRecv), ullNowBit);
+        }
+        Rfc2217Echo(pServer, ullNowBit);
+        if (iRecv == 0)
+        {
+            break;
+        }
+
+        if (pServer->dwRxBaudRate != 0)
+        {
+            out.clear();
+            abNotify[4] = Rfc2217ReadLine(pServer, ullNowBit, &out);
+            if (!out.empty())
+            {
+                send(pServer->s, (const char *)&out[0], int(out.size()), 0);
+            }
+            if (abNotify[4] != 0)
+            {
+                send(pServer->s, (const char *)abNotify, sizeof(abNotify), 0);
+            }
+        }
+
+        Sleep(1);
+    }
+
+    closesocket(pServer->s);
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! a listening socket on a free loopback port, WSACleanup is left to the caller once it is closed
+static DWORD ListenLoopback( SOCKET * psListen, unsigned int * puPort )
+{
+    WSADATA wsaData;
+    struct sockaddr_in addr;
+    int iLen = sizeof(addr);
+    DWORD dwError;
+
+    WSAStartup(MAKEWORD(2, 2), &wsaData);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = 0;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    *psListen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (*psListen == INVALID_SOCKET || bind(*psListen, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(*psListen, 1) != 0 || getsockname(*psListen, (struct sockaddr *)&addr, &iLen) != 0)
+    {
+        dwError = DWORD(WSAGetLastError());
+        if (*psListen != INVALID_SOCKET)
+        {
+            closesocket(*psListen);
+        }
+        WSACleanup();
+        return dwError;
+    }
+
+    *puPort = ntohs(addr.sin_port);
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! starts the stand-in of a terminal server on a loopback port, with the device in the given format;
+//!   without a sample the device echoes what it reads
+static DWORD StartRfc2217( BENCH_RFC2217 * pServer, const char * pcSample, int iBaudRate, int iByteSize, int iParity )
+{
+    unsigned int uPort;
+    DWORD dwError;
+
+    pServer->s = INVALID_SOCKET;
+    pServer->hThread = NULL;
+    pServer->bStop = FALSE;
+    pServer->pcSample = pcSample;
+    pServer->dwSampleLen = (pcSample != NULL) ? DWORD(strlen(pcSample)) : 0;
+    pServer->iBaudRate = iBaudRate;
+    pServer->iByteSize = iByteSize;
+    pServer->iParity = iParity;
+    pServer->dwRxBaudRate = 0;
+    pServer->iRxByteSize = 8;
+    pServer->iRxParity = NOPARITY;
+    pServer->ullSearchBit = 0;
+    pServer->iTelnetState = BENCH_T_STATE_DATA;
+    pServer->dwSbLen = 0;
+    pServer->rxBits.clear();
+    pServer->dwRxBitPos = 0;
+    pServer->txBits.clear();
+    pServer->ullTxBase = 0;
+    pServer->dwDeviceChars = 0;
+    pServer->dwDeviceErrors = 0;
+
+    dwError = ListenLoopback(&pServer->sListen, &uPort);
+    if (dwError != ERROR_SUCCESS)
+    {
+        return dwError;
+    }
+
+    _snprintf(pServer->cDevice, sizeof(pServer->cDevice) - 1, "rfc2217://127.0.0.1:%u", uPort);
+
+    pServer->hThread = ::CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)Rfc2217Thread, pServer, 0, NULL);
+    if (pServer->hThread == NULL)
+    {
+        closesocket(pServer->sListen);
+        WSACleanup();
+        return ::GetLastError();
+    }
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! stops the stand-in, closing the listening socket ends an accept still waiting
+static void StopRfc2217( BENCH_RFC2217 * pServer )
+{
+    pServer->bStop = TRUE;
+    closesocket(pServer->sListen);
+    WaitForSingleObject(pServer->hThread, INFINITE);
+    CloseHandle(pServer->hThread);
+    WSACleanup();
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static int BenchAutoBaud( int argc, char * argv[] )
+{
+    static const SERIAL_LINE_FORMAT aCases[] =
+    {
+        { CBR_9600, 8, NOPARITY, ONESTOPBIT },
+        { CBR_115200, 8, NOPARITY, ONESTOPBIT },
+        { CBR_2400, 8, NOPARITY, ONESTOPBIT },
+        { CBR_19200, 7, EVENPARITY, ONESTOPBIT },
+        { CBR_4800, 7, ODDPARITY, ONESTOPBIT },
+        { CBR_57600, 8, EVENPARITY, ONESTOPBIT },
+        { CBR_38400, 8, ODDPARITY, ONESTOPBIT },
+    };
+    static const char acFormat[] = "NOE";
+    static const char cSample[] = "$GPRMC,123519,A,4807.038,N,01131.000,E,022.4,084.4,230394,003.1,W*6A\r\n"
+                                  "$GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,*47\r\n";
+    DWORD dwBudgetMs = (argc > 0) ? DWORD(atoi(argv[0])) : BENCH_AUTOBAUD_BUDGET_MS;
+    BENCH_RFC2217 server;
+    SERIAL_LINE_FORMAT found;
+    ULONGLONG ullStartUs;
+    CSerial * pSerial;
+    CSerialAutoBaud * pAutoBaud;
+    BOOL bMatch;
+    BOOL bPass = TRUE;
+    DWORD dwError;
+    DWORD i;
+
+    if (dwBudgetMs == 0)
+    {
+        dwBudgetMs = BENCH_AUTOBAUD_BUDGET_MS;
+    }
+
+    printf("autobaud: %d devices behind an RFC 2217 stand-in, %lu ms allowed to each detection\n",
+           int(sizeof(aCases) / sizeof(aCases[0])), (unsigned long)dwBudgetMs);
+
+    for (i = 0; i < sizeof(aCases) / sizeof(aCases[0]); i++)
+    {
+        dwError = StartRfc2217(&server, cSample, aCases[i].iBaudRate, aCases[i].iByteSize, aCases[i].iParity);
+        if (dwError != ERROR_SUCCESS)
+        {
+            printf("  cannot start the stand-in: %lu\n", (unsigned long)dwError);
+            return 1;
+        }
+
+        // the port starts at a rate the device does not use
+        pSerial = new CSerial();
+        dwError = DWORD(pSerial->Open(server.cDevice, CBR_1200, 8, NOPARITY, ONESTOPBIT));
+        memset(&found, 0, sizeof(found));
+        ullStartUs = GetTimestampUs();
+        if (dwError == ERROR_SUCCESS)
+        {
+            pAutoBaud = new CSerialAutoBaud(pSerial);
+            dwError = pAutoBaud->Detect(&found, dwBudgetMs);
+            delete pAutoBaud;
+        }
+
+        bMatch = dwError == ERROR_SUCCESS && found.iBaudRate == aCases[i].iBaudRate && found.iByteSize == aCases[i].iByteSize &&
+                 found.iParity == aCases[i].iParity && found.iStopBits == ONESTOPBIT;
+        bPass = bPass && bMatch;
+
+        printf("  %6d %d%c1: ", aCases[i].iBaudRate, aCases[i].iByteSize, acFormat[aCases[i].iParity]);
+        if (dwError == ERROR_SUCCESS)
+        {
+            printf("%6d %d%c%d in %5.0f ms  %s\n", found.iBaudRate, found.iByteSize, acFormat[found.iParity % 3],
+                   (found.iStopBits == TWOSTOPBITS) ? 2 : 1, double(GetTimestampUs() - ullStartUs) / 1000.0, bMatch ? "ok" : "wrong");
+        }
+        else
+        {
+            printf("error %lu\n", (unsigned long)dwError);
+        }
+
+        delete pSerial;
+        StopRfc2217(&server);
+    }
+
+    printf("  %s\n", bPass ? "PASS" : "FAIL");
+
+    return bPass ? 0 : 1;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! one run of the open benchmark: every port opened by OpenSerialPorts, then closed; returns the
+//!   milliseconds the opening took, 0 when a port failed
+static double RunOpen( std::vector<SERIAL_OPEN_REQUEST> * pRequests, DWORD dwParallelism, double * pdOpenUs )
+{
+    ULONGLONG ullStartUs;
+    ULONGLONG ullOpenUs = 0;
+    double dMs;
+    DWORD dwError;
+    size_t i;
+
+    ullStartUs = GetTimestampUs();
+    dwError = OpenSerialPorts(&(*pRequests)[0], DWORD(pRequests->size()), dwParallelism);
+    dMs = double(GetTimestampUs() - ullStartUs) / 1000.0;
+
+    for (i = 0; i < pRequests->size(); i++)
+    {
+        ullOpenUs += (*pRequests)[i].dwOpenUs;
+        (*pRequests)[i].pSerial->Close();
+    }
+    *pdOpenUs = double(ullOpenUs) / double(pRequests->size());
+
+    if (dwError != ERROR_SUCCESS)
+    {
+        printf("  cannot open the ports: %lu\n", (unsigned long)dwError);
+        return 0.0;
+    }
+
+    return dMs;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static int BenchOpen( int argc, char * argv[] )
+{
+    DWORD dwPorts = (argc > 0) ? DWORD(atoi(argv[0])) : BENCH_OPEN_PORTS;
+    DWORD dwParallelism = (argc > 1) ? DWORD(atoi(argv[1])) : BENCH_OPEN_PARALLELISM;
+    const char * cFormat = (argc > 2) ? argv[2] : "mem://open-%lu";
+    std::vector<SERIAL_OPEN_REQUEST> requests;
+    std::vector<std::string> devices;
+    char cDevice[MAX_PATH];
+    double dSequentialMs = 0.0;
+    double dBulkMs = 0.0;
+    double dSequentialUs = 0.0;
+    double dBulkUs = 0.0;
+    double dMs;
+    double dOpenUs;
+    BOOL bPass = TRUE;
+    DWORD dwRound;
+    DWORD i;
+
+    dwPorts = (dwPorts > 0) ? dwPorts : BENCH_OPEN_PORTS;
+    dwParallelism = (dwParallelism > 0) ? dwParallelism : BENCH_OPEN_PARALLELISM;
+
+    for (i = 0; i < dwPorts; i++)
+    {
+        _snprintf(cDevice, sizeof(cDevice) - 1, cFormat, (unsigned long)i);
+        cDevice[sizeof(cDevice) - 1] = '\0';
+        devices.push_back(cDevice);
+    }
+
+    requests.resize(dwPorts);
+    for (i = 0; i < dwPorts; i++)
+    {
+        memset(&requests[i], 0, sizeof(requests[i]));
+        requests[i].pSerial = new CSerial();
+        requests[i].cDevice = devices[i].c_str();
+        requests[i].iBaudRate = CBR_115200;
+        requests[i].iByteSize = 8;
+        requests[i].iParity = NOPARITY;
+        requests[i].iStopBits = ONESTOPBIT;
+    }
+
+    printf("open: %lu ports (%s to %s), one at a time and %lu at a time, %d rounds\n", (unsigned long)dwPorts, devices.front().c_str(),
+           devices.back().c_str(), (unsigned long)dwParallelism, BENCH_OPEN_ROUNDS);
+
+    // the two ways in turn, so that both see the same state of the system
+    for (dwRound = 0; dwRound < BENCH_OPEN_ROUNDS && bPass; dwRound++)
+    {
+        dMs = RunOpen(&requests, 1, &dOpenUs);
+        dSequentialMs += dMs;
+        dSequentialUs += dOpenUs;
+        bPass = dMs > 0.0;
+
+        if (bPass)
+        {
+            dMs = RunOpen(&requests, dwParallelism, &dOpenUs);
+            dBulkMs += dMs;
+            dBulkUs += dOpenUs;
+            bPass = dMs > 0.0;
+        }
+    }
+
+    for (i = 0; i < dwPorts; i++)
+    {
+        delete requests[i].pSerial;
+    }
+
+    if (bPass)
+    {
+        printf("  sequential  %9.2f ms for all, %8.1f us per Open\n", dSequentialMs / BENCH_OPEN_ROUNDS, dSequentialUs / BENCH_OPEN_ROUNDS);
+        printf("  bulk        %9.2f ms for all, %8.1f us per Open (%.1f times faster)\n", dBulkMs / BENCH_OPEN_ROUNDS, dBulkUs / BENCH_OPEN_ROUNDS,
+               (dBulkMs > 0.0) ? dSequentialMs / dBulkMs : 0.0);
+    }
+
+    return bPass ? 0 : 1;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! the line framer byte by byte, as it was before SSE2: the reference of the framer test
+template <DWORD MaxLineLen>
+class CBenchScalarLineFramer
+{
+  private:
+
+    BYTE abLine[MaxLineLen];
+    DWORD dwLineLen;
+    BOOL bOverrun;
+    DWORD dwOverruns;
+
+  public:
+    CBenchScalarLineFramer( ) : dwLineLen(0), bOverrun(FALSE), dwOverruns(0)
+    {
+    }
+
+    DWORD Feed( const BYTE * pData, DWORD dwLen, const BYTE ** ppFrame, DWORD * pdwFrameLen )
+    {
+        DWORD dwLine;
+        DWORD i;
+
+        *ppFrame = NULL;
+
+        for (i = 0; i < dwLen; i++)
+        {
+            if (pData[i] != '\n')
+            {
+                if (dwLineLen + 1 >= MaxLineLen)
+                {
+                    bOverrun = TRUE;
+                    dwLineLen = 0;
+                }
+                else if (!bOverrun)
+                {
+                    abLine[dwLineLen++] = pData[i];
+                }
+                continue;
+            }
+
+            if (bOverrun)
+            {
+                dwOverruns++;
+                bOverrun = FALSE;
+            }
+            else
+            {
+                dwLine = (dwLineLen > 0 && abLine[dwLineLen - 1] == '\r') ? dwLineLen - 1 : dwLineLen;
+                if (dwLine > 0)
+                {
+                    *ppFrame = abLine;
+                    *pdwFrameLen = dwLine;
+                }
+            }
+
+            dwLineLen = 0;
+            return i + 1;
+        }
+
+        return dwLen;
+    }
+
+    DWORD GetOverruns( void )
+    {
+        return dwOverruns;
+    }
+};
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! feeds a stream to a framer in chunks of dwChunk bytes, or of random sizes up to BENCH_FRAMER_CHUNK when
+//!   it is 0; the lines found are appended to pLines, each after its length, unless it is NULL
+template <class Framer>
+static DWORD FeedFramer( Framer * pFramer, const std::vector<BYTE> & stream, DWORD dwChunk, std::vector<BYTE> * pLines )
+{
+    const BYTE * pData = &stream[0];
+    const BYTE * pFrame;
+    DWORD dwLeft = DWORD(stream.size());
+    DWORD dwFrameLen;
+    DWORD dwLines = 0;
+    DWORD dwLen;
+    DWORD dwUsed;
+
+    while (dwLeft > 0)
+    {
+        dwLen = (dwChunk != 0) ? dwChunk : DWORD(1 + rand() % BENCH_FRAMER_CHUNK);
+        dwLen = (dwLen < dwLeft) ? dwLen : dwLeft;
+        dwLeft -= dwLen;
+
+        while (dwLen > 0)
+        {
+            dwUsed = pFramer->Feed(pData, dwLen, &pFrame, &dwFrameLen);
+            pData += dwUsed;
+            dwLen -= dwUsed;
+
+            if (pFrame != NULL)
+            {
+                dwLines++;
+                if (pLines != NULL)
+                {
+                    pLines->insert(pLines->end(), (const BYTE *)&dwFrameLen, (const BYTE *)&dwFrameLen + sizeof(dwFrameLen));
+                    pLines->insert(pLines->end(), pFrame, pFrame + dwFrameLen);
+                }
+            }
+        }
+    }
+
+    return dwLines;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! lines of the framer test: dwLines lines of dwLineLen characters or, when it is 0, of every length
+//!   up to past the longest line, with CRLF and LF, empty lines and lone CRs
+static void BuildFramerStream( DWORD dwLines, DWORD dwLineLen, std::vector<BYTE> * pStream )
+{
+    DWORD dwLen;
+    DWORD i;
+    DWORD j;
+
+    pStream->clear();
+
+    for (i = 0; i < dwLines; i++)
+    {
+        dwLen = (dwLineLen != 0) ? dwLineLen : (i * 7) % (BENCH_FRAMER_LINE + 40);
+        for (j = 0; j < dwLen; j++)
+        {
+            pStream->push_back(BYTE(' ' + (i + j) % 95));
+        }
+
+        if (i % 3 != 0)
+        {
+            pStream->push_back('\r');
+        }
+        pStream->push_back('\n');
+
+        if (dwLineLen == 0 && i % 11 == 0)
+        {
+            pStream->push_back((i % 2 != 0) ? '\r' : '\n');
+            pStream->push_back('\n');
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static int BenchFramer( int argc, char * argv[] )
+{
+    static const DWORD adwLineLens[] = { 16, 80, 400 };
+    DWORD dwRounds = (argc > 0) ? DWORD(atoi(argv[0])) : BENCH_FRAMER_ROUNDS;
+    CSerialLineFramer<BENCH_FRAMER_LINE> * pSse2;
+    CBenchScalarLineFramer<BENCH_FRAMER_LINE> * pScalar;
+    std::vector<BYTE> stream;
+    std::vector<BYTE> expected;
+    std::vector<BYTE> lines;
+    ULONGLONG ullStartUs;
+    DWORD dwExpectedOverruns;
+    DWORD dwLines;
+    DWORD dwChunk;
+    DWORD dwRound;
+    double dSse2Us;
+    double dScalarUs;
+    BOOL bPass = TRUE;
+    DWORD i;
+
+    dwRounds = (dwRounds > 0) ? dwRounds : BENCH_FRAMER_ROUNDS;
+
+    // every chunk size up to a few blocks of SSE2 puts the terminators at every offset of a block
+    BuildFramerStream(BENCH_FRAMER_TEST_LINES, 0, &stream);
+
+    pScalar = new CBenchScalarLineFramer<BENCH_FRAMER_LINE>();
+    FeedFramer(pScalar, stream, DWORD(stream.size()), &expected);
+    dwExpectedOverruns = pScalar->GetOverruns();
+    delete pScalar;
+
+    printf("framer: CSerialLineFramer<%d>, SSE2, against the scalar framer\n", BENCH_FRAMER_LINE);
+
+    for (dwChunk = 0; dwChunk <= BENCH_FRAMER_CHUNK; dwChunk++)
+    {
+        pSse2 = new CSerialLineFramer<BENCH_FRAMER_LINE>();
+        lines.clear();
+        FeedFramer(pSse2, stream, dwChunk, &lines);
+        if (lines != expected || pSse2->GetOverruns() != dwExpectedOverruns)
+        {
+            printf("  chunks of %lu bytes (0 random): %lu bytes of lines and %lu overruns, %lu and %lu expected\n", (unsigned long)dwChunk,
+                   (unsigned long)lines.size(), (unsigned long)pSse2->GetOverruns(), (unsigned long)expected.size(),
+                   (unsigned long)dwExpectedOverruns);
+            bPass = FALSE;
+        }
+        delete pSse2;
+    }
+
+    printf("  same lines in chunks of 1 to %d bytes and of random sizes, %lu overruns: %s\n", BENCH_FRAMER_CHUNK,
+           (unsigned long)dwExpectedOverruns, bPass ? "ok" : "differ");
+
+    // the listener reads up to 1 KB at a time
+    for (i = 0; i < sizeof(adwLineLens) / sizeof(adwLineLens[0]); i++)
+    {
+        BuildFramerStream(BENCH_FRAMER_LINES, adwLineLens[i], &stream);
+
+        pSse2 = new CSerialLineFramer<BENCH_FRAMER_LINE>();
+        ullStartUs = GetTimestampUs();
+        for (dwRound = 0, dwLines = 0; dwRound < dwRounds; dwRound++)
+        {
+            dwLines += FeedFramer(pSse2, stream, 1024, NULL);
+        }
+        dSse2Us = double(GetTimestampUs() - ullStartUs);
+        delete pSse2;
+
+        pScalar = new CBenchScalarLineFramer<BENCH_FRAMER_LINE>();
+        ullStartUs = GetTimestampUs();
+        for (dwRound = 0; dwRound < dwRounds; dwRound++)
+        {
+            dwLines -= FeedFramer(pScalar, stream, 1024, NULL);
+        }
+        dScalarUs = double(GetTimestampUs() - ullStartUs);
+        delete pScalar;
+
+        bPass = bPass && dwLines == 0;
+
+        printf("  lines of %3lu: SSE2 %10.0f lines/s, scalar %10.0f lines/s (%.1f times)\n", (unsigned long)adwLineLens[i],
+               (dSse2Us > 0.0) ? double(BENCH_FRAMER_LINES) * dwRounds * 1e6 / dSse2Us : 0.0,
+               (dScalarUs > 0.0) ? double(BENCH_FRAMER_LINES) * dwRounds * 1e6 / dScalarUs : 0.0,
+               (dSse2Us > 0.0) ? dScalarUs / dSse2Us : 0.0);
+    }
+
+    printf("  %s\n", bPass ? "PASS" : "FAIL");
+
+    return bPass ? 0 : 1;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static void OnParityData( BYTE * pData, DWORD dwLen )
+{
+    EnterCriticalSection(&parityRx.cs);
+    parityRx.data.insert(parityRx.data.end(), pData, pData + dwLen);
+    LeaveCriticalSection(&parityRx.cs);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! listener of the hardware end of a device pair: sends back what it receives
+static void OnParityEcho( BYTE * pData, DWORD dwLen )
+{
+    parityRx.pEcho->Write((char *)pData, int(dwLen));
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! one round trip of the parity test: every 7 bit character, encoded with the parity given, sent at
+//!   8N1 to the 7E1 end and received back from it; returns the characters received with a wrong parity
+//!   by this end, MAXDWORD when they did not all come back or came back changed
+static DWORD RunParityEcho( CSerial * pSoft, int iParity )
+{
+    CSerialSoftParity parity(iParity);
+    std::vector<BYTE> sent;
+    std::vector<BYTE> received;
+    ULONGLONG ullStartUs;
+    DWORD dwErrors;
+    DWORD dwLen;
+    DWORD i;
+
+    for (i = 0; i < BENCH_PARITY_ECHO_ROUNDS * 128; i++)
+    {
+        sent.push_back(BYTE(i % 128));
+    }
+    received.resize(sent.size());
+    parity.Encode(&sent[0], DWORD(sent.size()), &received[0]);
+
+    EnterCriticalSection(&parityRx.cs);
+    parityRx.data.clear();
+    LeaveCriticalSection(&parityRx.cs);
+
+    pSoft->Write((char *)&received[0], int(received.size()));
+
+    ullStartUs = GetTimestampUs();
+    do
+    {
+        Sleep(10);
+        EnterCriticalSection(&parityRx.cs);
+        dwLen = DWORD(parityRx.data.size());
+        LeaveCriticalSection(&parityRx.cs);
+    }
+    while (dwLen < sent.size() && GetTimestampUs() - ullStartUs < ULONGLONG(BENCH_PARITY_TIMEOUT_MS) * 1000);
+
+    if (dwLen != sent.size())
+    {
+        printf("  %lu of %lu characters came back\n", (unsigned long)dwLen, (unsigned long)sent.size());
+        return MAXDWORD;
+    }
+
+    EnterCriticalSection(&parityRx.cs);
+    dwErrors = parity.Decode(&parityRx.data[0], dwLen, &received[0]);
+    LeaveCriticalSection(&parityRx.cs);
+
+    return (received == sent) ? dwErrors : MAXDWORD;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! parity errors of the 7E1 end of the round trip so far: the line errors of the hardware end, or the
+//!   characters the stand-in device read with a wrong parity
+static DWORD ParityEndErrors( CSerial * pHard, BENCH_RFC2217 * pServer )
+{
+    SERIAL_LINE_ERRORS errors;
+
+    if (pHard == NULL)
+    {
+        return pServer->dwDeviceErrors;
+    }
+
+    pHard->GetLineErrors(&errors);
+
+    return errors.dwParity;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static int BenchParity( int argc, char * argv[] )
+{
+    DWORD dwRounds = (argc > 0) ? DWORD(atoi(argv[0])) : BENCH_PARITY_ROUNDS;
+    CSerialSoftParity parity(EVENPARITY);
+    BENCH_RFC2217 server;
+    std::vector<BYTE> data(BENCH_PARITY_BYTES);
+    std::vector<BYTE> computed(BENCH_PARITY_BYTES);
+    std::vector<BYTE> table(BENCH_PARITY_BYTES);
+    BYTE abParity[256];
+    ULONGLONG ullStartUs;
+    CSerial * pSoft;
+    CSerial * pHard = NULL;
+    const char * cSoftDevice = (argc > 2) ? argv[1] : NULL;
+    const char * cHardDevice = (argc > 2) ? argv[2] : NULL;
+    double adComputedUs[3];
+    double adTableUs[3];
+    DWORD dwErrorsComputed = 0;
+    DWORD dwErrorsTable = 0;
+    DWORD dwEndErrors;
+    DWORD dwErrors;
+    DWORD dwRound;
+    DWORD dwError;
+    BOOL bPass = TRUE;
+    BYTE b;
+    DWORD i;
+
+    dwRounds = (dwRounds > 0) ? dwRounds : BENCH_PARITY_ROUNDS;
+
+    for (i = 0; i < 256; i++)
+    {
+        for (b = BYTE(i), abParity[i] = 0; b != 0; b >>= 1)
+        {
+            abParity[i] ^= b & 1;
+        }
+    }
+    for (i = 0; i < BENCH_PARITY_BYTES; i++)
+    {
+        data[i] = BYTE(rand());
+    }
+
+    // 7 bit characters, 7E1 on an 8N1 line: encoded, then checked as received
+    ullStartUs = GetTimestampUs();
+    for (dwRound = 0; dwRound < dwRounds; dwRound++)
+    {
+        parity.Encode(&data[0], BENCH_PARITY_BYTES, &computed[0]);
+    }
+    adComputedUs[0] = double(GetTimestampUs() - ullStartUs);
+
+    ullStartUs = GetTimestampUs();
+    for (dwRound = 0; dwRound < dwRounds; dwRound++)
+    {
+        for (i = 0; i < BENCH_PARITY_BYTES; i++)
+        {
+            table[i] = BYTE((data[i] & 0x7F) | (abParity[data[i] & 0x7F] << 7));
+        }
+    }
+    adTableUs[0] = double(GetTimestampUs() - ullStartUs);
+    bPass = bPass && computed == table;
+
+    ullStartUs = GetTimestampUs();
+    for (dwRound = 0; dwRound < dwRounds; dwRound++)
+    {
+        dwErrorsComputed += parity.Decode(&data[0], BENCH_PARITY_BYTES, &computed[0]);
+    }
+    adComputedUs[1] = double(GetTimestampUs() - ullStartUs);
+
+    ullStartUs = GetTimestampUs();
+    for (dwRound = 0; dwRound < dwRounds; dwRound++)
+    {
+        for (i = 0; i < BENCH_PARITY_BYTES; i++)
+        {
+            dwErrorsTable += abParity[data[i]];
+            table[i] = data[i] & 0x7F;
+        }
+    }
+    adTableUs[1] = double(GetTimestampUs() - ullStartUs);
+    bPass = bPass && computed == table && dwErrorsComputed == dwErrorsTable;
+
+    // 9 bit addressing: the parity that gives each byte its 9th bit
+    ullStartUs = GetTimestampUs();
+    for (dwRound = 0; dwRound < dwRounds; dwRound++)
+    {
+        CSerialSoftParity::NinthBitParity(&data[0], BENCH_PARITY_BYTES, (dwRound & 1) != 0, &computed[0]);
+    }
+    adComputedUs[2] = double(GetTimestampUs() - ullStartUs);
+
+    ullStartUs = GetTimestampUs();
+    for (dwRound = 0; dwRound < dwRounds; dwRound++)
+    {
+        b = BYTE(dwRound & 1);
+        for (i = 0; i < BENCH_PARITY_BYTES; i++)
+        {
+            table[i] = (abParity[data[i]] == b) ? EVENPARITY : ODDPARITY;
+        }
+    }
+    adTableUs[2] = double(GetTimestampUs() - ullStartUs);
+    bPass = bPass && computed == table;
+
+    printf("parity: %d KB %lu times, SSE2 computed against a table of 256 bytes%s\n", BENCH_PARITY_BYTES / 1024, (unsigned long)dwRounds,
+           bPass ? "" : ", RESULTS DIFFER");
+    for (i = 0; i < 3; i++)
+    {
+        printf("  %-22s computed %8.0f MB/s, table %8.0f MB/s (%.1f times)\n",
+               (i == 0) ? "7 bit encode" : (i == 1) ? "7 bit decode" : "9 bit address parity",
+               (adComputedUs[i] > 0.0) ? double(BENCH_PARITY_BYTES) * dwRounds / adComputedUs[i] : 0.0,
+               (adTableUs[i] > 0.0) ? double(BENCH_PARITY_BYTES) * dwRounds / adTableUs[i] : 0.0,
+               (adComputedUs[i] > 0.0) ? adTableUs[i] / adComputedUs[i] : 0.0);
+    }
+
+    // the 7E1 end checks the parity in hardware (fParity): the stand-in device, or the second port
+    //   of a pair of devices wired together
+    InitializeCriticalSection(&parityRx.cs);
+    pSoft = new CSerial();
+    if (cHardDevice != NULL)
+    {
+        pHard = new CSerial();
+        dwError = DWORD(pHard->Open(cHardDevice, CBR_115200, 7, EVENPARITY, ONESTOPBIT));
+        if (dwError == ERROR_SUCCESS)
+        {
+            parityRx.pEcho = pHard;
+            pHard->RegisterListenner(OnParityEcho);
+            dwError = DWORD(pSoft->Open(cSoftDevice, CBR_115200, 8, NOPARITY, ONESTOPBIT));
+        }
+    }
+    else
+    {
+        dwError = StartRfc2217(&server, NULL, CBR_115200, 7, EVENPARITY);
+        if (dwError == ERROR_SUCCESS)
+        {
+            cSoftDevice = server.cDevice;
+            dwError = DWORD(pSoft->Open(server.cDevice, CBR_115200, 8, NOPARITY, ONESTOPBIT));
+        }
+    }
+
+    if (dwError == ERROR_SUCCESS)
+    {
+        pSoft->RegisterListenner(OnParityData);
+
+        printf("  round trip, %s at 8N1 to a 7E1 end with fParity:\n", cSoftDevice);
+
+        // right every time with the parity of the 7E1 end, wrong every time with the other one
+        for (i = 0; i < 2; i++)
+        {
+            dwEndErrors = ParityEndErrors(pHard, &server);
+            dwErrors = RunParityEcho(pSoft, (i == 0) ? EVENPARITY : ODDPARITY);
+            dwEndErrors = ParityEndErrors(pHard, &server) - dwEndErrors;
+
+            printf("    %s: %lu parity errors at the 7E1 end, %lu here\n", (i == 0) ? "even" : "odd ", (unsigned long)dwEndErrors,
+                   (unsigned long)dwErrors);
+
+            if (i == 0)
+            {
+                bPass = bPass && dwEndErrors == 0 && dwErrors == 0;
+            }
+            else
+            {
+                // a driver counts the errors of each ClearCommError, not of each character
+                bPass = bPass && dwErrors == BENCH_PARITY_ECHO_ROUNDS * 128 &&
+                        ((pHard != NULL) ? dwEndErrors > 0 : dwEndErrors == BENCH_PARITY_ECHO_ROUNDS * 128);
+            }
+        }
+    }
+    else
+    {
+        printf("  cannot open the ends of the round trip: %lu\n", (unsigned long)dwError);
+        bPass = FALSE;
+    }
+
+    delete pSoft;
+    if (pHard != NULL)
+    {
+        delete pHard;
+    }
+    else if (cSoftDevice != NULL)
+    {
+        StopRfc2217(&server);
+    }
+    DeleteCriticalSection(&parityRx.cs);
+
+    printf("  %s\n", bPass ? "PASS" : "FAIL");
+
+    return bPass ? 0 : 1;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! reads from a transport until dwLen bytes came or the time is up, a few bytes at a time while the
+//!   emulated WaitCommEvent keeps a read of the stream pending; returns the events of the waits
+static DWORD Rfc2217Collect( CSerialTransport * pTransport, OVERLAPPED * pOvWait, BOOL * pbWaiting, DWORD * pdwEvent,
+                             std::vector<BYTE> * pReceived, DWORD dwLen, DWORD dwTimeoutMs )
+{
+    ULONGLONG ullStartUs = GetTimestampUs();
+    BYTE abPiece[BENCH_RFC2217_PIECE];
+    DWORD dwEvents = 0;
+    DWORD dwTransferred;
+    DWORD dwRead;
+
+    while (pReceived->size() < dwLen && GetTimestampUs() - ullStartUs < ULONGLONG(dwTimeoutMs) * 1000)
+    {
+        if (!*pbWaiting)
+        {
+            if (pTransport->WaitCommEvent(pdwEvent, pOvWait))
+            {
+                dwEvents |= *pdwEvent;
+            }
+            else if (::GetLastError() == ERROR_IO_PENDING)
+            {
+                *pbWaiting = TRUE;
+            }
+            else
+            {
+                break;
+            }
+        }
+
+        // the rest stays in the buffer at an offset, which the read completing must not write over
+        dwRead = 0;
+        pTransport->ReadFile(abPiece, sizeof(abPiece), &dwRead, NULL);
+        pReceived->insert(pReceived->end(), abPiece, abPiece + dwRead);
+
+        if (*pbWaiting && WaitForSingleObject(pOvWait->hEvent, (dwRead == 0) ? 1 : 0) == WAIT_OBJECT_0)
+        {
+            if (pTransport->GetOverlappedResult(pOvWait, &dwTransferred, FALSE))
+            {
+                dwEvents |= *pdwEvent;
+                *pbWaiting = FALSE;
+            }
+            else if (::GetLastError() != ERROR_IO_INCOMPLETE)
+            {
+                break;
+            }
+        }
+    }
+
+    return dwEvents;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static int BenchRfc2217( int argc, char * argv[] )
+{
+    BENCH_RFC2217 server;
+    CSerialRfc2217Transport * pTransport;
+    std::vector<BYTE> sent;
+    std::vector<BYTE> received;
+    OVERLAPPED ovWait;
+    OVERLAPPED ovWrite;
+    DCB dcb;
+    DWORD dwEvent = 0;
+    DWORD dwEvents;
+    DWORD dwErrors = 0;
+    DWORD dwWritten;
+    DWORD dwError;
+    BOOL bWaiting = FALSE;
+    BOOL bPass;
+    DWORD i;
+
+    for (i = 0; i < BENCH_RFC2217_BYTES; i++)
+    {
+        sent.push_back(BYTE(i * 7));
+    }
+
+    dwError = StartRfc2217(&server, NULL, CBR_256000, 8, NOPARITY);
+    if (dwError != ERROR_SUCCESS)
+    {
+        printf("rfc2217: cannot start the stand-in: %lu\n", (unsigned long)dwError);
+        return 1;
+    }
+
+    printf("rfc2217: CSerialRfc2217Transport to the stand-in, an echo device at 256000 8N1\n");
+
+    SecureZeroMemory(&ovWait, sizeof(ovWait));
+    SecureZeroMemory(&ovWrite, sizeof(ovWrite));
+    ovWait.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    ovWrite.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+    // the transport alone, to take the data as a listener does not
+    pTransport = new CSerialRfc2217Transport();
+    dwError = pTransport->Open(server.cDevice + strlen("rfc2217://"));
+    if (dwError == ERROR_SUCCESS)
+    {
+        pTransport->GetCommState(&dcb);
+        dcb.BaudRate = CBR_256000;
+        dcb.ByteSize = 8;
+        dcb.Parity = NOPARITY;
+        dcb.StopBits = ONESTOPBIT;
+
+        // without EV_RXCHAR the wait starts a read of the stream while data is left
+        if (!pTransport->SetCommState(&dcb) || !pTransport->SetCommMask(EV_ERR))
+        {
+            dwError = ::GetLastError();
+        }
+    }
+    if (dwError == ERROR_SUCCESS && !pTransport->WriteFile(&sent[0], DWORD(sent.size()), &dwWritten, &ovWrite))
+    {
+        dwError = ::GetLastError();
+        if (dwError == ERROR_IO_PENDING)
+        {
+            dwError = pTransport->GetOverlappedResult(&ovWrite, &dwWritten, TRUE) ? ERROR_SUCCESS : ::GetLastError();
+        }
+    }
+
+    if (dwError != ERROR_SUCCESS)
+    {
+        printf("  cannot open, set or write to %s: %lu\n", server.cDevice, (unsigned long)dwError);
+        bPass = FALSE;
+    }
+    else
+    {
+        // every byte value, 0xFF doubled both ways, taken a few bytes at a time
+        Rfc2217Collect(pTransport, &ovWait, &bWaiting, &dwEvent, &received, DWORD(sent.size()), BENCH_RFC2217_TIMEOUT_MS);
+        bPass = (received == sent);
+        printf("  echo of %lu bytes, %d at a time: %lu received, %s\n", (unsigned long)sent.size(), BENCH_RFC2217_PIECE,
+               (unsigned long)received.size(), bPass ? "same" : "DIFFERENT");
+
+        // the settings reached the server
+        printf("  settings at the server: %lu %d%c%s\n", (unsigned long)server.dwRxBaudRate, server.iRxByteSize,
+               "NOE"[server.iRxParity % 3], (server.dwRxBaudRate == CBR_256000 && server.iRxByteSize == 8 && server.iRxParity == NOPARITY) ? "" : ", WRONG");
+        bPass = bPass && server.dwRxBaudRate == CBR_256000 && server.iRxByteSize == 8 && server.iRxParity == NOPARITY;
+
+        // 8E1 reading 8N1: the errors the server notifies are those of ClearCommError, with EV_ERR
+        dcb.Parity = EVENPARITY;
+        received.clear();
+        pTransport->SetCommState(&dcb);
+        pTransport->WriteFile(&sent[0], BENCH_RFC2217_ERROR_BYTES, &dwWritten, &ovWrite);
+        pTransport->GetOverlappedResult(&ovWrite, &dwWritten, TRUE);
+        dwEvents = Rfc2217Collect(pTransport, &ovWait, &bWaiting, &dwEvent, &received, BENCH_RFC2217_ERROR_BYTES, BENCH_RFC2217_ERROR_MS);
+        pTransport->ClearCommError(&dwErrors, NULL);
+        printf("  8E1 reading 8N1: parity %s, errors%s%s%s\n", (server.iRxParity == EVENPARITY) ? "sent" : "NOT SENT",
+               (dwEvents & EV_ERR) ? " with EV_ERR:" : " WITHOUT EV_ERR:", (dwErrors & CE_FRAME) ? " framing" : "",
+               (dwErrors & CE_RXPARITY) ? " parity" : "");
+        bPass = bPass && server.iRxParity == EVENPARITY && (dwEvents & EV_ERR) && (dwErrors & (CE_FRAME | CE_RXPARITY));
+    }
+
+    if (bWaiting)
+    {
+        pTransport->CancelIoEx(&ovWait);
+    }
+    delete pTransport;
+    StopRfc2217(&server);
+
+    CloseHandle(ovWait.hEvent);
+    CloseHandle(ovWrite.hEvent);
+
+    printf("  %s\n", bPass ? "PASS" : "FAIL");
+
+    return bPass ? 0 : 1;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static void OnTransportsData( BYTE * pData, DWORD dwLen )
+{
+    DWORD dwOffset = transportsRx.dwReceived;
+    DWORD i;
+
+    for (i = 0; i < dwLen; i++)
+    {
+        if (pData[i] != BYTE(dwOffset + i))
+        {
+            transportsRx.bCorrupt = TRUE;
+            break;
+        }
+    }
+
+    transportsRx.dwReceived = dwOffset + dwLen;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! server of the transports benchmark: from the first 'G' of the client, sends the stream as fast
+//!   as the socket takes it, 0xFF doubled for a telnet client, then drains the client until it closes
+static DWORD WINAPI StreamServerThread( LPVOID lpParam )
+{
+    BENCH_STREAM_SERVER * pServer = (BENCH_STREAM_SERVER *)lpParam;
+    std::vector<BYTE> block;
+    char acReceived[256];
+    DWORD dwOffset = 0;
+    DWORD dwLen;
+    SOCKET s;
+    BOOL bGo = FALSE;
+    int iRecv;
+    BYTE b;
+    DWORD i;
+
+    s = accept(pServer->sListen, NULL, NULL);
+    if (s == INVALID_SOCKET)
+    {
+        return 1;
+    }
+
+    // the telnet negotiation of the client comes first
+    while (!bGo && (iRecv = recv(s, acReceived, sizeof(acReceived), 0)) > 0)
+    {
+        bGo = (memchr(acReceived, 'G', iRecv) != NULL);
+    }
+
+    while (bGo && dwOffset < pServer->dwBytes)
+    {
+        dwLen = std::min<DWORD>(pServer->dwBytes - dwOffset, BENCH_TRANSPORTS_BLOCK);
+        block.clear();
+        for (i = 0; i < dwLen; i++)
+        {
+            b = BYTE(dwOffset + i);
+            if (pServer->bTelnet && b == BENCH_T_IAC)
+            {
+                block.push_back(b);
+            }
+            block.push_back(b);
+        }
+
+        if (send(s, (const char *)&block[0], int(block.size()), 0) != int(block.size()))
+        {
+            break;
+        }
+        dwOffset += dwLen;
+    }
+
+    while (recv(s, acReceived, sizeof(acReceived), 0) > 0)
+    {
+    }
+
+    closesocket(s);
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! one transport of the transports benchmark: the stream comes from the tx end of a mem:// or a device
+//!   link, or from a loopback server for tcp:// and rfc2217://; returns FALSE if it did not all arrive intact
+static BOOL RunTransport( const char * cScheme, const char * cRxDevice, const char * cTxDevice, DWORD dwBytes, double * pdMs, double * pdCpuMs )
+{
+    BENCH_STREAM_SERVER server;
+    BENCH_LINK link;
+    std::vector<BYTE> block(BENCH_TRANSPORTS_BLOCK);
+    char cDevice[64];
+    unsigned int uPort;
+    ULONGLONG ullStartUs = 0;
+    double dCpuMs = 0.0;
+    BOOL bServer = (strcmp(cScheme, "tcp://") == 0 || strcmp(cScheme, "rfc2217://") == 0);
+    DWORD dwOffset;
+    DWORD dwLen;
+    DWORD dwError;
+    DWORD i;
+
+    transportsRx.dwReceived = 0;
+    transportsRx.bCorrupt = FALSE;
+
+    link.pRx = new CSerial();
+    link.pTx = NULL;
+    server.hThread = NULL;
+
+    if (bServer)
+    {
+        server.bTelnet = (strcmp(cScheme, "rfc2217://") == 0);
+        server.dwBytes = dwBytes;
+        dwError = ListenLoopback(&server.sListen, &uPort);
+        if (dwError == ERROR_SUCCESS)
+        {
+            server.hThread = ::CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)StreamServerThread, &server, 0, NULL);
+            if (server.hThread == NULL)
+            {
+                dwError = ::GetLastError();
+                closesocket(server.sListen);
+                WSACleanup();
+            }
+        }
+        if (dwError == ERROR_SUCCESS)
+        {
+            _snprintf(cDevice, sizeof(cDevice) - 1, "%s127.0.0.1:%u", cScheme, uPort);
+            cDevice[sizeof(cDevice) - 1] = '\0';
+            dwError = DWORD(link.pRx->Open(cDevice, CBR_115200, 8, NOPARITY, ONESTOPBIT));
+        }
+    }
+    else
+    {
+        link.pTx = new CSerial();
+        dwError = OpenLink(&link, cRxDevice, cTxDevice, CBR_115200);
+    }
+
+    if (dwError == ERROR_SUCCESS)
+    {
+        link.pRx->RegisterListenner(OnTransportsData);
+
+        ullStartUs = GetTimestampUs();
+        dCpuMs = CpuMs(GetCurrentProcess());
+
+        if (bServer)
+        {
+            link.pRx->Write((char *)"G", 1);
+        }
+        else
+        {
+            for (dwOffset = 0; dwOffset < dwBytes; dwOffset += dwLen)
+            {
+                dwLen = std::min<DWORD>(dwBytes - dwOffset, BENCH_TRANSPORTS_BLOCK);
+                for (i = 0; i < dwLen; i++)
+                {
+                    block[i] = BYTE(dwOffset + i);
+                }
+                if (link.pTx->Write((char *)&block[0], int(dwLen)) != int(dwLen))
+                {
+                    break;
+                }
+            }
+        }
+
+        while (transportsRx.dwReceived < dwBytes && !transportsRx.bCorrupt &&
+               GetTimestampUs() - ullStartUs < ULONGLONG(BENCH_TRANSPORTS_TIMEOUT_MS) * 1000)
+        {
+            Sleep(1);
+        }
+
+        *pdMs = double(GetTimestampUs() - ullStartUs) / 1000.0;
+        *pdCpuMs = CpuMs(GetCurrentProcess()) - dCpuMs;
+    }
+    else if (bServer)
+    {
+        printf("  cannot serve or open %s: %lu\n", cScheme, (unsigned long)dwError);
+    }
+
+    // closing the port ends the connection, and the server with it
+    delete link.pTx;
+    delete link.pRx;
+
+    if (server.hThread != NULL)
+    {
+        closesocket(server.sListen);
+        WaitForSingleObject(server.hThread, INFINITE);
+        CloseHandle(server.hThread);
+        WSACleanup();
+    }
+
+    return dwError == ERROR_SUCCESS && transportsRx.dwReceived == dwBytes && !transportsRx.bCorrupt;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static int BenchTransports( int argc, char * argv[] )
+{
+    static const char * acSchemes[] = { "mem://", "tcp://", "rfc2217://", "devices" };
+    DWORD dwMb = (argc > 0) ? DWORD(atoi(argv[0])) : BENCH_TRANSPORTS_MB;
+    const char * cRxDevice = (argc > 2) ? argv[1] : NULL;
+    const char * cTxDevice = (argc > 2) ? argv[2] : NULL;
+    BOOL bPass = TRUE;
+    BOOL bRun;
+    double dMs;
+    double dCpuMs;
+    DWORD i;
+
+    dwMb = (dwMb > 0) ? dwMb : BENCH_TRANSPORTS_MB;
+
+    printf("transports: %lu MB to a listener that checks every byte, written as fast as each transport takes it\n", (unsigned long)dwMb);
+
+    for (i = 0; i < sizeof(acSchemes) / sizeof(acSchemes[0]); i++)
+    {
+        // the devices are only for the local ports
+        if (i == 3 && cRxDevice == NULL)
+        {
+            continue;
+        }
+
+        dMs = 0.0;
+        dCpuMs = 0.0;
+        bRun = RunTransport(acSchemes[i], (i == 3) ? cRxDevice : "mem://transports", (i == 3) ? cTxDevice : "mem://transports",
+                            dwMb * 1024 * 1024, &dMs, &dCpuMs);
+        bPass = bPass && bRun;
+
+        printf("  %-11s %8.1f MB/s, %7.2f ms of CPU per MB, both ends%s\n", acSchemes[i], (dMs > 0.0) ? dwMb * 1000.0 / dMs : 0.0,
+               dCpuMs / dwMb, bRun ? "" : ", NOT ALL RECEIVED INTACT");
+    }
+
+    return bPass ? 0 : 1;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+int RunSerialBench( int argc, _TCHAR * argv[] )
+{
+    char acArgs[BENCH_MAX_ARGS][MAX_PATH];
+    char * apArgs[BENCH_MAX_ARGS];
+    int iResult = 2;
+    int i;
+
+    if (argc < 1 || argc > BENCH_MAX_ARGS)
+    {
+        printf("usage: SerialExample <mode> [arguments], see SerialBench.h\n");
+        return 2;
+    }
+
+    // the devices and the numbers are plain ANSI
+    for (i = 0; i < argc; i++)
+    {
+#ifdef _UNICODE
+        WideCharToMultiByte(CP_ACP, 0, argv[i], -1, acArgs[i], MAX_PATH, NULL, NULL);
+#else
+        strncpy(acArgs[i], argv[i], MAX_PATH);
+#endif
+        acArgs[i][MAX_PATH - 1] = '\0';
+        apArgs[i] = acArgs[i];
+    }
+
+    // the pacing of the writers sleeps by the millisecond
+    timeBeginPeriod(1);
+
+    if (strcmp(apArgs[0], "merger") == 0)
+    {
+        iResult = BenchMerger(argc - 1, apArgs + 1);
+    }
+    else if (strcmp(apArgs[0], "lanes") == 0)
+    {
+        iResult = BenchLanes(argc - 1, apArgs + 1);
+    }
+    else if (strcmp(apArgs[0], "completion") == 0)
+    {
+        iResult = BenchCompletion(argc - 1, apArgs + 1);
+    }
+    else if (strcmp(apArgs[0], "gap") == 0)
+    {
+        iResult = BenchGap(argc - 1, apArgs + 1);
+    }
+    else if (strcmp(apArgs[0], "shared") == 0)
+    {
+        iResult = BenchShared(argc - 1, apArgs + 1);
+    }
+    else if (strcmp(apArgs[0], "shared-sub") == 0)
+    {
+        iResult = BenchSharedSub(argc - 1, apArgs + 1);
+    }
+    else if (strcmp(apArgs[0], "relay-sub") == 0)
+    {
+        iResult = BenchRelaySub(argc - 1, apArgs + 1);
+    }
+    else if (strcmp(apArgs[0], "shared-lap") == 0)
+    {
+        iResult = BenchSharedLap(argc - 1, apArgs + 1);
+    }
+    else if (strcmp(apArgs[0], "flow") == 0)
+    {
+        iResult = BenchFlow(argc - 1, apArgs + 1);
+    }
+    else if (strcmp(apArgs[0], "cycle") == 0)
+    {
+        iResult = BenchCycle(argc - 1, apArgs + 1);
+    }
+    else if (strcmp(apArgs[0], "errors") == 0)
+    {
+        iResult = BenchErrors(argc - 1, apArgs + 1);
+    }
+    else if (strcmp(apArgs[0], "transfer") == 0)
+    {
+        iResult = BenchTransfer(argc - 1, apArgs + 1);
+    }
+    else if (strcmp(apArgs[0], "pipeline") == 0)
+    {
+        iResult = BenchPipeline(argc - 1, apArgs + 1);
+    }
+    else if (strcmp(apArgs[0], "autobaud") == 0)
+    {
+        iResult = BenchAutoBaud(argc - 1, apArgs + 1);
+    }
+    else if (strcmp(apArgs[0], "open") == 0)
+    {
+        iResult = BenchOpen(argc - 1, apArgs + 1);
+    }
+    else if (strcmp(apArgs[0], "framer") == 0)
+    {
+        iResult = BenchFramer(argc - 1, apArgs + 1);
+    }
+    else if (strcmp(apArgs[0], "parity") == 0)
+    {
+        iResult = BenchParity(argc - 1, apArgs + 1);
+    }
+    else if (strcmp(apArgs[0], "rfc2217") == 0)
+    {
+        iResult = BenchRfc2217(argc - 1, apArgs + 1);
+    }
+    else if (strcmp(apArgs[0], "transports") == 0)
+    {
+        iResult = BenchTransports(argc - 1, apArgs + 1);
+    }
+    else
+    {
+        printf("unknown mode %s, see SerialBench.h\n", apArgs[0]);
+    }
+
+    timeEndPeriod(1);
+
+    return iResult;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
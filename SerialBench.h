@@ -0,0 +1,118 @@
+// $Id$
+
+#ifndef __SERIAL_BENCH_H__
+#define __SERIAL_BENCH_H__
+
+#include <windows.h>
+#include <tchar.h>
+
+/**
+ *  \brief  Runs a benchmark or a test of the library, selected by the first argument. The links
+ *          are mem:// pairs of the process unless devices are given.
+ *            merger [sources] [seconds] [rate]
+ *              CSerialMerger fed by 64 sources of 32 byte chunks, rate chunks per second each
+ *              (500 by default, 0 as fast as possible); prints the chunks merged per second,
+ *              the late chunks and the delay of the merge
+ *            lanes [seconds] [rx-device tx-device]
+ *              CSerialTxLanes at 115200 bps: a bulk stream keeps lane 1 busy while an 8 byte
+ *              frame is sent on lane 0 every 20 ms; prints the wait of the urgent frames
+ *              (ullMaxWaitUs of lane 0) and the throughput of the bulk stream
+ *            completion [links] [seconds] [rate] [rings]
+ *              256 mem:// links with a 16 byte stamp every 10 ms on each (rate per second),
+ *              both ends on listener threads, then on a CSerialCompletionPort of 1 ring; prints
+ *              the latency and the CPU time of both, and checks that each port keeps its two
+ *              reads posted and that the blocking writes queue no completion
+ *            gap [rx-device tx-device [baudrate]]
+ *              test of the idle-line framing at 9600 bps for gaps of 2, 5, 9, 11 and 20 ms: each
+ *              frame is written in two halves half a gap apart, and the frames are two gaps
+ *              apart; every frame must be received whole, and closed no earlier than the gap.
+ *              Prints how late the frames were closed. A mem:// link only uses the timer; a
+ *              virtual null-modem pair, e.g. com0com, also covers the driver inter-byte timeout
+ *              the gaps of 10 ms and more use
+ *            shared [consumers] [seconds] [rate]
+ *              16 byte stamps, rate per second (1000 by default), received by a port and handed
+ *              to 4 consumer processes, first through a CSerialPublisher ring, then through a
+ *              loopback socket relay; each consumer prints its latency from the Write of the
+ *              stamps and its CPU time, the source prints its own CPU time
+ *            shared-sub <ring> <index>, relay-sub <port> <index>
+ *              the consumer processes started by shared
+ *            shared-lap [seconds]
+ *              test of a subscriber of a 64 KB ring that falls behind a stream written as fast as
+ *              possible: every chunk read must be intact and each overrun a single gap in the stream
+ *            flow [seconds] [rx-device tx-device]
+ *              test of the software flow control at 115200 bps: a stream written as fast as Write
+ *              takes it, to a consumer on an executor that sleeps 20 ms per chunk. The receiver
+ *              sends XOFF at 4096 queued bytes and XON at 1024, the sender holds Write meanwhile;
+ *              every byte must arrive in order, none dropped, and both ends must have throttled
+ *            cycle [cycles] [rx-device tx-device]
+ *              test of the listener lifecycle: 64 ports created and never opened, then an open
+ *              link with no data, must take no thread (the first) and no CPU time while idle;
+ *              then the link is opened and closed 10000 times as fast as possible, after which
+ *              the threads and the handles of the process must be back where they were.
+ *              Prints the cycles per second
+ *            errors [count]
+ *              cost of an error on the I/O paths: building and comparing the std::error_code of
+ *              serial_category, against the CWin32Error used before (FormatMessage and a heap
+ *              block each), and the message of the error_code formatted on request; prints the
+ *              nanoseconds per error of each, 100000 errors by default
+ *            transfer [size-kb] [latency-ms] [rx-device tx-device [baudrate]]
+ *              CSerialFileTransfer sends a 256 KB file with XMODEM-1K, YMODEM and ZMODEM to a
+ *              receiver of the benchmark, which waits latency-ms before each of its replies to
+ *              emulate the round trip of a remote link; the file received must match. Prints the
+ *              payload per second and per byte written by both ends, and on a device link (e.g.
+ *              a com0com pair, 115200 bps by default) the time the line was busy and the payload
+ *              against the baud limit
+ *            pipeline [sentences] [rx-device tx-device]
+ *              the templated CSerialT pipeline (line framer, NMEA checksum, a sink) against a
+ *              listener callback that does the same framing and checksum and hands each sentence
+ *              on through a function pointer: 100000 sentences, one in 50 with a wrong checksum,
+ *              first fed in 1 KB chunks to both in process, then sent over a mem:// link to each.
+ *              Both must count the same sentences; prints the nanoseconds per sentence and the
+ *              time of the link runs
+ *            autobaud [budget-ms]
+ *              test of CSerialAutoBaud against devices sending NMEA sentences at 9600, 115200 and
+ *              2400 8N1, 19200 7E1, 4800 7O1, 57600 8E1 and 38400 8O1, each behind a loopback
+ *              stand-in of an RFC 2217 terminal server: it emulates the line of the device, reads
+ *              it with the UART settings the port sends, and reports the framing, parity and
+ *              break errors as a real server does (a mem:// pair carries neither). Each detection
+ *              must find the settings of the device; prints the settings found and the time taken
+ *            open [ports] [parallelism] [device-format]
+ *              OpenSerialPorts opening 64 ports 16 at a time, against the same ports opened one
+ *              at a time; the devices are device-format with the index of the port, mem://open-%lu
+ *              by default, e.g. \\.\CNCA%lu for the ends of com0com pairs. Prints the time to
+ *              open all of them and the time of each Open, averaged over 5 rounds
+ *            framer [rounds]
+ *              test of the SSE2 line framer (CSerialLineFramer) against the scalar framer it
+ *              replaced: lines of every length up to past the longest, with CRLF, LF, empty lines
+ *              and lone CRs, fed in chunks of every size from 1 to 100 bytes and of random sizes,
+ *              must give the same lines and overruns as the scalar framer fed the whole stream.
+ *              Then prints the lines per second of both for lines of 16, 80 and 400 characters
+ *              in 1 KB chunks
+ *            parity [rounds] [soft-device hard-device]
+ *              CSerialSoftParity, computed with SSE2, against a lookup table: 7 bit encode and
+ *              decode and the parity of 9 bit addressing, over 64 KB 200 times; the results must
+ *              match and the MB/s of each are printed. Then a round trip: every 7 bit character
+ *              is encoded at 8N1 and sent to a 7E1 end that checks the parity in hardware
+ *              (dcb.fParity), which sends it back at 7E1; the characters must come back whole,
+ *              without parity errors at either end, and with one at each end for every character
+ *              when encoded with odd parity. The 7E1 end is the device of an RFC 2217 stand-in,
+ *              or hard-device, echoing to soft-device, for two ports wired together
+ *            rfc2217
+ *              test of CSerialRfc2217Transport, alone, against the RFC 2217 stand-in with an echo
+ *              device at 256000 8N1: 16 KB of every byte value are echoed, 0xFF doubled both ways,
+ *              and read 7 bytes at a time while a read of the stream is pending, so that the data
+ *              left in the buffer sits at an offset when the read completes; they must come back
+ *              unchanged, the line settings must reach the server, and with the port set to 8E1
+ *              the line state notifications must come back as errors of ClearCommError and EV_ERR
+ *            transports [mb] [rx-device tx-device]
+ *              cost of each transport: 16 MB received by a listener that checks every byte, from
+ *              the other end of a mem:// pair, from loopback servers for tcp:// and rfc2217:// (0xFF
+ *              doubled), and from tx-device for a pair of local ports, e.g. com0com; prints the
+ *              MB/s and the CPU time per MB of the process, both ends included
+ *  \param  argc number of arguments, the mode included
+ *  \param  argv arguments, the mode first
+ *  \return 0 when the run succeeded, and for a test when its results are within their bounds
+ */
+int RunSerialBench( int argc, _TCHAR * argv[] );
+
+#endif
@@ -0,0 +1,34 @@
+// $Id$
+
+#ifndef __SERIAL_CLOCK_H__
+#define __SERIAL_CLOCK_H__
+
+#include <windows.h>
+
+namespace network {
+
+  /**
+   *  \brief  Monotonic timestamp, in microseconds, taken from the performance counter
+   *  \return microseconds since an arbitrary (boot relative) origin
+   */
+  inline ULONGLONG GetTimestampUs( void )
+  {
+      // the frequency is fixed at boot, so a racy first initialization is harmless
+      static LARGE_INTEGER liFreq = { 0 };
+      LARGE_INTEGER liNow;
+
+      if (liFreq.QuadPart == 0)
+      {
+          QueryPerformanceFrequency(&liFreq);
+      }
+
+      QueryPerformanceCounter(&liNow);
+
+      // split the conversion to avoid overflowing 64 bits on long uptimes
+      return (ULONGLONG)(liNow.QuadPart / liFreq.QuadPart) * 1000000 +
+             (ULONGLONG)((liNow.QuadPart % liFreq.QuadPart) * 1000000 / liFreq.QuadPart);
+  }
+
+};
+
+#endif
@@ -0,0 +1,211 @@
+// $Id$
+
+#include "stdafx.h"
+#include "Serial.h"
+#include "SerialClock.h"
+
+using namespace network;
+
+//! most completions reaped by one call
+#define SERIAL_COMPLETION_BATCH     (64)
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+CSerialCompletionPort::CSerialCompletionPort( DWORD dwThreads )
+{
+    SYSTEM_INFO si;
+    RING * pRing;
+    DWORD i;
+
+    lNextRing = 0;
+    lPorts = 0;
+    lInFlight = 0;
+
+    if (dwThreads == 0)
+    {
+        GetSystemInfo(&si);
+        dwThreads = (si.dwNumberOfProcessors > 0) ? si.dwNumberOfProcessors : 1;
+    }
+
+    for (i = 0; i < dwThreads; i++)
+    {
+        pRing = new RING;
+        pRing->pCompletionPort = this;
+        pRing->hThread = NULL;
+        pRing->dwThreadId = 0;
+        pRing->llWaits = 0;
+        pRing->llCompletions = 0;
+        pRing->dwMaxBatch = 0;
+
+        // one thread per ring, so the completions of a port are never reaped concurrently
+        pRing->hIocp = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+        if (pRing->hIocp == NULL)
+        {
+            delete pRing;
+            throw (unsigned int)::GetLastError();
+        }
+        rings.push_back(pRing);
+
+        pRing->hThread = ::CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)CSerialCompletionPort::ThreadStartRing, pRing, 0, &pRing->dwThreadId);
+        if (pRing->hThread == NULL)
+        {
+            throw (unsigned int)::GetLastError();
+        }
+    }
+
+    return;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+CSerialCompletionPort::~CSerialCompletionPort( )
+{
+    size_t i;
+
+    // a completion without an OVERLAPPED stops a ring
+    for (i = 0; i < rings.size(); i++)
+    {
+        if (rings[i]->hThread != NULL)
+        {
+            PostQueuedCompletionStatus(rings[i]->hIocp, 0, 0, NULL);
+            WaitForSingleObject(rings[i]->hThread, INFINITE);
+            CloseHandle(rings[i]->hThread);
+        }
+    }
+
+    for (i = 0; i < rings.size(); i++)
+    {
+        CloseHandle(rings[i]->hIocp);
+        delete rings[i];
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialCompletionPort::GetThreadCount( void )
+{
+    return DWORD(rings.size());
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialCompletionPort::GetStats( SERIAL_COMPLETION_STATS * pStats )
+{
+    size_t i;
+
+    SecureZeroMemory(pStats, sizeof(SERIAL_COMPLETION_STATS));
+
+    pStats->lPorts = lPorts;
+    pStats->lInFlight = lInFlight;
+
+    for (i = 0; i < rings.size(); i++)
+    {
+        pStats->llWaits += rings[i]->llWaits;
+        pStats->llCompletions += rings[i]->llCompletions;
+        if (rings[i]->dwMaxBatch > pStats->dwMaxBatch)
+        {
+            pStats->dwMaxBatch = rings[i]->dwMaxBatch;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialCompletionPort::Attach( HANDLE hFile, CSerial * pSerial )
+{
+    RING * pRing = rings[DWORD(InterlockedIncrement(&lNextRing)) % rings.size()];
+
+    if (CreateIoCompletionPort(hFile, pRing->hIocp, (ULONG_PTR)pSerial, 0) == NULL)
+    {
+        return ::GetLastError();
+    }
+
+    // nobody waits on the handle itself, the driver may skip signaling it
+    SetFileCompletionNotificationModes(hFile, FILE_SKIP_SET_EVENT_ON_HANDLE);
+
+    InterlockedIncrement(&lPorts);
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialCompletionPort::Detach( void )
+{
+    InterlockedDecrement(&lPorts);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialCompletionPort::IsRingThread( void )
+{
+    DWORD dwThreadId = GetCurrentThreadId();
+    size_t i;
+
+    for (i = 0; i < rings.size(); i++)
+    {
+        if (rings[i]->dwThreadId == dwThreadId)
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialCompletionPort::RingLoop( RING * pRing )
+{
+    OVERLAPPED_ENTRY aEntries[SERIAL_COMPLETION_BATCH];
+    ULONG ulCount;
+    ULONG i;
+    ULONGLONG ullWakeUs;
+    BOOL bQuit = FALSE;
+
+    do
+    {
+        if (!GetQueuedCompletionStatusEx(pRing->hIocp, aEntries, SERIAL_COMPLETION_BATCH, &ulCount, INFINITE, FALSE))
+        {
+            return ::GetLastError();
+        }
+
+        // taken once for the batch, it is the time of the modem line edges and of the data
+        ullWakeUs = GetTimestampUs();
+
+        InterlockedIncrement64(&pRing->llWaits);
+        InterlockedExchangeAdd64(&pRing->llCompletions, ulCount);
+        if (ulCount > pRing->dwMaxBatch)
+        {
+            pRing->dwMaxBatch = ulCount;
+        }
+
+        // the ports of the ring are handled in the order their completions were queued
+        for (i = 0; i < ulCount; i++)
+        {
+            if (aEntries[i].lpOverlapped == NULL)
+            {
+                bQuit = TRUE;
+                continue;
+            }
+
+            ((CSerial*)aEntries[i].lpCompletionKey)->OnCompletion(aEntries[i].lpOverlapped, ullWakeUs);
+        }
+
+    } while (!bQuit);
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD WINAPI CSerialCompletionPort::ThreadStartRing( LPVOID lpParam )
+{
+    RING * pRing;
+
+    pRing = (RING*)lpParam;
+
+    return pRing->pCompletionPort->RingLoop(pRing);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,116 @@
+// $Id$
+
+#ifndef __SERIAL_COMPLETION_H__
+#define __SERIAL_COMPLETION_H__
+
+#include <windows.h>
+#include <vector>
+
+namespace network {
+
+  class CSerial;
+
+  //! kind of a SERIAL_COMPLETION_OP
+  enum EnumSerialCompletionOp
+  {
+    COMPLETION_OP_EVENT,    // WaitCommEvent
+    COMPLETION_OP_READ,     // pre-posted read
+    COMPLETION_OP_WRITE     // write of PostWrite
+  };
+
+  //! operation of a port in flight on a CSerialCompletionPort
+  struct SERIAL_COMPLETION_OP
+  {
+    OVERLAPPED  ov;
+    EnumSerialCompletionOp type;
+    DWORD       dwLen;        // length of a write, events of a WaitCommEvent
+    ULONGLONG   ullStartUs;   // time a write was posted
+    BYTE *      pData;        // buffer of a read or a write
+  };
+
+  //! counters of a completion port
+  struct SERIAL_COMPLETION_STATS
+  {
+    LONG      lPorts;         // ports served
+    LONGLONG  llWaits;        // calls to GetQueuedCompletionStatusEx
+    LONGLONG  llCompletions;  // completions reaped
+    DWORD     dwMaxBatch;     // most completions reaped by one call
+    LONG      lInFlight;      // operations posted and not reaped yet, of all the ports
+  };
+
+  /**
+   *  \brief  Serves many ports from a few threads instead of a listener thread per port. Each
+   *          thread owns an I/O completion port (a ring) and the ports are spread over the rings
+   *          round robin, so the completions of a port are always reaped in order by the same
+   *          thread. A port keeps a WaitCommEvent and a couple of reads pre-posted on its ring
+   *          (a mem:// link only the reads); the reads use the driver read timeouts to complete
+   *          as soon as data is there, so a chunk of received data costs one completion instead
+   *          of an event and a read, and the completions are reaped in batches by
+   *          GetQueuedCompletionStatusEx.
+   *          See CSerial::SetCompletionPort.
+   */
+  class CSerialCompletionPort
+  {
+    friend class CSerial;
+
+    private:
+
+      struct RING
+      {
+        CSerialCompletionPort * pCompletionPort;
+        HANDLE hIocp;
+        HANDLE hThread;
+        DWORD dwThreadId;
+        volatile LONGLONG llWaits;
+        volatile LONGLONG llCompletions;
+        volatile DWORD dwMaxBatch;
+      };
+
+      std::vector<RING*> rings;
+
+      //! round robin of the rings of the ports
+      volatile LONG lNextRing;
+
+      volatile LONG lPorts;
+
+      //! operations posted by the ports and not reaped yet, counted by CSerial
+      volatile LONG lInFlight;
+
+      //! associates the handle of a port with the next ring
+      DWORD Attach( HANDLE hFile, CSerial * pSerial );
+
+      //! the port no longer uses its ring
+      void Detach( void );
+
+      //! the calling thread is one of the rings, which must not wait for their own completions
+      BOOL IsRingThread( void );
+
+      DWORD RingLoop( RING * pRing );
+      static DWORD WINAPI ThreadStartRing( LPVOID lpParam );
+
+    public:
+      /**
+       *  \brief  Constructor
+       *  \param  dwThreads number of rings, 0 for one per processor
+       */
+      CSerialCompletionPort( DWORD dwThreads = 1 ) throw( ... );
+
+      /**
+       *  \brief  Destructor, the ports must have been closed before
+       */
+      virtual ~CSerialCompletionPort( );
+
+      /**
+       *  \brief  Number of rings
+       */
+      DWORD GetThreadCount( void );
+
+      /**
+       *  \brief  Read the counters of the rings, summed
+       */
+      void GetStats( SERIAL_COMPLETION_STATS * pStats );
+  };
+
+};
+
+#endif
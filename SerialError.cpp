@@ -0,0 +1,85 @@
+// $Id$
+
+#include "stdafx.h"
+#include "SerialError.h"
+
+using namespace network;
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+const char * CSerialErrorCategory::name( void ) const throw()
+{
+    return "serial";
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+std::string CSerialErrorCategory::message( int ev ) const
+{
+    char cMessage[256];
+    DWORD dwLen;
+
+    // formatted into the stack, the only allocation is the returned string
+    dwLen = FormatMessageA(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+                           NULL,
+                           DWORD(ev),
+                           MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
+                           cMessage,
+                           sizeof(cMessage),
+                           NULL);
+
+    if (dwLen == 0)
+    {
+        _snprintf(cMessage, sizeof(cMessage) - 1, "Win32 error %d", ev);
+        cMessage[sizeof(cMessage) - 1] = '\0';
+        return std::string(cMessage);
+    }
+
+    // the system messages end with a line break
+    while (dwLen > 0 && (cMessage[dwLen - 1] == '\r' || cMessage[dwLen - 1] == '\n' || cMessage[dwLen - 1] == ' '))
+    {
+        dwLen--;
+    }
+
+    return std::string(cMessage, dwLen);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+std::error_condition CSerialErrorCategory::default_error_condition( int ev ) const throw()
+{
+    switch (ev)
+    {
+        case ERROR_SUCCESS:                 return std::error_condition();
+        case ERROR_FILE_NOT_FOUND:
+        case ERROR_PATH_NOT_FOUND:          return std::make_error_condition(std::errc::no_such_file_or_directory);
+        case ERROR_ACCESS_DENIED:           return std::make_error_condition(std::errc::permission_denied);
+        case ERROR_INVALID_HANDLE:          return std::make_error_condition(std::errc::bad_file_descriptor);
+        case ERROR_NOT_ENOUGH_MEMORY:
+        case ERROR_OUTOFMEMORY:             return std::make_error_condition(std::errc::not_enough_memory);
+        case ERROR_BAD_COMMAND:
+        case ERROR_INVALID_PARAMETER:       return std::make_error_condition(std::errc::invalid_argument);
+        case ERROR_NOT_SUPPORTED:           return std::make_error_condition(std::errc::not_supported);
+        case ERROR_BUSY:
+        case ERROR_SHARING_VIOLATION:       return std::make_error_condition(std::errc::device_or_resource_busy);
+        case ERROR_DEVICE_NOT_CONNECTED:
+        case ERROR_GEN_FAILURE:             return std::make_error_condition(std::errc::no_such_device);
+        case ERROR_OPERATION_ABORTED:       return std::make_error_condition(std::errc::operation_canceled);
+        case ERROR_IO_PENDING:              return std::make_error_condition(std::errc::operation_in_progress);
+        case ERROR_TIMEOUT:
+        case WAIT_TIMEOUT:                  return std::make_error_condition(std::errc::timed_out);
+        default:                            return std::error_condition(ev, *this);
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+//! built before main, a function static would not be initialized thread safely
+static CSerialErrorCategory serialCategory;
+
+const std::error_category & network::serial_category( void )
+{
+    return serialCategory;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,57 @@
+// $Id$
+
+#ifndef __SERIAL_ERROR_H__
+#define __SERIAL_ERROR_H__
+
+#include <windows.h>
+#include <system_error>
+#include <string>
+
+namespace network {
+
+  /**
+   *  \brief  Error category of the serial library. The values are Win32 error codes, kept as
+   *          plain integers: the message text is only formatted when message() is called, so
+   *          building, copying and comparing the errors never allocates. Common codes map to
+   *          the portable std::errc conditions.
+   */
+  class CSerialErrorCategory : public std::error_category
+  {
+    public:
+      virtual const char * name( void ) const throw();
+      virtual std::string message( int ev ) const;
+      virtual std::error_condition default_error_condition( int ev ) const throw();
+  };
+
+  /**
+   *  \brief  The single instance of CSerialErrorCategory
+   */
+  const std::error_category & serial_category( void );
+
+  /**
+   *  \brief  Error code for a Win32 error
+   */
+  inline std::error_code MakeSerialError( DWORD dwError )
+  {
+      return std::error_code( int(dwError), serial_category() );
+  }
+
+  /**
+   *  \brief  Error code for an errno value
+   */
+  inline std::error_code MakeErrnoError( int iErrno )
+  {
+      return std::error_code( iErrno, std::generic_category() );
+  }
+
+  /**
+   *  \brief  Error code for the last error of the calling thread
+   */
+  inline std::error_code GetLastSerialError( void )
+  {
+      return MakeSerialError( ::GetLastError() );
+  }
+
+};
+
+#endif
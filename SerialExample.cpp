@@ -3,6 +3,7 @@
 
 #include "stdafx.h"
 #include "Serial.h"
+#include "SerialBench.h"
 
 using namespace network;
 
@@ -10,6 +11,12 @@ int _tmain(int argc, _TCHAR* argv[])
 {
     CSerial* pSerial;
 
+    // SerialExample <mode> runs a benchmark or a test, see SerialBench.h
+    if (argc > 1)
+    {
+        return RunSerialBench(argc - 1, argv + 1);
+    }
+
     pSerial = new CSerial();
     pSerial->Open("\\\\.\\COM1");
     pSerial->SetBaudRate(CBR_9600);
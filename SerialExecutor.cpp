@@ -0,0 +1,389 @@
+// $Id$
+
+#include "stdafx.h"
+#include "SerialExecutor.h"
+#include <stdlib.h>
+#include <stddef.h>
+
+using namespace network;
+
+//! chunks processed by a strand before it yields the worker to the other strands
+#define SERIAL_STRAND_BATCH     (16)
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+CSerialStrand::CSerialStrand( CSerialExecutor * pExecutor, SERIAL_STRAND_CALLBACK func, LPVOID pContext )
+{
+    this->pExecutor = pExecutor;
+    this->process = func;
+    this->pContext = pContext;
+
+    dwQueuedBytes = 0;
+    dwMaxDepth = 0;
+    bScheduled = FALSE;
+    dwRunThread = 0;
+    dwHomeWorker = DWORD(InterlockedIncrement(&pExecutor->lNextWorker)) % pExecutor->GetThreadCount();
+
+    InitializeCriticalSection(&csQueue);
+    InitializeConditionVariable(&cvIdle);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+CSerialStrand::~CSerialStrand( )
+{
+    Drain();
+    DeleteCriticalSection(&csQueue);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialStrand::Post( const BYTE * pData, DWORD dwLen, ULONGLONG ullFirstUs, ULONGLONG ullLastUs, DWORD dwFlags )
+{
+    SERIAL_CHUNK * pChunk;
+    BOOL bSchedule;
+
+    pChunk = (SERIAL_CHUNK*)malloc(offsetof(SERIAL_CHUNK, abData) + dwLen);
+    if (pChunk == NULL)
+    {
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    pChunk->dwLen = dwLen;
+    pChunk->dwFlags = dwFlags;
+    pChunk->ullFirstUs = ullFirstUs;
+    pChunk->ullLastUs = ullLastUs;
+    memcpy(pChunk->abData, pData, dwLen);
+
+    EnterCriticalSection(&csQueue);
+
+    // the deque allocates its blocks as it grows
+    try
+    {
+        queue.push_back(pChunk);
+    }
+    catch (...)
+    {
+        LeaveCriticalSection(&csQueue);
+        free(pChunk);
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    dwQueuedBytes += dwLen;
+    if (queue.size() > dwMaxDepth)
+    {
+        dwMaxDepth = DWORD(queue.size());
+    }
+
+    // only an idle strand is handed to the executor, a scheduled one picks the chunk up itself
+    bSchedule = !bScheduled;
+    bScheduled = TRUE;
+
+    LeaveCriticalSection(&csQueue);
+
+    if (bSchedule)
+    {
+        pExecutor->Schedule(this);
+    }
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialStrand::Run( void )
+{
+    SERIAL_CHUNK * pChunk;
+    int i;
+
+    dwRunThread = GetCurrentThreadId();
+
+    for (i = 0; i < SERIAL_STRAND_BATCH; i++)
+    {
+        EnterCriticalSection(&csQueue);
+
+        if (queue.empty())
+        {
+            dwRunThread = 0;
+            bScheduled = FALSE;
+            WakeAllConditionVariable(&cvIdle);
+            LeaveCriticalSection(&csQueue);
+            return;
+        }
+
+        pChunk = queue.front();
+        queue.pop_front();
+        dwQueuedBytes -= pChunk->dwLen;
+
+        LeaveCriticalSection(&csQueue);
+
+        process(pContext, pChunk->abData, pChunk->dwLen, pChunk->ullFirstUs, pChunk->ullLastUs, pChunk->dwFlags);
+        free(pChunk);
+
+        InterlockedIncrement64(&pExecutor->llExecuted);
+    }
+
+    dwRunThread = 0;
+
+    EnterCriticalSection(&csQueue);
+
+    if (queue.empty())
+    {
+        bScheduled = FALSE;
+        WakeAllConditionVariable(&cvIdle);
+        LeaveCriticalSection(&csQueue);
+        return;
+    }
+
+    LeaveCriticalSection(&csQueue);
+
+    // still busy: go to the back of the queue so the other strands are not starved
+    pExecutor->Schedule(this);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialStrand::Drain( void )
+{
+    EnterCriticalSection(&csQueue);
+
+    while (bScheduled)
+    {
+        SleepConditionVariableCS(&cvIdle, &csQueue, INFINITE);
+    }
+
+    LeaveCriticalSection(&csQueue);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialStrand::IsCurrentThread( void )
+{
+    return dwRunThread == GetCurrentThreadId();
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialStrand::GetQueueDepth( void )
+{
+    DWORD dwDepth;
+
+    EnterCriticalSection(&csQueue);
+    dwDepth = DWORD(queue.size());
+    LeaveCriticalSection(&csQueue);
+
+    return dwDepth;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialStrand::GetQueuedBytes( void )
+{
+    DWORD dwBytes;
+
+    EnterCriticalSection(&csQueue);
+    dwBytes = dwQueuedBytes;
+    LeaveCriticalSection(&csQueue);
+
+    return dwBytes;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialStrand::GetMaxQueueDepth( void )
+{
+    DWORD dwDepth;
+
+    EnterCriticalSection(&csQueue);
+    dwDepth = dwMaxDepth;
+    LeaveCriticalSection(&csQueue);
+
+    return dwDepth;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+CSerialExecutor::CSerialExecutor( DWORD dwThreads )
+{
+    SYSTEM_INFO si;
+    WORKER * pWorker;
+    DWORD i;
+
+    bQuit = FALSE;
+    lQueued = 0;
+    llExecuted = 0;
+    llStolen = 0;
+    lNextWorker = 0;
+
+    if (dwThreads == 0)
+    {
+        GetSystemInfo(&si);
+        dwThreads = (si.dwNumberOfProcessors > 0) ? si.dwNumberOfProcessors : 1;
+    }
+
+    hWork = CreateSemaphore(NULL, 0, MAXLONG, NULL);
+    if (hWork == NULL)
+    {
+        throw (unsigned int)::GetLastError();
+    }
+
+    // every queue exists before the first worker may try to steal from it
+    for (i = 0; i < dwThreads; i++)
+    {
+        pWorker = new WORKER;
+        pWorker->pExecutor = this;
+        pWorker->dwIndex = i;
+        pWorker->hThread = NULL;
+        InitializeCriticalSection(&pWorker->csQueue);
+        workers.push_back(pWorker);
+    }
+
+    for (i = 0; i < dwThreads; i++)
+    {
+        workers[i]->hThread = ::CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)CSerialExecutor::ThreadStartWorker, workers[i], 0, NULL);
+        if (workers[i]->hThread == NULL)
+        {
+            throw (unsigned int)::GetLastError();
+        }
+    }
+
+    return;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+CSerialExecutor::~CSerialExecutor( )
+{
+    size_t i;
+
+    bQuit = TRUE;
+    ReleaseSemaphore(hWork, LONG(workers.size()), NULL);
+
+    for (i = 0; i < workers.size(); i++)
+    {
+        if (workers[i]->hThread != NULL)
+        {
+            WaitForSingleObject(workers[i]->hThread, INFINITE);
+            CloseHandle(workers[i]->hThread);
+        }
+    }
+
+    for (i = 0; i < workers.size(); i++)
+    {
+        DeleteCriticalSection(&workers[i]->csQueue);
+        delete workers[i];
+    }
+
+    CloseHandle(hWork);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialExecutor::GetThreadCount( void )
+{
+    return DWORD(workers.size());
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialExecutor::GetStats( SERIAL_EXECUTOR_STATS * pStats )
+{
+    pStats->lQueued = lQueued;
+    pStats->llExecuted = llExecuted;
+    pStats->llStolen = llStolen;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialExecutor::Schedule( CSerialStrand * pStrand )
+{
+    WORKER * pWorker = workers[pStrand->dwHomeWorker];
+
+    EnterCriticalSection(&pWorker->csQueue);
+    pWorker->queue.push_back(pStrand);
+    LeaveCriticalSection(&pWorker->csQueue);
+
+    InterlockedIncrement(&lQueued);
+    ReleaseSemaphore(hWork, 1, NULL);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+CSerialStrand * CSerialExecutor::Take( WORKER * pWorker )
+{
+    CSerialStrand * pStrand = NULL;
+    WORKER * pVictim;
+    size_t i;
+
+    EnterCriticalSection(&pWorker->csQueue);
+    if (!pWorker->queue.empty())
+    {
+        pStrand = pWorker->queue.front();
+        pWorker->queue.pop_front();
+    }
+    LeaveCriticalSection(&pWorker->csQueue);
+
+    // steal from the tail, the end the owner will reach last
+    for (i = 1; pStrand == NULL && i < workers.size(); i++)
+    {
+        pVictim = workers[(pWorker->dwIndex + i) % workers.size()];
+
+        EnterCriticalSection(&pVictim->csQueue);
+        if (!pVictim->queue.empty())
+        {
+            pStrand = pVictim->queue.back();
+            pVictim->queue.pop_back();
+            InterlockedIncrement64(&llStolen);
+        }
+        LeaveCriticalSection(&pVictim->csQueue);
+    }
+
+    if (pStrand != NULL)
+    {
+        InterlockedDecrement(&lQueued);
+    }
+
+    return pStrand;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialExecutor::WorkerLoop( WORKER * pWorker )
+{
+    CSerialStrand * pStrand;
+
+    do
+    {
+        WaitForSingleObject(hWork, INFINITE);
+
+        if (bQuit == TRUE)
+        {
+            break;
+        }
+
+        // the count guarantees a queued strand, but the scan may pass a queue just
+        // before a strand is pushed to it while another worker takes the one it would find
+        while ((pStrand = Take(pWorker)) == NULL)
+        {
+            SwitchToThread();
+        }
+
+        pStrand->Run();
+
+    } while (1);
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD WINAPI CSerialExecutor::ThreadStartWorker( LPVOID lpParam )
+{
+    WORKER * pWorker;
+
+    pWorker = (WORKER*)lpParam;
+
+    return pWorker->pExecutor->WorkerLoop(pWorker);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,190 @@
+// $Id$
+
+#ifndef __SERIAL_EXECUTOR_H__
+#define __SERIAL_EXECUTOR_H__
+
+#include <windows.h>
+#include <deque>
+#include <vector>
+
+namespace network {
+
+  class CSerialExecutor;
+
+  //! function that processes the data dispatched by a strand: context, data, length, the
+  //!   timestamps (in microseconds) of the first and last bytes and the flags given to Post
+  typedef void(*SERIAL_STRAND_CALLBACK)( LPVOID, BYTE*, DWORD, ULONGLONG, ULONGLONG, DWORD );
+
+  //! counters of an executor
+  struct SERIAL_EXECUTOR_STATS
+  {
+    LONG      lQueued;      // strands waiting for a worker
+    LONGLONG  llExecuted;   // chunks processed
+    LONGLONG  llStolen;     // strands taken from the queue of another worker
+  };
+
+  /**
+   *  \brief  Ordered queue of received chunks executed by a CSerialExecutor. The chunks of a
+   *          strand are processed in the order they were posted and never concurrently, while
+   *          different strands run in parallel on the workers of the executor.
+   */
+  class CSerialStrand
+  {
+    friend class CSerialExecutor;
+
+    private:
+
+      //! chunk waiting to be processed, the data follows the header
+      struct SERIAL_CHUNK
+      {
+        DWORD     dwLen;
+        DWORD     dwFlags;
+        ULONGLONG ullFirstUs;
+        ULONGLONG ullLastUs;
+        BYTE      abData[1];
+      };
+
+      CSerialExecutor * pExecutor;
+
+      //! function that processes the chunks and its context
+      SERIAL_STRAND_CALLBACK process;
+      LPVOID pContext;
+
+      //! protects the queue and the scheduling state
+      CRITICAL_SECTION csQueue;
+
+      //! signaled when the strand becomes idle
+      CONDITION_VARIABLE cvIdle;
+
+      std::deque<SERIAL_CHUNK*> queue;
+
+      DWORD dwQueuedBytes;
+      DWORD dwMaxDepth;
+
+      //! the strand is in a worker queue or running, so it must not be scheduled again
+      BOOL bScheduled;
+
+      //! worker whose queue receives the strand
+      DWORD dwHomeWorker;
+
+      //! thread running the callback, 0 between the batches
+      volatile DWORD dwRunThread;
+
+      //! process a batch of chunks, called by a worker
+      void Run( void );
+
+    public:
+      /**
+       *  \brief  Constructor
+       *  \param  pExecutor executor that runs the strand
+       *  \param  func function that processes the chunks
+       *  \param  pContext value passed to func
+       */
+      CSerialStrand( CSerialExecutor * pExecutor, SERIAL_STRAND_CALLBACK func, LPVOID pContext );
+
+      /**
+       *  \brief  Destructor, waits for the queued chunks to be processed
+       */
+      virtual ~CSerialStrand( );
+
+      /**
+       *  \brief  Queue a copy of a chunk to be processed
+       *  \param  dwFlags value of the caller handed to the callback with the chunk
+       *  \return status of operation
+       */
+      DWORD Post( const BYTE * pData, DWORD dwLen, ULONGLONG ullFirstUs, ULONGLONG ullLastUs, DWORD dwFlags = 0 );
+
+      /**
+       *  \brief  Wait until every queued chunk was processed. Must not be called by the strand callback.
+       */
+      void Drain( void );
+
+      /**
+       *  \brief  The calling thread is running the callback of the strand, so it must not drain it
+       */
+      BOOL IsCurrentThread( void );
+
+      /**
+       *  \brief  Number of chunks waiting to be processed
+       */
+      DWORD GetQueueDepth( void );
+
+      /**
+       *  \brief  Number of bytes waiting to be processed
+       */
+      DWORD GetQueuedBytes( void );
+
+      /**
+       *  \brief  Largest number of chunks ever waiting to be processed
+       */
+      DWORD GetMaxQueueDepth( void );
+  };
+
+  /**
+   *  \brief  Fixed-size pool of worker threads that execute strands. Each worker has its own
+   *          queue and steals from the others when it runs out of work.
+   */
+  class CSerialExecutor
+  {
+    friend class CSerialStrand;
+
+    private:
+
+      struct WORKER
+      {
+        CSerialExecutor * pExecutor;
+        DWORD dwIndex;
+        HANDLE hThread;
+        CRITICAL_SECTION csQueue;
+        std::deque<CSerialStrand*> queue;
+      };
+
+      std::vector<WORKER*> workers;
+
+      //! semaphore with one count for each scheduled strand
+      HANDLE hWork;
+
+      volatile BOOL bQuit;
+
+      volatile LONG lQueued;
+      volatile LONGLONG llExecuted;
+      volatile LONGLONG llStolen;
+
+      //! round robin of the home worker of the strands
+      volatile LONG lNextWorker;
+
+      //! queue a strand to its home worker
+      void Schedule( CSerialStrand * pStrand );
+
+      //! take a strand from the worker queue or steal one from another worker
+      CSerialStrand * Take( WORKER * pWorker );
+
+      DWORD WorkerLoop( WORKER * pWorker );
+      static DWORD WINAPI ThreadStartWorker( LPVOID lpParam );
+
+    public:
+      /**
+       *  \brief  Constructor
+       *  \param  dwThreads number of workers, 0 for one per processor
+       */
+      CSerialExecutor( DWORD dwThreads = 0 ) throw( ... );
+
+      /**
+       *  \brief  Destructor, the strands must have been destroyed before
+       */
+      virtual ~CSerialExecutor( );
+
+      /**
+       *  \brief  Number of workers
+       */
+      DWORD GetThreadCount( void );
+
+      /**
+       *  \brief  Read the counters of the executor
+       */
+      void GetStats( SERIAL_EXECUTOR_STATS * pStats );
+  };
+
+};
+
+#endif
@@ -0,0 +1,1546 @@
+// $Id$
+
+#include "stdafx.h"
+#include "SerialFileTransfer.h"
+#include "SerialClock.h"
+#include <string.h>
+
+using namespace network;
+
+#define SERIAL_XFER_TX_LEN      (4096)
+#define SERIAL_XFER_RETRIES     (10)
+#define SERIAL_XFER_MAX_GARBAGE (1200)
+
+//! wait for the line end of a hex header, it follows the header on the wire
+#define SERIAL_XFER_TRAILER_MS  (100)
+
+//! results of RecvByte and of the ZMODEM receive functions
+#define SERIAL_RX_TIMEOUT       (-1)
+#define SERIAL_RX_CANCELLED     (-2)
+#define SERIAL_RX_BADCRC        (-3)
+
+// XMODEM / YMODEM
+#define X_SOH       (0x01)
+#define X_STX       (0x02)
+#define X_EOT       (0x04)
+#define X_ACK       (0x06)
+#define X_NAK       (0x15)
+#define X_CAN       (0x18)
+#define X_SUB       (0x1A)
+
+// ZMODEM
+#define Z_PAD       ('*')
+#define Z_DLE       (0x18)
+#define Z_BIN       ('A')
+#define Z_HEX       ('B')
+#define Z_BIN32     ('C')
+#define Z_RUB0      ('l')
+#define Z_RUB1      ('m')
+#define Z_XON       (0x11)
+#define Z_XOFF      (0x13)
+
+#define Z_RQINIT    (0)
+#define Z_RINIT     (1)
+#define Z_ACK       (3)
+#define Z_FILE      (4)
+#define Z_SKIP      (5)
+#define Z_NAK       (6)
+#define Z_FIN       (8)
+#define Z_RPOS      (9)
+#define Z_DATA      (10)
+#define Z_EOF       (11)
+#define Z_CRC       (13)
+#define Z_CHALLENGE (14)
+
+#define Z_CRCE      ('h')
+#define Z_CRCG      ('i')
+#define Z_CRCQ      ('j')
+#define Z_CRCW      ('k')
+
+//! ZF0 of ZRINIT
+#define Z_CANFC32   (0x20)
+#define Z_ESCCTL    (0x40)
+
+//! ZF0 of ZFILE, binary transfer
+#define Z_CBIN      (1)
+
+//! index of ZF0 in the 4 bytes of a header, the flags are stored in reverse order of the position
+#define Z_F0        (3)
+
+//! subpacket length of ZMODEM
+#define Z_BLOCK_LEN (1024)
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static void PutZPos( BYTE * pHdr, DWORD dwPos )
+{
+    pHdr[0] = BYTE(dwPos);
+    pHdr[1] = BYTE(dwPos >> 8);
+    pHdr[2] = BYTE(dwPos >> 16);
+    pHdr[3] = BYTE(dwPos >> 24);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static DWORD GetZPos( const BYTE * pHdr )
+{
+    return DWORD(pHdr[0]) | (DWORD(pHdr[1]) << 8) | (DWORD(pHdr[2]) << 16) | (DWORD(pHdr[3]) << 24);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static int HexValue( int c )
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+
+    return -1;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+CSerialFileTransfer::CSerialFileTransfer( CSerial * pSerial )
+{
+    DWORD i, j, dwCrc;
+
+    this->pSerial = pSerial;
+
+    dwRxHead = 0;
+    dwRxCount = 0;
+    dwTxCur = 0;
+    dwTxLastLen = 0;
+    bTxPending = FALSE;
+    pFile = NULL;
+    dwFileSize = 0;
+    cFileName[0] = '\0';
+    ullFileTime = 0;
+    dwTimeoutMs = 10000;
+    dwWindow = 0;
+    progress = NULL;
+    bCrc32 = FALSE;
+    bEscCtl = FALSE;
+    dwRxBufSize = 0;
+    memset(&stats, 0, sizeof(stats));
+
+    for (i = 0; i < 256; i++)
+    {
+        dwCrc = i << 8;
+        for (j = 0; j < 8; j++)
+        {
+            dwCrc = (dwCrc & 0x8000) ? (dwCrc << 1) ^ 0x1021 : (dwCrc << 1);
+        }
+        awCrc16[i] = WORD(dwCrc);
+
+        dwCrc = i;
+        for (j = 0; j < 8; j++)
+        {
+            dwCrc = (dwCrc & 1) ? (dwCrc >> 1) ^ 0xEDB88320 : (dwCrc >> 1);
+        }
+        adwCrc32[i] = dwCrc;
+    }
+
+    InitializeCriticalSection(&csRx);
+
+    hRxEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    hCancelEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (hRxEvent == NULL || hCancelEvent == NULL)
+    {
+        throw (unsigned int)::GetLastError();
+    }
+
+    pTx[0] = new BYTE[SERIAL_XFER_TX_LEN];
+    pTx[1] = new BYTE[SERIAL_XFER_TX_LEN];
+
+    return;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+CSerialFileTransfer::~CSerialFileTransfer( )
+{
+    delete [] pTx[0];
+    delete [] pTx[1];
+
+    CloseHandle(hRxEvent);
+    CloseHandle(hCancelEvent);
+    DeleteCriticalSection(&csRx);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialFileTransfer::Cancel( void )
+{
+    SetEvent(hCancelEvent);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialFileTransfer::SetTimeout( DWORD dwMs )
+{
+    dwTimeoutMs = dwMs;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialFileTransfer::SetWindow( DWORD dwBytes )
+{
+    dwWindow = dwBytes;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialFileTransfer::RegisterProgress( SERIAL_TRANSFER_PROGRESS func )
+{
+    progress = func;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialFileTransfer::GetStats( SERIAL_TRANSFER_STATS * pStats )
+{
+    *pStats = stats;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialFileTransfer::Send( const char * cPath, EnumSerialTransferProtocol protocol )
+{
+    HANDLE hFile;
+    HANDLE hMapping = NULL;
+    LARGE_INTEGER liSize;
+    FILETIME ftWrite;
+    const char * cName;
+    const char * p;
+    ULONGLONG ullStart;
+    DWORD dwResult;
+
+    memset(&stats, 0, sizeof(stats));
+    ullStart = GetTimestampUs();
+
+    hFile = CreateFileA(cPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return ::GetLastError();
+    }
+
+    if (!GetFileSizeEx(hFile, &liSize) || !GetFileTime(hFile, NULL, NULL, &ftWrite))
+    {
+        dwResult = ::GetLastError();
+        CloseHandle(hFile);
+        return dwResult;
+    }
+
+    // the protocols carry 32 bits positions, and ZMODEM treats them as signed
+    if (liSize.QuadPart > 0x7FFFFFFF)
+    {
+        CloseHandle(hFile);
+        return ERROR_FILE_TOO_LARGE;
+    }
+
+    dwFileSize = DWORD(liSize.QuadPart);
+    pFile = NULL;
+
+    // an empty file cannot be mapped
+    if (dwFileSize > 0)
+    {
+        hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (hMapping != NULL)
+        {
+            pFile = (const BYTE*)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+        }
+
+        if (pFile == NULL)
+        {
+            dwResult = ::GetLastError();
+            if (hMapping != NULL)
+            {
+                CloseHandle(hMapping);
+            }
+            CloseHandle(hFile);
+            return dwResult;
+        }
+    }
+
+    // seconds since 1970 for the file information of YMODEM and ZMODEM
+    ullFileTime = ((ULONGLONG(ftWrite.dwHighDateTime) << 32) | ftWrite.dwLowDateTime);
+    ullFileTime = (ullFileTime > 116444736000000000ULL) ? (ullFileTime - 116444736000000000ULL) / 10000000 : 0;
+
+    cName = cPath;
+    for (p = cPath; *p != '\0'; p++)
+    {
+        if (*p == '\\' || *p == '/' || *p == ':')
+        {
+            cName = p + 1;
+        }
+    }
+    _snprintf(cFileName, sizeof(cFileName) - 1, "%s", cName);
+    cFileName[sizeof(cFileName) - 1] = '\0';
+
+    ResetEvent(hCancelEvent);
+    PurgeRx();
+    dwTxCur = 0;
+    bTxPending = FALSE;
+
+    pSerial->SetReceiveTap(CSerialFileTransfer::OnReceive, this);
+
+    switch (protocol)
+    {
+        case TRANSFER_XMODEM_1K:
+            dwResult = SendXmodem(FALSE);
+            break;
+
+        case TRANSFER_YMODEM:
+            dwResult = SendXmodem(TRUE);
+            break;
+
+        case TRANSFER_ZMODEM:
+            dwResult = SendZmodem();
+            break;
+
+        default:
+            dwResult = ERROR_INVALID_PARAMETER;
+            break;
+    }
+
+    TxWait();
+
+    // leave the receiver in a known state
+    if (dwResult != ERROR_SUCCESS && dwResult != ERROR_INVALID_PARAMETER)
+    {
+        SendCancel();
+    }
+
+    pSerial->SetReceiveTap(NULL, NULL);
+
+    if (pFile != NULL)
+    {
+        UnmapViewOfFile(pFile);
+        CloseHandle(hMapping);
+        pFile = NULL;
+    }
+    CloseHandle(hFile);
+
+    stats.ullElapsedUs = GetTimestampUs() - ullStart;
+
+    return dwResult;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialFileTransfer::OnReceive( LPVOID pContext, BYTE * pBuffer, DWORD dwLen )
+{
+    CSerialFileTransfer * pThis = (CSerialFileTransfer*)pContext;
+    DWORD i;
+
+    EnterCriticalSection(&pThis->csRx);
+
+    // the replies are short, whatever does not fit is line noise anyway
+    for (i = 0; i < dwLen && pThis->dwRxCount < sizeof(pThis->abRx); i++)
+    {
+        pThis->abRx[(pThis->dwRxHead + pThis->dwRxCount) % sizeof(pThis->abRx)] = pBuffer[i];
+        pThis->dwRxCount++;
+    }
+
+    SetEvent(pThis->hRxEvent);
+
+    LeaveCriticalSection(&pThis->csRx);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+int CSerialFileTransfer::RecvByte( DWORD dwTimeoutMs, BOOL bPeek )
+{
+    HANDLE ahWait[2];
+    int c;
+
+    ahWait[0] = hCancelEvent;
+    ahWait[1] = hRxEvent;
+
+    do
+    {
+        EnterCriticalSection(&csRx);
+
+        if (dwRxCount > 0)
+        {
+            c = abRx[dwRxHead];
+            if (!bPeek)
+            {
+                dwRxHead = (dwRxHead + 1) % sizeof(abRx);
+                dwRxCount--;
+            }
+            LeaveCriticalSection(&csRx);
+            return c;
+        }
+
+        // reset under the lock, so a byte arriving now sets it again
+        ResetEvent(hRxEvent);
+
+        LeaveCriticalSection(&csRx);
+
+        switch (WaitForMultipleObjects(2, ahWait, FALSE, dwTimeoutMs))
+        {
+            case WAIT_OBJECT_0:
+                return SERIAL_RX_CANCELLED;
+
+            case WAIT_OBJECT_0 + 1:
+                break;
+
+            default:
+                return SERIAL_RX_TIMEOUT;
+        }
+
+    } while (1);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialFileTransfer::PurgeRx( void )
+{
+    EnterCriticalSection(&csRx);
+    dwRxHead = 0;
+    dwRxCount = 0;
+    LeaveCriticalSection(&csRx);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+WORD CSerialFileTransfer::Crc16( WORD wCrc, const BYTE * pData, DWORD dwLen )
+{
+    while (dwLen-- > 0)
+    {
+        wCrc = WORD((wCrc << 8) ^ awCrc16[(wCrc >> 8) ^ *pData++]);
+    }
+
+    return wCrc;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialFileTransfer::Crc32( DWORD dwCrc, const BYTE * pData, DWORD dwLen )
+{
+    while (dwLen-- > 0)
+    {
+        dwCrc = (dwCrc >> 8) ^ adwCrc32[(dwCrc ^ *pData++) & 0xFF];
+    }
+
+    return dwCrc;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BYTE * CSerialFileTransfer::TxBuffer( void )
+{
+    return pTx[dwTxCur];
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialFileTransfer::TxWait( void )
+{
+    if (bTxPending)
+    {
+        bTxPending = FALSE;
+
+        if (pSerial->EndWrite() != int(dwTxLastLen))
+        {
+            return ERROR_WRITE_FAULT;
+        }
+    }
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialFileTransfer::TxSend( DWORD dwLen )
+{
+    DWORD dwResult;
+
+    if (WaitForSingleObject(hCancelEvent, 0) == WAIT_OBJECT_0)
+    {
+        return ERROR_CANCELLED;
+    }
+
+    dwResult = TxWait();
+    if (dwResult != ERROR_SUCCESS)
+    {
+        return dwResult;
+    }
+
+    dwResult = pSerial->BeginWrite((const char*)pTx[dwTxCur], int(dwLen));
+    if (dwResult != ERROR_SUCCESS)
+    {
+        return dwResult;
+    }
+
+    bTxPending = TRUE;
+    dwTxLastLen = dwLen;
+    stats.ullLineBytes += dwLen;
+
+    // the caller builds the next block while this one is on the wire
+    dwTxCur ^= 1;
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialFileTransfer::TxResend( void )
+{
+    DWORD dwResult;
+
+    if (WaitForSingleObject(hCancelEvent, 0) == WAIT_OBJECT_0)
+    {
+        return ERROR_CANCELLED;
+    }
+
+    dwResult = TxWait();
+    if (dwResult != ERROR_SUCCESS)
+    {
+        return dwResult;
+    }
+
+    dwResult = pSerial->BeginWrite((const char*)pTx[dwTxCur ^ 1], int(dwTxLastLen));
+    if (dwResult != ERROR_SUCCESS)
+    {
+        return dwResult;
+    }
+
+    bTxPending = TRUE;
+    stats.ullLineBytes += dwTxLastLen;
+    stats.dwRetries++;
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialFileTransfer::SendRaw( const BYTE * pData, DWORD dwLen )
+{
+    memcpy(TxBuffer(), pData, dwLen);
+
+    return TxSend(dwLen);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialFileTransfer::SendCancel( void )
+{
+    static const BYTE abCancel[] = { X_CAN, X_CAN, X_CAN, X_CAN, X_CAN, X_CAN, X_CAN, X_CAN,
+                                     0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08 };
+
+    // Cancel may be the reason, so bypass TxSend
+    TxWait();
+    memcpy(TxBuffer(), abCancel, sizeof(abCancel));
+    if (pSerial->BeginWrite((const char*)TxBuffer(), sizeof(abCancel)) == ERROR_SUCCESS)
+    {
+        pSerial->EndWrite();
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialFileTransfer::ReportProgress( ULONGLONG ullDone )
+{
+    stats.ullFileBytes = ullDone;
+
+    if (progress != NULL)
+    {
+        progress(ullDone, dwFileSize);
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialFileTransfer::BuildXmodemBlock( BYTE * pBlock, DWORD dwSeq, const BYTE * pData, DWORD dwLen, DWORD dwBlockLen, BOOL bCrc, BYTE bPad )
+{
+    WORD wCrc;
+    BYTE bSum;
+    DWORD i;
+
+    pBlock[0] = (dwBlockLen == 1024) ? X_STX : X_SOH;
+    pBlock[1] = BYTE(dwSeq);
+    pBlock[2] = BYTE(~dwSeq);
+
+    memcpy(pBlock + 3, pData, dwLen);
+    memset(pBlock + 3 + dwLen, bPad, dwBlockLen - dwLen);
+
+    if (bCrc)
+    {
+        wCrc = Crc16(0, pBlock + 3, dwBlockLen);
+        pBlock[3 + dwBlockLen] = BYTE(wCrc >> 8);
+        pBlock[4 + dwBlockLen] = BYTE(wCrc);
+        return dwBlockLen + 5;
+    }
+
+    bSum = 0;
+    for (i = 0; i < dwBlockLen; i++)
+    {
+        bSum = BYTE(bSum + pBlock[3 + i]);
+    }
+    pBlock[3 + dwBlockLen] = bSum;
+
+    return dwBlockLen + 4;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialFileTransfer::BuildYmodemHeader( BYTE * pBlock, BOOL bEnd )
+{
+    char cInfo[MAX_PATH + 64];
+    DWORD dwLen = 0;
+
+    // the null header ends the batch
+    if (!bEnd)
+    {
+        dwLen = DWORD(strlen(cFileName)) + 1;
+        memcpy(cInfo, cFileName, dwLen);
+        dwLen += _snprintf(cInfo + dwLen, sizeof(cInfo) - dwLen - 1, "%lu %llo 100644", (unsigned long)dwFileSize, ullFileTime);
+    }
+
+    return BuildXmodemBlock(pBlock, 0, (const BYTE*)cInfo, dwLen, (dwLen <= 128) ? 128 : 1024, TRUE, 0);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialFileTransfer::WaitXmodemStart( BOOL * pbCrc )
+{
+    DWORD dwTries = 0;
+    BOOL bCan = FALSE;
+    int c;
+
+    while (dwTries < SERIAL_XFER_RETRIES)
+    {
+        c = RecvByte(dwTimeoutMs);
+
+        switch (c)
+        {
+            case 'C':
+                *pbCrc = TRUE;
+                return ERROR_SUCCESS;
+
+            case X_NAK:
+                *pbCrc = FALSE;
+                return ERROR_SUCCESS;
+
+            case X_CAN:
+                if (bCan)
+                {
+                    return ERROR_CANCELLED;
+                }
+                bCan = TRUE;
+                continue;
+
+            case SERIAL_RX_TIMEOUT:
+                dwTries++;
+                break;
+
+            case SERIAL_RX_CANCELLED:
+                return ERROR_CANCELLED;
+        }
+
+        bCan = FALSE;
+    }
+
+    return ERROR_TIMEOUT;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialFileTransfer::WaitXmodemAck( void )
+{
+    DWORD dwTries = 0;
+    DWORD dwResult;
+    BOOL bCan = FALSE;
+    int c;
+
+    while (dwTries < SERIAL_XFER_RETRIES)
+    {
+        c = RecvByte(dwTimeoutMs);
+
+        switch (c)
+        {
+            case X_ACK:
+                return ERROR_SUCCESS;
+
+            case X_CAN:
+                if (bCan)
+                {
+                    return ERROR_CANCELLED;
+                }
+                bCan = TRUE;
+                continue;
+
+            case X_NAK:
+            case SERIAL_RX_TIMEOUT:
+                dwTries++;
+                dwResult = TxResend();
+                if (dwResult != ERROR_SUCCESS)
+                {
+                    return dwResult;
+                }
+                break;
+
+            case SERIAL_RX_CANCELLED:
+                return ERROR_CANCELLED;
+        }
+
+        bCan = FALSE;
+    }
+
+    return ERROR_TIMEOUT;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialFileTransfer::SendXmodem( BOOL bYmodem )
+{
+    static const BYTE abEot[] = { X_EOT };
+    DWORD dwOffset = 0;
+    DWORD dwSeq = 1;
+    DWORD dwLen = 0;
+    DWORD dwNextLen = 0;
+    DWORD dwNextData = 0;
+    DWORD dwBlockLen;
+    DWORD dwTries;
+    DWORD dwResult;
+    BOOL bCrc;
+    int c;
+
+    dwResult = WaitXmodemStart(&bCrc);
+    if (dwResult != ERROR_SUCCESS)
+    {
+        return dwResult;
+    }
+
+    if (bYmodem)
+    {
+        if (!bCrc)
+        {
+            return ERROR_INVALID_DATA;
+        }
+
+        dwResult = TxSend(BuildYmodemHeader(TxBuffer(), FALSE));
+        if (dwResult == ERROR_SUCCESS)
+        {
+            dwResult = WaitXmodemAck();
+        }
+
+        // the receiver asks for the data with a new 'C'
+        if (dwResult == ERROR_SUCCESS)
+        {
+            dwResult = WaitXmodemStart(&bCrc);
+        }
+
+        if (dwResult != ERROR_SUCCESS)
+        {
+            return dwResult;
+        }
+    }
+
+    // 1K blocks, but a short tail goes in a 128 bytes block to save the padding.
+    // Without CRC the receiver is a plain XMODEM one, which knows only 128 bytes blocks.
+    if (dwFileSize > 0)
+    {
+        dwBlockLen = (bCrc && dwFileSize > 128) ? 1024 : 128;
+        dwLen = (dwFileSize < dwBlockLen) ? dwFileSize : dwBlockLen;
+        dwResult = TxSend(BuildXmodemBlock(TxBuffer(), dwSeq, pFile, dwLen, dwBlockLen, bCrc, X_SUB));
+        if (dwResult != ERROR_SUCCESS)
+        {
+            return dwResult;
+        }
+    }
+
+    while (dwOffset < dwFileSize)
+    {
+        // build the next block while the current one is on the wire
+        if (dwOffset + dwLen < dwFileSize)
+        {
+            dwBlockLen = (bCrc && dwFileSize - dwOffset - dwLen > 128) ? 1024 : 128;
+            dwNextData = dwFileSize - dwOffset - dwLen;
+            dwNextData = (dwNextData < dwBlockLen) ? dwNextData : dwBlockLen;
+            dwNextLen = BuildXmodemBlock(TxBuffer(), dwSeq + 1, pFile + dwOffset + dwLen, dwNextData, dwBlockLen, bCrc, X_SUB);
+        }
+
+        dwResult = WaitXmodemAck();
+        if (dwResult != ERROR_SUCCESS)
+        {
+            return dwResult;
+        }
+
+        dwOffset += dwLen;
+        dwSeq++;
+        ReportProgress(dwOffset);
+
+        if (dwOffset < dwFileSize)
+        {
+            dwLen = dwNextData;
+            dwResult = TxSend(dwNextLen);
+            if (dwResult != ERROR_SUCCESS)
+            {
+                return dwResult;
+            }
+        }
+    }
+
+    // YMODEM receivers NAK the first EOT
+    for (dwTries = 0; ; dwTries++)
+    {
+        if (dwTries == SERIAL_XFER_RETRIES)
+        {
+            return ERROR_TIMEOUT;
+        }
+
+        dwResult = SendRaw(abEot, sizeof(abEot));
+        if (dwResult != ERROR_SUCCESS)
+        {
+            return dwResult;
+        }
+
+        do
+        {
+            c = RecvByte(dwTimeoutMs);
+        } while (c >= 0 && c != X_ACK && c != X_NAK);
+
+        if (c == X_ACK)
+        {
+            break;
+        }
+
+        if (c == SERIAL_RX_CANCELLED)
+        {
+            return ERROR_CANCELLED;
+        }
+    }
+
+    if (bYmodem)
+    {
+        dwResult = WaitXmodemStart(&bCrc);
+        if (dwResult == ERROR_SUCCESS)
+        {
+            dwResult = TxSend(BuildYmodemHeader(TxBuffer(), TRUE));
+        }
+        if (dwResult == ERROR_SUCCESS)
+        {
+            dwResult = WaitXmodemAck();
+        }
+    }
+
+    return dwResult;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialFileTransfer::ZEscape( BYTE * pOut, const BYTE * pIn, DWORD dwLen )
+{
+    BYTE * p = pOut;
+    BYTE c;
+
+    while (dwLen-- > 0)
+    {
+        c = *pIn++;
+
+        // ZDLE and the flow control characters, in both parities
+        if (c == Z_DLE || (c & 0x7F) == 0x10 || (c & 0x7F) == Z_XON || (c & 0x7F) == Z_XOFF ||
+            (bEscCtl && (c & 0x60) == 0))
+        {
+            *p++ = Z_DLE;
+            *p++ = c ^ 0x40;
+        }
+        else
+        {
+            *p++ = c;
+        }
+    }
+
+    return DWORD(p - pOut);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialFileTransfer::BuildZHexHeader( BYTE * pOut, BYTE bType, const BYTE * pHdr )
+{
+    static const char cHex[] = "0123456789abcdef";
+    BYTE abFrame[7];
+    BYTE * p = pOut;
+    WORD wCrc;
+    int i;
+
+    abFrame[0] = bType;
+    memcpy(abFrame + 1, pHdr, 4);
+    wCrc = Crc16(0, abFrame, 5);
+    abFrame[5] = BYTE(wCrc >> 8);
+    abFrame[6] = BYTE(wCrc);
+
+    *p++ = Z_PAD;
+    *p++ = Z_PAD;
+    *p++ = Z_DLE;
+    *p++ = Z_HEX;
+
+    for (i = 0; i < 7; i++)
+    {
+        *p++ = cHex[abFrame[i] >> 4];
+        *p++ = cHex[abFrame[i] & 0x0F];
+    }
+
+    *p++ = '\r';
+    *p++ = 0x8A;
+
+    // the receiver may have been stopped by a spurious XOFF
+    if (bType != Z_ACK && bType != Z_FIN)
+    {
+        *p++ = Z_XON;
+    }
+
+    return DWORD(p - pOut);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialFileTransfer::BuildZBinHeader( BYTE * pOut, BYTE bType, const BYTE * pHdr )
+{
+    BYTE abFrame[9];
+    BYTE * p = pOut;
+    DWORD dwCrc;
+    DWORD dwLen;
+
+    abFrame[0] = bType;
+    memcpy(abFrame + 1, pHdr, 4);
+
+    *p++ = Z_PAD;
+    *p++ = Z_DLE;
+
+    if (bCrc32)
+    {
+        *p++ = Z_BIN32;
+        dwCrc = ~Crc32(0xFFFFFFFF, abFrame, 5);
+        PutZPos(abFrame + 5, dwCrc);
+        dwLen = 9;
+    }
+    else
+    {
+        *p++ = Z_BIN;
+        dwCrc = Crc16(0, abFrame, 5);
+        abFrame[5] = BYTE(dwCrc >> 8);
+        abFrame[6] = BYTE(dwCrc);
+        dwLen = 7;
+    }
+
+    p += ZEscape(p, abFrame, dwLen);
+
+    return DWORD(p - pOut);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialFileTransfer::BuildZData( BYTE * pOut, const BYTE * pData, DWORD dwLen, BYTE bFrameEnd )
+{
+    BYTE abCrc[4];
+    BYTE * p = pOut;
+    DWORD dwCrc;
+
+    p += ZEscape(p, pData, dwLen);
+
+    *p++ = Z_DLE;
+    *p++ = bFrameEnd;
+
+    // the frame end is covered by the CRC
+    if (bCrc32)
+    {
+        dwCrc = Crc32(0xFFFFFFFF, pData, dwLen);
+        dwCrc = ~Crc32(dwCrc, &bFrameEnd, 1);
+        PutZPos(abCrc, dwCrc);
+        p += ZEscape(p, abCrc, 4);
+    }
+    else
+    {
+        dwCrc = Crc16(Crc16(0, pData, dwLen), &bFrameEnd, 1);
+        abCrc[0] = BYTE(dwCrc >> 8);
+        abCrc[1] = BYTE(dwCrc);
+        p += ZEscape(p, abCrc, 2);
+    }
+
+    if (bFrameEnd == Z_CRCW)
+    {
+        *p++ = Z_XON;
+    }
+
+    return DWORD(p - pOut);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialFileTransfer::SendZHeader( BYTE bType, const BYTE * pHdr, BOOL bHex )
+{
+    if (bHex)
+    {
+        return TxSend(BuildZHexHeader(TxBuffer(), bType, pHdr));
+    }
+
+    return TxSend(BuildZBinHeader(TxBuffer(), bType, pHdr));
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+int CSerialFileTransfer::RecvZByte( DWORD dwTimeoutMs )
+{
+    int c;
+
+    do
+    {
+        c = RecvByte(dwTimeoutMs);
+    } while (c >= 0 && ((c & 0x7F) == Z_XON || (c & 0x7F) == Z_XOFF));
+
+    if (c != Z_DLE)
+    {
+        return c;
+    }
+
+    do
+    {
+        c = RecvByte(dwTimeoutMs);
+    } while (c >= 0 && ((c & 0x7F) == Z_XON || (c & 0x7F) == Z_XOFF));
+
+    if (c < 0)
+    {
+        return c;
+    }
+
+    // ZDLE followed by CANs is the abort sequence
+    if (c == X_CAN)
+    {
+        if (RecvByte(dwTimeoutMs) == X_CAN && RecvByte(dwTimeoutMs) == X_CAN)
+        {
+            return SERIAL_RX_CANCELLED;
+        }
+        return SERIAL_RX_BADCRC;
+    }
+
+    if (c == Z_RUB0)
+    {
+        return 0x7F;
+    }
+
+    if (c == Z_RUB1)
+    {
+        return 0xFF;
+    }
+
+    if ((c & 0x60) == 0x40)
+    {
+        return c ^ 0x40;
+    }
+
+    return SERIAL_RX_BADCRC;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+int CSerialFileTransfer::RecvZHeader( BYTE * pHdr, DWORD dwTimeoutMs )
+{
+    BYTE abFrame[9];
+    DWORD dwGarbage = 0;
+    DWORD dwCan = 0;
+    DWORD dwCrc;
+    BOOL bPad = FALSE;
+    int iFormat = 0;
+    int c, hi, lo, i;
+
+    // hunt for ZPAD ZDLE and the format, only the first byte waits for dwTimeoutMs. A caller
+    // polling with 0 does not wait for the garbage either, only for the rest of a header started
+    while (iFormat == 0)
+    {
+        c = RecvByte(bPad ? this->dwTimeoutMs : dwTimeoutMs);
+        if (c < 0)
+        {
+            return c;
+        }
+
+        dwCan = (c == X_CAN) ? dwCan + 1 : 0;
+        if (dwCan == 5)
+        {
+            return SERIAL_RX_CANCELLED;
+        }
+
+        if (c == Z_PAD)
+        {
+            bPad = TRUE;
+            continue;
+        }
+
+        if (c == Z_DLE && bPad)
+        {
+            c = RecvByte(this->dwTimeoutMs);
+            if (c < 0)
+            {
+                return c;
+            }
+
+            if (c == Z_HEX || c == Z_BIN || c == Z_BIN32)
+            {
+                iFormat = c;
+                break;
+            }
+
+            dwCan = (c == X_CAN) ? 2 : 0;
+        }
+
+        bPad = FALSE;
+
+        if (++dwGarbage > SERIAL_XFER_MAX_GARBAGE)
+        {
+            return SERIAL_RX_BADCRC;
+        }
+
+        if (dwTimeoutMs != 0)
+        {
+            dwTimeoutMs = this->dwTimeoutMs;
+        }
+    }
+
+    if (iFormat == Z_HEX)
+    {
+        for (i = 0; i < 7; i++)
+        {
+            hi = RecvByte(this->dwTimeoutMs);
+            lo = (hi < 0) ? hi : RecvByte(this->dwTimeoutMs);
+            if (lo < 0)
+            {
+                return lo;
+            }
+
+            hi = HexValue(hi);
+            lo = HexValue(lo);
+            if (hi < 0 || lo < 0)
+            {
+                return SERIAL_RX_BADCRC;
+            }
+
+            abFrame[i] = BYTE((hi << 4) | lo);
+        }
+
+        if (Crc16(0, abFrame, 5) != ((WORD(abFrame[5]) << 8) | abFrame[6]))
+        {
+            return SERIAL_RX_BADCRC;
+        }
+
+        // the line end, CR and LF with the parity bit, then an XON except after ZACK and ZFIN;
+        // left in the queue they would look like pending data to the next poll
+        for (i = 0; i < ((abFrame[0] == Z_ACK || abFrame[0] == Z_FIN) ? 2 : 3); i++)
+        {
+            c = RecvByte(SERIAL_XFER_TRAILER_MS, TRUE);
+            if (c < 0 || ((c & 0x7F) != '\r' && (c & 0x7F) != '\n' && (c & 0x7F) != Z_XON))
+            {
+                break;
+            }
+            RecvByte(0);
+        }
+    }
+    else
+    {
+        for (i = 0; i < ((iFormat == Z_BIN32) ? 9 : 7); i++)
+        {
+            c = RecvZByte(this->dwTimeoutMs);
+            if (c < 0)
+            {
+                return c;
+            }
+
+            abFrame[i] = BYTE(c);
+        }
+
+        if (iFormat == Z_BIN32)
+        {
+            dwCrc = ~Crc32(0xFFFFFFFF, abFrame, 5);
+            if (dwCrc != GetZPos(abFrame + 5))
+            {
+                return SERIAL_RX_BADCRC;
+            }
+        }
+        else if (Crc16(0, abFrame, 5) != ((WORD(abFrame[5]) << 8) | abFrame[6]))
+        {
+            return SERIAL_RX_BADCRC;
+        }
+    }
+
+    memcpy(pHdr, abFrame + 1, 4);
+
+    return abFrame[0];
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialFileTransfer::SendZmodem( void )
+{
+    static const BYTE abRz[] = { 'r', 'z', '\r' };
+    static const BYTE abOver[] = { 'O', 'O' };
+    BYTE abHdr[4];
+    char cInfo[MAX_PATH + 64];
+    DWORD dwInfoLen;
+    DWORD dwOffset = 0;
+    DWORD dwTries;
+    DWORD dwResult;
+    BOOL bSkip = FALSE;
+    int iType;
+
+    // wake up the receiver and wait for its capabilities
+    dwResult = SendRaw(abRz, sizeof(abRz));
+    if (dwResult != ERROR_SUCCESS)
+    {
+        return dwResult;
+    }
+
+    for (dwTries = 0; ; dwTries++)
+    {
+        if (dwTries == SERIAL_XFER_RETRIES)
+        {
+            return ERROR_TIMEOUT;
+        }
+
+        memset(abHdr, 0, sizeof(abHdr));
+        dwResult = SendZHeader(Z_RQINIT, abHdr, TRUE);
+        if (dwResult != ERROR_SUCCESS)
+        {
+            return dwResult;
+        }
+
+        iType = RecvZHeader(abHdr, dwTimeoutMs);
+
+        if (iType == Z_RINIT)
+        {
+            break;
+        }
+
+        if (iType == Z_CHALLENGE)
+        {
+            dwResult = SendZHeader(Z_ACK, abHdr, TRUE);
+            if (dwResult != ERROR_SUCCESS)
+            {
+                return dwResult;
+            }
+        }
+
+        if (iType == SERIAL_RX_CANCELLED)
+        {
+            return ERROR_CANCELLED;
+        }
+    }
+
+    bCrc32 = (abHdr[Z_F0] & Z_CANFC32) != 0;
+    bEscCtl = (abHdr[Z_F0] & Z_ESCCTL) != 0;
+    dwRxBufSize = DWORD(abHdr[0]) | (DWORD(abHdr[1]) << 8);
+
+    // file information, the receiver answers with the position to start from
+    dwInfoLen = DWORD(strlen(cFileName)) + 1;
+    memcpy(cInfo, cFileName, dwInfoLen);
+    dwInfoLen += _snprintf(cInfo + dwInfoLen, sizeof(cInfo) - dwInfoLen - 1, "%lu %llo 100644 0 1 %lu",
+                           (unsigned long)dwFileSize, ullFileTime, (unsigned long)dwFileSize);
+    cInfo[dwInfoLen++] = '\0';
+
+    for (dwTries = 0; ; dwTries++)
+    {
+        if (dwTries == SERIAL_XFER_RETRIES)
+        {
+            return ERROR_TIMEOUT;
+        }
+
+        memset(abHdr, 0, sizeof(abHdr));
+        abHdr[Z_F0] = Z_CBIN;
+        dwResult = SendZHeader(Z_FILE, abHdr, FALSE);
+        if (dwResult == ERROR_SUCCESS)
+        {
+            dwResult = TxSend(BuildZData(TxBuffer(), (const BYTE*)cInfo, dwInfoLen, Z_CRCW));
+        }
+        if (dwResult != ERROR_SUCCESS)
+        {
+            return dwResult;
+        }
+
+        iType = RecvZHeader(abHdr, dwTimeoutMs);
+
+        // the receiver checks whether its partial copy matches before resuming
+        while (iType == Z_CRC)
+        {
+            dwOffset = GetZPos(abHdr);
+            dwOffset = (dwOffset == 0 || dwOffset > dwFileSize) ? dwFileSize : dwOffset;
+            PutZPos(abHdr, ~Crc32(0xFFFFFFFF, pFile, dwOffset));
+            dwResult = SendZHeader(Z_CRC, abHdr, TRUE);
+            if (dwResult != ERROR_SUCCESS)
+            {
+                return dwResult;
+            }
+
+            iType = RecvZHeader(abHdr, dwTimeoutMs);
+        }
+
+        if (iType == Z_RPOS)
+        {
+            dwOffset = GetZPos(abHdr);
+            break;
+        }
+
+        if (iType == Z_SKIP)
+        {
+            bSkip = TRUE;
+            break;
+        }
+
+        if (iType == SERIAL_RX_CANCELLED)
+        {
+            return ERROR_CANCELLED;
+        }
+    }
+
+    if (!bSkip)
+    {
+        if (dwOffset > dwFileSize)
+        {
+            return ERROR_INVALID_DATA;
+        }
+
+        stats.ullStartOffset = dwOffset;
+
+        dwResult = SendZFileData(dwOffset);
+        if (dwResult != ERROR_SUCCESS)
+        {
+            return dwResult;
+        }
+
+        // ZEOF is confirmed by the next ZRINIT, or rejected with a ZRPOS to send again
+        dwTries = 0;
+        while (1)
+        {
+            if (dwTries == SERIAL_XFER_RETRIES)
+            {
+                return ERROR_TIMEOUT;
+            }
+
+            PutZPos(abHdr, dwFileSize);
+            dwResult = SendZHeader(Z_EOF, abHdr, FALSE);
+            if (dwResult != ERROR_SUCCESS)
+            {
+                return dwResult;
+            }
+
+            do
+            {
+                iType = RecvZHeader(abHdr, dwTimeoutMs);
+            } while (iType == Z_ACK);
+
+            if (iType == Z_RINIT)
+            {
+                break;
+            }
+
+            if (iType == SERIAL_RX_CANCELLED)
+            {
+                return ERROR_CANCELLED;
+            }
+
+            if (iType == Z_RPOS)
+            {
+                stats.dwRetries++;
+                dwResult = SendZFileData(GetZPos(abHdr));
+                if (dwResult != ERROR_SUCCESS)
+                {
+                    return dwResult;
+                }
+                dwTries = 0;
+                continue;
+            }
+
+            dwTries++;
+        }
+    }
+
+    // end of the session, the "over and out" is not acknowledged
+    for (dwTries = 0; dwTries < SERIAL_XFER_RETRIES; dwTries++)
+    {
+        memset(abHdr, 0, sizeof(abHdr));
+        dwResult = SendZHeader(Z_FIN, abHdr, TRUE);
+        if (dwResult != ERROR_SUCCESS)
+        {
+            return dwResult;
+        }
+
+        iType = RecvZHeader(abHdr, dwTimeoutMs);
+
+        if (iType == Z_FIN)
+        {
+            return SendRaw(abOver, sizeof(abOver));
+        }
+
+        if (iType == SERIAL_RX_CANCELLED)
+        {
+            return ERROR_CANCELLED;
+        }
+    }
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialFileTransfer::SendZFileData( DWORD dwOffset )
+{
+    BYTE abHdr[4];
+    DWORD dwAcked;
+    DWORD dwAskAt;
+    DWORD dwFrameBytes;
+    DWORD dwTimeouts = 0;
+    DWORD dwLen;
+    DWORD dwResult;
+    BOOL bRestart;
+    BOOL bWaitAck;
+    BOOL bWindowFull;
+    BOOL bPending;
+    BYTE bEnd;
+    int iType;
+
+    if (dwOffset > dwFileSize)
+    {
+        return ERROR_INVALID_DATA;
+    }
+
+    dwAcked = dwOffset;
+
+    while (dwOffset < dwFileSize)
+    {
+        if (dwTimeouts == SERIAL_XFER_RETRIES)
+        {
+            return ERROR_TIMEOUT;
+        }
+
+        PutZPos(abHdr, dwOffset);
+        dwResult = SendZHeader(Z_DATA, abHdr, FALSE);
+        if (dwResult != ERROR_SUCCESS)
+        {
+            return dwResult;
+        }
+
+        dwFrameBytes = 0;
+        dwAskAt = dwOffset + ((dwWindow / 4 > Z_BLOCK_LEN) ? dwWindow / 4 : Z_BLOCK_LEN);
+        bRestart = FALSE;
+
+        while (!bRestart && dwOffset < dwFileSize)
+        {
+            dwLen = dwFileSize - dwOffset;
+            dwLen = (dwLen < Z_BLOCK_LEN) ? dwLen : Z_BLOCK_LEN;
+
+            // ZCRCE ends the data, ZCRCW stops at the end of the receiver buffer,
+            // ZCRCQ asks for a ZACK to move the window, ZCRCG keeps streaming
+            if (dwOffset + dwLen == dwFileSize)
+            {
+                bEnd = Z_CRCE;
+            }
+            else if (dwRxBufSize != 0 && dwFrameBytes + dwLen + Z_BLOCK_LEN > dwRxBufSize)
+            {
+                bEnd = Z_CRCW;
+            }
+            else if (dwWindow != 0 && dwOffset + dwLen >= dwAskAt)
+            {
+                bEnd = Z_CRCQ;
+                dwAskAt += (dwWindow / 4 > Z_BLOCK_LEN) ? dwWindow / 4 : Z_BLOCK_LEN;
+            }
+            else
+            {
+                bEnd = Z_CRCG;
+            }
+
+            // the subpacket is built while the previous one is on the wire
+            dwResult = TxSend(BuildZData(TxBuffer(), pFile + dwOffset, dwLen, bEnd));
+            if (dwResult != ERROR_SUCCESS)
+            {
+                return dwResult;
+            }
+
+            // sent, not acknowledged: without a window nothing is until ZEOF
+            dwOffset += dwLen;
+            dwFrameBytes += dwLen;
+            ReportProgress(dwOffset);
+
+            if (bEnd == Z_CRCE)
+            {
+                break;
+            }
+
+            bWaitAck = (bEnd == Z_CRCW);
+
+            // read the reverse channel without stopping, unless the window is full or a ZACK is due
+            while (1)
+            {
+                bWindowFull = (dwWindow != 0 && dwOffset - dwAcked >= dwWindow);
+
+                if (!bWaitAck && !bWindowFull)
+                {
+                    EnterCriticalSection(&csRx);
+                    bPending = (dwRxCount > 0);
+                    LeaveCriticalSection(&csRx);
+
+                    if (!bPending)
+                    {
+                        break;
+                    }
+                }
+
+                iType = RecvZHeader(abHdr, (bWaitAck || bWindowFull) ? dwTimeoutMs : 0);
+
+                if (iType == Z_ACK)
+                {
+                    dwTimeouts = 0;
+                    dwAcked = (GetZPos(abHdr) > dwAcked && GetZPos(abHdr) <= dwOffset) ? GetZPos(abHdr) : dwAcked;
+
+                    if (bWaitAck)
+                    {
+                        bRestart = TRUE;
+                        break;
+                    }
+                }
+                else if (iType == Z_RPOS)
+                {
+                    // the receiver lost data, go back to where it asks
+                    if (GetZPos(abHdr) > dwFileSize)
+                    {
+                        return ERROR_INVALID_DATA;
+                    }
+
+                    dwOffset = GetZPos(abHdr);
+                    dwAcked = dwOffset;
+                    stats.dwRetries++;
+                    TxWait();
+                    PurgeRx();
+                    bRestart = TRUE;
+                    break;
+                }
+                else if (iType == SERIAL_RX_CANCELLED)
+                {
+                    return ERROR_CANCELLED;
+                }
+                else if (iType == SERIAL_RX_TIMEOUT && (bWaitAck || bWindowFull))
+                {
+                    // nothing acknowledged, send again from the last known position
+                    dwTimeouts++;
+                    dwOffset = dwAcked;
+                    stats.dwRetries++;
+                    bRestart = TRUE;
+                    break;
+                }
+                else if (iType < 0 && !bWaitAck && !bWindowFull)
+                {
+                    break;
+                }
+            }
+        }
+    }
+
+    return TxWait();
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,166 @@
+// $Id$
+
+#ifndef __SERIAL_FILE_TRANSFER_H__
+#define __SERIAL_FILE_TRANSFER_H__
+
+#include <windows.h>
+#include "Serial.h"
+
+namespace network {
+
+  // Enum para selecao do protocolo de transferencia
+  enum EnumSerialTransferProtocol
+  {
+	  TRANSFER_XMODEM_1K	=	0,			// XMODEM-1K (falls back to XMODEM checksum on NAK)
+	  TRANSFER_YMODEM		=	1,			// YMODEM batch, one file
+	  TRANSFER_ZMODEM		=	2,			// ZMODEM streaming with sliding window and resume
+  };
+
+  //! progress of a transfer: bytes of the file sent and size of the file. XMODEM and YMODEM count
+  //! the blocks acknowledged; ZMODEM streams, it counts the data sent and goes back after a ZRPOS
+  typedef void(*SERIAL_TRANSFER_PROGRESS)( ULONGLONG, ULONGLONG );
+
+  //! counters of a transfer
+  struct SERIAL_TRANSFER_STATS
+  {
+    ULONGLONG ullFileBytes;     // bytes of the file sent, as reported to the progress
+    ULONGLONG ullStartOffset;   // offset the receiver asked to resume from (ZMODEM)
+    ULONGLONG ullLineBytes;     // bytes written to the line, protocol overhead included
+    ULONGLONG ullElapsedUs;     // duration of the transfer
+    DWORD     dwRetries;        // blocks sent again after a NAK, a timeout or a ZRPOS
+  };
+
+  /**
+   *  \brief  Sends a file through a CSerial with XMODEM-1K, YMODEM or ZMODEM. The file is
+   *          memory-mapped and the next block (framing and CRC) is built while the previous
+   *          one is being transmitted, so the line does not wait for the CPU.
+   *          The replies of the receiver are taken with SetReceiveTap during the transfer.
+   */
+  class CSerialFileTransfer
+  {
+    private:
+
+      CSerial * pSerial;
+
+      //! replies of the receiver, filled by the listener thread
+      BYTE abRx[4096];
+      DWORD dwRxHead;
+      DWORD dwRxCount;
+      CRITICAL_SECTION csRx;
+      HANDLE hRxEvent;
+
+      //! signaled by Cancel
+      HANDLE hCancelEvent;
+
+      //! blocks being built and transmitted, alternately
+      BYTE * pTx[2];
+      DWORD dwTxCur;
+      DWORD dwTxLastLen;
+      BOOL bTxPending;
+
+      //! file being sent
+      const BYTE * pFile;
+      DWORD dwFileSize;
+      char cFileName[MAX_PATH];
+      ULONGLONG ullFileTime;
+
+      DWORD dwTimeoutMs;
+      DWORD dwWindow;
+
+      SERIAL_TRANSFER_PROGRESS progress;
+      SERIAL_TRANSFER_STATS stats;
+
+      //! ZMODEM options of the receiver
+      BOOL bCrc32;
+      BOOL bEscCtl;
+      DWORD dwRxBufSize;
+
+      static void OnReceive( LPVOID pContext, BYTE * pBuffer, DWORD dwLen );
+
+      //! next byte from the receiver, -1 on timeout, -2 if cancelled; bPeek leaves it in the queue
+      int RecvByte( DWORD dwTimeoutMs, BOOL bPeek = FALSE );
+      void PurgeRx( void );
+
+      //! lookup tables of CRC-16/XMODEM and CRC-32
+      WORD awCrc16[256];
+      DWORD adwCrc32[256];
+
+      WORD Crc16( WORD wCrc, const BYTE * pData, DWORD dwLen );
+      DWORD Crc32( DWORD dwCrc, const BYTE * pData, DWORD dwLen );
+
+      //! buffer where the next block is built
+      BYTE * TxBuffer( void );
+
+      //! start the transmission of the built block once the previous one is on the wire
+      DWORD TxSend( DWORD dwLen );
+      DWORD TxResend( void );
+      DWORD TxWait( void );
+      DWORD SendRaw( const BYTE * pData, DWORD dwLen );
+      void SendCancel( void );
+      void ReportProgress( ULONGLONG ullDone );
+
+      DWORD BuildXmodemBlock( BYTE * pBlock, DWORD dwSeq, const BYTE * pData, DWORD dwLen, DWORD dwBlockLen, BOOL bCrc, BYTE bPad );
+      DWORD BuildYmodemHeader( BYTE * pBlock, BOOL bEnd );
+      DWORD WaitXmodemStart( BOOL * pbCrc );
+      DWORD WaitXmodemAck( void );
+      DWORD SendXmodem( BOOL bYmodem );
+
+      DWORD ZEscape( BYTE * pOut, const BYTE * pIn, DWORD dwLen );
+      DWORD BuildZHexHeader( BYTE * pOut, BYTE bType, const BYTE * pHdr );
+      DWORD BuildZBinHeader( BYTE * pOut, BYTE bType, const BYTE * pHdr );
+      DWORD BuildZData( BYTE * pOut, const BYTE * pData, DWORD dwLen, BYTE bFrameEnd );
+      DWORD SendZHeader( BYTE bType, const BYTE * pHdr, BOOL bHex );
+      int RecvZByte( DWORD dwTimeoutMs );
+      int RecvZHeader( BYTE * pHdr, DWORD dwTimeoutMs );
+      DWORD SendZmodem( void );
+      DWORD SendZFileData( DWORD dwOffset );
+
+    public:
+      /**
+       *  \brief  Constructor
+       *  \param  pSerial open port used for the transfers
+       */
+      CSerialFileTransfer( CSerial * pSerial ) throw( ... );
+
+      /**
+       *  \brief  Destructor
+       */
+      virtual ~CSerialFileTransfer( );
+
+      /**
+       *  \brief  Sends a file, blocking until the receiver acknowledges it or the transfer fails
+       *  \param  cPath path of the file
+       *  \param  protocol protocol of the transfer. Look at EnumSerialTransferProtocol.
+       *  \return status of operation: ERROR_TIMEOUT, ERROR_CANCELLED (Cancel or CAN from the receiver), ERROR_INVALID_DATA (protocol error)
+       */
+      DWORD Send( const char * cPath, EnumSerialTransferProtocol protocol );
+
+      /**
+       *  \brief  Aborts the transfer in progress, from another thread
+       */
+      void Cancel( void );
+
+      /**
+       *  \brief  Time to wait for each reply of the receiver, 10 s by default
+       */
+      void SetTimeout( DWORD dwMs );
+
+      /**
+       *  \brief  Bytes ZMODEM sends before it waits for an acknowledgement, 0 (default) for full streaming
+       */
+      void SetWindow( DWORD dwBytes );
+
+      /**
+       *  \brief  perform the action of set the function that receives the progress of the transfers
+       */
+      void RegisterProgress( SERIAL_TRANSFER_PROGRESS func );
+
+      /**
+       *  \brief  Counters of the last transfer
+       */
+      void GetStats( SERIAL_TRANSFER_STATS * pStats );
+  };
+
+};
+
+#endif
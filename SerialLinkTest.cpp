@@ -0,0 +1,510 @@
+// $Id$
+
+#include "stdafx.h"
+#include "SerialLinkTest.h"
+#include "SerialClock.h"
+#include <emmintrin.h>
+#include <algorithm>
+#include <string.h>
+
+using namespace network;
+
+//! bytes that must match the seeded generator before the checker locks; a false lock on random
+//!   data would need 64 bits right by chance
+#define SERIAL_PRBS_CONFIRM_LEN     (8)
+
+//! bit errors in a block of 16 bytes that mean the pattern was lost, random data gives 64
+#define SERIAL_PRBS_LOSS_BITS       (32)
+
+//! time the receiver gets to catch up after the last Write, on top of one chunk of line time
+#define SERIAL_LINK_TEST_DRAIN_MS   (500)
+
+//! latency samples kept by a run
+#define SERIAL_LINK_TEST_MAX_SAMPLES    (1048576)
+
+//! number of bits set
+static DWORD BitCount( ULONGLONG ullBits )
+{
+    ullBits = ullBits - ((ullBits >> 1) & 0x5555555555555555ULL);
+    ullBits = (ullBits & 0x3333333333333333ULL) + ((ullBits >> 2) & 0x3333333333333333ULL);
+    ullBits = (ullBits + (ullBits >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+
+    return DWORD((ullBits * 0x0101010101010101ULL) >> 56);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+CSerialPrbs::CSerialPrbs( EnumSerialPrbs prbs )
+{
+    Reset(prbs);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialPrbs::Reset( EnumSerialPrbs prbs )
+{
+    dwOrder = DWORD(prbs);
+
+    // the shortest tap: that many bits of the sequence only depend on bits already known
+    switch (prbs)
+    {
+        case PRBS_7:    dwStep = 6;     break;
+        case PRBS_15:   dwStep = 14;    break;
+        case PRBS_23:   dwStep = 18;    break;
+        default:        dwOrder = 31;
+                        dwStep = 28;    break;
+    }
+
+    dwState = DWORD((1ULL << dwOrder) - 1);
+    ullOut = 0;
+    dwOutBits = 0;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialPrbs::SeedLength( void )
+{
+    return (dwOrder + 7) / 8;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialPrbs::SeedFromStream( const BYTE * pLast )
+{
+    ULONGLONG ullBits = 0;
+    DWORD dwLen = SeedLength();
+    DWORD i;
+
+    // the first byte received holds the oldest bits
+    for (i = 0; i < dwLen; i++)
+    {
+        ullBits |= (ULONGLONG)pLast[i] << (8 * i);
+    }
+
+    dwState = DWORD(ullBits >> (8 * dwLen - dwOrder)) & DWORD((1ULL << dwOrder) - 1);
+    ullOut = 0;
+    dwOutBits = 0;
+
+    // the LFSR would stay at zero
+    return (dwState != 0);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialPrbs::Generate( BYTE * pBuffer, DWORD dwLen )
+{
+    DWORD dwShift = dwOrder - dwStep;
+    DWORD dwMask = (1UL << dwStep) - 1;
+    DWORD dwNew;
+    DWORD i;
+
+    for (i = 0; i < dwLen; i++)
+    {
+        // b[k] = b[k - order] ^ b[k - tap], dwStep bits at once
+        while (dwOutBits < 8)
+        {
+            dwNew = (dwState ^ (dwState >> dwShift)) & dwMask;
+            dwState = (dwState >> dwStep) | (dwNew << dwShift);
+            ullOut |= (ULONGLONG)dwNew << dwOutBits;
+            dwOutBits += dwStep;
+        }
+
+        pBuffer[i] = BYTE(ullOut);
+        ullOut >>= 8;
+        dwOutBits -= 8;
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+CSerialPrbsChecker::CSerialPrbsChecker( EnumSerialPrbs prbs )
+{
+    Reset(prbs);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialPrbsChecker::Reset( EnumSerialPrbs prbs )
+{
+    this->prbs.Reset(prbs);
+
+    dwHuntLen = 0;
+    bSeeded = FALSE;
+    dwConfirmed = 0;
+    bLocked = FALSE;
+    memset(&stats, 0, sizeof(stats));
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialPrbsChecker::Hunt( BYTE bData )
+{
+    DWORD dwSeedLen = prbs.SeedLength();
+    BYTE bExpected;
+    BOOL bMatch = FALSE;
+
+    stats.ullBytesUnsynced++;
+
+    if (bSeeded)
+    {
+        prbs.Generate(&bExpected, 1);
+        bMatch = (bExpected == bData);
+    }
+
+    // the latest bytes, to seed again
+    if (dwHuntLen == dwSeedLen)
+    {
+        memmove(abHunt, abHunt + 1, dwSeedLen - 1);
+        dwHuntLen--;
+    }
+    abHunt[dwHuntLen++] = bData;
+
+    if (bMatch)
+    {
+        bLocked = (++dwConfirmed == SERIAL_PRBS_CONFIRM_LEN);
+        return;
+    }
+
+    dwConfirmed = 0;
+    bSeeded = (dwHuntLen == dwSeedLen) && prbs.SeedFromStream(abHunt);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialPrbsChecker::Check( const BYTE * pData, DWORD dwLen )
+{
+    ULONGLONG aullXor[2];
+    __m128i xXor;
+    DWORD dwBlock;
+    DWORD dwGroup;
+    DWORD dwErrors;
+    DWORD i = 0;
+    DWORD j;
+    DWORD k;
+
+    while (i < dwLen)
+    {
+        if (!bLocked)
+        {
+            Hunt(pData[i++]);
+            continue;
+        }
+
+        dwBlock = (dwLen - i < DWORD(BLOCK_LEN)) ? dwLen - i : DWORD(BLOCK_LEN);
+        prbs.Generate(abExpected, dwBlock);
+
+        for (j = 0; j < dwBlock; j += dwGroup)
+        {
+            dwGroup = (dwBlock - j < 16) ? dwBlock - j : 16;
+            dwErrors = 0;
+
+            if (dwGroup == 16)
+            {
+                // a clean link leaves almost every block equal, only those that differ are counted
+                xXor = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(pData + i + j)), _mm_loadu_si128((const __m128i*)(abExpected + j)));
+                if (_mm_movemask_epi8(_mm_cmpeq_epi8(xXor, _mm_setzero_si128())) != 0xFFFF)
+                {
+                    _mm_storeu_si128((__m128i*)aullXor, xXor);
+                    dwErrors = BitCount(aullXor[0]) + BitCount(aullXor[1]);
+
+                    // a slip leaves the data unrelated to the pattern: hunt again from this block
+                    if (dwErrors > SERIAL_PRBS_LOSS_BITS)
+                    {
+                        stats.dwSyncLosses++;
+                        bLocked = FALSE;
+                        bSeeded = FALSE;
+                        dwHuntLen = 0;
+                        dwConfirmed = 0;
+                        break;
+                    }
+                }
+            }
+            else
+            {
+                // too few bits to tell a slip from errors, the next full block does
+                for (k = 0; k < dwGroup; k++)
+                {
+                    dwErrors += BitCount(pData[i + j + k] ^ abExpected[j + k]);
+                }
+            }
+
+            stats.ullBitsChecked += dwGroup * 8;
+            stats.ullBitErrors += dwErrors;
+        }
+
+        i += j;
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialPrbsChecker::IsLocked( void )
+{
+    return bLocked;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialPrbsChecker::GetStats( SERIAL_PRBS_STATS * pStats )
+{
+    *pStats = stats;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+CSerialLinkTest::CSerialLinkTest( CSerial * pTx, CSerial * pRx )
+{
+    this->pTx = pTx;
+    this->pRx = (pRx != NULL) ? pRx : pTx;
+
+    ullRxBytes = 0;
+    ullLastRxUs = 0;
+    dwMarkHead = 0;
+    dwMarkCount = 0;
+
+    InitializeCriticalSection(&csRx);
+
+    hRxEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    hCancelEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (hRxEvent == NULL || hCancelEvent == NULL)
+    {
+        throw (unsigned int)::GetLastError();
+    }
+
+    return;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+CSerialLinkTest::~CSerialLinkTest( )
+{
+    CloseHandle(hRxEvent);
+    CloseHandle(hCancelEvent);
+    DeleteCriticalSection(&csRx);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialLinkTest::Cancel( void )
+{
+    SetEvent(hCancelEvent);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialLinkTest::AddMark( ULONGLONG ullEnd, ULONGLONG ullWriteUs )
+{
+    // the receiver is that far behind only if it lost the data, the oldest chunk is forgotten
+    if (dwMarkCount == MAX_MARKS)
+    {
+        dwMarkHead = (dwMarkHead + 1) % MAX_MARKS;
+        dwMarkCount--;
+    }
+
+    aMarks[(dwMarkHead + dwMarkCount) % MAX_MARKS].ullEnd = ullEnd;
+    aMarks[(dwMarkHead + dwMarkCount) % MAX_MARKS].ullWriteUs = ullWriteUs;
+    dwMarkCount++;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialLinkTest::TimeReception( ULONGLONG ullOffset, ULONGLONG ullNowUs )
+{
+    // the chunks received whole are done with
+    while (dwMarkCount > 0 && aMarks[dwMarkHead].ullEnd <= ullOffset)
+    {
+        dwMarkHead = (dwMarkHead + 1) % MAX_MARKS;
+        dwMarkCount--;
+    }
+
+    // more bytes than were sent: noise on the line
+    if (dwMarkCount == 0)
+    {
+        return;
+    }
+
+    if (vLatencies.size() < SERIAL_LINK_TEST_MAX_SAMPLES)
+    {
+        vLatencies.push_back(DWORD(ullNowUs - aMarks[dwMarkHead].ullWriteUs));
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialLinkTest::OnReceive( LPVOID pContext, BYTE * pBuffer, DWORD dwLen )
+{
+    CSerialLinkTest * pThis = (CSerialLinkTest*)pContext;
+    ULONGLONG ullNowUs = GetTimestampUs();
+
+    EnterCriticalSection(&pThis->csRx);
+
+    pThis->checker.Check(pBuffer, dwLen);
+    pThis->ullRxBytes += dwLen;
+    pThis->ullLastRxUs = ullNowUs;
+
+    // bytes are matched to the chunks by their offset, a dropped byte shifts the later ones by one
+    pThis->TimeReception(pThis->ullRxBytes - 1, ullNowUs);
+
+    LeaveCriticalSection(&pThis->csRx);
+
+    SetEvent(pThis->hRxEvent);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialLinkTest::OnTxDone( LPVOID pContext, ULONGLONG ullEnd, ULONGLONG ullReturnUs, ULONGLONG ullWireUs )
+{
+    CSerialLinkTest * pThis = (CSerialLinkTest*)pContext;
+
+    EnterCriticalSection(&pThis->csRx);
+
+    if (pThis->vWireGaps.size() < SERIAL_LINK_TEST_MAX_SAMPLES)
+    {
+        pThis->vWireGaps.push_back(DWORD((ullWireUs > ullReturnUs) ? ullWireUs - ullReturnUs : 0));
+    }
+
+    LeaveCriticalSection(&pThis->csRx);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialLinkTest::Run( EnumSerialPrbs prbs, DWORD dwDurationMs, SERIAL_LINK_TEST_RESULTS * pResults, DWORD dwChunkLen )
+{
+    CSerialPrbs generator(prbs);
+    BYTE * pTxBuffer;
+    DWORD dwCur = 0;
+    DWORD dwResult = ERROR_SUCCESS;
+    DWORD dwCharTimeNs;
+    DWORD dwDrainMs;
+    ULONGLONG ullStartUs;
+    ULONGLONG ullDeadlineUs;
+    ULONGLONG ullSent = 0;
+    ULONGLONG ullReceived;
+    size_t nSamples;
+
+    if (dwChunkLen == 0)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    memset(pResults, 0, sizeof(SERIAL_LINK_TEST_RESULTS));
+
+    EnterCriticalSection(&csRx);
+    checker.Reset(prbs);
+    ullRxBytes = 0;
+    ullLastRxUs = 0;
+    dwMarkHead = 0;
+    dwMarkCount = 0;
+    vLatencies.clear();
+    vWireGaps.clear();
+    LeaveCriticalSection(&csRx);
+
+    ResetEvent(hCancelEvent);
+    ResetEvent(hRxEvent);
+
+    // what was waiting in the receiver is not part of the run
+    pRx->Purge(PURGE_RXCLEAR);
+    pRx->SetReceiveTap(CSerialLinkTest::OnReceive, this);
+    pTx->SetTxMonitor(CSerialLinkTest::OnTxDone, this);
+
+    // two chunks: the next one is generated while the previous one is sent
+    pTxBuffer = new BYTE[2 * dwChunkLen];
+    generator.Generate(pTxBuffer, dwChunkLen);
+
+    ullStartUs = GetTimestampUs();
+    ullDeadlineUs = ullStartUs + (ULONGLONG)dwDurationMs * 1000;
+
+    while (GetTimestampUs() < ullDeadlineUs)
+    {
+        if (WaitForSingleObject(hCancelEvent, 0) == WAIT_OBJECT_0)
+        {
+            dwResult = ERROR_CANCELLED;
+            break;
+        }
+
+        EnterCriticalSection(&csRx);
+        AddMark(ullSent + dwChunkLen, GetTimestampUs());
+        LeaveCriticalSection(&csRx);
+
+        dwResult = pTx->BeginWrite((const char*)(pTxBuffer + dwCur * dwChunkLen), int(dwChunkLen));
+        if (dwResult != ERROR_SUCCESS)
+        {
+            break;
+        }
+
+        dwCur ^= 1;
+        generator.Generate(pTxBuffer + dwCur * dwChunkLen, dwChunkLen);
+
+        if (pTx->EndWrite() != int(dwChunkLen))
+        {
+            dwResult = ERROR_WRITE_FAULT;
+            break;
+        }
+        ullSent += dwChunkLen;
+    }
+
+    // the receiver still gets what is in the driver buffers and on the line
+    dwCharTimeNs = pTx->GetCharTime();
+    dwDrainMs = SERIAL_LINK_TEST_DRAIN_MS + DWORD((ULONGLONG)dwChunkLen * dwCharTimeNs / 1000000);
+    do
+    {
+        EnterCriticalSection(&csRx);
+        ullReceived = ullRxBytes;
+        LeaveCriticalSection(&csRx);
+
+        if (ullReceived >= ullSent)
+        {
+            break;
+        }
+    } while (WaitForSingleObject(hRxEvent, dwDrainMs) == WAIT_OBJECT_0);
+
+    // waits for the tap in progress, nothing changes the counters after this
+    pRx->SetReceiveTap(NULL, NULL);
+    pTx->SetTxMonitor(NULL, NULL);
+
+    delete [] pTxBuffer;
+
+    pResults->ullBytesSent = ullSent;
+    pResults->ullBytesReceived = ullRxBytes;
+    checker.GetStats(&pResults->prbs);
+
+    if (pResults->prbs.ullBitsChecked != 0)
+    {
+        pResults->dBitErrorRate = double(pResults->prbs.ullBitErrors) / double(pResults->prbs.ullBitsChecked);
+    }
+    if (ullLastRxUs > ullStartUs)
+    {
+        pResults->dBytesPerSec = double(ullRxBytes) * 1000000.0 / double(ullLastRxUs - ullStartUs);
+    }
+    if (dwCharTimeNs != 0)
+    {
+        pResults->dLineBytesPerSec = 1000000000.0 / dwCharTimeNs;
+    }
+
+    nSamples = vLatencies.size();
+    if (nSamples != 0)
+    {
+        std::sort(vLatencies.begin(), vLatencies.end());
+
+        pResults->dwLatencySamples = DWORD(nSamples);
+        pResults->dwLatencyP50Us = vLatencies[(nSamples - 1) * 50 / 100];
+        pResults->dwLatencyP90Us = vLatencies[(nSamples - 1) * 90 / 100];
+        pResults->dwLatencyP99Us = vLatencies[(nSamples - 1) * 99 / 100];
+        pResults->dwLatencyMaxUs = vLatencies[nSamples - 1];
+    }
+
+    nSamples = vWireGaps.size();
+    if (nSamples != 0)
+    {
+        std::sort(vWireGaps.begin(), vWireGaps.end());
+
+        pResults->dwWireGapSamples = DWORD(nSamples);
+        pResults->dwWireGapP50Us = vWireGaps[(nSamples - 1) * 50 / 100];
+        pResults->dwWireGapP99Us = vWireGaps[(nSamples - 1) * 99 / 100];
+        pResults->dwWireGapMaxUs = vWireGaps[nSamples - 1];
+    }
+
+    return dwResult;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
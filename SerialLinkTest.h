@@ -0,0 +1,236 @@
+// $Id$
+
+#ifndef __SERIAL_LINK_TEST_H__
+#define __SERIAL_LINK_TEST_H__
+
+#include <windows.h>
+#include <vector>
+#include "Serial.h"
+
+namespace network {
+
+  // Enum para selecao da sequencia pseudo-aleatoria (ITU-T O.150, nao invertida)
+  enum EnumSerialPrbs
+  {
+	  PRBS_7		=	7,			// x^7 + x^6 + 1
+	  PRBS_15		=	15,			// x^15 + x^14 + 1
+	  PRBS_23		=	23,			// x^23 + x^18 + 1
+	  PRBS_31		=	31,			// x^31 + x^28 + 1
+  };
+
+  //! counters of a CSerialPrbsChecker
+  struct SERIAL_PRBS_STATS
+  {
+    ULONGLONG ullBitsChecked;     // bits compared with the pattern while locked
+    ULONGLONG ullBitErrors;       // bits that differed
+    ULONGLONG ullBytesUnsynced;   // bytes received while hunting for the pattern
+    DWORD     dwSyncLosses;       // times the pattern was lost (slip, dropped or inserted bytes)
+  };
+
+  //! results of a CSerialLinkTest run
+  struct SERIAL_LINK_TEST_RESULTS
+  {
+    ULONGLONG ullBytesSent;
+    ULONGLONG ullBytesReceived;
+    SERIAL_PRBS_STATS prbs;
+    double    dBitErrorRate;      // ullBitErrors / ullBitsChecked
+    double    dBytesPerSec;       // received, from the first Write to the last byte received
+    double    dLineBytesPerSec;   // theoretical, from the baud rate and the character format
+    DWORD     dwLatencySamples;   // received chunks timed
+    DWORD     dwLatencyP50Us;     // from the Write of a byte to the tap that received it
+    DWORD     dwLatencyP90Us;
+    DWORD     dwLatencyP99Us;
+    DWORD     dwLatencyMaxUs;
+    DWORD     dwWireGapSamples;   // writes seen leaving the line by the transmit monitor
+    DWORD     dwWireGapP50Us;     // from the return of a Write to its last stop bit on the line
+    DWORD     dwWireGapP99Us;
+    DWORD     dwWireGapMaxUs;
+  };
+
+  /**
+   *  \brief  Generator of a PRBS, as the bytes transmitted least significant bit first.
+   *          The LFSR steps as many bits at once as its shortest tap allows.
+   */
+  class CSerialPrbs
+  {
+    private:
+
+      DWORD dwOrder;
+      DWORD dwStep;
+
+      //! last dwOrder bits of the sequence, the oldest in bit 0
+      DWORD dwState;
+
+      //! bits generated and not yet output
+      ULONGLONG ullOut;
+      DWORD dwOutBits;
+
+    public:
+      /**
+       *  \brief  Constructor, starts the sequence with all ones
+       */
+      CSerialPrbs( EnumSerialPrbs prbs = PRBS_15 );
+
+      /**
+       *  \brief  Selects a sequence and starts it with all ones
+       */
+      void Reset( EnumSerialPrbs prbs );
+
+      /**
+       *  \brief  Number of bytes SeedFromStream needs
+       */
+      DWORD SeedLength( void );
+
+      /**
+       *  \brief  Continues the sequence after bytes of it, e.g. received ones
+       *  \param  pLast the last SeedLength() bytes of the sequence
+       *  \return FALSE if the bytes cannot be part of the sequence (all its bits zero)
+       */
+      BOOL SeedFromStream( const BYTE * pLast );
+
+      /**
+       *  \brief  Writes the next bytes of the sequence
+       */
+      void Generate( BYTE * pBuffer, DWORD dwLen );
+  };
+
+  /**
+   *  \brief  Checks received bytes against a PRBS. The checker locks onto the sequence from the
+   *          received data itself, so it needs no start marker, and locks again after a slip.
+   *          The bytes are compared 16 at a time with SSE2, the errors counted only in the
+   *          blocks that differ.
+   */
+  class CSerialPrbsChecker
+  {
+    private:
+
+      enum { BLOCK_LEN = 256 };
+
+      CSerialPrbs prbs;
+
+      //! bytes received while hunting, to seed the generator
+      BYTE abHunt[4];
+      DWORD dwHuntLen;
+
+      //! the generator was seeded from abHunt, the next bytes confirm the seed
+      BOOL bSeeded;
+
+      //! bytes that matched since the seed
+      DWORD dwConfirmed;
+      BOOL bLocked;
+
+      BYTE abExpected[BLOCK_LEN];
+
+      SERIAL_PRBS_STATS stats;
+
+      //! take one byte while not locked
+      void Hunt( BYTE bData );
+
+    public:
+      /**
+       *  \brief  Constructor
+       */
+      CSerialPrbsChecker( EnumSerialPrbs prbs = PRBS_15 );
+
+      /**
+       *  \brief  Selects the sequence expected, clears the counters and hunts for the pattern
+       */
+      void Reset( EnumSerialPrbs prbs );
+
+      /**
+       *  \brief  Checks the next received bytes
+       */
+      void Check( const BYTE * pData, DWORD dwLen );
+
+      /**
+       *  \brief  The checker follows the pattern
+       */
+      BOOL IsLocked( void );
+
+      /**
+       *  \brief  Read the counters
+       */
+      void GetStats( SERIAL_PRBS_STATS * pStats );
+  };
+
+  /**
+   *  \brief  Measures the error rate, throughput and latency of a link by streaming a PRBS
+   *          through Write and checking it in the receive path. In loopback mode (a loopback
+   *          plug) one port sends and receives; in two port mode one port sends and the other,
+   *          e.g. the far end of a cable or a pair of virtual ports, receives. The received
+   *          data is taken with SetReceiveTap during the run, and the writes are followed to
+   *          the line with SetTxMonitor, which replaces the transmit monitor of pTx.
+   */
+  class CSerialLinkTest
+  {
+    private:
+
+      enum { MAX_MARKS = 256 };
+
+      CSerial * pTx;
+      CSerial * pRx;
+
+      //! receive side, filled by the listener thread of pRx
+      CSerialPrbsChecker checker;
+      ULONGLONG ullRxBytes;
+      ULONGLONG ullLastRxUs;
+      std::vector<DWORD> vLatencies;
+      std::vector<DWORD> vWireGaps;
+      CRITICAL_SECTION csRx;
+      HANDLE hRxEvent;
+
+      //! end offset and write time of the chunks sent, oldest first, to time their reception
+      struct TX_MARK
+      {
+        ULONGLONG ullEnd;
+        ULONGLONG ullWriteUs;
+      };
+      TX_MARK aMarks[MAX_MARKS];
+      DWORD dwMarkHead;
+      DWORD dwMarkCount;
+
+      //! signaled by Cancel
+      HANDLE hCancelEvent;
+
+      static void OnReceive( LPVOID pContext, BYTE * pBuffer, DWORD dwLen );
+
+      static void OnTxDone( LPVOID pContext, ULONGLONG ullEnd, ULONGLONG ullReturnUs, ULONGLONG ullWireUs );
+
+      //! record a chunk about to be written, with csRx held
+      void AddMark( ULONGLONG ullEnd, ULONGLONG ullWriteUs );
+
+      //! time the reception of the byte at ullOffset, with csRx held
+      void TimeReception( ULONGLONG ullOffset, ULONGLONG ullNowUs );
+
+    public:
+      /**
+       *  \brief  Constructor
+       *  \param  pTx open port that sends the pattern
+       *  \param  pRx open port that receives it, NULL for the loopback mode
+       */
+      CSerialLinkTest( CSerial * pTx, CSerial * pRx = NULL ) throw( ... );
+
+      /**
+       *  \brief  Destructor
+       */
+      virtual ~CSerialLinkTest( );
+
+      /**
+       *  \brief  Streams the pattern for a while, then waits for the receiver to catch up
+       *  \param  prbs pattern sent
+       *  \param  dwDurationMs time spent sending
+       *  \param  pResults results of the run
+       *  \param  dwChunkLen bytes per Write
+       *  \return status of operation: ERROR_CANCELLED, or the error of Write
+       */
+      DWORD Run( EnumSerialPrbs prbs, DWORD dwDurationMs, SERIAL_LINK_TEST_RESULTS * pResults, DWORD dwChunkLen = 1024 );
+
+      /**
+       *  \brief  Stops the run in progress, from another thread
+       */
+      void Cancel( void );
+  };
+
+};
+
+#endif
@@ -0,0 +1,401 @@
+// $Id$
+
+#include "stdafx.h"
+#include "SerialMerger.h"
+#include "SerialClock.h"
+#include <algorithm>
+#include <stdlib.h>
+#include <stddef.h>
+
+using namespace network;
+
+//! size of the write buffer of the capture file
+#define SERIAL_MERGER_FILE_BUFFER   (65536)
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+CSerialMerger::CSerialMerger( DWORD dwWindowUs )
+{
+    ullWindowUs = dwWindowUs;
+    ullLastEmittedUs = 0;
+    dwPending = 0;
+    process = NULL;
+    hFile = INVALID_HANDLE_VALUE;
+    pFileBuffer = NULL;
+    dwFileBuffered = 0;
+    hMergeThread = NULL;
+    bQuit = FALSE;
+    memset(&stats, 0, sizeof(stats));
+
+    hWakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (hWakeEvent == NULL)
+    {
+        throw (unsigned int)::GetLastError();
+    }
+
+    return;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+CSerialMerger::~CSerialMerger( )
+{
+    size_t i;
+
+    Stop();
+
+    for (i = 0; i < ports.size(); i++)
+    {
+        DeleteCriticalSection(&ports[i]->csIncoming);
+        delete ports[i];
+    }
+
+    if (hFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(hFile);
+    }
+
+    delete [] pFileBuffer;
+    CloseHandle(hWakeEvent);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialMerger::AddPort( CSerial * pSerial, DWORD dwPortId )
+{
+    MERGE_PORT * pPort;
+
+    if (hMergeThread != NULL)
+    {
+        return ERROR_BUSY;
+    }
+
+    pPort = new MERGE_PORT;
+    pPort->pMerger = this;
+    pPort->pSerial = pSerial;
+    pPort->dwPortId = dwPortId;
+    pPort->ullLastUs = 0;
+    InitializeCriticalSection(&pPort->csIncoming);
+
+    ports.push_back(pPort);
+    heap.reserve(ports.size());
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialMerger::SetOutputFile( const char * cPath )
+{
+    if (hMergeThread != NULL)
+    {
+        return ERROR_BUSY;
+    }
+
+    if (hFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(hFile);
+    }
+
+    hFile = CreateFileA(cPath, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return ::GetLastError();
+    }
+
+    if (pFileBuffer == NULL)
+    {
+        pFileBuffer = new BYTE[SERIAL_MERGER_FILE_BUFFER];
+    }
+    dwFileBuffered = 0;
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialMerger::SetOutputCallback( SERIAL_MERGE_CALLBACK func )
+{
+    process = func;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialMerger::Start( void )
+{
+    size_t i;
+
+    if (hMergeThread != NULL)
+    {
+        return ERROR_BUSY;
+    }
+
+    bQuit = FALSE;
+    ullLastEmittedUs = 0;
+
+    hMergeThread = ::CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)CSerialMerger::ThreadStartMerge, this, 0, NULL);
+    if (hMergeThread == NULL)
+    {
+        return ::GetLastError();
+    }
+
+    for (i = 0; i < ports.size(); i++)
+    {
+        ports[i]->pSerial->SetCapture(CSerialMerger::OnCapture, ports[i]);
+    }
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialMerger::Stop( void )
+{
+    size_t i;
+
+    if (hMergeThread == NULL)
+    {
+        return;
+    }
+
+    // SetCapture waits for a capture in progress, so nothing arrives after this
+    for (i = 0; i < ports.size(); i++)
+    {
+        ports[i]->pSerial->SetCapture(NULL, NULL);
+    }
+
+    bQuit = TRUE;
+    SetEvent(hWakeEvent);
+    WaitForSingleObject(hMergeThread, INFINITE);
+    CloseHandle(hMergeThread);
+    hMergeThread = NULL;
+
+    if (hFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(hFile);
+        hFile = INVALID_HANDLE_VALUE;
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialMerger::GetStats( SERIAL_MERGER_STATS * pStats )
+{
+    *pStats = stats;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialMerger::OnCapture( LPVOID pContext, const BYTE * pData, DWORD dwLen, ULONGLONG ullTimestampUs )
+{
+    MERGE_PORT * pPort = (MERGE_PORT*)pContext;
+    MERGE_CHUNK * pChunk;
+
+    pChunk = (MERGE_CHUNK*)malloc(offsetof(MERGE_CHUNK, abData) + dwLen);
+    if (pChunk == NULL)
+    {
+        return;
+    }
+
+    pChunk->dwLen = dwLen;
+    memcpy(pChunk->abData, pData, dwLen);
+
+    EnterCriticalSection(&pPort->csIncoming);
+
+    // the merge relies on every port being in order, and the estimate of the first byte
+    // of a chunk may step back over the previous chunk
+    pChunk->ullTimestampUs = (ullTimestampUs > pPort->ullLastUs) ? ullTimestampUs : pPort->ullLastUs;
+    pPort->ullLastUs = pChunk->ullTimestampUs;
+    pPort->incoming.push_back(pChunk);
+
+    LeaveCriticalSection(&pPort->csIncoming);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialMerger::Collect( void )
+{
+    std::vector<MERGE_CHUNK*> batch;
+    MERGE_PORT * pPort;
+    BOOL bWasEmpty;
+    size_t i;
+
+    for (i = 0; i < ports.size(); i++)
+    {
+        pPort = ports[i];
+
+        // one short lock per port and tick: the vectors are swapped, not copied
+        EnterCriticalSection(&pPort->csIncoming);
+        if (pPort->incoming.empty())
+        {
+            LeaveCriticalSection(&pPort->csIncoming);
+            continue;
+        }
+        batch.swap(pPort->incoming);
+        LeaveCriticalSection(&pPort->csIncoming);
+
+        bWasEmpty = pPort->pending.empty();
+        pPort->pending.insert(pPort->pending.end(), batch.begin(), batch.end());
+        dwPending += DWORD(batch.size());
+        batch.clear();
+
+        // appending behind the first chunk does not move the port in the heap
+        if (bWasEmpty)
+        {
+            heap.push_back(pPort);
+            std::push_heap(heap.begin(), heap.end(), LATER());
+        }
+    }
+
+    if (dwPending > stats.dwMaxPending)
+    {
+        stats.dwMaxPending = dwPending;
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialMerger::Emit( ULONGLONG ullWatermarkUs )
+{
+    MERGE_PORT * pPort;
+    MERGE_CHUNK * pChunk;
+
+    while (!heap.empty())
+    {
+        pPort = heap.front();
+        pChunk = pPort->pending.front();
+
+        if (pChunk->ullTimestampUs > ullWatermarkUs)
+        {
+            break;
+        }
+
+        std::pop_heap(heap.begin(), heap.end(), LATER());
+        heap.pop_back();
+
+        pPort->pending.pop_front();
+        dwPending--;
+
+        Output(pPort, pChunk);
+        free(pChunk);
+
+        if (!pPort->pending.empty())
+        {
+            heap.push_back(pPort);
+            std::push_heap(heap.begin(), heap.end(), LATER());
+        }
+    }
+
+    FlushFile();
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialMerger::Output( MERGE_PORT * pPort, MERGE_CHUNK * pChunk )
+{
+    SERIAL_CAPTURE_RECORD record;
+    DWORD dwWritten;
+
+    // delivered out of order: its listener was held longer than the window
+    if (pChunk->ullTimestampUs < ullLastEmittedUs)
+    {
+        stats.llLate++;
+    }
+    else
+    {
+        ullLastEmittedUs = pChunk->ullTimestampUs;
+    }
+
+    stats.llChunks++;
+    stats.llBytes += pChunk->dwLen;
+
+    if (process != NULL)
+    {
+        process(pPort->dwPortId, pChunk->abData, pChunk->dwLen, pChunk->ullTimestampUs);
+    }
+
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return;
+    }
+
+    if (dwFileBuffered + sizeof(record) + pChunk->dwLen > SERIAL_MERGER_FILE_BUFFER)
+    {
+        FlushFile();
+    }
+
+    record.ullTimestampUs = pChunk->ullTimestampUs;
+    record.dwPortId = pPort->dwPortId;
+    record.dwLen = pChunk->dwLen;
+
+    // a chunk larger than the buffer goes straight to the file
+    if (sizeof(record) + pChunk->dwLen > SERIAL_MERGER_FILE_BUFFER)
+    {
+        WriteFile(hFile, &record, sizeof(record), &dwWritten, NULL);
+        WriteFile(hFile, pChunk->abData, pChunk->dwLen, &dwWritten, NULL);
+        return;
+    }
+
+    memcpy(pFileBuffer + dwFileBuffered, &record, sizeof(record));
+    memcpy(pFileBuffer + dwFileBuffered + sizeof(record), pChunk->abData, pChunk->dwLen);
+    dwFileBuffered += sizeof(record) + pChunk->dwLen;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialMerger::FlushFile( void )
+{
+    DWORD dwWritten;
+
+    if (hFile != INVALID_HANDLE_VALUE && dwFileBuffered > 0)
+    {
+        WriteFile(hFile, pFileBuffer, dwFileBuffered, &dwWritten, NULL);
+        dwFileBuffered = 0;
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialMerger::MergeLoop( void )
+{
+    ULONGLONG ullNowUs;
+    DWORD dwTickMs;
+
+    // a tick of a quarter of the window keeps the added latency small
+    dwTickMs = DWORD(ullWindowUs / 4000);
+    dwTickMs = (dwTickMs > 0) ? dwTickMs : 1;
+
+    do
+    {
+        WaitForSingleObject(hWakeEvent, dwTickMs);
+
+        Collect();
+
+        if (bQuit == TRUE)
+        {
+            break;
+        }
+
+        ullNowUs = GetTimestampUs();
+        Emit((ullNowUs > ullWindowUs) ? ullNowUs - ullWindowUs : 0);
+
+    } while (1);
+
+    // the captures are stopped, everything left is in order
+    Emit(~0ULL);
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD WINAPI CSerialMerger::ThreadStartMerge( LPVOID lpParam )
+{
+    CSerialMerger * merger;
+
+    merger = (CSerialMerger*)lpParam;
+
+    return merger->MergeLoop();
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
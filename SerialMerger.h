@@ -0,0 +1,166 @@
+// $Id$
+
+#ifndef __SERIAL_MERGER_H__
+#define __SERIAL_MERGER_H__
+
+#include <windows.h>
+#include <deque>
+#include <vector>
+#include "Serial.h"
+
+namespace network {
+
+  //! function that receives the merged stream: port identifier, data, length and timestamp
+  //!   (in microseconds) of the first byte
+  typedef void(*SERIAL_MERGE_CALLBACK)( DWORD, const BYTE*, DWORD, ULONGLONG );
+
+  //! header of each record of the capture file, followed by dwLen bytes of data
+  struct SERIAL_CAPTURE_RECORD
+  {
+    ULONGLONG ullTimestampUs;
+    DWORD     dwPortId;
+    DWORD     dwLen;
+  };
+
+  //! counters of a merger
+  struct SERIAL_MERGER_STATS
+  {
+    LONGLONG  llChunks;     // chunks emitted
+    LONGLONG  llBytes;      // bytes emitted
+    LONGLONG  llLate;       // chunks that arrived after the window closed on their timestamp
+    DWORD     dwMaxPending; // largest number of chunks held in the window
+  };
+
+  /**
+   *  \brief  Merges the received data of many ports into one stream ordered by timestamp.
+   *          Each port captures its chunks (see CSerial::SetCapture); a merge thread holds them
+   *          for the reorder window and emits them through a k-way merge, so a chunk is
+   *          delayed by at most the window plus one tick.
+   */
+  class CSerialMerger
+  {
+    private:
+
+      //! captured chunk, the data follows the header
+      struct MERGE_CHUNK
+      {
+        ULONGLONG ullTimestampUs;
+        DWORD     dwLen;
+        BYTE      abData[1];
+      };
+
+      struct MERGE_PORT
+      {
+        CSerialMerger * pMerger;
+        CSerial * pSerial;
+        DWORD dwPortId;
+
+        //! chunks captured by the listener, taken in batches by the merge thread
+        CRITICAL_SECTION csIncoming;
+        std::vector<MERGE_CHUNK*> incoming;
+        ULONGLONG ullLastUs;
+
+        //! chunks in the window, owned by the merge thread
+        std::deque<MERGE_CHUNK*> pending;
+      };
+
+      //! orders the heap by the timestamp of the first pending chunk, the earliest on top
+      struct LATER
+      {
+        bool operator()( const MERGE_PORT * a, const MERGE_PORT * b ) const
+        {
+          if (a->pending.front()->ullTimestampUs != b->pending.front()->ullTimestampUs)
+          {
+            return a->pending.front()->ullTimestampUs > b->pending.front()->ullTimestampUs;
+          }
+          return a->dwPortId > b->dwPortId;
+        }
+      };
+
+      std::vector<MERGE_PORT*> ports;
+
+      //! ports with pending chunks
+      std::vector<MERGE_PORT*> heap;
+      DWORD dwPending;
+
+      ULONGLONG ullWindowUs;
+      ULONGLONG ullLastEmittedUs;
+
+      SERIAL_MERGE_CALLBACK process;
+
+      //! capture file and its write buffer
+      HANDLE hFile;
+      BYTE * pFileBuffer;
+      DWORD dwFileBuffered;
+
+      HANDLE hMergeThread;
+      HANDLE hWakeEvent;
+      volatile BOOL bQuit;
+
+      SERIAL_MERGER_STATS stats;
+
+      static void OnCapture( LPVOID pContext, const BYTE * pData, DWORD dwLen, ULONGLONG ullTimestampUs );
+
+      //! move the captured chunks into the window
+      void Collect( void );
+
+      //! emit, in order, the chunks older than ullWatermarkUs
+      void Emit( ULONGLONG ullWatermarkUs );
+
+      void Output( MERGE_PORT * pPort, MERGE_CHUNK * pChunk );
+      void FlushFile( void );
+
+      DWORD MergeLoop( void );
+      static DWORD WINAPI ThreadStartMerge( LPVOID lpParam );
+
+    public:
+      /**
+       *  \brief  Constructor
+       *  \param  dwWindowUs reorder window: how long a chunk waits for earlier chunks of other ports
+       */
+      CSerialMerger( DWORD dwWindowUs = 10000 ) throw( ... );
+
+      /**
+       *  \brief  Destructor, stops the merge
+       */
+      virtual ~CSerialMerger( );
+
+      /**
+       *  \brief  Adds a port to the merge, before Start
+       *  \param  pSerial port, its capture is taken by the merger until Stop
+       *  \param  dwPortId identifier of the port in the merged stream
+       *  \return status of operation
+       */
+      DWORD AddPort( CSerial * pSerial, DWORD dwPortId );
+
+      /**
+       *  \brief  Writes the merged stream to a file of SERIAL_CAPTURE_RECORD, before Start
+       *  \return status of operation
+       */
+      DWORD SetOutputFile( const char * cPath );
+
+      /**
+       *  \brief  perform the action of set the function that receives the merged stream, before Start
+       */
+      void SetOutputCallback( SERIAL_MERGE_CALLBACK func );
+
+      /**
+       *  \brief  Starts capturing the ports and the merge thread
+       *  \return status of operation
+       */
+      DWORD Start( void );
+
+      /**
+       *  \brief  Stops capturing, emits everything still in the window and closes the file
+       */
+      void Stop( void );
+
+      /**
+       *  \brief  Read the counters of the merger
+       */
+      void GetStats( SERIAL_MERGER_STATS * pStats );
+  };
+
+};
+
+#endif
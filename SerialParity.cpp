@@ -0,0 +1,236 @@
+// $Id$
+
+#include "stdafx.h"
+#include "SerialParity.h"
+#include <emmintrin.h>
+#include <intrin.h>
+#include <string.h>
+
+using namespace network;
+
+//! parity of each byte in its bit 0, the other bits are garbage
+static __m128i FoldParity( __m128i xData )
+{
+    // the 16 bit shifts bring bits of the high byte into the low one, but never down to bit 0
+    xData = _mm_xor_si128(xData, _mm_srli_epi16(xData, 4));
+    xData = _mm_xor_si128(xData, _mm_srli_epi16(xData, 2));
+    xData = _mm_xor_si128(xData, _mm_srli_epi16(xData, 1));
+
+    return xData;
+}
+
+//! parity of a byte, 1 if it has an odd number of bits set
+static BYTE ByteParity( BYTE b )
+{
+    b ^= b >> 4;
+    b ^= b >> 2;
+    b ^= b >> 1;
+
+    return b & 1;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+CSerialSoftParity::CSerialSoftParity( int iParity )
+{
+    this->iParity = EVENPARITY;
+    SetParity(iParity);
+
+    memset(&stats, 0, sizeof(stats));
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialSoftParity::SetParity( int iParity )
+{
+    switch (iParity)
+    {
+        case NOPARITY:
+        case EVENPARITY:
+        case ODDPARITY:
+        case MARKPARITY:
+        case SPACEPARITY:
+            this->iParity = iParity;
+            return ERROR_SUCCESS;
+    }
+
+    return ERROR_BAD_COMMAND;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialSoftParity::Encode( const BYTE * pData, DWORD dwLen, BYTE * pOut )
+{
+    const __m128i xOne = _mm_set1_epi8(1);
+    const __m128i xLow7 = _mm_set1_epi8(0x7F);
+    __m128i xData;
+    __m128i xInvert;
+    __m128i xBit;
+    BYTE bFixed;
+    BYTE bBit;
+    DWORD i = 0;
+
+    if (iParity == EVENPARITY || iParity == ODDPARITY)
+    {
+        // the odd parity bit is the even one inverted
+        bBit = (iParity == ODDPARITY) ? 1 : 0;
+        xInvert = _mm_set1_epi8(char(bBit));
+
+        for (; i + 16 <= dwLen; i += 16)
+        {
+            xData = _mm_and_si128(_mm_loadu_si128((const __m128i*)(pData + i)), xLow7);
+            xBit = _mm_xor_si128(_mm_and_si128(FoldParity(xData), xOne), xInvert);
+            _mm_storeu_si128((__m128i*)(pOut + i), _mm_or_si128(xData, _mm_slli_epi16(xBit, 7)));
+        }
+
+        for (; i < dwLen; i++)
+        {
+            pOut[i] = BYTE((pData[i] & 0x7F) | ((ByteParity(pData[i] & 0x7F) ^ bBit) << 7));
+        }
+        return;
+    }
+
+    // a fixed bit 7: mark sets it, space and no parity clear it
+    bFixed = (iParity == MARKPARITY) ? 0x80 : 0x00;
+
+    for (; i + 16 <= dwLen; i += 16)
+    {
+        xData = _mm_and_si128(_mm_loadu_si128((const __m128i*)(pData + i)), xLow7);
+        _mm_storeu_si128((__m128i*)(pOut + i), _mm_or_si128(xData, _mm_set1_epi8(char(bFixed))));
+    }
+
+    for (; i < dwLen; i++)
+    {
+        pOut[i] = BYTE((pData[i] & 0x7F) | bFixed);
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialSoftParity::Decode( const BYTE * pData, DWORD dwLen, BYTE * pOut, DWORD * pdwFirstError )
+{
+    const __m128i xOne = _mm_set1_epi8(1);
+    const __m128i xLow7 = _mm_set1_epi8(0x7F);
+    __m128i xData;
+    __m128i xBad;
+    __m128i xExpected;
+    DWORD dwFirst = dwLen;
+    DWORD dwErrors = 0;
+    DWORD dwMask;
+    unsigned long ulIndex;
+    BYTE bExpected;
+    BYTE bBad;
+    DWORD i = 0;
+
+    // the bit that marks a good byte: the parity of the whole byte for even and odd, bit 7 for
+    //   mark and space
+    bExpected = (iParity == ODDPARITY || iParity == MARKPARITY) ? 1 : 0;
+    xExpected = _mm_set1_epi8(char(bExpected));
+
+    for (; i + 16 <= dwLen; i += 16)
+    {
+        xData = _mm_loadu_si128((const __m128i*)(pData + i));
+
+        if (iParity == NOPARITY)
+        {
+            dwMask = 0;
+        }
+        else
+        {
+            if (iParity == EVENPARITY || iParity == ODDPARITY)
+            {
+                xBad = _mm_and_si128(FoldParity(xData), xOne);
+            }
+            else
+            {
+                xBad = _mm_and_si128(_mm_srli_epi16(xData, 7), xOne);
+            }
+            dwMask = DWORD(_mm_movemask_epi8(_mm_cmpeq_epi8(xBad, xExpected))) ^ 0xFFFF;
+        }
+
+        _mm_storeu_si128((__m128i*)(pOut + i), _mm_and_si128(xData, xLow7));
+
+        // errors are rare, the mask is only walked when there is one
+        if (dwMask != 0)
+        {
+            if (dwFirst == dwLen)
+            {
+                _BitScanForward(&ulIndex, dwMask);
+                dwFirst = i + ulIndex;
+            }
+            for (; dwMask != 0; dwMask &= dwMask - 1)
+            {
+                dwErrors++;
+            }
+        }
+    }
+
+    for (; i < dwLen; i++)
+    {
+        if (iParity == EVENPARITY || iParity == ODDPARITY)
+        {
+            bBad = (ByteParity(pData[i]) != bExpected);
+        }
+        else
+        {
+            bBad = (iParity != NOPARITY) && ((pData[i] >> 7) != bExpected);
+        }
+
+        if (bBad)
+        {
+            if (dwFirst == dwLen)
+            {
+                dwFirst = i;
+            }
+            dwErrors++;
+        }
+
+        pOut[i] = pData[i] & 0x7F;
+    }
+
+    stats.ullBytes += dwLen;
+    stats.ullErrors += dwErrors;
+    if (dwErrors != 0)
+    {
+        stats.dwBadChunks++;
+    }
+
+    if (pdwFirstError != NULL)
+    {
+        *pdwFirstError = dwFirst;
+    }
+
+    return dwErrors;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialSoftParity::GetStats( SERIAL_PARITY_STATS * pStats )
+{
+    *pStats = stats;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialSoftParity::NinthBitParity( const BYTE * pData, DWORD dwLen, BOOL bNinthBit, BYTE * pParity )
+{
+    const __m128i xOne = _mm_set1_epi8(1);
+    const __m128i xNinth = _mm_set1_epi8(bNinthBit ? 1 : 0);
+    __m128i xSame;
+    BYTE bNinth = bNinthBit ? 1 : 0;
+    DWORD i = 0;
+
+    // the even parity bit is the parity of the byte: even where it equals the 9th bit, odd elsewhere
+    for (; i + 16 <= dwLen; i += 16)
+    {
+        xSame = _mm_cmpeq_epi8(_mm_and_si128(FoldParity(_mm_loadu_si128((const __m128i*)(pData + i))), xOne), xNinth);
+        _mm_storeu_si128((__m128i*)(pParity + i), _mm_add_epi8(_mm_set1_epi8(ODDPARITY), _mm_and_si128(xSame, xOne)));
+    }
+
+    for (; i < dwLen; i++)
+    {
+        pParity[i] = (ByteParity(pData[i]) == bNinth) ? EVENPARITY : ODDPARITY;
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
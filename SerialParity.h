@@ -0,0 +1,84 @@
+// $Id$
+
+#ifndef __SERIAL_PARITY_H__
+#define __SERIAL_PARITY_H__
+
+#include <windows.h>
+
+namespace network {
+
+  //! counters of a CSerialSoftParity
+  struct SERIAL_PARITY_STATS
+  {
+    ULONGLONG ullBytes;       // bytes decoded
+    ULONGLONG ullErrors;      // bytes whose parity bit was wrong
+    DWORD     dwBadChunks;    // chunks with at least one error
+  };
+
+  /**
+   *  \brief  Parity computed by the library, for adapters that handle 7 bit characters or
+   *          mark/space parity poorly: the port runs at 8N1 and each byte carries 7 data bits
+   *          and the parity bit in bit 7, as 7E1, 7O1, 7M1 or 7S1 would put it on the line.
+   *          The bytes are encoded and checked 16 at a time with SSE2, folding each byte onto
+   *          its parity bit, and one at a time for the tail of the buffer.
+   */
+  class CSerialSoftParity
+  {
+    private:
+
+      int iParity;
+
+      SERIAL_PARITY_STATS stats;
+
+    public:
+      /**
+       *  \brief  Constructor
+       *  \param  iParity parity emulated: NOPARITY (bit 7 is stripped only), EVENPARITY, ODDPARITY, MARKPARITY or SPACEPARITY
+       */
+      CSerialSoftParity( int iParity = EVENPARITY );
+
+      /**
+       *  \brief  Changes the parity emulated
+       *  \return status of operation
+       */
+      DWORD SetParity( int iParity );
+
+      /**
+       *  \brief  Encodes 7 bit characters for the line: bit 7 of each byte is replaced by the parity bit
+       *  \param  pData characters to send, bit 7 is ignored
+       *  \param  dwLen number of characters
+       *  \param  pOut encoded bytes, may be pData
+       */
+      void Encode( const BYTE * pData, DWORD dwLen, BYTE * pOut );
+
+      /**
+       *  \brief  Checks and strips the parity bit of received bytes
+       *  \param  pData received bytes
+       *  \param  dwLen number of bytes
+       *  \param  pOut 7 bit characters, may be pData
+       *  \param  pdwFirstError offset of the first byte with a wrong parity, dwLen if none; may be NULL
+       *  \return number of bytes of the chunk with a wrong parity
+       */
+      DWORD Decode( const BYTE * pData, DWORD dwLen, BYTE * pOut, DWORD * pdwFirstError = NULL );
+
+      /**
+       *  \brief  Read the counters of Decode
+       */
+      void GetStats( SERIAL_PARITY_STATS * pStats );
+
+      /**
+       *  \brief  Parity that gives each byte a 9th bit, for the 9 bit addressing of multidrop
+       *          buses on adapters without mark and space parity: sent with the parity given here
+       *          (SetParity), a byte carries bNinthBit in its parity bit. The parity may only be
+       *          changed once the bytes sent with the previous one have left the line.
+       *  \param  pData bytes to send
+       *  \param  dwLen number of bytes
+       *  \param  bNinthBit TRUE for the address bytes (mark), FALSE for the data bytes (space)
+       *  \param  pParity receives EVENPARITY or ODDPARITY for each byte
+       */
+      static void NinthBitParity( const BYTE * pData, DWORD dwLen, BOOL bNinthBit, BYTE * pParity );
+  };
+
+};
+
+#endif
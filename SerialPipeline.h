@@ -0,0 +1,719 @@
+// $Id$
+
+#ifndef __SERIAL_PIPELINE_H__
+#define __SERIAL_PIPELINE_H__
+
+#include <windows.h>
+#include <string.h>
+#include <emmintrin.h>
+#include <intrin.h>
+#include "Serial.h"
+#include "SerialParity.h"
+
+namespace network {
+
+  /**
+   *  Receive pipeline assembled at compile time. CSerialT<Framer, Checksum, Sink> runs its own
+   *  listener loop that feeds the received chunks to the framer, checks each frame and hands it
+   *  to the sink, all through inlined calls on concrete types.
+   *
+   *  Framer:   DWORD Feed( const BYTE * pData, DWORD dwLen, const BYTE ** ppFrame, DWORD * pdwFrameLen )
+   *            consumes at least one byte and returns how many, setting *ppFrame to a complete frame
+   *            (valid until the next Feed) or to NULL.
+   *  Checksum: enum { LENGTH }, trailer length, and static BOOL Verify( const BYTE * pFrame, DWORD dwLen ).
+   *  Sink:     void OnFrame( const BYTE * pData, DWORD dwLen, ULONGLONG ullTimestampUs ), frame without
+   *            the trailer, and void OnBadFrame( const BYTE * pFrame, DWORD dwLen, ULONGLONG ullTimestampUs ).
+   */
+
+  /**
+   *  \brief  Framer that hands over every received chunk as it is
+   */
+  class CSerialChunkFramer
+  {
+    public:
+      DWORD Feed( const BYTE * pData, DWORD dwLen, const BYTE ** ppFrame, DWORD * pdwFrameLen )
+      {
+          *ppFrame = pData;
+          *pdwFrameLen = dwLen;
+          return dwLen;
+      }
+  };
+
+  /**
+   *  \brief  Framer of frames terminated by a delimiter (not included in the frame). Frames
+   *          longer than MaxFrameLen are dropped.
+   */
+  template <BYTE Delimiter, DWORD MaxFrameLen>
+  class CSerialDelimiterFramer
+  {
+    private:
+
+      BYTE abFrame[MaxFrameLen];
+      DWORD dwFrameLen;
+
+      //! the frame being assembled is too long, drop it up to the delimiter
+      BOOL bOverrun;
+      DWORD dwOverruns;
+
+    public:
+      enum { MAX_FRAME_LEN = MaxFrameLen };
+
+      CSerialDelimiterFramer( ) : dwFrameLen(0), bOverrun(FALSE), dwOverruns(0)
+      {
+      }
+
+      DWORD Feed( const BYTE * pData, DWORD dwLen, const BYTE ** ppFrame, DWORD * pdwFrameLen )
+      {
+          const BYTE * pEnd = (const BYTE*)memchr(pData, Delimiter, dwLen);
+          DWORD dwTake = (pEnd != NULL) ? DWORD(pEnd - pData) : dwLen;
+
+          *ppFrame = NULL;
+
+          // a frame that lies entirely in the chunk is not copied
+          if (pEnd != NULL && dwFrameLen == 0 && !bOverrun && dwTake <= MaxFrameLen)
+          {
+              *ppFrame = pData;
+              *pdwFrameLen = dwTake;
+              return dwTake + 1;
+          }
+
+          if (bOverrun || dwFrameLen + dwTake > MaxFrameLen)
+          {
+              bOverrun = TRUE;
+              dwFrameLen = 0;
+          }
+          else
+          {
+              memcpy(abFrame + dwFrameLen, pData, dwTake);
+              dwFrameLen += dwTake;
+          }
+
+          if (pEnd == NULL)
+          {
+              return dwLen;
+          }
+
+          if (bOverrun)
+          {
+              dwOverruns++;
+              bOverrun = FALSE;
+          }
+          else
+          {
+              *ppFrame = abFrame;
+              *pdwFrameLen = dwFrameLen;
+          }
+
+          dwFrameLen = 0;
+          return dwTake + 1;
+      }
+
+      //! number of frames dropped for being too long
+      DWORD GetOverruns( void )
+      {
+          return dwOverruns;
+      }
+  };
+
+  /**
+   *  \brief  Framer of text lines terminated by LF; the CR of a CRLF is removed and the empty
+   *          lines are skipped. The terminator is searched 32 bytes at a time with SSE2, and a
+   *          line that lies entirely in the chunk is not copied. Lines longer than MaxLineLen,
+   *          terminator included, are dropped.
+   */
+  template <DWORD MaxLineLen>
+  class CSerialLineFramer
+  {
+    private:
+
+      BYTE abLine[MaxLineLen];
+      DWORD dwLineLen;
+
+      //! the line being assembled is too long, drop it up to the terminator
+      BOOL bOverrun;
+      DWORD dwOverruns;
+
+      static const BYTE * FindLineFeed( const BYTE * pData, DWORD dwLen )
+      {
+          const __m128i xLf = _mm_set1_epi8('\n');
+          unsigned long ulIndex;
+          int iMask;
+          DWORD i = 0;
+
+          // two blocks per test, a line of text rarely ends in the first 16 bytes
+          for (; i + 32 <= dwLen; i += 32)
+          {
+              iMask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(pData + i)), xLf)) |
+                      (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(pData + i + 16)), xLf)) << 16);
+              if (iMask != 0)
+              {
+                  _BitScanForward(&ulIndex, (unsigned long)iMask);
+                  return pData + i + ulIndex;
+              }
+          }
+
+          for (; i + 16 <= dwLen; i += 16)
+          {
+              iMask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(pData + i)), xLf));
+              if (iMask != 0)
+              {
+                  _BitScanForward(&ulIndex, (unsigned long)iMask);
+                  return pData + i + ulIndex;
+              }
+          }
+
+          for (; i < dwLen; i++)
+          {
+              if (pData[i] == '\n')
+              {
+                  return pData + i;
+              }
+          }
+
+          return NULL;
+      }
+
+    public:
+      enum { MAX_FRAME_LEN = MaxLineLen };
+
+      CSerialLineFramer( ) : dwLineLen(0), bOverrun(FALSE), dwOverruns(0)
+      {
+      }
+
+      DWORD Feed( const BYTE * pData, DWORD dwLen, const BYTE ** ppFrame, DWORD * pdwFrameLen )
+      {
+          const BYTE * pEnd = FindLineFeed(pData, dwLen);
+          DWORD dwTake = (pEnd != NULL) ? DWORD(pEnd - pData) : dwLen;
+          DWORD dwLine;
+
+          *ppFrame = NULL;
+
+          // a line that lies entirely in the chunk is not copied
+          if (pEnd != NULL && dwLineLen == 0 && !bOverrun && dwTake < MaxLineLen)
+          {
+              dwLine = (dwTake > 0 && pData[dwTake - 1] == '\r') ? dwTake - 1 : dwTake;
+              if (dwLine > 0)
+              {
+                  *ppFrame = pData;
+                  *pdwFrameLen = dwLine;
+              }
+              return dwTake + 1;
+          }
+
+          if (bOverrun || dwLineLen + dwTake >= MaxLineLen)
+          {
+              bOverrun = TRUE;
+              dwLineLen = 0;
+          }
+          else
+          {
+              memcpy(abLine + dwLineLen, pData, dwTake);
+              dwLineLen += dwTake;
+          }
+
+          if (pEnd == NULL)
+          {
+              return dwLen;
+          }
+
+          if (bOverrun)
+          {
+              dwOverruns++;
+              bOverrun = FALSE;
+          }
+          else
+          {
+              dwLine = (dwLineLen > 0 && abLine[dwLineLen - 1] == '\r') ? dwLineLen - 1 : dwLineLen;
+              if (dwLine > 0)
+              {
+                  *ppFrame = abLine;
+                  *pdwFrameLen = dwLine;
+              }
+          }
+
+          dwLineLen = 0;
+          return dwTake + 1;
+      }
+
+      //! number of lines dropped for being too long
+      DWORD GetOverruns( void )
+      {
+          return dwOverruns;
+      }
+  };
+
+  /**
+   *  \brief  Framer of SLIP (RFC 1055) frames. Frames longer than MaxFrameLen are dropped.
+   */
+  template <DWORD MaxFrameLen>
+  class CSerialSlipFramer
+  {
+    private:
+
+      enum { SLIP_END = 0xC0, SLIP_ESC = 0xDB, SLIP_ESC_END = 0xDC, SLIP_ESC_ESC = 0xDD };
+
+      BYTE abFrame[MaxFrameLen];
+      DWORD dwFrameLen;
+      BOOL bEscape;
+      BOOL bOverrun;
+      DWORD dwOverruns;
+
+    public:
+      enum { MAX_FRAME_LEN = MaxFrameLen };
+
+      CSerialSlipFramer( ) : dwFrameLen(0), bEscape(FALSE), bOverrun(FALSE), dwOverruns(0)
+      {
+      }
+
+      DWORD Feed( const BYTE * pData, DWORD dwLen, const BYTE ** ppFrame, DWORD * pdwFrameLen )
+      {
+          DWORD i;
+          BYTE b;
+
+          for (i = 0; i < dwLen; i++)
+          {
+              b = pData[i];
+
+              if (b == SLIP_END)
+              {
+                  if (bOverrun)
+                  {
+                      dwOverruns++;
+                  }
+                  else if (dwFrameLen > 0)
+                  {
+                      *ppFrame = abFrame;
+                      *pdwFrameLen = dwFrameLen;
+                      dwFrameLen = 0;
+                      bEscape = FALSE;
+                      return i + 1;
+                  }
+
+                  dwFrameLen = 0;
+                  bEscape = FALSE;
+                  bOverrun = FALSE;
+                  continue;
+              }
+
+              if (bEscape)
+              {
+                  b = (b == SLIP_ESC_END) ? BYTE(SLIP_END) : (b == SLIP_ESC_ESC) ? BYTE(SLIP_ESC) : b;
+                  bEscape = FALSE;
+              }
+              else if (b == SLIP_ESC)
+              {
+                  bEscape = TRUE;
+                  continue;
+              }
+
+              if (dwFrameLen == MaxFrameLen)
+              {
+                  bOverrun = TRUE;
+              }
+              else
+              {
+                  abFrame[dwFrameLen++] = b;
+              }
+          }
+
+          *ppFrame = NULL;
+          return dwLen;
+      }
+
+      //! number of frames dropped for being too long
+      DWORD GetOverruns( void )
+      {
+          return dwOverruns;
+      }
+  };
+
+  /**
+   *  \brief  Framer adapter that checks and strips the parity computed by the library (see
+   *          CSerialSoftParity) before Framer, for 7 bit protocols run on an 8N1 port. Each
+   *          chunk is decoded once, however many frames Framer takes from it; Framer must
+   *          consume a chunk wholly before the next one is fed, as CSerialT does.
+   *  \param  ChunkLen largest chunk decoded at once, the RxBufferLen of the CSerialT
+   */
+  template <class Framer, DWORD ChunkLen = 1024>
+  class CSerialParityFramer
+  {
+    private:
+
+      Framer framer;
+      CSerialSoftParity parity;
+
+      //! the chunk being framed, decoded, and the next received byte it corresponds to
+      BYTE abDecoded[ChunkLen];
+      DWORD dwDecodedPos;
+      DWORD dwDecodedLeft;
+      const BYTE * pNext;
+
+      DWORD dwChunkErrors;
+
+    public:
+      CSerialParityFramer( ) : dwDecodedPos(0), dwDecodedLeft(0), pNext(NULL), dwChunkErrors(0)
+      {
+      }
+
+      DWORD Feed( const BYTE * pData, DWORD dwLen, const BYTE ** ppFrame, DWORD * pdwFrameLen )
+      {
+          DWORD dwUsed;
+
+          // a new chunk
+          if (pData != pNext || dwLen != dwDecodedLeft)
+          {
+              dwLen = (dwLen < ChunkLen) ? dwLen : ChunkLen;
+              dwChunkErrors = parity.Decode(pData, dwLen, abDecoded);
+              dwDecodedPos = 0;
+              dwDecodedLeft = dwLen;
+          }
+
+          dwUsed = framer.Feed(abDecoded + dwDecodedPos, dwDecodedLeft, ppFrame, pdwFrameLen);
+          dwDecodedPos += dwUsed;
+          dwDecodedLeft -= dwUsed;
+          pNext = pData + dwUsed;
+
+          return dwUsed;
+      }
+
+      //! parity emulated and its counters
+      CSerialSoftParity & GetParity( void )
+      {
+          return parity;
+      }
+
+      //! the framer behind the adapter
+      Framer & GetFramer( void )
+      {
+          return framer;
+      }
+
+      //! bytes with a wrong parity in the last chunk received
+      DWORD GetChunkErrors( void )
+      {
+          return dwChunkErrors;
+      }
+  };
+
+  /**
+   *  \brief  No trailer, every frame is accepted
+   */
+  class CSerialNoChecksum
+  {
+    public:
+      enum { LENGTH = 0 };
+
+      static BOOL Verify( const BYTE * pFrame, DWORD dwLen )
+      {
+          return TRUE;
+      }
+  };
+
+  /**
+   *  \brief  Trailer of one byte with the XOR of the frame (LRC)
+   */
+  class CSerialXorChecksum
+  {
+    public:
+      enum { LENGTH = 1 };
+
+      static BOOL Verify( const BYTE * pFrame, DWORD dwLen )
+      {
+          BYTE bXor = 0;
+          DWORD i;
+
+          if (dwLen < LENGTH)
+          {
+              return FALSE;
+          }
+
+          for (i = 0; i < dwLen; i++)
+          {
+              bXor ^= pFrame[i];
+          }
+
+          // the XOR of the data and its trailer is zero
+          return bXor == 0;
+      }
+  };
+
+  /**
+   *  \brief  Checksum of the NMEA 0183 sentences, $...*hh (or !...*hh for AIS) where hh is the
+   *          XOR, in hexadecimal, of the characters between the start and the asterisk. The
+   *          trailer "*hh" is removed from the sentences handed to the sink. The XOR is folded
+   *          16 bytes at a time with SSE2, over a line the framer has just brought to the cache.
+   */
+  class CSerialNmeaChecksum
+  {
+    private:
+
+      static int HexValue( BYTE b )
+      {
+          if (b >= '0' && b <= '9')
+          {
+              return b - '0';
+          }
+          if (b >= 'A' && b <= 'F')
+          {
+              return b - 'A' + 10;
+          }
+          if (b >= 'a' && b <= 'f')
+          {
+              return b - 'a' + 10;
+          }
+          return -1;
+      }
+
+    public:
+      enum { LENGTH = 3 };
+
+      static BOOL Verify( const BYTE * pFrame, DWORD dwLen )
+      {
+          __m128i xXor = _mm_setzero_si128();
+          const BYTE * pData;
+          DWORD dwDataLen;
+          int iHigh;
+          int iLow;
+          BYTE bXor;
+          DWORD i;
+
+          if (dwLen < LENGTH + 1 || (pFrame[0] != '$' && pFrame[0] != '!') || pFrame[dwLen - LENGTH] != '*')
+          {
+              return FALSE;
+          }
+
+          iHigh = HexValue(pFrame[dwLen - 2]);
+          iLow = HexValue(pFrame[dwLen - 1]);
+          if (iHigh < 0 || iLow < 0)
+          {
+              return FALSE;
+          }
+
+          pData = pFrame + 1;
+          dwDataLen = dwLen - 1 - LENGTH;
+
+          for (i = 0; i + 16 <= dwDataLen; i += 16)
+          {
+              xXor = _mm_xor_si128(xXor, _mm_loadu_si128((const __m128i*)(pData + i)));
+          }
+
+          // fold the 16 lanes into the lowest one
+          xXor = _mm_xor_si128(xXor, _mm_srli_si128(xXor, 8));
+          xXor = _mm_xor_si128(xXor, _mm_srli_si128(xXor, 4));
+          xXor = _mm_xor_si128(xXor, _mm_srli_si128(xXor, 2));
+          xXor = _mm_xor_si128(xXor, _mm_srli_si128(xXor, 1));
+          bXor = BYTE(_mm_cvtsi128_si32(xXor));
+
+          for (; i < dwDataLen; i++)
+          {
+              bXor ^= pData[i];
+          }
+
+          return bXor == BYTE((iHigh << 4) | iLow);
+      }
+  };
+
+  //! lookup table of CRC-16/MODBUS, a template so the header can define it
+  template <int N>
+  struct CSerialModbusCrcTable
+  {
+    static const WORD awCrc[256];
+  };
+
+  template <int N>
+  const WORD CSerialModbusCrcTable<N>::awCrc[256] =
+  {
+    0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
+    0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
+    0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
+    0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
+    0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
+    0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
+    0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
+    0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
+    0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
+    0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
+    0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
+    0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
+    0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
+    0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
+    0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
+    0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
+    0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
+    0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
+    0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
+    0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
+    0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
+    0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
+    0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
+    0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
+    0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
+    0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
+    0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
+    0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
+    0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
+    0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
+    0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
+    0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040
+  };
+
+  /**
+   *  \brief  Trailer of two bytes with the CRC-16/MODBUS of the frame, low byte first
+   */
+  class CSerialModbusChecksum
+  {
+    public:
+      enum { LENGTH = 2 };
+
+      static BOOL Verify( const BYTE * pFrame, DWORD dwLen )
+      {
+          WORD wCrc = 0xFFFF;
+          DWORD i;
+
+          if (dwLen < LENGTH)
+          {
+              return FALSE;
+          }
+
+          for (i = 0; i < dwLen - LENGTH; i++)
+          {
+              wCrc = WORD((wCrc >> 8) ^ CSerialModbusCrcTable<0>::awCrc[(wCrc ^ pFrame[i]) & 0xFF]);
+          }
+
+          return pFrame[dwLen - 2] == BYTE(wCrc) && pFrame[dwLen - 1] == BYTE(wCrc >> 8);
+      }
+  };
+
+  /**
+   *  \brief  Sink that forwards the frames to a SERIAL_PORT_CALLBACK, for code written for
+   *          RegisterListenner. The frames with a bad checksum are dropped.
+   */
+  class CSerialCallbackSink
+  {
+    private:
+
+      SERIAL_PORT_CALLBACK process;
+      volatile DWORD dwBadFrames;
+
+    public:
+      CSerialCallbackSink( ) : process(NULL), dwBadFrames(0)
+      {
+      }
+
+      void SetCallback( SERIAL_PORT_CALLBACK func )
+      {
+          process = func;
+      }
+
+      DWORD GetBadFrames( void )
+      {
+          return dwBadFrames;
+      }
+
+      void OnFrame( const BYTE * pData, DWORD dwLen, ULONGLONG ullTimestampUs )
+      {
+          if (process != NULL)
+          {
+              process(const_cast<BYTE*>(pData), dwLen);
+          }
+      }
+
+      void OnBadFrame( const BYTE * pFrame, DWORD dwLen, ULONGLONG ullTimestampUs )
+      {
+          dwBadFrames++;
+      }
+  };
+
+  /**
+   *  \brief  CSerial whose received data goes through a pipeline fixed at compile time instead
+   *          of the callbacks. The framer and the sink run on the listener thread. Idle-line
+   *          framing and the executor do not apply; the modem line callback, the flow control,
+   *          the receive tap and the capture do.
+   *  \param  RxBufferLen size of the buffer of each read
+   */
+  template <class Framer, class Checksum, class Sink, DWORD RxBufferLen = 1024>
+  class CSerialT : public CSerial
+  {
+    protected:
+
+      Framer framer;
+      Sink sink;
+
+      virtual DWORD SerialPortListener( void )
+      {
+          BYTE abBuffer[RxBufferLen];
+          DWORD dwRead;
+          ULONGLONG ullTimestampUs;
+
+          if (ListenerStart())
+          {
+              while (ListenerRead(abBuffer, RxBufferLen, &dwRead, &ullTimestampUs))
+              {
+                  Process(abBuffer, dwRead, ullTimestampUs);
+              }
+          }
+
+          return ListenerStop();
+      }
+
+      void Process( const BYTE * pData, DWORD dwLen, ULONGLONG ullTimestampUs )
+      {
+          const BYTE * pFrame;
+          DWORD dwFrameLen;
+          DWORD dwUsed;
+
+          while (dwLen > 0)
+          {
+              dwUsed = framer.Feed(pData, dwLen, &pFrame, &dwFrameLen);
+              pData += dwUsed;
+              dwLen -= dwUsed;
+
+              if (pFrame == NULL)
+              {
+                  continue;
+              }
+
+              if (Checksum::Verify(pFrame, dwFrameLen))
+              {
+                  sink.OnFrame(pFrame, dwFrameLen - DWORD(Checksum::LENGTH), ullTimestampUs);
+              }
+              else
+              {
+                  sink.OnBadFrame(pFrame, dwFrameLen, ullTimestampUs);
+              }
+          }
+      }
+
+    public:
+      CSerialT( ) throw( ... )
+      {
+      }
+
+      /**
+       *  \brief  Destructor, stops the listener while the framer and the sink still exist
+       */
+      virtual ~CSerialT( )
+      {
+          Close();
+      }
+
+      /**
+       *  \brief  Framer of the pipeline, shared with the listener thread
+       */
+      Framer & GetFramer( void )
+      {
+          return framer;
+      }
+
+      /**
+       *  \brief  Sink of the pipeline, shared with the listener thread
+       */
+      Sink & GetSink( void )
+      {
+          return sink;
+      }
+  };
+
+};
+
+#endif
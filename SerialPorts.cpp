@@ -0,0 +1,240 @@
+// $Id$
+
+#include "stdafx.h"
+#include "SerialPorts.h"
+#include "SerialClock.h"
+#include <setupapi.h>
+#include <cfgmgr32.h>
+#include <stdlib.h>
+#include <string.h>
+
+#pragma comment(lib, "setupapi.lib")
+
+using namespace network;
+
+//! GUID_DEVINTERFACE_COMPORT, the interface of every serial port driver
+static const GUID guidComPort = { 0x86E0D1E0, 0x8089, 0x11D0, { 0x9C, 0xE4, 0x08, 0x00, 0x3E, 0x30, 0x1F, 0x73 } };
+
+//! levels of parent devices searched for the USB device of a port
+#define SERIAL_USB_MAX_DEPTH        (3)
+
+//! state shared by the threads of OpenSerialPorts
+struct SERIAL_BULK_OPEN
+{
+    SERIAL_OPEN_REQUEST * pRequests;
+    DWORD dwCount;
+    volatile LONG lNext;
+    ULONGLONG ullStartUs;
+};
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+/**
+ *  \brief  Reads the vendor, product and serial number from a USB device instance id,
+ *          USB\VID_xxxx&PID_xxxx\<serial number>
+ *  \return TRUE if the id is the one of the USB device, FALSE if the parent must be searched
+ */
+static BOOL ParseUsbId( const char * cId, SERIAL_PORT_INFO * pInfo )
+{
+    const char * cSerial;
+    char * cEnd;
+    WORD wVendorId;
+    WORD wProductId;
+
+    if (_strnicmp(cId, "USB\\VID_", 8) != 0)
+    {
+        return FALSE;
+    }
+
+    wVendorId = WORD(strtoul(cId + 8, &cEnd, 16));
+    if (_strnicmp(cEnd, "&PID_", 5) != 0)
+    {
+        return FALSE;
+    }
+    wProductId = WORD(strtoul(cEnd + 5, &cEnd, 16));
+
+    if (pInfo->wVendorId == 0)
+    {
+        pInfo->wVendorId = wVendorId;
+        pInfo->wProductId = wProductId;
+    }
+
+    // an interface of a composite device, the serial number belongs to its parent
+    if (_strnicmp(cEnd, "&MI_", 4) == 0)
+    {
+        return FALSE;
+    }
+
+    // without a serial number Windows makes up an id with '&', unique only to the USB port
+    cSerial = strchr(cEnd, '\\');
+    if (cSerial != NULL && strchr(cSerial + 1, '&') == NULL)
+    {
+        _snprintf(pInfo->cSerialNumber, sizeof(pInfo->cSerialNumber) - 1, "%s", cSerial + 1);
+    }
+
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD network::EnumerateSerialPorts( std::vector<SERIAL_PORT_INFO> * pPorts )
+{
+    HDEVINFO hDevInfo;
+    SP_DEVINFO_DATA devInfo;
+    SERIAL_PORT_INFO info;
+    HKEY hKey;
+    DEVINST devInst;
+    char cId[MAX_DEVICE_ID_LEN];
+    DWORD dwType;
+    DWORD dwSize;
+    DWORD dwError;
+    LONG lResult;
+    DWORD i;
+    int iDepth;
+
+    pPorts->clear();
+
+    hDevInfo = SetupDiGetClassDevsA(&guidComPort, NULL, NULL, DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
+    if (hDevInfo == INVALID_HANDLE_VALUE)
+    {
+        return ::GetLastError();
+    }
+
+    for (i = 0; ; i++)
+    {
+        devInfo.cbSize = sizeof(SP_DEVINFO_DATA);
+        if (!SetupDiEnumDeviceInfo(hDevInfo, i, &devInfo))
+        {
+            dwError = ::GetLastError();
+            break;
+        }
+
+        SecureZeroMemory(&info, sizeof(SERIAL_PORT_INFO));
+
+        // the port name is what CreateFile opens, a device without one cannot be used
+        hKey = SetupDiOpenDevRegKey(hDevInfo, &devInfo, DICS_FLAG_GLOBAL, 0, DIREG_DEV, KEY_READ);
+        if (hKey == INVALID_HANDLE_VALUE)
+        {
+            continue;
+        }
+
+        dwSize = sizeof(info.cPortName) - 1;
+        lResult = RegQueryValueExA(hKey, "PortName", NULL, &dwType, (LPBYTE)info.cPortName, &dwSize);
+        RegCloseKey(hKey);
+
+        if (lResult != ERROR_SUCCESS || dwType != REG_SZ)
+        {
+            continue;
+        }
+
+        // the \\.\ prefix is required from COM10 on
+        _snprintf(info.cDevice, sizeof(info.cDevice) - 1, "\\\\.\\%s", info.cPortName);
+
+        SetupDiGetDeviceRegistryPropertyA(hDevInfo, &devInfo, SPDRP_FRIENDLYNAME, NULL, (PBYTE)info.cFriendlyName, sizeof(info.cFriendlyName) - 1, NULL);
+        SetupDiGetDeviceRegistryPropertyA(hDevInfo, &devInfo, SPDRP_SERVICE, NULL, (PBYTE)info.cDriver, sizeof(info.cDriver) - 1, NULL);
+        SetupDiGetDeviceInstanceIdA(hDevInfo, &devInfo, info.cInstanceId, sizeof(info.cInstanceId) - 1, NULL);
+
+        // usbser is the USB device itself, the ports of FTDIBUS and of composite devices are
+        // its children
+        devInst = devInfo.DevInst;
+        for (iDepth = 0; iDepth < SERIAL_USB_MAX_DEPTH; iDepth++)
+        {
+            if (CM_Get_Device_IDA(devInst, cId, sizeof(cId), 0) != CR_SUCCESS || ParseUsbId(cId, &info))
+            {
+                break;
+            }
+
+            if (CM_Get_Parent(&devInst, devInst, 0) != CR_SUCCESS)
+            {
+                break;
+            }
+        }
+
+        pPorts->push_back(info);
+    }
+
+    SetupDiDestroyDeviceInfoList(hDevInfo);
+
+    return (dwError == ERROR_NO_MORE_ITEMS) ? ERROR_SUCCESS : dwError;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static DWORD WINAPI ThreadStartBulkOpen( LPVOID lpParam )
+{
+    SERIAL_BULK_OPEN * pBulk = (SERIAL_BULK_OPEN*)lpParam;
+    SERIAL_OPEN_REQUEST * pRequest;
+    ULONGLONG ullStartUs;
+    LONG lIndex;
+
+    // each thread takes the next port until none is left, so a slow port holds back one thread only
+    while ((lIndex = InterlockedIncrement(&pBulk->lNext) - 1) < LONG(pBulk->dwCount))
+    {
+        pRequest = &pBulk->pRequests[lIndex];
+
+        ullStartUs = GetTimestampUs();
+        pRequest->dwQueuedUs = DWORD(ullStartUs - pBulk->ullStartUs);
+
+        pRequest->dwError = pRequest->pSerial->Open(pRequest->cDevice, pRequest->iBaudRate, pRequest->iByteSize,
+                                                    pRequest->iParity, pRequest->iStopBits);
+
+        pRequest->dwOpenUs = DWORD(GetTimestampUs() - ullStartUs);
+    }
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD network::OpenSerialPorts( SERIAL_OPEN_REQUEST * pRequests, DWORD dwCount, DWORD dwParallelism )
+{
+    SERIAL_BULK_OPEN bulk;
+    std::vector<HANDLE> threads;
+    HANDLE hThread;
+    DWORD i;
+
+    bulk.pRequests = pRequests;
+    bulk.dwCount = dwCount;
+    bulk.lNext = 0;
+    bulk.ullStartUs = GetTimestampUs();
+
+    for (i = 0; i < dwCount; i++)
+    {
+        pRequests[i].dwError = ERROR_OPERATION_ABORTED;
+        pRequests[i].dwQueuedUs = 0;
+        pRequests[i].dwOpenUs = 0;
+    }
+
+    dwParallelism = (dwParallelism < dwCount) ? dwParallelism : dwCount;
+
+    // the calling thread is one of the workers; with fewer threads created, the others do more ports
+    for (i = 1; i < dwParallelism; i++)
+    {
+        hThread = ::CreateThread(NULL, 0, ThreadStartBulkOpen, &bulk, 0, NULL);
+        if (hThread == NULL)
+        {
+            break;
+        }
+        threads.push_back(hThread);
+    }
+
+    ThreadStartBulkOpen(&bulk);
+
+    for (i = 0; i < threads.size(); i++)
+    {
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+    }
+
+    for (i = 0; i < dwCount; i++)
+    {
+        if (pRequests[i].dwError != ERROR_SUCCESS)
+        {
+            return pRequests[i].dwError;
+        }
+    }
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
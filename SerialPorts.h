@@ -0,0 +1,61 @@
+// $Id$
+
+#ifndef __SERIAL_PORTS_H__
+#define __SERIAL_PORTS_H__
+
+#include <windows.h>
+#include <vector>
+#include "Serial.h"
+
+namespace network {
+
+  //! serial device present in the system
+  struct SERIAL_PORT_INFO
+  {
+    char  cPortName[16];            // COM3
+    char  cDevice[32];              // \\.\COM3, the name taken by CSerial::Open
+    char  cFriendlyName[128];       // as shown by the device manager
+    char  cDriver[64];              // driver service, as usbser or FTDIBUS
+    char  cInstanceId[MAX_PATH];    // device instance id, follows the device whatever COM number it gets
+    char  cSerialNumber[64];        // USB serial number, empty when the device has none
+    WORD  wVendorId;                // USB vendor id, 0 when the port is not on USB
+    WORD  wProductId;               // USB product id
+  };
+
+  //! port to open with OpenSerialPorts and the result of its opening
+  struct SERIAL_OPEN_REQUEST
+  {
+    CSerial *     pSerial;
+    const char *  cDevice;
+    int           iBaudRate;
+    int           iByteSize;
+    int           iParity;
+    int           iStopBits;
+
+    DWORD         dwError;          // result of CSerial::Open
+    DWORD         dwQueuedUs;       // time waited for a free worker
+    DWORD         dwOpenUs;         // time taken by CSerial::Open
+  };
+
+  /**
+   *  \brief  Lists the serial devices present in the system, with the identity of the USB
+   *          device behind each port
+   *  \param  pPorts devices found
+   *  \return status of operation
+   */
+  DWORD EnumerateSerialPorts( std::vector<SERIAL_PORT_INFO> * pPorts );
+
+  /**
+   *  \brief  Opens and configures many ports concurrently. Most of the time of an open is spent
+   *          waiting for the driver (a USB adapter answers every configuration request with a
+   *          round trip), so the ports are opened by dwParallelism threads, the caller among them.
+   *  \param  pRequests ports to open, each receives its result and timings
+   *  \param  dwCount number of ports
+   *  \param  dwParallelism largest number of ports being opened at the same time
+   *  \return ERROR_SUCCESS if every port was opened, otherwise the error of the first one that failed
+   */
+  DWORD OpenSerialPorts( SERIAL_OPEN_REQUEST * pRequests, DWORD dwCount, DWORD dwParallelism = 16 );
+
+};
+
+#endif
@@ -0,0 +1,525 @@
+// $Id$
+
+#include "stdafx.h"
+#include "SerialShared.h"
+#include <stddef.h>
+#include <string.h>
+
+using namespace network;
+
+#define SERIAL_SHARED_MAGIC         (0x4D485353)    // "SSHM"
+#define SERIAL_SHARED_VERSION       (1)
+
+//! smallest ring, it must hold several of the largest chunks of the listener
+#define SERIAL_SHARED_MIN_CAPACITY  (65536)
+
+//! name of the mapping and, followed by the slot number, of the reader events
+#define SERIAL_SHARED_PREFIX        "Local\\SerialShared."
+
+//! size of the header, the ring starts on its own cache line
+static DWORD HeaderSize( DWORD dwMaxReaders )
+{
+    DWORD dwSize = DWORD(offsetof(SERIAL_SHARED_HEADER, readers)) + dwMaxReaders * sizeof(SERIAL_SHARED_READER);
+
+    return (dwSize + 63) & ~63UL;
+}
+
+//! size of a record in the ring
+static DWORD RecordSize( DWORD dwLen )
+{
+    return sizeof(SERIAL_SHARED_RECORD) + ((dwLen + 7) & ~7UL);
+}
+
+//! 64 bits read that is atomic in 32 bits processes too
+static LONGLONG ReadPosition( volatile LONGLONG * pllPos )
+{
+    return InterlockedCompareExchange64(pllPos, 0, 0);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+CSerialPublisher::CSerialPublisher( )
+{
+    pSerial = NULL;
+    hMapping = NULL;
+    pHeader = NULL;
+    pRing = NULL;
+    phEvents = NULL;
+    llWritePos = 0;
+    memset(&stats, 0, sizeof(stats));
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+CSerialPublisher::~CSerialPublisher( )
+{
+    Stop();
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialPublisher::Start( CSerial * pSerial, const char * cName, DWORD dwCapacity, DWORD dwMaxReaders )
+{
+    char cObject[MAX_PATH];
+    DWORD dwHeaderSize;
+    DWORD dwError;
+    BOOL bExisting;
+    DWORD i;
+
+    if (hMapping != NULL)
+    {
+        return ERROR_BUSY;
+    }
+
+    if (dwCapacity < SERIAL_SHARED_MIN_CAPACITY || (dwCapacity & (dwCapacity - 1)) != 0 || dwMaxReaders == 0)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    dwHeaderSize = HeaderSize(dwMaxReaders);
+
+    _snprintf(cObject, sizeof(cObject) - 1, SERIAL_SHARED_PREFIX "%s", cName);
+    cObject[sizeof(cObject) - 1] = '\0';
+
+    hMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, dwHeaderSize + dwCapacity, cObject);
+    if (hMapping == NULL)
+    {
+        return ::GetLastError();
+    }
+    bExisting = (::GetLastError() == ERROR_ALREADY_EXISTS);
+
+    pHeader = (SERIAL_SHARED_HEADER*)MapViewOfFile(hMapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+    if (pHeader == NULL)
+    {
+        dwError = ::GetLastError();
+        Release();
+        return dwError;
+    }
+    pRing = (BYTE*)pHeader + dwHeaderSize;
+
+    if (bExisting)
+    {
+        // the readers of a stopped publisher still hold the ring: go on where it stopped
+        if (pHeader->dwMagic != SERIAL_SHARED_MAGIC || pHeader->dwVersion != SERIAL_SHARED_VERSION ||
+            pHeader->dwCapacity != dwCapacity || pHeader->dwMaxReaders != dwMaxReaders || pHeader->lPublishing != 0)
+        {
+            Release();
+            return ERROR_ALREADY_EXISTS;
+        }
+    }
+    else
+    {
+        // a new mapping is zeroed, so the positions and the reader slots start empty
+        pHeader->dwMagic = SERIAL_SHARED_MAGIC;
+        pHeader->dwVersion = SERIAL_SHARED_VERSION;
+        pHeader->dwCapacity = dwCapacity;
+        pHeader->dwMaxReaders = dwMaxReaders;
+    }
+
+    llWritePos = ReadPosition(&pHeader->llWritePos);
+
+    phEvents = new HANDLE[dwMaxReaders];
+    for (i = 0; i < dwMaxReaders; i++)
+    {
+        _snprintf(cObject, sizeof(cObject) - 1, SERIAL_SHARED_PREFIX "%s.%u", cName, i);
+        cObject[sizeof(cObject) - 1] = '\0';
+
+        phEvents[i] = CreateEventA(NULL, FALSE, FALSE, cObject);
+        if (phEvents[i] == NULL)
+        {
+            dwError = ::GetLastError();
+            while (i-- > 0)
+            {
+                CloseHandle(phEvents[i]);
+            }
+            delete [] phEvents;
+            phEvents = NULL;
+            Release();
+            return dwError;
+        }
+    }
+
+    memset(&stats, 0, sizeof(stats));
+    InterlockedExchange(&pHeader->lPublishing, 1);
+
+    this->pSerial = pSerial;
+    pSerial->SetCapture(CSerialPublisher::OnCapture, this);
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialPublisher::Stop( void )
+{
+    DWORD i;
+
+    if (hMapping == NULL)
+    {
+        return;
+    }
+
+    // SetCapture waits for a capture in progress, nothing is written after this
+    if (pSerial != NULL)
+    {
+        pSerial->SetCapture(NULL, NULL);
+        pSerial = NULL;
+    }
+
+    InterlockedExchange(&pHeader->lPublishing, 0);
+
+    // every reader asleep finds the ring stopped
+    for (i = 0; i < pHeader->dwMaxReaders; i++)
+    {
+        SetEvent(phEvents[i]);
+        CloseHandle(phEvents[i]);
+    }
+    delete [] phEvents;
+    phEvents = NULL;
+
+    Release();
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialPublisher::Release( void )
+{
+    if (pHeader != NULL)
+    {
+        UnmapViewOfFile(pHeader);
+        pHeader = NULL;
+        pRing = NULL;
+    }
+
+    if (hMapping != NULL)
+    {
+        CloseHandle(hMapping);
+        hMapping = NULL;
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialPublisher::GetStats( SERIAL_PUBLISHER_STATS * pStats )
+{
+    *pStats = stats;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialPublisher::CopyIn( LONGLONG llPos, const void * pData, DWORD dwLen )
+{
+    DWORD dwOffset = DWORD(llPos) & (pHeader->dwCapacity - 1);
+    DWORD dwFirst = pHeader->dwCapacity - dwOffset;
+
+    if (dwFirst >= dwLen)
+    {
+        memcpy(pRing + dwOffset, pData, dwLen);
+        return;
+    }
+
+    memcpy(pRing + dwOffset, pData, dwFirst);
+    memcpy(pRing, (const BYTE*)pData + dwFirst, dwLen - dwFirst);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialPublisher::OnCapture( LPVOID pContext, const BYTE * pData, DWORD dwLen, ULONGLONG ullTimestampUs )
+{
+    CSerialPublisher * pThis = (CSerialPublisher*)pContext;
+    SERIAL_SHARED_HEADER * pHeader = pThis->pHeader;
+    SERIAL_SHARED_RECORD record;
+    LONGLONG llEnd;
+    DWORD i;
+
+    record.ullTimestampUs = ullTimestampUs;
+    record.dwLen = dwLen;
+    record.dwReserved = 0;
+
+    llEnd = pThis->llWritePos + RecordSize(dwLen);
+
+    // announced before the copy: a reader that copies the data it overwrites sees it was lapped
+    InterlockedExchange64(&pHeader->llReservePos, llEnd);
+
+    pThis->CopyIn(pThis->llWritePos, &record, sizeof(record));
+    pThis->CopyIn(pThis->llWritePos + sizeof(record), pData, dwLen);
+
+    pThis->llWritePos = llEnd;
+    InterlockedExchange64(&pHeader->llWritePos, llEnd);
+
+    pThis->stats.llChunks++;
+    pThis->stats.llBytes += dwLen;
+
+    // only the readers asleep cost a system call
+    for (i = 0; i < pHeader->dwMaxReaders; i++)
+    {
+        if (pHeader->readers[i].lWaiting != 0 && InterlockedExchange(&pHeader->readers[i].lWaiting, 0) != 0)
+        {
+            SetEvent(pThis->phEvents[i]);
+            pThis->stats.llWakeups++;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+CSerialSubscriber::CSerialSubscriber( )
+{
+    hMapping = NULL;
+    pHeader = NULL;
+    pRing = NULL;
+    pSlot = NULL;
+    hEvent = NULL;
+    dwCapacity = 0;
+    llReadPos = 0;
+    dwOverruns = 0;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+CSerialSubscriber::~CSerialSubscriber( )
+{
+    Close();
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialSubscriber::Open( const char * cName )
+{
+    char cObject[MAX_PATH];
+    HANDLE hProcess;
+    DWORD dwExitCode;
+    DWORD dwError;
+    LONG lOwner;
+    DWORD i;
+
+    if (hMapping != NULL)
+    {
+        return ERROR_BUSY;
+    }
+
+    _snprintf(cObject, sizeof(cObject) - 1, SERIAL_SHARED_PREFIX "%s", cName);
+    cObject[sizeof(cObject) - 1] = '\0';
+
+    hMapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, cObject);
+    if (hMapping == NULL)
+    {
+        return ::GetLastError();
+    }
+
+    pHeader = (SERIAL_SHARED_HEADER*)MapViewOfFile(hMapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+    if (pHeader == NULL)
+    {
+        dwError = ::GetLastError();
+        Close();
+        return dwError;
+    }
+
+    if (pHeader->dwMagic != SERIAL_SHARED_MAGIC || pHeader->dwVersion != SERIAL_SHARED_VERSION)
+    {
+        Close();
+        return ERROR_BAD_FORMAT;
+    }
+
+    dwCapacity = pHeader->dwCapacity;
+    pRing = (BYTE*)pHeader + HeaderSize(pHeader->dwMaxReaders);
+
+    for (i = 0; i < pHeader->dwMaxReaders && pSlot == NULL; i++)
+    {
+        lOwner = pHeader->readers[i].lOwner;
+
+        // a slot left by a reader that died is taken over
+        if (lOwner != 0)
+        {
+            hProcess = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, DWORD(lOwner));
+            if (hProcess != NULL)
+            {
+                dwExitCode = STILL_ACTIVE;
+                GetExitCodeProcess(hProcess, &dwExitCode);
+                CloseHandle(hProcess);
+                if (dwExitCode == STILL_ACTIVE)
+                {
+                    continue;
+                }
+            }
+            else if (::GetLastError() != ERROR_INVALID_PARAMETER)
+            {
+                continue;
+            }
+        }
+
+        if (InterlockedCompareExchange(&pHeader->readers[i].lOwner, LONG(GetCurrentProcessId()), lOwner) != lOwner)
+        {
+            continue;
+        }
+
+        _snprintf(cObject, sizeof(cObject) - 1, SERIAL_SHARED_PREFIX "%s.%u", cName, i);
+        cObject[sizeof(cObject) - 1] = '\0';
+
+        hEvent = OpenEventA(SYNCHRONIZE, FALSE, cObject);
+        if (hEvent == NULL)
+        {
+            dwError = ::GetLastError();
+            InterlockedExchange(&pHeader->readers[i].lOwner, 0);
+            Close();
+            return dwError;
+        }
+
+        pSlot = &pHeader->readers[i];
+    }
+
+    if (pSlot == NULL)
+    {
+        Close();
+        return ERROR_BUSY;
+    }
+
+    // the reader gets what is published from now on
+    pSlot->lWaiting = 0;
+    llReadPos = ReadPosition(&pHeader->llWritePos);
+    InterlockedExchange64(&pSlot->llReadPos, llReadPos);
+    dwOverruns = 0;
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialSubscriber::Close( void )
+{
+    if (pSlot != NULL)
+    {
+        pSlot->lWaiting = 0;
+        InterlockedExchange(&pSlot->lOwner, 0);
+        pSlot = NULL;
+    }
+
+    if (hEvent != NULL)
+    {
+        CloseHandle(hEvent);
+        hEvent = NULL;
+    }
+
+    if (pHeader != NULL)
+    {
+        UnmapViewOfFile(pHeader);
+        pHeader = NULL;
+        pRing = NULL;
+    }
+
+    if (hMapping != NULL)
+    {
+        CloseHandle(hMapping);
+        hMapping = NULL;
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialSubscriber::CopyOut( LONGLONG llPos, void * pData, DWORD dwLen )
+{
+    DWORD dwOffset = DWORD(llPos) & (dwCapacity - 1);
+    DWORD dwFirst = dwCapacity - dwOffset;
+
+    if (dwFirst >= dwLen)
+    {
+        memcpy(pData, pRing + dwOffset, dwLen);
+        return;
+    }
+
+    memcpy(pData, pRing + dwOffset, dwFirst);
+    memcpy((BYTE*)pData + dwFirst, pRing, dwLen - dwFirst);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialSubscriber::Lapped( LONGLONG llPos )
+{
+    return ReadPosition(&pHeader->llReservePos) - llPos > LONGLONG(dwCapacity);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialSubscriber::Read( BYTE * pBuffer, DWORD dwLen, DWORD * pdwRead, ULONGLONG * pullTimestampUs, DWORD dwTimeoutMs )
+{
+    SERIAL_SHARED_RECORD record;
+    LONGLONG llWritePos;
+    DWORD dwRet;
+
+    if (pSlot == NULL)
+    {
+        return ERROR_INVALID_HANDLE;
+    }
+
+    do
+    {
+        llWritePos = ReadPosition(&pHeader->llWritePos);
+
+        if (llWritePos == llReadPos)
+        {
+            if (pHeader->lPublishing == 0)
+            {
+                return ERROR_BROKEN_PIPE;
+            }
+
+            // announce the sleep, then look again: a chunk published meanwhile did not see the flag
+            InterlockedExchange(&pSlot->lWaiting, 1);
+            if (ReadPosition(&pHeader->llWritePos) != llReadPos || pHeader->lPublishing == 0)
+            {
+                continue;
+            }
+
+            dwRet = WaitForSingleObject(hEvent, dwTimeoutMs);
+            if (dwRet == WAIT_TIMEOUT)
+            {
+                pSlot->lWaiting = 0;
+                return ERROR_TIMEOUT;
+            }
+            if (dwRet != WAIT_OBJECT_0)
+            {
+                pSlot->lWaiting = 0;
+                return ::GetLastError();
+            }
+            continue;
+        }
+
+        // the records are copied out, then checked: the publisher does not wait for the readers.
+        // It writes over the oldest bytes first, so the start of the record is the one to check,
+        // and a copy lapped halfway counts one overrun like a record lapped before the copy
+        CopyOut(llReadPos, &record, sizeof(record));
+        if (!Lapped(llReadPos))
+        {
+            if (record.dwLen > dwLen)
+            {
+                *pdwRead = record.dwLen;
+                return ERROR_MORE_DATA;
+            }
+
+            CopyOut(llReadPos + sizeof(record), pBuffer, record.dwLen);
+            if (!Lapped(llReadPos))
+            {
+                llReadPos += RecordSize(record.dwLen);
+                InterlockedExchange64(&pSlot->llReadPos, llReadPos);
+
+                *pdwRead = record.dwLen;
+                *pullTimestampUs = record.ullTimestampUs;
+                return ERROR_SUCCESS;
+            }
+        }
+
+        // fell behind by more than the ring: skip to the newest data
+        dwOverruns++;
+        llReadPos = ReadPosition(&pHeader->llWritePos);
+        InterlockedExchange64(&pSlot->llReadPos, llReadPos);
+
+    } while (1);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialSubscriber::GetOverruns( void )
+{
+    return dwOverruns;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
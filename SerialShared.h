@@ -0,0 +1,196 @@
+// $Id$
+
+#ifndef __SERIAL_SHARED_H__
+#define __SERIAL_SHARED_H__
+
+#include <windows.h>
+#include "Serial.h"
+
+namespace network {
+
+  //! counters of a publisher
+  struct SERIAL_PUBLISHER_STATS
+  {
+    LONGLONG  llChunks;     // chunks published
+    LONGLONG  llBytes;      // bytes published
+    LONGLONG  llWakeups;    // events signaled to waiting readers
+  };
+
+  /**
+   *  Layout of the shared memory: a SERIAL_SHARED_HEADER, then dwCapacity bytes of ring holding
+   *  records of a SERIAL_SHARED_RECORD followed by the data, padded to 8 bytes. The positions are
+   *  byte counts since the start of the ring, never wrapped, so a reader that was lapped sees it
+   *  from its position alone. Every field has the same size for 32 and 64 bits processes.
+   */
+  struct SERIAL_SHARED_RECORD
+  {
+    ULONGLONG ullTimestampUs;
+    DWORD     dwLen;
+    DWORD     dwReserved;
+  };
+
+  struct SERIAL_SHARED_READER
+  {
+    //! id of the process that owns the slot, 0 when free
+    volatile LONG     lOwner;
+
+    //! set by the reader before it sleeps, cleared by the publisher when it signals the event
+    volatile LONG     lWaiting;
+
+    //! position of the reader, for monitoring: the publisher never waits for the readers
+    volatile LONGLONG llReadPos;
+  };
+
+  struct SERIAL_SHARED_HEADER
+  {
+    DWORD     dwMagic;
+    DWORD     dwVersion;
+    DWORD     dwCapacity;
+    DWORD     dwMaxReaders;
+
+    //! cleared when the publisher stops; the readers drain the ring and then stop
+    volatile LONG     lPublishing;
+    DWORD     dwReserved;
+
+    //! end of the last record published
+    volatile LONGLONG llWritePos;
+
+    //! end of the record being written, the data up to capacity bytes before it is intact
+    volatile LONGLONG llReservePos;
+
+    SERIAL_SHARED_READER readers[1];
+  };
+
+  /**
+   *  \brief  Publishes the data received by a port in a named shared memory ring, where any
+   *          number of processes (up to the reader slots) read it with CSerialSubscriber. The
+   *          listener writes each chunk into the ring once, whatever the number of readers, and
+   *          never waits for them: a reader that falls more than the ring behind loses data.
+   *          A reader only costs the publisher a system call when it is asleep waiting for data.
+   */
+  class CSerialPublisher
+  {
+    private:
+
+      CSerial * pSerial;
+
+      HANDLE hMapping;
+      SERIAL_SHARED_HEADER * pHeader;
+      BYTE * pRing;
+
+      //! events of the reader slots, signaled when data arrives for a waiting reader
+      HANDLE * phEvents;
+
+      //! written by the listener only
+      LONGLONG llWritePos;
+
+      SERIAL_PUBLISHER_STATS stats;
+
+      static void OnCapture( LPVOID pContext, const BYTE * pData, DWORD dwLen, ULONGLONG ullTimestampUs );
+
+      void CopyIn( LONGLONG llPos, const void * pData, DWORD dwLen );
+
+      void Release( void );
+
+    public:
+      /**
+       *  \brief  Constructor
+       */
+      CSerialPublisher( );
+
+      /**
+       *  \brief  Destructor, stops the publication
+       */
+      virtual ~CSerialPublisher( );
+
+      /**
+       *  \brief  Creates the shared ring and starts publishing the data of a port through its
+       *          capture (see CSerial::SetCapture). A ring left by a previous publisher of the same
+       *          name and size is taken over, its readers go on reading.
+       *  \param  pSerial port to publish
+       *  \param  cName name of the ring, the readers open it by this name
+       *  \param  dwCapacity size of the ring, a power of two of at least 64 KB
+       *  \param  dwMaxReaders number of reader slots
+       *  \return status of operation
+       */
+      DWORD Start( CSerial * pSerial, const char * cName, DWORD dwCapacity = 1048576, DWORD dwMaxReaders = 8 );
+
+      /**
+       *  \brief  Stops publishing; the readers get what is left in the ring, then ERROR_BROKEN_PIPE
+       */
+      void Stop( void );
+
+      /**
+       *  \brief  Read the counters of the publisher
+       */
+      void GetStats( SERIAL_PUBLISHER_STATS * pStats );
+  };
+
+  /**
+   *  \brief  Reads, from another process, the data published by a CSerialPublisher. Each
+   *          subscriber has its own position in the ring and gets every chunk published after
+   *          it opened the ring, with its timestamp, unless it falls behind by more than the ring.
+   */
+  class CSerialSubscriber
+  {
+    private:
+
+      HANDLE hMapping;
+      SERIAL_SHARED_HEADER * pHeader;
+      BYTE * pRing;
+      SERIAL_SHARED_READER * pSlot;
+      HANDLE hEvent;
+
+      DWORD dwCapacity;
+      LONGLONG llReadPos;
+      DWORD dwOverruns;
+
+      void CopyOut( LONGLONG llPos, void * pData, DWORD dwLen );
+
+      //! the data from llPos on may have been overwritten by the publisher
+      BOOL Lapped( LONGLONG llPos );
+
+    public:
+      /**
+       *  \brief  Constructor
+       */
+      CSerialSubscriber( );
+
+      /**
+       *  \brief  Destructor, closes the ring
+       */
+      virtual ~CSerialSubscriber( );
+
+      /**
+       *  \brief  Opens a ring and takes a reader slot
+       *  \param  cName name given to CSerialPublisher::Start
+       *  \return status of operation: ERROR_FILE_NOT_FOUND if there is no such ring, ERROR_BUSY if every slot is taken
+       */
+      DWORD Open( const char * cName );
+
+      /**
+       *  \brief  Releases the slot and closes the ring
+       */
+      void Close( void );
+
+      /**
+       *  \brief  Reads the next chunk, waiting for it
+       *  \param  pBuffer buffer that receives the chunk
+       *  \param  dwLen size of the buffer
+       *  \param  pdwRead length of the chunk
+       *  \param  pullTimestampUs timestamp of the first byte of the chunk, in microseconds of GetTimestampUs
+       *  \param  dwTimeoutMs longest wait for a chunk
+       *  \return status of operation: ERROR_TIMEOUT, ERROR_MORE_DATA if the buffer is smaller than
+       *          *pdwRead (the chunk is not consumed), ERROR_BROKEN_PIPE once the publisher stopped
+       */
+      DWORD Read( BYTE * pBuffer, DWORD dwLen, DWORD * pdwRead, ULONGLONG * pullTimestampUs, DWORD dwTimeoutMs = INFINITE );
+
+      /**
+       *  \brief  Number of times the reader fell behind by more than the ring and skipped to the newest data
+       */
+      DWORD GetOverruns( void );
+  };
+
+};
+
+#endif
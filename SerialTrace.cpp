@@ -0,0 +1,143 @@
+// $Id$
+
+#include "stdafx.h"
+#include "SerialTrace.h"
+#include <evntprov.h>
+#include <string.h>
+
+#pragma comment(lib, "advapi32.lib")
+
+using namespace network;
+
+//! {1963CE2D-AEAA-40B1-844F-CCCBFB5E4044}, the guid of the provider in SerialTrace.man
+static const GUID guidProvider = { 0x1963CE2D, 0xAEAA, 0x40B1, { 0x84, 0x4F, 0xCC, 0xCB, 0xFB, 0x5E, 0x40, 0x44 } };
+
+//! descriptors of the events, indexed by EnumSerialTraceEvent; must match SerialTrace.man
+static const EVENT_DESCRIPTOR aDescriptors[] =
+{
+    { 0,                            0, 0, 0,                            0, 0, 0 },
+    { SERIAL_EVENT_OPEN,            0, 0, SERIAL_TRACE_LEVEL_INFO,      0, 0, SERIAL_TRACE_KEYWORD_PORT },
+    { SERIAL_EVENT_CLOSE,           0, 0, SERIAL_TRACE_LEVEL_INFO,      0, 0, SERIAL_TRACE_KEYWORD_PORT },
+    { SERIAL_EVENT_CONFIG,          0, 0, SERIAL_TRACE_LEVEL_INFO,      0, 0, SERIAL_TRACE_KEYWORD_PORT },
+    { SERIAL_EVENT_READ,            0, 0, SERIAL_TRACE_LEVEL_VERBOSE,   0, 0, SERIAL_TRACE_KEYWORD_RECEIVE },
+    { SERIAL_EVENT_CALLBACK_ENTER,  0, 0, SERIAL_TRACE_LEVEL_VERBOSE,   0, 0, SERIAL_TRACE_KEYWORD_RECEIVE },
+    { SERIAL_EVENT_CALLBACK_EXIT,   0, 0, SERIAL_TRACE_LEVEL_VERBOSE,   0, 0, SERIAL_TRACE_KEYWORD_RECEIVE },
+    { SERIAL_EVENT_WRITE_START,     0, 0, SERIAL_TRACE_LEVEL_VERBOSE,   0, 0, SERIAL_TRACE_KEYWORD_TRANSMIT },
+    { SERIAL_EVENT_WRITE_DONE,      0, 0, SERIAL_TRACE_LEVEL_VERBOSE,   0, 0, SERIAL_TRACE_KEYWORD_TRANSMIT },
+    { SERIAL_EVENT_ERROR,           0, 0, SERIAL_TRACE_LEVEL_ERROR,     0, 0, SERIAL_TRACE_KEYWORD_PORT }
+};
+
+//! handshake reported by SERIAL_EVENT_CONFIG
+#define SERIAL_TRACE_HANDSHAKE_OFF          (0)
+#define SERIAL_TRACE_HANDSHAKE_HARDWARE     (1)
+#define SERIAL_TRACE_HANDSHAKE_SOFTWARE     (2)
+
+volatile UCHAR CSerialTrace::ucLevel = 0;
+volatile ULONGLONG CSerialTrace::ullKeywords = 0;
+
+//! registration of the provider, shared by every CSerial
+static SRWLOCK srwProvider = SRWLOCK_INIT;
+static LONG lProviderUsers = 0;
+static REGHANDLE hProvider = 0;
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+static void NTAPI OnEnable( LPCGUID pSourceId, ULONG ulControlCode, UCHAR ucLevel, ULONGLONG ullMatchAnyKeyword,
+                            ULONGLONG ullMatchAllKeyword, PEVENT_FILTER_DESCRIPTOR pFilterData, PVOID pContext )
+{
+    switch (ulControlCode)
+    {
+        case EVENT_CONTROL_CODE_ENABLE_PROVIDER:
+            // level and keywords 0 mean everything
+            CSerialTrace::ullKeywords = (ullMatchAnyKeyword != 0) ? ullMatchAnyKeyword : ~0ULL;
+            CSerialTrace::ucLevel = (ucLevel != 0) ? ucLevel : 0xFF;
+            break;
+
+        case EVENT_CONTROL_CODE_DISABLE_PROVIDER:
+            CSerialTrace::ucLevel = 0;
+            CSerialTrace::ullKeywords = 0;
+            break;
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialTrace::AddRef( void )
+{
+    AcquireSRWLockExclusive(&srwProvider);
+
+    if (lProviderUsers++ == 0)
+    {
+        // without the provider the trace points stay disabled, nothing else depends on it
+        if (EventRegister(&guidProvider, OnEnable, NULL, &hProvider) != ERROR_SUCCESS)
+        {
+            hProvider = 0;
+        }
+    }
+
+    ReleaseSRWLockExclusive(&srwProvider);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialTrace::Release( void )
+{
+    AcquireSRWLockExclusive(&srwProvider);
+
+    if (--lProviderUsers == 0 && hProvider != 0)
+    {
+        EventUnregister(hProvider);
+        hProvider = 0;
+        ucLevel = 0;
+        ullKeywords = 0;
+    }
+
+    ReleaseSRWLockExclusive(&srwProvider);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialTrace::Write( EnumSerialTraceEvent event, const char * cDevice, ULONGLONG ullValue, DWORD dwStatus )
+{
+    EVENT_DATA_DESCRIPTOR data[3];
+    DWORD dwLastError = ::GetLastError();
+
+    EventDataDescCreate(&data[0], cDevice, ULONG(strlen(cDevice) + 1));
+    EventDataDescCreate(&data[1], &ullValue, sizeof(ULONGLONG));
+    EventDataDescCreate(&data[2], &dwStatus, sizeof(DWORD));
+
+    EventWrite(hProvider, &aDescriptors[event], 3, data);
+
+    // the trace points sit between a failed call and the GetLastError of its caller
+    SetLastError(dwLastError);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialTrace::WriteConfig( const char * cDevice, const DCB * pDcb, DWORD dwStatus )
+{
+    EVENT_DATA_DESCRIPTOR data[7];
+    DWORD dwBaudRate = pDcb->BaudRate;
+    BYTE bByteSize = pDcb->ByteSize;
+    BYTE bParity = pDcb->Parity;
+    BYTE bStopBits = pDcb->StopBits;
+    BYTE bHandshake;
+    DWORD dwLastError = ::GetLastError();
+
+    bHandshake = pDcb->fOutxCtsFlow ? SERIAL_TRACE_HANDSHAKE_HARDWARE :
+                 pDcb->fOutX ? SERIAL_TRACE_HANDSHAKE_SOFTWARE : SERIAL_TRACE_HANDSHAKE_OFF;
+
+    EventDataDescCreate(&data[0], cDevice, ULONG(strlen(cDevice) + 1));
+    EventDataDescCreate(&data[1], &dwBaudRate, sizeof(DWORD));
+    EventDataDescCreate(&data[2], &bByteSize, sizeof(BYTE));
+    EventDataDescCreate(&data[3], &bParity, sizeof(BYTE));
+    EventDataDescCreate(&data[4], &bStopBits, sizeof(BYTE));
+    EventDataDescCreate(&data[5], &bHandshake, sizeof(BYTE));
+    EventDataDescCreate(&data[6], &dwStatus, sizeof(DWORD));
+
+    EventWrite(hProvider, &aDescriptors[SERIAL_EVENT_CONFIG], 7, data);
+
+    SetLastError(dwLastError);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
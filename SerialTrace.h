@@ -0,0 +1,110 @@
+// $Id$
+
+#ifndef __SERIAL_TRACE_H__
+#define __SERIAL_TRACE_H__
+
+#include <windows.h>
+
+namespace network {
+
+  //! events of the ETW provider, as declared by SerialTrace.man
+  enum EnumSerialTraceEvent
+  {
+    SERIAL_EVENT_OPEN = 1,          // value: baud rate, status: result of Open
+    SERIAL_EVENT_CLOSE,
+    SERIAL_EVENT_CONFIG,            // SerialTraceConfig template
+    SERIAL_EVENT_READ,              // value: bytes read
+    SERIAL_EVENT_CALLBACK_ENTER,    // value: bytes handed to the callback
+    SERIAL_EVENT_CALLBACK_EXIT,
+    SERIAL_EVENT_WRITE_START,       // value: bytes to write
+    SERIAL_EVENT_WRITE_DONE,        // value: bytes written, status: error of the write
+    SERIAL_EVENT_ERROR              // value: EnumSerialTraceOperation, status: error
+  };
+
+  //! operation that failed, reported by SERIAL_EVENT_ERROR
+  enum EnumSerialTraceOperation
+  {
+    SERIAL_OPERATION_LISTENER = 1,  // the listener stopped on the error
+    SERIAL_OPERATION_LINE,          // the status holds the CE_* flags of a line error
+    SERIAL_OPERATION_DISPATCH       // a received chunk could not be queued to the strand, it is lost
+  };
+
+  //! levels of the events, as in evntrace.h
+  #define SERIAL_TRACE_LEVEL_ERROR        (2)
+  #define SERIAL_TRACE_LEVEL_INFO         (4)
+  #define SERIAL_TRACE_LEVEL_VERBOSE      (5)
+
+  //! keywords of the events
+  #define SERIAL_TRACE_KEYWORD_PORT       (0x1ULL)    // open, close, configuration and errors
+  #define SERIAL_TRACE_KEYWORD_RECEIVE    (0x2ULL)    // reads and callbacks
+  #define SERIAL_TRACE_KEYWORD_TRANSMIT   (0x4ULL)    // writes
+
+  /**
+   *  \brief  ETW provider of the serial library. The events are always compiled in; while no
+   *          trace session enables the provider, each trace point costs a compare of ucLevel.
+   *          The provider is registered while at least one CSerial exists. Define SERIAL_NO_TRACE
+   *          to compile the trace points out.
+   */
+  class CSerialTrace
+  {
+    public:
+
+      //! highest level enabled by the trace sessions, 0 while none listens
+      static volatile UCHAR ucLevel;
+
+      //! keywords enabled by the trace sessions
+      static volatile ULONGLONG ullKeywords;
+
+      /**
+       *  \brief  Registers the provider on the first call
+       */
+      static void AddRef( void );
+
+      /**
+       *  \brief  Unregisters the provider on the call matching the first AddRef
+       */
+      static void Release( void );
+
+      static BOOL IsEnabled( UCHAR ucEventLevel, ULONGLONG ullEventKeyword )
+      {
+          return ucLevel >= ucEventLevel && (ullKeywords & ullEventKeyword) != 0;
+      }
+
+      /**
+       *  \brief  Writes an event of the SerialTraceEvent template
+       */
+      static void Write( EnumSerialTraceEvent event, const char * cDevice, ULONGLONG ullValue, DWORD dwStatus );
+
+      /**
+       *  \brief  Writes SERIAL_EVENT_CONFIG with the line settings of the dcb
+       */
+      static void WriteConfig( const char * cDevice, const DCB * pDcb, DWORD dwStatus );
+  };
+
+};
+
+#ifndef SERIAL_NO_TRACE
+
+#define SERIAL_TRACE(event, level, keyword, device, value, status) \
+    do { if (network::CSerialTrace::IsEnabled((level), (keyword))) { network::CSerialTrace::Write((event), (device), (value), (status)); } } while (0)
+
+#define SERIAL_TRACE_CONFIG(device, dcb, status) \
+    do { if (network::CSerialTrace::IsEnabled(SERIAL_TRACE_LEVEL_INFO, SERIAL_TRACE_KEYWORD_PORT)) { network::CSerialTrace::WriteConfig((device), (dcb), (status)); } } while (0)
+
+#else
+
+#define SERIAL_TRACE(event, level, keyword, device, value, status)  do { } while (0)
+#define SERIAL_TRACE_CONFIG(device, dcb, status)                      do { } while (0)
+
+#endif
+
+#define SERIAL_TRACE_OPEN(device, baud, status)     SERIAL_TRACE(network::SERIAL_EVENT_OPEN, SERIAL_TRACE_LEVEL_INFO, SERIAL_TRACE_KEYWORD_PORT, device, baud, status)
+#define SERIAL_TRACE_CLOSE(device)                  SERIAL_TRACE(network::SERIAL_EVENT_CLOSE, SERIAL_TRACE_LEVEL_INFO, SERIAL_TRACE_KEYWORD_PORT, device, 0, ERROR_SUCCESS)
+#define SERIAL_TRACE_READ(device, len)              SERIAL_TRACE(network::SERIAL_EVENT_READ, SERIAL_TRACE_LEVEL_VERBOSE, SERIAL_TRACE_KEYWORD_RECEIVE, device, len, ERROR_SUCCESS)
+#define SERIAL_TRACE_CALLBACK_ENTER(device, len)    SERIAL_TRACE(network::SERIAL_EVENT_CALLBACK_ENTER, SERIAL_TRACE_LEVEL_VERBOSE, SERIAL_TRACE_KEYWORD_RECEIVE, device, len, ERROR_SUCCESS)
+#define SERIAL_TRACE_CALLBACK_EXIT(device, len)     SERIAL_TRACE(network::SERIAL_EVENT_CALLBACK_EXIT, SERIAL_TRACE_LEVEL_VERBOSE, SERIAL_TRACE_KEYWORD_RECEIVE, device, len, ERROR_SUCCESS)
+#define SERIAL_TRACE_WRITE_START(device, len)       SERIAL_TRACE(network::SERIAL_EVENT_WRITE_START, SERIAL_TRACE_LEVEL_VERBOSE, SERIAL_TRACE_KEYWORD_TRANSMIT, device, len, ERROR_SUCCESS)
+#define SERIAL_TRACE_WRITE_DONE(device, len, status) SERIAL_TRACE(network::SERIAL_EVENT_WRITE_DONE, SERIAL_TRACE_LEVEL_VERBOSE, SERIAL_TRACE_KEYWORD_TRANSMIT, device, len, status)
+#define SERIAL_TRACE_ERROR(device, operation, status) SERIAL_TRACE(network::SERIAL_EVENT_ERROR, SERIAL_TRACE_LEVEL_ERROR, SERIAL_TRACE_KEYWORD_PORT, device, operation, status)
+
+#endif
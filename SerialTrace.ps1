@@ -0,0 +1,124 @@
+# $Id$
+#
+# Records the events of the serial library (SerialTrace.man) on a live system and summarizes them
+# as histograms: read sizes, receive callback latency and write latency, per device.
+#
+#   SerialTrace.ps1 -Install -Exe C:\app\SerialExample.exe   register the manifest, once per machine
+#   SerialTrace.ps1 -Start [-Verbose]                         start a session (errors and configuration only without -Verbose)
+#   SerialTrace.ps1 -Stop                                     stop the session
+#   SerialTrace.ps1 -Report [-Etl serial.etl]                 print the histograms
+#
+# Starting, stopping and installing need an elevated prompt.
+
+[CmdletBinding()]
+param(
+    [switch] $Install,
+    [switch] $Start,
+    [switch] $Stop,
+    [switch] $Report,
+    [string] $Exe = "SerialExample.exe",
+    [string] $Etl = "serial.etl"
+)
+
+$Provider = "{1963CE2D-AEAA-40B1-844F-CCCBFB5E4044}"
+$Session = "SerialTrace"
+
+# power of two buckets, as printed by bpftrace hist()
+function Write-Histogram($Title, $Values, $Unit)
+{
+    if ($Values.Count -eq 0) { return }
+
+    $buckets = @{}
+    foreach ($v in $Values)
+    {
+        $b = 0
+        if ($v -ge 1) { $b = [int][math]::Floor([math]::Log([double]$v, 2)) + 1 }
+        $buckets[$b] = 1 + $buckets[$b]
+    }
+
+    $max = ($buckets.Values | Measure-Object -Maximum).Maximum
+    Write-Output ""
+    Write-Output ("{0} ({1} samples)" -f $Title, $Values.Count)
+    foreach ($b in ($buckets.Keys | Sort-Object))
+    {
+        $low = if ($b -eq 0) { 0 } else { [math]::Pow(2, $b - 1) }
+        $high = [math]::Pow(2, $b)
+        $bar = "@" * [int][math]::Ceiling(50 * $buckets[$b] / $max)
+        Write-Output ("  [{0,8}, {1,8}) {2} {3,8} |{4,-50}|" -f $low, $high, $Unit, $buckets[$b], $bar)
+    }
+}
+
+if ($Install)
+{
+    $path = (Resolve-Path $Exe).Path
+    wevtutil um "$PSScriptRoot\SerialTrace.man" 2>$null
+    wevtutil im "$PSScriptRoot\SerialTrace.man" /rf:"$path" /mf:"$path"
+}
+
+if ($Start)
+{
+    # level 5 (verbose) enables the reads, callbacks and writes, level 4 only the port events
+    $level = if ($VerbosePreference -eq "Continue") { "0x5" } else { "0x4" }
+    logman start $Session -p $Provider 0xFFFFFFFFFFFFFFFF $level -o $Etl -ets -bs 1024 -nb 64 256
+}
+
+if ($Stop)
+{
+    logman stop $Session -ets
+}
+
+if ($Report)
+{
+    $reads = @{}
+    $callbacks = @{}
+    $writes = @{}
+    $entered = @{}
+    $started = @{}
+
+    foreach ($e in (Get-WinEvent -Path $Etl -Oldest | Where-Object { $_.ProviderId -eq [guid]$Provider }))
+    {
+        $device = $e.Properties[0].Value
+
+        switch ($e.Id)
+        {
+            1 { Write-Output ("{0} {1} open at {2} baud, status {3}" -f $e.TimeCreated.ToString("HH:mm:ss.ffffff"), $device, $e.Properties[1].Value, $e.Properties[2].Value) }
+            2 { Write-Output ("{0} {1} closed" -f $e.TimeCreated.ToString("HH:mm:ss.ffffff"), $device) }
+            9 { Write-Output ("{0} {1} error {2} in operation {3}" -f $e.TimeCreated.ToString("HH:mm:ss.ffffff"), $device, $e.Properties[2].Value, $e.Properties[1].Value) }
+
+            4
+            {
+                if (-not $reads[$device]) { $reads[$device] = New-Object System.Collections.ArrayList }
+                [void]$reads[$device].Add([double]$e.Properties[1].Value)
+            }
+
+            # the callbacks of a port run on one thread at a time, enter and exit pair by thread
+            5 { $entered["$device/$($e.ThreadId)"] = $e.TimeCreated }
+            6
+            {
+                $key = "$device/$($e.ThreadId)"
+                if ($entered[$key])
+                {
+                    if (-not $callbacks[$device]) { $callbacks[$device] = New-Object System.Collections.ArrayList }
+                    [void]$callbacks[$device].Add(($e.TimeCreated - $entered[$key]).Ticks / 10.0)
+                    $entered.Remove($key)
+                }
+            }
+
+            7 { $started["$device/$($e.ThreadId)"] = $e.TimeCreated }
+            8
+            {
+                $key = "$device/$($e.ThreadId)"
+                if ($started[$key])
+                {
+                    if (-not $writes[$device]) { $writes[$device] = New-Object System.Collections.ArrayList }
+                    [void]$writes[$device].Add(($e.TimeCreated - $started[$key]).Ticks / 10.0)
+                    $started.Remove($key)
+                }
+            }
+        }
+    }
+
+    foreach ($device in $reads.Keys) { Write-Histogram "$device read size" $reads[$device] "bytes" }
+    foreach ($device in $callbacks.Keys) { Write-Histogram "$device callback latency" $callbacks[$device] "us" }
+    foreach ($device in $writes.Keys) { Write-Histogram "$device write latency" $writes[$device] "us" }
+}
@@ -0,0 +1,1625 @@
+// $Id$
+
+#include "stdafx.h"
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include "SerialTransport.h"
+#include <stdio.h>
+#include <string.h>
+
+#pragma comment(lib, "ws2_32.lib")
+
+using namespace network;
+
+//! telnet commands and options (RFC 854, 856, 858) and the COM-PORT-OPTION commands (RFC 2217)
+#define TELNET_SE                   (240)
+#define TELNET_SB                   (250)
+#define TELNET_WILL                 (251)
+#define TELNET_WONT                 (252)
+#define TELNET_DO                   (253)
+#define TELNET_DONT                 (254)
+#define TELNET_IAC                  (255)
+#define TELNET_BINARY               (0)
+#define TELNET_SGA                  (3)
+#define TELNET_COM_PORT             (44)
+
+#define RFC2217_SET_BAUDRATE        (1)
+#define RFC2217_SET_DATASIZE        (2)
+#define RFC2217_SET_PARITY          (3)
+#define RFC2217_SET_STOPSIZE        (4)
+#define RFC2217_SET_CONTROL         (5)
+#define RFC2217_NOTIFY_LINESTATE    (6)
+#define RFC2217_NOTIFY_MODEMSTATE   (7)
+#define RFC2217_SET_LINESTATE_MASK  (10)
+#define RFC2217_SET_MODEMSTATE_MASK (11)
+#define RFC2217_PURGE_DATA          (12)
+
+//! the server answers a command with the command + 100
+#define RFC2217_SERVER_OFFSET       (100)
+
+//! telnet receive states
+#define TELNET_STATE_DATA           (0)
+#define TELNET_STATE_IAC            (1)
+#define TELNET_STATE_OPTION         (2)
+#define TELNET_STATE_SB             (3)
+#define TELNET_STATE_SB_IAC         (4)
+
+//! the modem lines of a link without them: the peer is there and ready
+#define SERIAL_STREAM_MODEM_STATUS  (MS_CTS_ON | MS_DSR_ON | MS_RLSD_ON)
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+CSerialTransport * CSerialTransport::Create( const char * pDevice, const char ** ppAddress )
+{
+    if (_strnicmp(pDevice, "tcp://", 6) == 0)
+    {
+        *ppAddress = pDevice + 6;
+        return new CSerialTcpTransport();
+    }
+
+    if (_strnicmp(pDevice, "rfc2217://", 10) == 0)
+    {
+        *ppAddress = pDevice + 10;
+        return new CSerialRfc2217Transport();
+    }
+
+    if (_strnicmp(pDevice, "mem://", 6) == 0)
+    {
+        *ppAddress = pDevice + 6;
+        return new CSerialMemoryTransport();
+    }
+
+    // a plain path is a local port
+    *ppAddress = (_strnicmp(pDevice, "tty://", 6) == 0) ? pDevice + 6 : pDevice;
+
+    return new CSerialTtyTransport();
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+CSerialTtyTransport::CSerialTtyTransport( )
+{
+    hPort = NULL;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+CSerialTtyTransport::~CSerialTtyTransport( )
+{
+    Close();
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialTtyTransport::Open( const char * pAddress )
+{
+    hPort = CreateFileA(pAddress,
+                        GENERIC_READ | GENERIC_WRITE,
+                        0,
+                        NULL,
+                        OPEN_EXISTING,
+                        FILE_FLAG_OVERLAPPED,
+                        NULL);
+
+    if (hPort == INVALID_HANDLE_VALUE)
+    {
+        hPort = NULL;
+        return ::GetLastError();
+    }
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialTtyTransport::Close( void )
+{
+    if (hPort != NULL)
+    {
+        CloseHandle(hPort);
+        hPort = NULL;
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+HANDLE CSerialTtyTransport::GetHandle( void )
+{
+    return hPort;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialTtyTransport::HasIntervalTimeout( void )
+{
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialTtyTransport::HasStreamReads( void )
+{
+    return FALSE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialTtyTransport::HasTxEmpty( void )
+{
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialTtyTransport::ReadStream( LPVOID pBuffer, DWORD dwLen, OVERLAPPED * pOv )
+{
+    // the driver reads are ReadFile with the read timeouts
+    SetLastError(ERROR_NOT_SUPPORTED);
+    return FALSE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialTtyTransport::GetCommState( DCB * pDcb )
+{
+    return ::GetCommState(hPort, pDcb);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialTtyTransport::SetCommState( DCB * pDcb )
+{
+    return ::SetCommState(hPort, pDcb);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialTtyTransport::SetCommTimeouts( COMMTIMEOUTS * pTimeouts )
+{
+    return ::SetCommTimeouts(hPort, pTimeouts);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialTtyTransport::SetCommMask( DWORD dwMask )
+{
+    return ::SetCommMask(hPort, dwMask);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialTtyTransport::WaitCommEvent( DWORD * pdwEvent, OVERLAPPED * pOv )
+{
+    return ::WaitCommEvent(hPort, pdwEvent, pOv);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialTtyTransport::ClearCommError( DWORD * pdwErrors, COMSTAT * pStat )
+{
+    return ::ClearCommError(hPort, pdwErrors, pStat);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialTtyTransport::PurgeComm( DWORD dwFlags )
+{
+    return ::PurgeComm(hPort, dwFlags);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialTtyTransport::EscapeCommFunction( DWORD dwFunc )
+{
+    return ::EscapeCommFunction(hPort, dwFunc);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialTtyTransport::GetCommModemStatus( DWORD * pdwModemStatus )
+{
+    return ::GetCommModemStatus(hPort, pdwModemStatus);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialTtyTransport::TransmitCommChar( char cChar )
+{
+    return ::TransmitCommChar(hPort, cChar);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialTtyTransport::ReadFile( LPVOID pBuffer, DWORD dwLen, DWORD * pdwRead, OVERLAPPED * pOv )
+{
+    return ::ReadFile(hPort, pBuffer, dwLen, pdwRead, pOv);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialTtyTransport::WriteFile( LPCVOID pBuffer, DWORD dwLen, DWORD * pdwWritten, OVERLAPPED * pOv )
+{
+    return ::WriteFile(hPort, pBuffer, dwLen, pdwWritten, pOv);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialTtyTransport::GetOverlappedResult( OVERLAPPED * pOv, DWORD * pdwTransferred, BOOL bWait )
+{
+    return ::GetOverlappedResult(hPort, pOv, pdwTransferred, bWait);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialTtyTransport::CancelIo( void )
+{
+    return ::CancelIo(hPort);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialTtyTransport::CancelIoEx( OVERLAPPED * pOv )
+{
+    return ::CancelIoEx(hPort, pOv);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialTtyTransport::FlushFileBuffers( void )
+{
+    return ::FlushFileBuffers(hPort);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+CSerialStreamTransport::CSerialStreamTransport( )
+{
+    hStream = NULL;
+
+    SecureZeroMemory(&dcb, sizeof(DCB));
+    dcb.DCBlength = sizeof(DCB);
+    dcb.BaudRate = CBR_9600;
+    dcb.ByteSize = 8;
+    dcb.Parity = NOPARITY;
+    dcb.StopBits = ONESTOPBIT;
+    dcb.fBinary = TRUE;
+    SecureZeroMemory(&timeouts, sizeof(COMMTIMEOUTS));
+
+    dwRxHead = 0;
+    dwRxLen = 0;
+    SecureZeroMemory(&ovRx, sizeof(OVERLAPPED));
+    bRxPending = FALSE;
+
+    dwMask = 0;
+    dwEvents = 0;
+    pOvWait = NULL;
+    pdwWaitEvent = NULL;
+    bMaskWake = FALSE;
+
+    dwErrors = 0;
+    dwModemStatus = SERIAL_STREAM_MODEM_STATUS;
+
+    pOvWrite = NULL;
+    dwWriteLen = 0;
+    dwWriteWireLen = 0;
+
+    InitializeCriticalSection(&cs);
+    InitializeCriticalSection(&csSend);
+
+    hSendEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (hSendEvent == NULL)
+    {
+        throw (unsigned int)::GetLastError();
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+CSerialStreamTransport::~CSerialStreamTransport( )
+{
+    // the derived class closed the stream, CloseStream is its own
+    CloseHandle(hSendEvent);
+    DeleteCriticalSection(&csSend);
+    DeleteCriticalSection(&cs);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialStreamTransport::Close( void )
+{
+    DWORD dwRead;
+
+    if (hStream == NULL)
+    {
+        return;
+    }
+
+    // the kernel still refers to ovRx
+    if (bRxPending)
+    {
+        ::CancelIoEx(hStream, &ovRx);
+        ::GetOverlappedResult(hStream, &ovRx, &dwRead, TRUE);
+        bRxPending = FALSE;
+    }
+
+    CloseStream();
+    hStream = NULL;
+
+    dwRxHead = 0;
+    dwRxLen = 0;
+    dwEvents = 0;
+    pOvWait = NULL;
+    pdwWaitEvent = NULL;
+    bMaskWake = FALSE;
+    dwErrors = 0;
+    dwModemStatus = SERIAL_STREAM_MODEM_STATUS;
+    pOvWrite = NULL;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+HANDLE CSerialStreamTransport::GetHandle( void )
+{
+    return hStream;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialStreamTransport::HasIntervalTimeout( void )
+{
+    return FALSE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialStreamTransport::HasStreamReads( void )
+{
+    // a read of 0 bytes is the end of a socket, and the telnet stream must be decoded
+    return FALSE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialStreamTransport::HasTxEmpty( void )
+{
+    // the stream takes the data at its own pace, there is no line to drain (see FlushFileBuffers)
+    return FALSE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialStreamTransport::ReadStream( LPVOID pBuffer, DWORD dwLen, OVERLAPPED * pOv )
+{
+    if (hStream == NULL)
+    {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+
+    return ::ReadFile(hStream, pBuffer, dwLen, NULL, pOv);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialStreamTransport::GetCommState( DCB * pDcb )
+{
+    if (hStream == NULL)
+    {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+
+    *pDcb = dcb;
+
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialStreamTransport::SetCommState( DCB * pDcb )
+{
+    if (hStream == NULL)
+    {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+
+    // nothing on the other side toggles RTS while the data goes out
+    if (pDcb->fRtsControl == RTS_CONTROL_TOGGLE)
+    {
+        SetLastError(ERROR_NOT_SUPPORTED);
+        return FALSE;
+    }
+
+    dcb = *pDcb;
+
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialStreamTransport::SetCommTimeouts( COMMTIMEOUTS * pTimeouts )
+{
+    timeouts = *pTimeouts;
+
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialStreamTransport::SetCommMask( DWORD dwMask )
+{
+    EnterCriticalSection(&cs);
+
+    this->dwMask = dwMask;
+
+    // as the driver, a new mask ends the wait in progress with no event
+    if (pOvWait != NULL)
+    {
+        bMaskWake = TRUE;
+        SetEvent(pOvWait->hEvent);
+    }
+
+    LeaveCriticalSection(&cs);
+
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialStreamTransport::StartRead( HANDLE hEvent, DWORD dwLen )
+{
+    SecureZeroMemory(&ovRx, sizeof(OVERLAPPED));
+    ovRx.hEvent = hEvent;
+
+    if (!::ReadFile(hStream, abRaw, dwLen, NULL, &ovRx) && ::GetLastError() != ERROR_IO_PENDING)
+    {
+        return FALSE;
+    }
+
+    bRxPending = TRUE;
+
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialStreamTransport::FinishRead( DWORD * pdwRead )
+{
+    if (!::GetOverlappedResult(hStream, &ovRx, pdwRead, FALSE))
+    {
+        return FALSE;
+    }
+
+    // the peer closed the stream, as a device that is removed
+    if (*pdwRead == 0)
+    {
+        SetLastError(ERROR_HANDLE_EOF);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialStreamTransport::Decode( BYTE * pData, DWORD dwLen )
+{
+    return dwLen;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialStreamTransport::Encode( const BYTE * pData, DWORD dwLen )
+{
+    return FALSE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialStreamTransport::CompleteRead( void )
+{
+    DWORD dwRead;
+
+    bRxPending = FALSE;
+
+    if (!FinishRead(&dwRead))
+    {
+        return FALSE;
+    }
+
+    // the read was sized for the room left by dwRxLen when it started; ReadFile may have taken data
+    //   from the front since, so what is left goes first to make that room whole
+    if (dwRxHead != 0)
+    {
+        memmove(abRx, abRx + dwRxHead, dwRxLen);
+        dwRxHead = 0;
+    }
+
+    dwRead = Decode(abRaw, dwRead);
+    memcpy(abRx + dwRxLen, abRaw, dwRead);
+    dwRxLen += dwRead;
+
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialStreamTransport::TakeEvents( void )
+{
+    DWORD dwEvent = dwEvents & dwMask;
+
+    dwEvents = 0;
+
+    // signaled while there is data, the listener reads it all anyway; a full buffer is signaled
+    //   whatever the mask, the stream is not read meanwhile
+    if (dwRxLen != 0 && ((dwMask & EV_RXCHAR) || dwRxLen == RX_LEN))
+    {
+        dwEvent |= EV_RXCHAR;
+    }
+
+    return dwEvent;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialStreamTransport::WaitCommEvent( DWORD * pdwEvent, OVERLAPPED * pOv )
+{
+    DWORD dwEvent;
+
+    EnterCriticalSection(&cs);
+
+    if (hStream == NULL)
+    {
+        LeaveCriticalSection(&cs);
+        SetLastError(ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+
+    for (;;)
+    {
+        if (bRxPending)
+        {
+            if (!HasOverlappedIoCompleted(&ovRx))
+            {
+                break;
+            }
+
+            if (!CompleteRead())
+            {
+                LeaveCriticalSection(&cs);
+                return FALSE;
+            }
+        }
+
+        dwEvent = TakeEvents();
+        if (dwEvent != 0)
+        {
+            *pdwEvent = dwEvent;
+            LeaveCriticalSection(&cs);
+            return TRUE;
+        }
+
+        // the read takes the room the data left leaves, CompleteRead moves that data to the front
+        if (!StartRead(pOv->hEvent, RX_LEN - dwRxLen))
+        {
+            LeaveCriticalSection(&cs);
+            return FALSE;
+        }
+    }
+
+    // the read signals the event of the caller, which always waits with the same OVERLAPPED; an
+    //   event left signaled by SetCommMask must not end this wait
+    ResetEvent(pOv->hEvent);
+    if (HasOverlappedIoCompleted(&ovRx))
+    {
+        SetEvent(pOv->hEvent);
+    }
+
+    pOvWait = pOv;
+    pdwWaitEvent = pdwEvent;
+    bMaskWake = FALSE;
+
+    LeaveCriticalSection(&cs);
+
+    SetLastError(ERROR_IO_PENDING);
+    return FALSE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialStreamTransport::GetOverlappedResult( OVERLAPPED * pOv, DWORD * pdwTransferred, BOOL bWait )
+{
+    DWORD dwEvent = 0;
+
+    if (pOv == pOvWrite)
+    {
+        if (!::GetOverlappedResult(hStream, pOv, pdwTransferred, bWait))
+        {
+            return FALSE;
+        }
+
+        // the encoding is not seen by the caller
+        if (*pdwTransferred == dwWriteWireLen)
+        {
+            *pdwTransferred = dwWriteLen;
+        }
+        else if (dwWriteWireLen != 0)
+        {
+            *pdwTransferred = DWORD((ULONGLONG)*pdwTransferred * dwWriteLen / dwWriteWireLen);
+        }
+        return TRUE;
+    }
+
+    if (pOv != pOvWait)
+    {
+        return ::GetOverlappedResult(hStream, pOv, pdwTransferred, bWait);
+    }
+
+    if (bWait)
+    {
+        WaitForSingleObject(pOv->hEvent, INFINITE);
+    }
+
+    EnterCriticalSection(&cs);
+
+    if (!bMaskWake && bRxPending && !HasOverlappedIoCompleted(&ovRx))
+    {
+        LeaveCriticalSection(&cs);
+        SetLastError(ERROR_IO_INCOMPLETE);
+        return FALSE;
+    }
+
+    pOvWait = NULL;
+
+    // after SetCommMask a read that completed meanwhile is taken by the next wait
+    if (!bMaskWake)
+    {
+        if (bRxPending && !CompleteRead())
+        {
+            LeaveCriticalSection(&cs);
+            return FALSE;
+        }
+        dwEvent = TakeEvents();
+    }
+    bMaskWake = FALSE;
+
+    *pdwWaitEvent = dwEvent;
+    *pdwTransferred = 0;
+
+    LeaveCriticalSection(&cs);
+
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialStreamTransport::ClearCommError( DWORD * pdwErrors, COMSTAT * pStat )
+{
+    if (hStream == NULL)
+    {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+
+    EnterCriticalSection(&cs);
+
+    if (pdwErrors != NULL)
+    {
+        *pdwErrors = dwErrors;
+    }
+    dwErrors = 0;
+
+    // what was written is in the hands of the stream, not waiting in a queue of the link
+    if (pStat != NULL)
+    {
+        SecureZeroMemory(pStat, sizeof(COMSTAT));
+        pStat->cbInQue = dwRxLen;
+        pStat->cbOutQue = 0;
+    }
+
+    LeaveCriticalSection(&cs);
+
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialStreamTransport::PurgeComm( DWORD dwFlags )
+{
+    if (hStream == NULL)
+    {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+
+    if (dwFlags & PURGE_RXCLEAR)
+    {
+        EnterCriticalSection(&cs);
+        dwRxHead = 0;
+        dwRxLen = 0;
+        LeaveCriticalSection(&cs);
+    }
+
+    if ((dwFlags & PURGE_TXABORT) && pOvWrite != NULL)
+    {
+        ::CancelIoEx(hStream, pOvWrite);
+    }
+
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialStreamTransport::EscapeCommFunction( DWORD dwFunc )
+{
+    if (hStream == NULL)
+    {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialStreamTransport::GetCommModemStatus( DWORD * pdwModemStatus )
+{
+    if (hStream == NULL)
+    {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+
+    *pdwModemStatus = dwModemStatus;
+
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialStreamTransport::TransmitCommChar( char cChar )
+{
+    return Send((const BYTE*)&cChar, 1);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialStreamTransport::ReadFile( LPVOID pBuffer, DWORD dwLen, DWORD * pdwRead, OVERLAPPED * pOv )
+{
+    DWORD dwCopy;
+
+    if (hStream == NULL)
+    {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+
+    // what is there, as the driver with a ReadIntervalTimeout of MAXDWORD
+    EnterCriticalSection(&cs);
+
+    dwCopy = (dwLen < dwRxLen) ? dwLen : dwRxLen;
+    memcpy(pBuffer, abRx + dwRxHead, dwCopy);
+    dwRxHead += dwCopy;
+    dwRxLen -= dwCopy;
+    if (dwRxLen == 0)
+    {
+        dwRxHead = 0;
+    }
+
+    LeaveCriticalSection(&cs);
+
+    *pdwRead = dwCopy;
+
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialStreamTransport::WriteFile( LPCVOID pBuffer, DWORD dwLen, DWORD * pdwWritten, OVERLAPPED * pOv )
+{
+    const BYTE * pData = (const BYTE*)pBuffer;
+    DWORD dwWireLen = dwLen;
+
+    if (hStream == NULL)
+    {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+
+    // vTx lives until the next write, there is one in progress at most
+    if (Encode(pData, dwLen))
+    {
+        pData = &vTx[0];
+        dwWireLen = DWORD(vTx.size());
+    }
+
+    pOvWrite = pOv;
+    dwWriteLen = dwLen;
+    dwWriteWireLen = dwWireLen;
+
+    if (!::WriteFile(hStream, pData, dwWireLen, pdwWritten, pOv))
+    {
+        return FALSE;
+    }
+
+    if (pdwWritten != NULL && *pdwWritten == dwWireLen)
+    {
+        *pdwWritten = dwLen;
+    }
+
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialStreamTransport::CancelIo( void )
+{
+    DWORD dwRead;
+
+    // the read signals the event of the caller, it is over before the caller closes it; what it
+    //   read before it was cancelled is kept
+    EnterCriticalSection(&cs);
+    if (bRxPending)
+    {
+        ::CancelIoEx(hStream, &ovRx);
+        ::GetOverlappedResult(hStream, &ovRx, &dwRead, TRUE);
+        CompleteRead();
+    }
+    LeaveCriticalSection(&cs);
+
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialStreamTransport::CancelIoEx( OVERLAPPED * pOv )
+{
+    // NULL cancels every operation of the handle, the stream reads of a completion port included
+    if (pOv != NULL && pOv == pOvWait)
+    {
+        return CancelIo();
+    }
+
+    return ::CancelIoEx(hStream, pOv);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialStreamTransport::FlushFileBuffers( void )
+{
+    // the stream takes care of the data written, there is no line to drain
+    return (hStream != NULL);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialStreamTransport::Send( const BYTE * pData, DWORD dwLen )
+{
+    OVERLAPPED ovSend;
+    DWORD dwSent = 0;
+    BOOL bResult;
+
+    if (hStream == NULL)
+    {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+
+    EnterCriticalSection(&csSend);
+
+    SecureZeroMemory(&ovSend, sizeof(OVERLAPPED));
+
+    // waited for here: the low bit keeps its completion off a completion port the stream is on
+    ovSend.hEvent = (HANDLE)((ULONG_PTR)hSendEvent | 1);
+
+    bResult = ::WriteFile(hStream, pData, dwLen, &dwSent, &ovSend);
+    if (!bResult && ::GetLastError() == ERROR_IO_PENDING)
+    {
+        bResult = ::GetOverlappedResult(hStream, &ovSend, &dwSent, TRUE);
+    }
+
+    LeaveCriticalSection(&csSend);
+
+    return bResult && (dwSent == dwLen);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+CSerialTcpTransport::CSerialTcpTransport( )
+{
+    bWsa = FALSE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+CSerialTcpTransport::~CSerialTcpTransport( )
+{
+    Close();
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialTcpTransport::Open( const char * pAddress )
+{
+    WSADATA wsaData;
+    ADDRINFOA hints;
+    ADDRINFOA * pInfo;
+    ADDRINFOA * pCur;
+    SOCKET s = INVALID_SOCKET;
+    char cHost[256];
+    const char * pPort;
+    BOOL bNoDelay = TRUE;
+    int iError;
+
+    // host:port, the last colon separates the port
+    pPort = strrchr(pAddress, ':');
+    if (pPort == NULL || pPort == pAddress || DWORD(pPort - pAddress) >= sizeof(cHost))
+    {
+        return ERROR_BAD_NETPATH;
+    }
+    memcpy(cHost, pAddress, pPort - pAddress);
+    cHost[pPort - pAddress] = '\0';
+    pPort++;
+
+    iError = WSAStartup(MAKEWORD(2, 2), &wsaData);
+    if (iError != 0)
+    {
+        return DWORD(iError);
+    }
+    bWsa = TRUE;
+
+    SecureZeroMemory(&hints, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+
+    iError = getaddrinfo(cHost, pPort, &hints, &pInfo);
+    if (iError != 0)
+    {
+        CloseStream();
+        return DWORD(iError);
+    }
+
+    // overlapped, the socket is read and written as a file
+    iError = WSAHOST_NOT_FOUND;
+    for (pCur = pInfo; pCur != NULL; pCur = pCur->ai_next)
+    {
+        s = WSASocket(pCur->ai_family, pCur->ai_socktype, pCur->ai_protocol, NULL, 0, WSA_FLAG_OVERLAPPED);
+        if (s == INVALID_SOCKET)
+        {
+            iError = WSAGetLastError();
+            continue;
+        }
+
+        if (connect(s, pCur->ai_addr, int(pCur->ai_addrlen)) == 0)
+        {
+            break;
+        }
+
+        iError = WSAGetLastError();
+        closesocket(s);
+        s = INVALID_SOCKET;
+    }
+
+    freeaddrinfo(pInfo);
+
+    if (s == INVALID_SOCKET)
+    {
+        CloseStream();
+        return DWORD(iError);
+    }
+
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&bNoDelay, sizeof(bNoDelay));
+
+    hStream = (HANDLE)s;
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialTcpTransport::CloseStream( void )
+{
+    if (hStream != NULL)
+    {
+        closesocket((SOCKET)hStream);
+    }
+
+    if (bWsa)
+    {
+        WSACleanup();
+        bWsa = FALSE;
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+CSerialRfc2217Transport::CSerialRfc2217Transport( )
+{
+    iTelnetState = TELNET_STATE_DATA;
+    bVerb = 0;
+    dwSbLen = 0;
+    bConfigured = FALSE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialRfc2217Transport::Open( const char * pAddress )
+{
+    static const BYTE abNegotiation[] =
+    {
+        TELNET_IAC, TELNET_WILL, TELNET_BINARY,
+        TELNET_IAC, TELNET_DO, TELNET_BINARY,
+        TELNET_IAC, TELNET_WILL, TELNET_SGA,
+        TELNET_IAC, TELNET_DO, TELNET_SGA,
+        TELNET_IAC, TELNET_WILL, TELNET_COM_PORT,
+    };
+    // break, framing, parity and overrun; all the modem lines and their changes
+    BYTE bLineMask = 0x1E;
+    BYTE bModemMask = 0xFF;
+    DWORD dwError;
+
+    iTelnetState = TELNET_STATE_DATA;
+    dwSbLen = 0;
+    bConfigured = FALSE;
+
+    dwError = CSerialTcpTransport::Open(pAddress);
+    if (dwError != ERROR_SUCCESS)
+    {
+        return dwError;
+    }
+
+    // the answers of the server are not waited for, a command it refuses has no effect
+    if (!Send(abNegotiation, sizeof(abNegotiation)) ||
+        !SendComPort(RFC2217_SET_LINESTATE_MASK, &bLineMask, 1) ||
+        !SendComPort(RFC2217_SET_MODEMSTATE_MASK, &bModemMask, 1))
+    {
+        dwError = ::GetLastError();
+        Close();
+        return dwError;
+    }
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialRfc2217Transport::SendComPort( BYTE bCommand, const BYTE * pValue, DWORD dwLen )
+{
+    BYTE abCommand[32];
+    DWORD dwCommandLen = 0;
+    DWORD i;
+
+    abCommand[dwCommandLen++] = TELNET_IAC;
+    abCommand[dwCommandLen++] = TELNET_SB;
+    abCommand[dwCommandLen++] = TELNET_COM_PORT;
+    abCommand[dwCommandLen++] = bCommand;
+
+    // the value is escaped as the data
+    for (i = 0; i < dwLen; i++)
+    {
+        if (pValue[i] == TELNET_IAC)
+        {
+            abCommand[dwCommandLen++] = TELNET_IAC;
+        }
+        abCommand[dwCommandLen++] = pValue[i];
+    }
+
+    abCommand[dwCommandLen++] = TELNET_IAC;
+    abCommand[dwCommandLen++] = TELNET_SE;
+
+    return Send(abCommand, dwCommandLen);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialRfc2217Transport::SendControl( BYTE bValue )
+{
+    return SendComPort(RFC2217_SET_CONTROL, &bValue, 1);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialRfc2217Transport::SetCommState( DCB * pDcb )
+{
+    BYTE abBaud[4];
+    BYTE bValue;
+    BOOL bHandshake;
+    BOOL bSoftware;
+
+    if (hStream == NULL)
+    {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+
+    if (pDcb->fRtsControl == RTS_CONTROL_TOGGLE)
+    {
+        SetLastError(ERROR_NOT_SUPPORTED);
+        return FALSE;
+    }
+
+    // only what changed goes to the server, all of it the first time
+    if (!bConfigured || pDcb->BaudRate != dcb.BaudRate)
+    {
+        abBaud[0] = BYTE(pDcb->BaudRate >> 24);
+        abBaud[1] = BYTE(pDcb->BaudRate >> 16);
+        abBaud[2] = BYTE(pDcb->BaudRate >> 8);
+        abBaud[3] = BYTE(pDcb->BaudRate);
+        if (!SendComPort(RFC2217_SET_BAUDRATE, abBaud, 4))
+        {
+            return FALSE;
+        }
+    }
+
+    if (!bConfigured || pDcb->ByteSize != dcb.ByteSize)
+    {
+        if (!SendComPort(RFC2217_SET_DATASIZE, &pDcb->ByteSize, 1))
+        {
+            return FALSE;
+        }
+    }
+
+    if (!bConfigured || pDcb->Parity != dcb.Parity)
+    {
+        // NONE, ODD, EVEN, MARK, SPACE are 1 to 5, one more than NOPARITY to SPACEPARITY
+        bValue = BYTE(pDcb->Parity + 1);
+        if (!SendComPort(RFC2217_SET_PARITY, &bValue, 1))
+        {
+            return FALSE;
+        }
+    }
+
+    if (!bConfigured || pDcb->StopBits != dcb.StopBits)
+    {
+        bValue = (pDcb->StopBits == TWOSTOPBITS) ? 2 : (pDcb->StopBits == ONE5STOPBITS) ? 3 : 1;
+        if (!SendComPort(RFC2217_SET_STOPSIZE, &bValue, 1))
+        {
+            return FALSE;
+        }
+    }
+
+    // outbound flow control: none, XON/XOFF or hardware
+    bHandshake = (pDcb->fRtsControl == RTS_CONTROL_HANDSHAKE || pDcb->fOutxCtsFlow);
+    bSoftware = (pDcb->fOutX || pDcb->fInX);
+    if (!bConfigured || bHandshake != (dcb.fRtsControl == RTS_CONTROL_HANDSHAKE || dcb.fOutxCtsFlow) ||
+        bSoftware != (dcb.fOutX || dcb.fInX))
+    {
+        if (!SendControl(bHandshake ? 3 : bSoftware ? 2 : 1))
+        {
+            return FALSE;
+        }
+    }
+
+    // DTR on and off are 8 and 9, RTS on and off 11 and 12
+    if (pDcb->fDtrControl != DTR_CONTROL_HANDSHAKE && (!bConfigured || pDcb->fDtrControl != dcb.fDtrControl))
+    {
+        if (!SendControl((pDcb->fDtrControl == DTR_CONTROL_ENABLE) ? 8 : 9))
+        {
+            return FALSE;
+        }
+    }
+
+    if (!bHandshake && (!bConfigured || pDcb->fRtsControl != dcb.fRtsControl))
+    {
+        if (!SendControl((pDcb->fRtsControl == RTS_CONTROL_ENABLE) ? 11 : 12))
+        {
+            return FALSE;
+        }
+    }
+
+    bConfigured = TRUE;
+    dcb = *pDcb;
+
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialRfc2217Transport::PurgeComm( DWORD dwFlags )
+{
+    BYTE bValue;
+
+    if (!CSerialStreamTransport::PurgeComm(dwFlags))
+    {
+        return FALSE;
+    }
+
+    // the buffers of the server: 1 receive, 2 transmit, 3 both
+    bValue = ((dwFlags & PURGE_RXCLEAR) ? 1 : 0) | ((dwFlags & PURGE_TXCLEAR) ? 2 : 0);
+    if (bValue == 0)
+    {
+        return TRUE;
+    }
+
+    return SendComPort(RFC2217_PURGE_DATA, &bValue, 1);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialRfc2217Transport::EscapeCommFunction( DWORD dwFunc )
+{
+    if (hStream == NULL)
+    {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+
+    switch (dwFunc)
+    {
+        case SETBREAK:  return SendControl(5);
+        case CLRBREAK:  return SendControl(6);
+        case SETDTR:    return SendControl(8);
+        case CLRDTR:    return SendControl(9);
+        case SETRTS:    return SendControl(11);
+        case CLRRTS:    return SendControl(12);
+    }
+
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialRfc2217Transport::TransmitCommChar( char cChar )
+{
+    static const BYTE abIac[2] = { TELNET_IAC, TELNET_IAC };
+
+    if (BYTE(cChar) == TELNET_IAC)
+    {
+        return Send(abIac, 2);
+    }
+
+    return Send((const BYTE*)&cChar, 1);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialRfc2217Transport::Encode( const BYTE * pData, DWORD dwLen )
+{
+    DWORD i;
+
+    // most writes have no 0xFF and go as they are
+    if (memchr(pData, TELNET_IAC, dwLen) == NULL)
+    {
+        return FALSE;
+    }
+
+    vTx.clear();
+    vTx.reserve(dwLen + dwLen / 8);
+    for (i = 0; i < dwLen; i++)
+    {
+        if (pData[i] == TELNET_IAC)
+        {
+            vTx.push_back(TELNET_IAC);
+        }
+        vTx.push_back(pData[i]);
+    }
+
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialRfc2217Transport::Decode( BYTE * pData, DWORD dwLen )
+{
+    BYTE abReply[3];
+    BYTE b;
+    DWORD dwOut = 0;
+    DWORD i;
+
+    for (i = 0; i < dwLen; i++)
+    {
+        b = pData[i];
+
+        switch (iTelnetState)
+        {
+            case TELNET_STATE_DATA:
+                if (b == TELNET_IAC)
+                {
+                    iTelnetState = TELNET_STATE_IAC;
+                }
+                else
+                {
+                    pData[dwOut++] = b;
+                }
+                break;
+
+            case TELNET_STATE_IAC:
+                iTelnetState = TELNET_STATE_DATA;
+                if (b == TELNET_IAC)
+                {
+                    pData[dwOut++] = b;
+                }
+                else if (b == TELNET_WILL || b == TELNET_WONT || b == TELNET_DO || b == TELNET_DONT)
+                {
+                    bVerb = b;
+                    iTelnetState = TELNET_STATE_OPTION;
+                }
+                else if (b == TELNET_SB)
+                {
+                    dwSbLen = 0;
+                    iTelnetState = TELNET_STATE_SB;
+                }
+                break;
+
+            case TELNET_STATE_OPTION:
+                iTelnetState = TELNET_STATE_DATA;
+
+                // the options asked for in Open are taken, the others refused
+                abReply[0] = TELNET_IAC;
+                abReply[2] = b;
+                if (bVerb == TELNET_DO && b != TELNET_BINARY && b != TELNET_SGA && b != TELNET_COM_PORT)
+                {
+                    abReply[1] = TELNET_WONT;
+                    Send(abReply, 3);
+                }
+                else if (bVerb == TELNET_WILL && b != TELNET_BINARY && b != TELNET_SGA)
+                {
+                    abReply[1] = TELNET_DONT;
+                    Send(abReply, 3);
+                }
+                break;
+
+            case TELNET_STATE_SB:
+                if (b == TELNET_IAC)
+                {
+                    iTelnetState = TELNET_STATE_SB_IAC;
+                }
+                else if (dwSbLen < sizeof(abSb))
+                {
+                    abSb[dwSbLen++] = b;
+                }
+                break;
+
+            case TELNET_STATE_SB_IAC:
+                if (b == TELNET_SE)
+                {
+                    iTelnetState = TELNET_STATE_DATA;
+                    OnSubnegotiation();
+                }
+                else
+                {
+                    iTelnetState = TELNET_STATE_SB;
+                    if (dwSbLen < sizeof(abSb))
+                    {
+                        abSb[dwSbLen++] = b;
+                    }
+                }
+                break;
+        }
+    }
+
+    return dwOut;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialRfc2217Transport::OnSubnegotiation( void )
+{
+    BYTE bState;
+
+    if (dwSbLen < 3 || abSb[0] != TELNET_COM_PORT)
+    {
+        return;
+    }
+
+    bState = abSb[2];
+
+    switch (abSb[1])
+    {
+        case RFC2217_NOTIFY_LINESTATE + RFC2217_SERVER_OFFSET:
+            // break 0x10, framing 0x08, parity 0x04, overrun 0x02
+            if (bState & 0x10)
+            {
+                dwErrors |= CE_BREAK;
+                dwEvents |= EV_BREAK;
+            }
+            if (bState & 0x0E)
+            {
+                dwErrors |= ((bState & 0x08) ? CE_FRAME : 0) | ((bState & 0x04) ? CE_RXPARITY : 0) | ((bState & 0x02) ? CE_OVERRUN : 0);
+                dwEvents |= EV_ERR;
+            }
+            break;
+
+        case RFC2217_NOTIFY_MODEMSTATE + RFC2217_SERVER_OFFSET:
+            // CD 0x80, RI 0x40, DSR 0x20, CTS 0x10; the low bits tell which ones changed
+            dwModemStatus = ((bState & 0x80) ? MS_RLSD_ON : 0) | ((bState & 0x40) ? MS_RING_ON : 0) |
+                            ((bState & 0x20) ? MS_DSR_ON : 0) | ((bState & 0x10) ? MS_CTS_ON : 0);
+            dwEvents |= ((bState & 0x08) ? EV_RLSD : 0) | ((bState & 0x04) ? EV_RING : 0) |
+                        ((bState & 0x02) ? EV_DSR : 0) | ((bState & 0x01) ? EV_CTS : 0);
+            break;
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+CSerialMemoryTransport::CSerialMemoryTransport( )
+{
+    bServer = FALSE;
+    bConnected = FALSE;
+    bConnecting = FALSE;
+    pOvConnect = NULL;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+CSerialMemoryTransport::~CSerialMemoryTransport( )
+{
+    Close();
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialMemoryTransport::Open( const char * pAddress )
+{
+    char cPipe[MAX_PATH];
+
+    // the pairs of a process are its own
+    _snprintf(cPipe, sizeof(cPipe) - 1, "\\\\.\\pipe\\SerialMemory.%lu.%s", GetCurrentProcessId(), pAddress);
+    cPipe[sizeof(cPipe) - 1] = '\0';
+
+    bConnecting = FALSE;
+    pOvConnect = NULL;
+
+    hStream = CreateNamedPipeA(cPipe,
+                               PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE,
+                               PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT,
+                               1,
+                               RX_LEN,
+                               RX_LEN,
+                               0,
+                               NULL);
+    if (hStream != INVALID_HANDLE_VALUE)
+    {
+        bServer = TRUE;
+        bConnected = FALSE;
+        return ERROR_SUCCESS;
+    }
+
+    // the pair exists, this is its other end
+    hStream = CreateFileA(cPipe, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+    if (hStream == INVALID_HANDLE_VALUE)
+    {
+        hStream = NULL;
+        return ::GetLastError();
+    }
+
+    bServer = FALSE;
+    bConnected = TRUE;
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialMemoryTransport::HasStreamReads( void )
+{
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialMemoryTransport::ReadStream( LPVOID pBuffer, DWORD dwLen, OVERLAPPED * pOv )
+{
+    if (hStream == NULL)
+    {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+
+    // until the other end is there, one read waits for it and completes with no data once it
+    // connects; the pipe takes a single connect, the other reads are refused until that read
+    // is posted again
+    if (!bConnected)
+    {
+        if (pOvConnect == pOv)
+        {
+            pOvConnect = NULL;
+            bConnected = TRUE;
+        }
+        else if (pOvConnect != NULL)
+        {
+            SetLastError(ERROR_PIPE_LISTENING);
+            return FALSE;
+        }
+        else if (ConnectNamedPipe(hStream, pOv))
+        {
+            pOvConnect = pOv;
+            return TRUE;
+        }
+        else
+        {
+            switch (::GetLastError())
+            {
+                case ERROR_PIPE_CONNECTED:
+                    bConnected = TRUE;
+                    break;
+
+                case ERROR_IO_PENDING:
+                    pOvConnect = pOv;
+                    return FALSE;
+
+                default:
+                    return FALSE;
+            }
+        }
+    }
+
+    return ::ReadFile(hStream, pBuffer, dwLen, NULL, pOv);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialMemoryTransport::StartRead( HANDLE hEvent, DWORD dwLen )
+{
+    if (bConnected)
+    {
+        return CSerialStreamTransport::StartRead(hEvent, dwLen);
+    }
+
+    // the first read of the end that created the pair waits for the other end
+    SecureZeroMemory(&ovRx, sizeof(OVERLAPPED));
+    ovRx.hEvent = hEvent;
+
+    if (!ConnectNamedPipe(hStream, &ovRx))
+    {
+        switch (::GetLastError())
+        {
+            case ERROR_PIPE_CONNECTED:
+                bConnected = TRUE;
+                return CSerialStreamTransport::StartRead(hEvent, dwLen);
+
+            case ERROR_IO_PENDING:
+                break;
+
+            default:
+                return FALSE;
+        }
+    }
+
+    bConnecting = TRUE;
+    bRxPending = TRUE;
+
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+BOOL CSerialMemoryTransport::FinishRead( DWORD * pdwRead )
+{
+    if (!bConnecting)
+    {
+        return CSerialStreamTransport::FinishRead(pdwRead);
+    }
+
+    bConnecting = FALSE;
+
+    if (!::GetOverlappedResult(hStream, &ovRx, pdwRead, FALSE))
+    {
+        return FALSE;
+    }
+
+    // connected, no data yet
+    bConnected = TRUE;
+    *pdwRead = 0;
+
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialMemoryTransport::CloseStream( void )
+{
+    if (hStream != NULL)
+    {
+        CloseHandle(hStream);
+    }
+
+    bConnected = FALSE;
+    bConnecting = FALSE;
+    pOvConnect = NULL;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
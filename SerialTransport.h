@@ -0,0 +1,348 @@
+// $Id$
+
+#ifndef __SERIAL_TRANSPORT_H__
+#define __SERIAL_TRANSPORT_H__
+
+#include <windows.h>
+#include <vector>
+
+namespace network {
+
+  /**
+   *  \brief  Link under a CSerial: the comm driver calls of the listener and of Write, made on
+   *          a local port or emulated over a byte stream. The transport is selected by the
+   *          scheme of the device given to Open:
+   *            - \\.\COM3 or tty://\\.\COM3, a local port
+   *            - tcp://host:port, a raw TCP port of a terminal server
+   *            - rfc2217://host:port, a terminal server that takes the line settings and the
+   *              modem lines from RFC 2217 (telnet COM-PORT-OPTION)
+   *            - mem://name, one end of an in-memory pair, the first Open of a name creates
+   *              the pair and the second one connects to it
+   *          The methods follow the Win32 functions of the same name.
+   */
+  class CSerialTransport
+  {
+    public:
+      /**
+       *  \brief  Creates the transport of a device, closed
+       *  \param  pDevice device given to CSerial::Open
+       *  \param  ppAddress receives the address to give to Open, pDevice without its scheme
+       */
+      static CSerialTransport * Create( const char * pDevice, const char ** ppAddress );
+
+      virtual ~CSerialTransport( ) {}
+
+      /**
+       *  \brief  Opens the link for overlapped I/O
+       *  \return status of operation
+       */
+      virtual DWORD Open( const char * pAddress ) = 0;
+
+      /**
+       *  \brief  Closes the link, there must be no I/O pending
+       */
+      virtual void Close( void ) = 0;
+
+      /**
+       *  \brief  Handle of the open link, NULL when closed
+       */
+      virtual HANDLE GetHandle( void ) = 0;
+
+      /**
+       *  \brief  The reads honour the ReadIntervalTimeout of SetCommTimeouts, so the idle gaps
+       *          can be detected by the driver
+       */
+      virtual BOOL HasIntervalTimeout( void ) = 0;
+
+      /**
+       *  \brief  The link is a plain byte stream without line events: ReadStream reads its handle
+       *          directly, and a read completes as soon as data is there
+       */
+      virtual BOOL HasStreamReads( void ) = 0;
+
+      /**
+       *  \brief  The link has a line whose end of transmission is signaled (EV_TXEMPTY) and
+       *          polled (the transmit queue of ClearCommError); on the others a write is over
+       *          when it completes
+       */
+      virtual BOOL HasTxEmpty( void ) = 0;
+
+      /**
+       *  \brief  Starts an overlapped read of the handle itself, see HasStreamReads. A read that
+       *          completes with no data only readied the link, the caller starts another one.
+       *          A read refused with ERROR_PIPE_LISTENING waits for the next completion of a read.
+       *  \return as ReadFile
+       */
+      virtual BOOL ReadStream( LPVOID pBuffer, DWORD dwLen, OVERLAPPED * pOv ) = 0;
+
+      virtual BOOL GetCommState( DCB * pDcb ) = 0;
+      virtual BOOL SetCommState( DCB * pDcb ) = 0;
+      virtual BOOL SetCommTimeouts( COMMTIMEOUTS * pTimeouts ) = 0;
+      virtual BOOL SetCommMask( DWORD dwMask ) = 0;
+      virtual BOOL WaitCommEvent( DWORD * pdwEvent, OVERLAPPED * pOv ) = 0;
+      virtual BOOL ClearCommError( DWORD * pdwErrors, COMSTAT * pStat ) = 0;
+      virtual BOOL PurgeComm( DWORD dwFlags ) = 0;
+      virtual BOOL EscapeCommFunction( DWORD dwFunc ) = 0;
+      virtual BOOL GetCommModemStatus( DWORD * pdwModemStatus ) = 0;
+      virtual BOOL TransmitCommChar( char cChar ) = 0;
+      virtual BOOL ReadFile( LPVOID pBuffer, DWORD dwLen, DWORD * pdwRead, OVERLAPPED * pOv ) = 0;
+      virtual BOOL WriteFile( LPCVOID pBuffer, DWORD dwLen, DWORD * pdwWritten, OVERLAPPED * pOv ) = 0;
+      virtual BOOL GetOverlappedResult( OVERLAPPED * pOv, DWORD * pdwTransferred, BOOL bWait ) = 0;
+      virtual BOOL CancelIo( void ) = 0;
+      virtual BOOL CancelIoEx( OVERLAPPED * pOv ) = 0;
+      virtual BOOL FlushFileBuffers( void ) = 0;
+  };
+
+  /**
+   *  \brief  Local port, the calls go to the comm driver
+   */
+  class CSerialTtyTransport : public CSerialTransport
+  {
+    private:
+
+      HANDLE hPort;
+
+    public:
+      CSerialTtyTransport( );
+      virtual ~CSerialTtyTransport( );
+
+      virtual DWORD Open( const char * pAddress );
+      virtual void Close( void );
+      virtual HANDLE GetHandle( void );
+      virtual BOOL HasIntervalTimeout( void );
+      virtual BOOL HasStreamReads( void );
+      virtual BOOL HasTxEmpty( void );
+      virtual BOOL ReadStream( LPVOID pBuffer, DWORD dwLen, OVERLAPPED * pOv );
+
+      virtual BOOL GetCommState( DCB * pDcb );
+      virtual BOOL SetCommState( DCB * pDcb );
+      virtual BOOL SetCommTimeouts( COMMTIMEOUTS * pTimeouts );
+      virtual BOOL SetCommMask( DWORD dwMask );
+      virtual BOOL WaitCommEvent( DWORD * pdwEvent, OVERLAPPED * pOv );
+      virtual BOOL ClearCommError( DWORD * pdwErrors, COMSTAT * pStat );
+      virtual BOOL PurgeComm( DWORD dwFlags );
+      virtual BOOL EscapeCommFunction( DWORD dwFunc );
+      virtual BOOL GetCommModemStatus( DWORD * pdwModemStatus );
+      virtual BOOL TransmitCommChar( char cChar );
+      virtual BOOL ReadFile( LPVOID pBuffer, DWORD dwLen, DWORD * pdwRead, OVERLAPPED * pOv );
+      virtual BOOL WriteFile( LPCVOID pBuffer, DWORD dwLen, DWORD * pdwWritten, OVERLAPPED * pOv );
+      virtual BOOL GetOverlappedResult( OVERLAPPED * pOv, DWORD * pdwTransferred, BOOL bWait );
+      virtual BOOL CancelIo( void );
+      virtual BOOL CancelIoEx( OVERLAPPED * pOv );
+      virtual BOOL FlushFileBuffers( void );
+  };
+
+  /**
+   *  \brief  Comm driver emulated over a byte stream opened for overlapped I/O. WaitCommEvent
+   *          starts a read of the stream that signals the event of its OVERLAPPED, the bytes
+   *          read are kept until ReadFile takes them, and SetCommMask ends the wait as the
+   *          driver does. The line settings are only kept, the modem lines read as connected.
+   */
+  class CSerialStreamTransport : public CSerialTransport
+  {
+    protected:
+
+      enum { RX_LEN = 4096 };
+
+      HANDLE hStream;
+
+      //! protects the receive side and the emulated wait
+      CRITICAL_SECTION cs;
+
+      DCB dcb;
+      COMMTIMEOUTS timeouts;
+
+      //! received data not taken by ReadFile yet
+      BYTE abRx[RX_LEN];
+      DWORD dwRxHead;
+      DWORD dwRxLen;
+
+      //! read of the stream in progress
+      OVERLAPPED ovRx;
+      BYTE abRaw[RX_LEN];
+      BOOL bRxPending;
+
+      //! emulated WaitCommEvent in progress, and the events waiting for it
+      DWORD dwMask;
+      DWORD dwEvents;
+      OVERLAPPED * pOvWait;
+      DWORD * pdwWaitEvent;
+      BOOL bMaskWake;
+
+      //! line errors and modem lines reported by the stream
+      DWORD dwErrors;
+      DWORD dwModemStatus;
+
+      //! write in progress, with its length before and after Encode
+      OVERLAPPED * pOvWrite;
+      DWORD dwWriteLen;
+      DWORD dwWriteWireLen;
+      std::vector<BYTE> vTx;
+
+      //! synchronous writes of Send
+      CRITICAL_SECTION csSend;
+      HANDLE hSendEvent;
+
+      //! starts the read of the stream into abRaw, signaling hEvent, with cs held
+      virtual BOOL StartRead( HANDLE hEvent, DWORD dwLen );
+
+      //! result of the read, with cs held
+      virtual BOOL FinishRead( DWORD * pdwRead );
+
+      //! turns the bytes read into data, in place, with cs held; returns the data length
+      virtual DWORD Decode( BYTE * pData, DWORD dwLen );
+
+      //! encodes data for the stream into vTx, returns FALSE if it is sent as is
+      virtual BOOL Encode( const BYTE * pData, DWORD dwLen );
+
+      //! releases the stream
+      virtual void CloseStream( void ) = 0;
+
+      //! takes the result of the read that completed, with cs held
+      BOOL CompleteRead( void );
+
+      //! events to report, with cs held
+      DWORD TakeEvents( void );
+
+      //! writes bytes on the stream and waits for them, from any thread
+      BOOL Send( const BYTE * pData, DWORD dwLen );
+
+    public:
+      CSerialStreamTransport( ) throw( ... );
+      virtual ~CSerialStreamTransport( );
+
+      virtual void Close( void );
+      virtual HANDLE GetHandle( void );
+      virtual BOOL HasIntervalTimeout( void );
+      virtual BOOL HasStreamReads( void );
+      virtual BOOL HasTxEmpty( void );
+      virtual BOOL ReadStream( LPVOID pBuffer, DWORD dwLen, OVERLAPPED * pOv );
+
+      virtual BOOL GetCommState( DCB * pDcb );
+      virtual BOOL SetCommState( DCB * pDcb );
+      virtual BOOL SetCommTimeouts( COMMTIMEOUTS * pTimeouts );
+      virtual BOOL SetCommMask( DWORD dwMask );
+      virtual BOOL WaitCommEvent( DWORD * pdwEvent, OVERLAPPED * pOv );
+      virtual BOOL ClearCommError( DWORD * pdwErrors, COMSTAT * pStat );
+      virtual BOOL PurgeComm( DWORD dwFlags );
+      virtual BOOL EscapeCommFunction( DWORD dwFunc );
+      virtual BOOL GetCommModemStatus( DWORD * pdwModemStatus );
+      virtual BOOL TransmitCommChar( char cChar );
+      virtual BOOL ReadFile( LPVOID pBuffer, DWORD dwLen, DWORD * pdwRead, OVERLAPPED * pOv );
+      virtual BOOL WriteFile( LPCVOID pBuffer, DWORD dwLen, DWORD * pdwWritten, OVERLAPPED * pOv );
+      virtual BOOL GetOverlappedResult( OVERLAPPED * pOv, DWORD * pdwTransferred, BOOL bWait );
+      virtual BOOL CancelIo( void );
+      virtual BOOL CancelIoEx( OVERLAPPED * pOv );
+      virtual BOOL FlushFileBuffers( void );
+  };
+
+  /**
+   *  \brief  Raw TCP port of a terminal server, the socket is used as the stream. Nagle is
+   *          disabled, a write goes out at once as it would on a local port.
+   */
+  class CSerialTcpTransport : public CSerialStreamTransport
+  {
+    private:
+
+      BOOL bWsa;
+
+    protected:
+      virtual void CloseStream( void );
+
+    public:
+      CSerialTcpTransport( );
+      virtual ~CSerialTcpTransport( );
+
+      /**
+       *  \brief  Connects to host:port
+       */
+      virtual DWORD Open( const char * pAddress );
+  };
+
+  /**
+   *  \brief  Terminal server that follows RFC 2217: SetCommState, EscapeCommFunction and
+   *          PurgeComm are sent to the server as COM-PORT-OPTION commands, and its line state
+   *          and modem state notifications come back as the line errors, the modem lines and
+   *          their events. The data is sent in telnet binary mode, 0xFF doubled.
+   */
+  class CSerialRfc2217Transport : public CSerialTcpTransport
+  {
+    private:
+
+      //! telnet receive state
+      int iTelnetState;
+      BYTE bVerb;
+      BYTE abSb[16];
+      DWORD dwSbLen;
+
+      //! the line settings were sent once
+      BOOL bConfigured;
+
+      //! sends a COM-PORT-OPTION command
+      BOOL SendComPort( BYTE bCommand, const BYTE * pValue, DWORD dwLen );
+
+      //! sends a SET-CONTROL command
+      BOOL SendControl( BYTE bValue );
+
+      //! handles a subnegotiation received, with cs held
+      void OnSubnegotiation( void );
+
+    protected:
+      virtual DWORD Decode( BYTE * pData, DWORD dwLen );
+      virtual BOOL Encode( const BYTE * pData, DWORD dwLen );
+
+    public:
+      CSerialRfc2217Transport( );
+
+      /**
+       *  \brief  Connects to host:port and negotiates the binary mode and COM-PORT-OPTION
+       */
+      virtual DWORD Open( const char * pAddress );
+
+      virtual BOOL SetCommState( DCB * pDcb );
+      virtual BOOL PurgeComm( DWORD dwFlags );
+      virtual BOOL EscapeCommFunction( DWORD dwFunc );
+      virtual BOOL TransmitCommChar( char cChar );
+  };
+
+  /**
+   *  \brief  One end of an in-memory pair, a named pipe of the process: what one end writes
+   *          the other receives. The end that creates the pair accepts the other one with
+   *          the first read of the listener, or of the completion port; until then its writes
+   *          fail, and the other reads of the completion port are refused with ERROR_PIPE_LISTENING
+   *          for the caller to post them once that first one completed. The pipe has no line
+   *          events, a completion port reads it directly.
+   */
+  class CSerialMemoryTransport : public CSerialStreamTransport
+  {
+    private:
+
+      //! this end created the pair and waits for the other one
+      BOOL bServer;
+      BOOL bConnected;
+      BOOL bConnecting;
+
+      //! read of ReadStream that carries the connect to the other end, until it was reposted
+      OVERLAPPED * pOvConnect;
+
+    protected:
+      virtual BOOL StartRead( HANDLE hEvent, DWORD dwLen );
+      virtual BOOL FinishRead( DWORD * pdwRead );
+      virtual void CloseStream( void );
+
+    public:
+      CSerialMemoryTransport( );
+      virtual ~CSerialMemoryTransport( );
+
+      virtual BOOL HasStreamReads( void );
+      virtual BOOL ReadStream( LPVOID pBuffer, DWORD dwLen, OVERLAPPED * pOv );
+
+      /**
+       *  \brief  Creates the pair of the name, or connects to it
+       */
+      virtual DWORD Open( const char * pAddress );
+  };
+
+};
+
+#endif
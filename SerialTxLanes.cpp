@@ -0,0 +1,392 @@
+// $Id$
+
+#include "stdafx.h"
+#include "SerialTxLanes.h"
+#include "SerialClock.h"
+#include <stdlib.h>
+#include <stddef.h>
+
+using namespace network;
+
+//! chunk of the stream lanes while the character time is not known
+#define SERIAL_LANES_DEFAULT_CHUNK  (64)
+
+//! largest chunk of the stream lanes, whatever the preemption allows
+#define SERIAL_LANES_MAX_CHUNK      (65536)
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+CSerialTxLanes::CSerialTxLanes( CSerial * pSerial, DWORD dwLanes )
+{
+    DWORD i;
+
+    if (dwLanes == 0)
+    {
+        throw (unsigned int)ERROR_INVALID_PARAMETER;
+    }
+
+    this->pSerial = pSerial;
+
+    lanes.resize(dwLanes);
+    for (i = 0; i < dwLanes; i++)
+    {
+        lanes[i].dwWeight = 1;
+        lanes[i].bStream = FALSE;
+        lanes[i].llDeficit = 0;
+        lanes[i].dwRound = 0;
+        SecureZeroMemory(&lanes[i].stats, sizeof(SERIAL_LANE_STATS));
+    }
+
+    // after the round of the lanes, so the first frame of each starts with its credit
+    dwRound = 1;
+    dwMaxPreemptionUs = 10000;
+    bWriting = FALSE;
+    bQuit = FALSE;
+
+    InitializeCriticalSection(&cs);
+    InitializeConditionVariable(&cvWork);
+    InitializeConditionVariable(&cvIdle);
+
+    hThread = ::CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)CSerialTxLanes::ThreadStartWriter, this, 0, NULL);
+    if (hThread == NULL)
+    {
+        DWORD dwError = ::GetLastError();
+        DeleteCriticalSection(&cs);
+        throw (unsigned int)dwError;
+    }
+
+    return;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+CSerialTxLanes::~CSerialTxLanes( )
+{
+    size_t i;
+
+    EnterCriticalSection(&cs);
+    bQuit = TRUE;
+    WakeAllConditionVariable(&cvWork);
+    WakeAllConditionVariable(&cvIdle);
+    LeaveCriticalSection(&cs);
+
+    // a Write in progress is finished first
+    WaitForSingleObject(hThread, INFINITE);
+    CloseHandle(hThread);
+
+    for (i = 0; i < lanes.size(); i++)
+    {
+        while (!lanes[i].queue.empty())
+        {
+            free(lanes[i].queue.front());
+            lanes[i].queue.pop_front();
+        }
+    }
+
+    DeleteCriticalSection(&cs);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialTxLanes::SetLane( DWORD dwLane, DWORD dwWeight, BOOL bStream )
+{
+    // a lane without weight would never receive credit
+    if (dwLane >= lanes.size() || dwWeight == 0)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    EnterCriticalSection(&cs);
+    lanes[dwLane].dwWeight = dwWeight;
+    lanes[dwLane].bStream = bStream;
+    LeaveCriticalSection(&cs);
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialTxLanes::SetMaxPreemption( DWORD dwUs )
+{
+    dwMaxPreemptionUs = dwUs;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialTxLanes::Send( DWORD dwLane, const BYTE * pData, DWORD dwLen )
+{
+    LANE_FRAME * pFrame;
+    LANE * pLane;
+
+    if (dwLane >= lanes.size())
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    if (dwLen == 0)
+    {
+        return ERROR_SUCCESS;
+    }
+
+    pFrame = (LANE_FRAME*)malloc(offsetof(LANE_FRAME, abData) + dwLen);
+    if (pFrame == NULL)
+    {
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    pFrame->dwLen = dwLen;
+    pFrame->dwSent = 0;
+    memcpy(pFrame->abData, pData, dwLen);
+
+    EnterCriticalSection(&cs);
+
+    pLane = &lanes[dwLane];
+
+    // a lane that wakes up starts with its credit, once per round: it did not use the line meanwhile
+    if (pLane->queue.empty() && pLane->dwRound != dwRound)
+    {
+        pLane->llDeficit = (LONGLONG)pLane->dwWeight * ChunkBytes();
+        pLane->dwRound = dwRound;
+    }
+
+    pFrame->ullQueuedUs = GetTimestampUs();
+
+    // the deque allocates its blocks as it grows
+    try
+    {
+        pLane->queue.push_back(pFrame);
+    }
+    catch (...)
+    {
+        LeaveCriticalSection(&cs);
+        free(pFrame);
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    pLane->stats.dwQueued++;
+    pLane->stats.dwQueuedBytes += dwLen;
+
+    WakeConditionVariable(&cvWork);
+
+    LeaveCriticalSection(&cs);
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+void CSerialTxLanes::Drain( void )
+{
+    size_t i;
+    BOOL bBusy;
+
+    EnterCriticalSection(&cs);
+
+    do
+    {
+        bBusy = bWriting;
+        for (i = 0; i < lanes.size(); i++)
+        {
+            bBusy = bBusy || !lanes[i].queue.empty();
+        }
+
+        if (bBusy && !bQuit)
+        {
+            SleepConditionVariableCS(&cvIdle, &cs, INFINITE);
+        }
+    } while (bBusy && !bQuit);
+
+    LeaveCriticalSection(&cs);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialTxLanes::GetStats( DWORD dwLane, SERIAL_LANE_STATS * pStats )
+{
+    if (dwLane >= lanes.size())
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    EnterCriticalSection(&cs);
+    *pStats = lanes[dwLane].stats;
+    LeaveCriticalSection(&cs);
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialTxLanes::ChunkBytes( void )
+{
+    DWORD dwCharNs = pSerial->GetCharTime();
+    ULONGLONG ullChunk;
+
+    if (dwCharNs == 0)
+    {
+        return SERIAL_LANES_DEFAULT_CHUNK;
+    }
+
+    ullChunk = (ULONGLONG)dwMaxPreemptionUs * 1000 / dwCharNs;
+
+    if (ullChunk == 0)
+    {
+        return 1;
+    }
+
+    return (ullChunk > SERIAL_LANES_MAX_CHUNK) ? SERIAL_LANES_MAX_CHUNK : DWORD(ullChunk);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+int CSerialTxLanes::NextLane( DWORD dwChunk )
+{
+    BOOL bBusy;
+    size_t i;
+
+    do
+    {
+        // the highest lane with data and credit
+        bBusy = FALSE;
+        for (i = 0; i < lanes.size(); i++)
+        {
+            if (!lanes[i].queue.empty())
+            {
+                if (lanes[i].llDeficit > 0)
+                {
+                    return int(i);
+                }
+                bBusy = TRUE;
+            }
+        }
+
+        if (!bBusy)
+        {
+            return -1;
+        }
+
+        // every lane with data spent its credit: next round. The idle lanes lose what they had
+        // left, they get their credit again when they wake up
+        dwRound++;
+        for (i = 0; i < lanes.size(); i++)
+        {
+            if (lanes[i].queue.empty())
+            {
+                lanes[i].llDeficit = 0;
+            }
+            else
+            {
+                lanes[i].llDeficit += (LONGLONG)lanes[i].dwWeight * dwChunk;
+                lanes[i].dwRound = dwRound;
+            }
+        }
+
+    } while (1);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD CSerialTxLanes::WriterLoop( void )
+{
+    LANE * pLane;
+    LANE_FRAME * pFrame;
+    ULONGLONG ullWaitUs;
+    DWORD dwChunk;
+    DWORD dwLen;
+    int iLane;
+    int iWrote;
+
+    EnterCriticalSection(&cs);
+
+    while (!bQuit)
+    {
+        dwChunk = ChunkBytes();
+
+        iLane = NextLane(dwChunk);
+        if (iLane < 0)
+        {
+            WakeAllConditionVariable(&cvIdle);
+            SleepConditionVariableCS(&cvWork, &cs, INFINITE);
+            continue;
+        }
+
+        pLane = &lanes[iLane];
+        pFrame = pLane->queue.front();
+
+        dwLen = pFrame->dwLen - pFrame->dwSent;
+        if (pLane->bStream && dwLen > dwChunk)
+        {
+            dwLen = dwChunk;
+        }
+
+        // the wait of a frame ends when its first byte is handed to Write
+        if (pFrame->dwSent == 0)
+        {
+            ullWaitUs = GetTimestampUs() - pFrame->ullQueuedUs;
+            pLane->stats.ullLastWaitUs = ullWaitUs;
+            pLane->stats.ullTotalWaitUs += ullWaitUs;
+            if (ullWaitUs > pLane->stats.ullMaxWaitUs)
+            {
+                pLane->stats.ullMaxWaitUs = ullWaitUs;
+            }
+        }
+
+        pLane->llDeficit -= dwLen;
+        bWriting = TRUE;
+
+        LeaveCriticalSection(&cs);
+
+        // the frame stays at the head of its lane, Send only queues behind it
+        iWrote = pSerial->Write((char *)pFrame->abData + pFrame->dwSent, int(dwLen));
+
+        EnterCriticalSection(&cs);
+
+        bWriting = FALSE;
+
+        if (iWrote == int(dwLen))
+        {
+            pFrame->dwSent += dwLen;
+            pLane->stats.ullBytes += dwLen;
+            pLane->stats.dwQueuedBytes -= dwLen;
+
+            if (pFrame->dwSent < pFrame->dwLen)
+            {
+                continue;
+            }
+
+            ullWaitUs = GetTimestampUs() - pFrame->ullQueuedUs;
+            if (ullWaitUs > pLane->stats.ullMaxDoneUs)
+            {
+                pLane->stats.ullMaxDoneUs = ullWaitUs;
+            }
+            pLane->stats.llFrames++;
+        }
+        else
+        {
+            // the rest of a frame cut by an error would be garbage for the peer
+            pLane->stats.dwErrors++;
+            pLane->stats.dwQueuedBytes -= pFrame->dwLen - pFrame->dwSent;
+        }
+
+        pLane->queue.pop_front();
+        pLane->stats.dwQueued--;
+        free(pFrame);
+    }
+
+    LeaveCriticalSection(&cs);
+
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
+
+DWORD WINAPI CSerialTxLanes::ThreadStartWriter( LPVOID lpParam )
+{
+    CSerialTxLanes * pLanes;
+
+    pLanes = (CSerialTxLanes*)lpParam;
+
+    return pLanes->WriterLoop();
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,151 @@
+// $Id$
+
+#ifndef __SERIAL_TX_LANES_H__
+#define __SERIAL_TX_LANES_H__
+
+#include <windows.h>
+#include <deque>
+#include <vector>
+#include "Serial.h"
+
+namespace network {
+
+  //! counters of a lane of a CSerialTxLanes
+  struct SERIAL_LANE_STATS
+  {
+    DWORD     dwQueued;         // frames waiting, the one being written included
+    DWORD     dwQueuedBytes;    // bytes of the frames waiting not written yet
+    LONGLONG  llFrames;         // frames written
+    ULONGLONG ullBytes;         // bytes written
+    DWORD     dwErrors;         // frames dropped because Write failed
+    ULONGLONG ullLastWaitUs;    // from Send to the first byte handed to Write, last frame
+    ULONGLONG ullMaxWaitUs;     // longest wait
+    ULONGLONG ullTotalWaitUs;   // sum of the waits
+    ULONGLONG ullMaxDoneUs;     // longest time from Send to the last byte written
+  };
+
+  /**
+   *  \brief  Transmit lanes of a CSerial: the frames of several senders are queued by lane and
+   *          written by a thread of the lanes, one Write at a time, so an urgent frame does not
+   *          wait behind a bulk transfer queued before it. Lane 0 has the highest priority.
+   *          At each boundary, the end of a frame or of a chunk of a stream lane, the highest
+   *          lane with credit is written next. The credit is a deficit round robin: each lane
+   *          receives its weight times the preemption chunk per round, spends the bytes it
+   *          writes, and a lane that wakes up starts with its credit of the round. A sporadic
+   *          urgent frame is thus written at the next boundary, while a lane that keeps the
+   *          line busy is held to its share and cannot starve the lower ones.
+   */
+  class CSerialTxLanes
+  {
+    private:
+
+      //! frame waiting in a lane, the data follows the header
+      struct LANE_FRAME
+      {
+        DWORD     dwLen;
+        DWORD     dwSent;
+        ULONGLONG ullQueuedUs;
+        BYTE      abData[1];
+      };
+
+      struct LANE
+      {
+        std::deque<LANE_FRAME*> queue;
+        DWORD dwWeight;
+        BOOL bStream;
+
+        //! bytes the lane may still write in the round, negative after a frame longer than its credit
+        LONGLONG llDeficit;
+
+        //! last round the lane received its credit
+        DWORD dwRound;
+
+        SERIAL_LANE_STATS stats;
+      };
+
+      CSerial * pSerial;
+
+      std::vector<LANE> lanes;
+
+      //! protects the lanes and the round
+      CRITICAL_SECTION cs;
+
+      //! signaled when a frame is queued, or to stop the writer
+      CONDITION_VARIABLE cvWork;
+
+      //! signaled when every lane is empty
+      CONDITION_VARIABLE cvIdle;
+
+      DWORD dwRound;
+      DWORD dwMaxPreemptionUs;
+
+      //! a frame is handed to Write
+      BOOL bWriting;
+
+      volatile BOOL bQuit;
+      HANDLE hThread;
+
+      //! largest number of bytes written at once by a stream lane, from dwMaxPreemptionUs
+      DWORD ChunkBytes( void );
+
+      //! lane to write next, starting a round if needed, -1 if all are empty; with cs held
+      int NextLane( DWORD dwChunk );
+
+      DWORD WriterLoop( void );
+      static DWORD WINAPI ThreadStartWriter( LPVOID lpParam );
+
+    public:
+      /**
+       *  \brief  Constructor, starts the writer thread. Every lane has a weight of 1 and
+       *          writes whole frames, see SetLane.
+       *  \param  pSerial port the frames are written to, open or not
+       *  \param  dwLanes number of lanes, 2 by default: urgent and bulk
+       */
+      CSerialTxLanes( CSerial * pSerial, DWORD dwLanes = 2 ) throw( ... );
+
+      /**
+       *  \brief  Destructor, the frames still queued are discarded
+       */
+      virtual ~CSerialTxLanes( );
+
+      /**
+       *  \brief  Configures a lane
+       *  \param  dwLane lane, 0 is the highest priority
+       *  \param  dwWeight share of the line the lane keeps when all lanes are busy, relative to the others
+       *  \param  bStream the data of the lane is a byte stream that may be cut anywhere, e.g. a
+       *          file upload: it is written in chunks and the other lanes go in between. Otherwise
+       *          each Send is a frame written whole, and the frames of the lane bound the wait of
+       *          the higher lanes.
+       *  \return status of operation
+       */
+      DWORD SetLane( DWORD dwLane, DWORD dwWeight, BOOL bStream );
+
+      /**
+       *  \brief  Longest time a stream lane holds the line before the higher lanes can go,
+       *          10 ms by default. The chunks are as many characters as fit in it, at least one.
+       *          The driver and the adapter FIFO add their own delay.
+       */
+      void SetMaxPreemption( DWORD dwUs );
+
+      /**
+       *  \brief  Queues a copy of a frame, without waiting for it to be written
+       *  \param  dwLane lane of the frame
+       *  \return status of operation
+       */
+      DWORD Send( DWORD dwLane, const BYTE * pData, DWORD dwLen );
+
+      /**
+       *  \brief  Waits until every frame queued was written
+       */
+      void Drain( void );
+
+      /**
+       *  \brief  Read the counters of a lane
+       *  \return status of operation
+       */
+      DWORD GetStats( DWORD dwLane, SERIAL_LANE_STATS * pStats );
+  };
+
+};
+
+#endif